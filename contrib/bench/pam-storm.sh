@@ -0,0 +1,330 @@
+#!/bin/bash
+# ==============================================================================
+# PAM login storm against a local MIT KDC
+#
+# The script creates several realms with cross-realm trusts and AFS service
+# principals in a private krb5kdc instance, simulated users, and a PAM service
+# with pam_kafs_session. Everything is done in a private mount namespace, where
+# /etc/passwd, /etc/pam.d, /etc/krb5.conf, and /etc/kafs-user are replaced,
+# so the host configuration is not modified. Then pam-storm is executed.
+#
+# requirements: root, krb5-kdc, krb5-admin-server (kadmin.local), krb5-user,
+#               util-linux (unshare), kAFS or -M (in-memory keyrings)
+# ==============================================================================
+
+set -o pipefail
+
+BUILD_DIR="${BUILD_DIR:-$(pwd)}"
+NREALMS=2
+NUSERS=10
+NWORKERS=4
+NITERATIONS=100
+LATENCY=0
+JITTER=0
+DROP=0
+USE_PAM_KRB5=0
+MACHINE=""
+MEMKEYS=0
+APPDEFAULTS=()
+KDC_PORT="${KDC_PORT:-18888}"
+PROXY_PORT="${PROXY_PORT:-18889}"
+PASSWORD="storm-password"
+
+# ------------------------------------------------------------------------------
+
+function print_usage()
+{
+    cat << EOF
+
+Usage: pam-storm.sh [-h] [-b BUILD_DIR] [-r REALMS] [-n USERS] [-w WORKERS] [-i ITERATIONS]
+                    [-l MS] [-J MS] [-f PERCENT] [-k] [-M] [-m] [-a KEY=VALUE]...
+
+Options:
+   -h   Print this help.
+   -b   Build directory with pam_kafs_session.so and pam-storm (default: current directory).
+   -r   Number of realms (cells), users are in the first one (default: 2).
+   -n   Number of users (default: 10).
+   -w   Number of concurrent workers (default: 4).
+   -i   Number of login cycles per worker (default: 100).
+   -l   Delay KDC requests by MS milliseconds.
+   -J   Add random jitter up to MS milliseconds to KDC requests.
+   -f   Drop PERCENT of KDC requests.
+   -k   Authenticate by pam_krb5 (password) instead of prepared ccaches.
+   -M   Use in-memory keyrings instead of kAFS (KAFS_BACKEND=mem).
+   -m   Machine-readable output.
+   -a   Add pam_kafs_session option to [appdefaults], e.g. -a afslog_concurrency=4.
+
+EOF
+}
+
+# ------------------------------------------------------------------------------
+
+function cleanup()
+{
+    if [ -n "$KDC_PID" ]; then
+        kill "$KDC_PID" 2> /dev/null
+        wait "$KDC_PID" 2> /dev/null
+    fi
+    if [ -n "$WORK" ] && [ -d "$WORK" ]; then
+        rm -rf "$WORK"
+    fi
+}
+
+# ------------------------------------------------------------------------------
+
+function die()
+{
+    echo "pam-storm.sh: $*" 1>&2
+    exit 1
+}
+
+# ------------------------------------------------------------------------------
+
+function realm_name()
+{
+    echo "STORM$1.TEST"
+}
+
+# ------------------------------------------------------------------------------
+
+function cell_name()
+{
+    echo "cell$1.storm.test"
+}
+
+# ------------------------------------------------------------------------------
+
+function user_name()
+{
+    printf "storm%04d" "$1"
+}
+
+# ------------------------------------------------------------------------------
+
+function write_config()
+{
+    local client_port="$KDC_PORT"
+    if [ "$LATENCY" != "0" ] || [ "$JITTER" != "0" ] || [ "$DROP" != "0" ]; then
+        client_port="$PROXY_PORT"
+    fi
+
+    # KDC
+    {
+        echo "[kdcdefaults]"
+        echo "    kdc_ports = $KDC_PORT"
+        echo "    kdc_tcp_ports = $KDC_PORT"
+        echo ""
+        echo "[realms]"
+        for((i=1; i <= NREALMS; i++)); do
+            echo "    $(realm_name $i) = {"
+            echo "        database_name = $WORK/db/$(realm_name $i)/principal"
+            echo "        key_stash_file = $WORK/db/$(realm_name $i)/stash"
+            echo "        max_life = 1d"
+            echo "        max_renewable_life = 7d"
+            echo "    }"
+        done
+    } > "$WORK/kdc.conf"
+
+    # clients, UDP is preferred so that requests pass through the proxy
+    {
+        echo "[libdefaults]"
+        echo "    default_realm = $(realm_name 1)"
+        echo "    dns_lookup_kdc = false"
+        echo "    dns_lookup_realm = false"
+        echo "    rdns = false"
+        echo "    udp_preference_limit = 4096"
+        echo ""
+        echo "[realms]"
+        for((i=1; i <= NREALMS; i++)); do
+            echo "    $(realm_name $i) = {"
+            echo "        kdc = 127.0.0.1:$client_port"
+            echo "    }"
+        done
+        echo ""
+        echo "[domain_realm]"
+        for((i=1; i <= NREALMS; i++)); do
+            echo "    $(cell_name $i) = $(realm_name $i)"
+        done
+        echo ""
+        echo "[logging]"
+        echo "    kdc = FILE:$WORK/kdc.log"
+        echo ""
+        echo "[appdefaults]"
+        echo "    pam_kafs_session = {"
+        echo "        summary = yes"
+        for opt in "${APPDEFAULTS[@]}"; do
+            echo "        ${opt%%=*} = ${opt#*=}"
+        done
+        echo "    }"
+    } > "$WORK/krb5.conf"
+
+    # kafs-user
+    mkdir -p "$WORK/kafs-user"
+    cell_name 1 > "$WORK/kafs-user/ThisCell"
+    for((i=1; i <= NREALMS; i++)); do
+        cell_name $i
+    done > "$WORK/kafs-user/TheseCells"
+    touch "$WORK/kafs-user/CellServDB"
+
+    # PAM service
+    mkdir -p "$WORK/pam.d"
+    {
+        if [ "$USE_PAM_KRB5" == "1" ]; then
+            echo "auth     required  pam_krb5.so minimum_uid=1000"
+        else
+            echo "auth     required  pam_permit.so"
+        fi
+        echo "auth     optional  $PAM_MODULE"
+        echo "account  required  pam_permit.so"
+        echo "session  optional  $PAM_MODULE"
+    } > "$WORK/pam.d/kafs-storm"
+
+    # users
+    cp /etc/passwd "$WORK/passwd"
+    for((u=1; u <= NUSERS; u++)); do
+        echo "$(user_name $u):x:$((61000 + u)):61000:pam-storm:/nonexistent:/usr/sbin/nologin"
+    done >> "$WORK/passwd"
+}
+
+# ------------------------------------------------------------------------------
+
+function create_realms()
+{
+    for((i=1; i <= NREALMS; i++)); do
+        local realm="$(realm_name $i)"
+        mkdir -p "$WORK/db/$realm"
+        kdb5_util -r "$realm" create -s -P "master-$realm" > /dev/null || die "unable to create realm $realm"
+
+        {
+            echo "addprinc -randkey afs/$(cell_name $i)@$realm"
+            # trust between the user realm and the resource realms
+            if [ $i -ne 1 ]; then
+                echo "addprinc -pw cross-realm krbtgt/$realm@$(realm_name 1)"
+                echo "addprinc -pw cross-realm krbtgt/$(realm_name 1)@$realm"
+            fi
+        } | kadmin.local -r "$realm" > /dev/null 2>&1 || die "unable to populate realm $realm"
+
+        if [ $i -ne 1 ]; then
+            {
+                echo "addprinc -pw cross-realm krbtgt/$realm@$(realm_name 1)"
+                echo "addprinc -pw cross-realm krbtgt/$(realm_name 1)@$realm"
+            } | kadmin.local -r "$(realm_name 1)" > /dev/null 2>&1 || die "unable to create trust for $realm"
+        fi
+    done
+
+    # users
+    {
+        for((u=1; u <= NUSERS; u++)); do
+            echo "addprinc -pw $PASSWORD $(user_name $u)"
+            echo "ktadd -k $WORK/users.keytab -norandkey $(user_name $u)"
+        done
+    } | kadmin.local -r "$(realm_name 1)" > /dev/null 2>&1 || die "unable to create users"
+}
+
+# ------------------------------------------------------------------------------
+
+function create_ccaches()
+{
+    mkdir -p "$WORK/cc"
+    chmod 755 "$WORK" "$WORK/cc"
+    for((u=1; u <= NUSERS; u++)); do
+        local user="$(user_name $u)"
+        kinit -k -t "$WORK/users.keytab" -c "FILE:$WORK/cc/krb5cc_$user" "$user" || die "unable to get TGT for $user"
+        chown "$((61000 + u)):61000" "$WORK/cc/krb5cc_$user"
+    done
+}
+
+# ------------------------------------------------------------------------------
+
+function inner()
+{
+    WORK="$(mktemp -d /tmp/pam-storm.XXXXXX)" || die "unable to create working directory"
+    trap cleanup EXIT
+
+    export KRB5_CONFIG="$WORK/krb5.conf"
+    export KRB5_KDC_PROFILE="$WORK/kdc.conf"
+
+    APPDEFAULTS=()
+    if [ -n "$APPDEFAULTS_LIST" ]; then
+        mapfile -t APPDEFAULTS <<< "$APPDEFAULTS_LIST"
+    fi
+
+    write_config
+    create_realms
+
+    local realms=()
+    for((i=1; i <= NREALMS; i++)); do
+        realms+=(-r "$(realm_name $i)")
+    done
+    krb5kdc -n "${realms[@]}" &
+    KDC_PID=$!
+    sleep 1
+    kill -0 "$KDC_PID" 2> /dev/null || die "krb5kdc is not running, see $WORK/kdc.log"
+
+    # the PAM module uses secure krb5 context, which reads only /etc/krb5.conf
+    mkdir -p /etc/kafs-user
+    mount --bind "$WORK/krb5.conf" /etc/krb5.conf || die "unable to replace /etc/krb5.conf"
+    mount --bind "$WORK/kafs-user" /etc/kafs-user || die "unable to replace /etc/kafs-user"
+    mount --bind "$WORK/pam.d" /etc/pam.d || die "unable to replace /etc/pam.d"
+    mount --bind "$WORK/passwd" /etc/passwd || die "unable to replace /etc/passwd"
+
+    local args=(-s kafs-storm -u storm -n "$NUSERS" -w "$NWORKERS" -i "$NITERATIONS" $MACHINE)
+    if [ "$USE_PAM_KRB5" == "1" ]; then
+        args+=(-P "$PASSWORD")
+    else
+        create_ccaches
+        args+=(-c "FILE:$WORK/cc/krb5cc_%s")
+    fi
+    if [ "$LATENCY" != "0" ] || [ "$JITTER" != "0" ] || [ "$DROP" != "0" ]; then
+        args+=(-x "$PROXY_PORT:$KDC_PORT" -l "$LATENCY" -J "$JITTER" -f "$DROP")
+    fi
+
+    if [ "$MEMKEYS" == "1" ]; then
+        export KAFS_BACKEND=mem
+    fi
+
+    "$PAM_STORM" "${args[@]}"
+}
+
+# ------------------------------------------------------------------------------
+
+if [ "$1" == "--inner" ]; then
+    inner
+    exit $?
+fi
+
+while getopts "hb:r:n:w:i:l:J:f:kMma:" opt; do
+    case $opt in
+        h) print_usage; exit 0 ;;
+        b) BUILD_DIR="$OPTARG" ;;
+        r) NREALMS="$OPTARG" ;;
+        n) NUSERS="$OPTARG" ;;
+        w) NWORKERS="$OPTARG" ;;
+        i) NITERATIONS="$OPTARG" ;;
+        l) LATENCY="$OPTARG" ;;
+        J) JITTER="$OPTARG" ;;
+        f) DROP="$OPTARG" ;;
+        k) USE_PAM_KRB5=1 ;;
+        M) MEMKEYS=1 ;;
+        m) MACHINE="-m" ;;
+        a) APPDEFAULTS+=("$OPTARG") ;;
+        *) print_usage; exit 1 ;;
+    esac
+done
+
+[ "$(id -u)" == "0" ] || die "must be executed by root"
+for cmd in krb5kdc kdb5_util kadmin.local kinit unshare; do
+    type "$cmd" > /dev/null 2>&1 || die "'$cmd' not found"
+done
+[ -e /etc/krb5.conf ] || die "/etc/krb5.conf must exist (it is replaced only in private mount namespace)"
+
+PAM_MODULE="$(readlink -f "$BUILD_DIR/lib/pam_kafs_session.so")"
+PAM_STORM="$(readlink -f "$BUILD_DIR/bench/pam-storm")"
+[ -f "$PAM_MODULE" ] || die "pam_kafs_session.so not found in $BUILD_DIR/lib"
+[ -x "$PAM_STORM" ] || die "pam-storm not found in $BUILD_DIR/bench (configure with -DENABLE_BENCH=ON)"
+
+export NREALMS NUSERS NWORKERS NITERATIONS LATENCY JITTER DROP USE_PAM_KRB5 MACHINE MEMKEYS
+export KDC_PORT PROXY_PORT PAM_MODULE PAM_STORM
+export APPDEFAULTS_LIST="$(printf "%s\n" "${APPDEFAULTS[@]}")"
+
+exec unshare --mount --propagation private "$0" --inner
@@ -0,0 +1,133 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <time.h>
+#include <linux/limits.h>
+#include <krb5.h>
+
+#include <kafs-user.h>
+#include <kafs_locl.h>
+
+#include "bench-kafs.h"
+
+/* ============================================================================= */
+
+void bench_fill_creds(krb5_creds* creds,krb5_enctype enctype,unsigned char* key,unsigned int keylen,
+                      unsigned char* ticket,unsigned int* seed)
+{
+    for(unsigned int i=0; i < keylen; i++) key[i] = rand_r(seed);
+
+    memset(creds,0,sizeof(krb5_creds));
+#ifdef HEIMDAL
+    creds->session.keytype          = enctype;
+    creds->session.keyvalue.data    = key;
+    creds->session.keyvalue.length  = keylen;
+#else
+    creds->keyblock.enctype         = enctype;
+    creds->keyblock.contents        = key;
+    creds->keyblock.length          = keylen;
+#endif
+    creds->ticket.data              = (char*)ticket;
+    creds->ticket.length            = BENCH_TICKET_LEN;
+    creds->times.authtime           = time(NULL);
+    creds->times.starttime          = creds->times.authtime;
+    creds->times.endtime            = creds->times.authtime + 10*3600;
+}
+
+/* ============================================================================= */
+
+void bench_write_file(const char* path,const char* content)
+{
+    FILE* p_f = fopen(path,"w");
+    if( p_f == NULL ) err(1,"Unable to create '%s'",path);
+    fputs(content,p_f);
+    fclose(p_f);
+}
+
+/* ============================================================================= */
+
+static void bench_path(char* path,const char* dir,const char* name,const char* suffix)
+{
+    if( suffix != NULL ){
+        snprintf(path,PATH_MAX,"%s/%s.%s",dir,name,suffix);
+    } else {
+        snprintf(path,PATH_MAX,"%s/%s",dir,name);
+    }
+}
+
+/* ------------------------ */
+
+void bench_setup_config(struct bench_config* cfg,const char* dir,const char* suffix,const char* domain,
+                        const char* realm,int ncells,int nservdb,int nservers)
+{
+    bench_path(cfg->thiscell,dir,"ThisCell",suffix);
+    bench_path(cfg->thesecells,dir,"TheseCells",suffix);
+    bench_path(cfg->cellservdb,dir,"CellServDB",suffix);
+    bench_path(cfg->cellrealms,dir,"CellRealms",suffix);
+    bench_path(cfg->usercells,dir,"UserCells",suffix);
+    bench_path(cfg->realm_cache,dir,"cell-realms",suffix);
+
+    char line[256];
+    snprintf(line,sizeof(line),"cell00000.%s\n",domain);
+    bench_write_file(cfg->thiscell,line);
+
+    FILE* p_f = fopen(cfg->thesecells,"w");
+    if( p_f == NULL ) err(1,"Unable to create '%s'",cfg->thesecells);
+    for(int i=0; i < ncells; i++){
+        fprintf(p_f,"cell%05d.%s\n",i,domain);
+    }
+    fclose(p_f);
+
+    p_f = fopen(cfg->cellservdb,"w");
+    if( p_f == NULL ) err(1,"Unable to create '%s'",cfg->cellservdb);
+    for(int i=0; i < nservdb; i++){
+        fprintf(p_f,">cell%05d.%s    #Benchmark cell %d\n",i,domain,i);
+        for(int j=0; j < nservers; j++){
+            fprintf(p_f,"10.%d.%d.%d                  #afsdb%d.cell%05d.%s\n",
+                    (i >> 8) & 0xff,i & 0xff,j+1,j+1,i,domain);
+        }
+    }
+    fclose(p_f);
+
+    line[0] = '\0';
+    if( realm != NULL ) snprintf(line,sizeof(line),".%s %s\n",domain,realm);
+    bench_write_file(cfg->cellrealms,line);
+    bench_write_file(cfg->usercells,"");
+
+    _kafs_path_thiscell     = cfg->thiscell;
+    _kafs_path_thesecells   = cfg->thesecells;
+    _kafs_path_cellservdb   = cfg->cellservdb;
+    _kafs_path_cellrealms   = cfg->cellrealms;
+    _kafs_path_usercells    = cfg->usercells;
+    _kafs_path_realm_cache  = cfg->realm_cache;
+}
+
+/* ============================================================================= */
+
+void bench_cleanup_config(struct bench_config* cfg)
+{
+    _kafs_path_thiscell     = _PATH_KAFS_USER_THISCELL;
+    _kafs_path_thesecells   = _PATH_KAFS_USER_THESECELLS;
+    _kafs_path_cellservdb   = _PATH_KAFS_USER_CELLSERVDB;
+    _kafs_path_cellrealms   = _PATH_KAFS_USER_CELLREALMS;
+    _kafs_path_usercells    = _PATH_KAFS_USER_USERCELLS;
+    _kafs_path_realm_cache  = _PATH_KAFS_USER_REALM_CACHE;
+
+    unlink(cfg->thiscell);
+    unlink(cfg->thesecells);
+    unlink(cfg->cellservdb);
+    unlink(cfg->cellrealms);
+    unlink(cfg->usercells);
+    unlink(cfg->realm_cache);
+}
+
+/* ============================================================================= */
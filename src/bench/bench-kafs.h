@@ -0,0 +1,50 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+#ifndef __KAFS_BENCH_KAFS_H__
+#define __KAFS_BENCH_KAFS_H__
+
+#include <linux/limits.h>
+#include <krb5.h>
+
+/* ============================================================================= */
+
+/* helpers of programs linked with the libkafs sources */
+
+#define BENCH_TICKET_LEN    1024
+
+/* generated configuration files */
+struct bench_config {
+    char    thiscell[PATH_MAX];
+    char    thesecells[PATH_MAX];
+    char    cellservdb[PATH_MAX];
+    char    cellrealms[PATH_MAX];
+    char    usercells[PATH_MAX];
+    char    realm_cache[PATH_MAX];
+};
+
+/* ============================================================================= */
+
+/* fake service ticket with random session key of given type,
+ * the key and the ticket of BENCH_TICKET_LEN bytes are owned by the caller */
+void bench_fill_creds(krb5_creds* creds,krb5_enctype enctype,unsigned char* key,unsigned int keylen,
+                      unsigned char* ticket,unsigned int* seed);
+
+/* create file with given content, exit on failure */
+void bench_write_file(const char* path,const char* content);
+
+/* write configuration files into dir and redirect libkafs to them, suffix of the file names can be NULL
+ * cells are named cellNNNNN.domain, the first one is ThisCell, TheseCells lists ncells of them,
+ * CellServDB nservdb of them with nservers VL servers each, CellRealms maps the domain to realm
+ * (can be NULL), UserCells is empty */
+void bench_setup_config(struct bench_config* cfg,const char* dir,const char* suffix,const char* domain,
+                        const char* realm,int ncells,int nservdb,int nservers);
+
+/* remove the configuration files and restore the default paths */
+void bench_cleanup_config(struct bench_config* cfg);
+
+/* ============================================================================= */
+
+#endif /* __KAFS_BENCH_KAFS_H__ */
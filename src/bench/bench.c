@@ -0,0 +1,103 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+/* ============================================================================= */
+
+long bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return(ts.tv_sec*1000000000L + ts.tv_nsec);
+}
+
+/* ============================================================================= */
+
+int bench_add(struct bench_samples* samples,long value)
+{
+    if( samples->nvalues == samples->mvalues ){
+        size_t  mvalues = samples->mvalues ? 2*samples->mvalues : 1024;
+        long*   p_values = realloc(samples->values,mvalues*sizeof(long));
+        if( p_values == NULL ) return(-1);
+        samples->values = p_values;
+        samples->mvalues = mvalues;
+    }
+    samples->values[samples->nvalues++] = value;
+    return(0);
+}
+
+/* ============================================================================= */
+
+void bench_free(struct bench_samples* samples)
+{
+    free(samples->values);
+    memset(samples,0,sizeof(struct bench_samples));
+}
+
+/* ============================================================================= */
+
+static int bench_cmp(const void* p_a,const void* p_b)
+{
+    long a = *(const long*)p_a;
+    long b = *(const long*)p_b;
+    return( (a > b) - (a < b) );
+}
+
+/* ============================================================================= */
+
+long bench_percentile(struct bench_samples* samples,double p)
+{
+    if( samples->nvalues == 0 ) return(0);
+
+    qsort(samples->values,samples->nvalues,sizeof(long),bench_cmp);
+
+    /* nearest-rank method */
+    size_t rank = (size_t)(p/100.0*samples->nvalues + 0.5);
+    if( rank < 1 ) rank = 1;
+    if( rank > samples->nvalues ) rank = samples->nvalues;
+    return(samples->values[rank-1]);
+}
+
+/* ============================================================================= */
+
+void bench_report_header(FILE* p_fout,int machine)
+{
+    if( machine ) return;
+
+    fprintf(p_fout,"# Benchmark                          Count   Failed      Ops/s   Min[us]   p50[us]   p95[us]   p99[us]   Max[us]\n");
+    fprintf(p_fout,"# -------------------------------- -------- -------- ---------- --------- --------- --------- --------- ---------\n");
+}
+
+/* ============================================================================= */
+
+void bench_report(FILE* p_fout,int machine,const char* name,struct bench_samples* samples,long elapsed)
+{
+    if( elapsed == 0 ){
+        for(size_t i=0; i < samples->nvalues; i++) elapsed += samples->values[i];
+    }
+
+    double  ops = elapsed > 0 ? samples->nvalues*1e9/elapsed : 0.0;
+    long    p50 = bench_percentile(samples,50.0);
+    long    p95 = bench_percentile(samples,95.0);
+    long    p99 = bench_percentile(samples,99.0);
+    long    min = samples->nvalues ? samples->values[0] : 0;
+    long    max = samples->nvalues ? samples->values[samples->nvalues-1] : 0;
+
+    if( machine ){
+        fprintf(p_fout,"bench=%s count=%lu failed=%ld elapsed_ns=%ld ops_per_s=%.1f min_ns=%ld p50_ns=%ld p95_ns=%ld p99_ns=%ld max_ns=%ld\n",
+                name,(unsigned long)samples->nvalues,samples->failed,elapsed,ops,min,p50,p95,p99,max);
+    } else {
+        fprintf(p_fout,"%-34s %8lu %8ld %10.1f %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+                name,(unsigned long)samples->nvalues,samples->failed,ops,min/1e3,p50/1e3,p95/1e3,p99/1e3,max/1e3);
+    }
+}
+
+/* ============================================================================= */
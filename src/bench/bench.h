@@ -0,0 +1,50 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+#ifndef __KAFS_BENCH_H__
+#define __KAFS_BENCH_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* ============================================================================= */
+
+/* latency samples in ns */
+struct bench_samples {
+    long*   values;
+    size_t  nvalues;
+    size_t  mvalues;
+    long    failed;     /* number of failed operations */
+};
+
+/* ============================================================================= */
+
+/* monotonic time in ns */
+long bench_now_ns(void);
+
+/* add sample, return 0 or -1 on OOM */
+int bench_add(struct bench_samples* samples,long value);
+
+/* release samples */
+void bench_free(struct bench_samples* samples);
+
+/* return p-th percentile (0-100), the samples are sorted */
+long bench_percentile(struct bench_samples* samples,double p);
+
+/* ============================================================================= */
+
+/* print header of the report, nothing in machine-readable mode */
+void bench_report_header(FILE* p_fout,int machine);
+
+/* print one line of the report
+ * machine-readable format is one key=value record per line:
+ *   bench=NAME count=N failed=N elapsed_ns=N ops_per_s=X min_ns=N p50_ns=N p95_ns=N p99_ns=N max_ns=N
+ * the table is in us, elapsed is the wall time of the whole run in ns used for throughput, 0 -> sum of samples
+ */
+void bench_report(FILE* p_fout,int machine,const char* name,struct bench_samples* samples,long elapsed);
+
+/* ============================================================================= */
+
+#endif /* __KAFS_BENCH_H__ */
@@ -0,0 +1,288 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * Microbenchmarks of libkafs hot paths.
+ *
+ * The program is linked with the library sources so that it can call internal
+ * functions and redirect configuration files to generated ones. Tokens are
+ * installed into in-memory keyrings unless -K is specified.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <getopt.h>
+#include <time.h>
+#include <linux/limits.h>
+#include <krb5.h>
+
+#include <kafs-user.h>
+#include <kafs_locl.h>
+
+#include "bench.h"
+#include "bench-kafs.h"
+
+/* ========================================================================== */
+
+int              machine        = 0;
+int              niterations    = 1000;
+int              kernel_keys    = 0;
+const char*      filter         = NULL;
+char             work_dir[]     = "/tmp/kafs-bench.XXXXXX";
+
+struct option longopts[] = {
+   { "machine", no_argument,       NULL,     'm' },
+   { 0, 0, 0, 0 }
+};
+
+/* enctypes are numbered according to the IANA Kerberos registry */
+struct bench_enctype {
+    const char*     name;
+    krb5_enctype    enctype;
+    unsigned int    keylen;
+};
+
+const struct bench_enctype enctypes[] = {
+    { "des-cbc-crc",                    1,  8 },
+    { "des3-cbc-sha1",                  16, 24 },
+    { "aes128-cts-hmac-sha1-96",        17, 16 },
+    { "aes256-cts-hmac-sha1-96",        18, 32 },
+    { "aes128-cts-hmac-sha256-128",     19, 16 },
+    { "aes256-cts-hmac-sha384-192",     20, 32 },
+    { "arcfour-hmac",                   23, 16 },
+    { "camellia128-cts-cmac",           25, 16 },
+    { "camellia256-cts-cmac",           26, 32 },
+    { NULL, 0, 0 }
+};
+
+#define BENCH_NCELLS        5
+
+/* ========================================================================== */
+
+void print_usage(void)
+{
+    printf("\n");
+    printf("Microbenchmarks of libkafs hot paths.\n");
+    printf("\n");
+    printf("Usage: kafs-bench [-hmK] [-n ITERATIONS] [-b FILTER]\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("   -h   Print this help.\n");
+    printf("   -m   Machine-readable output (--machine).\n");
+    printf("   -n   Number of iterations (default: 1000), huge inputs use 1/10 of them.\n");
+    printf("   -b   Run only benchmarks containing FILTER in their names.\n");
+    printf("   -K   Use kernel keyrings (requires kAFS for rxrpc keys).\n");
+    printf("\n");
+}
+
+/* ========================================================================== */
+
+int selected(const char* name)
+{
+    return( (filter == NULL) || (strstr(name,filter) != NULL) );
+}
+
+/* ========================================================================== */
+
+void report(const char* name,struct bench_samples* samples)
+{
+    bench_report(stdout,machine,name,samples,0);
+    bench_free(samples);
+}
+
+/* ========================================================================== */
+
+int derive_key(krb5_creds* creds,unsigned char* session_key)
+{
+#ifdef HEIMDAL
+    return( _kafs_derive_des_key(creds->session.keytype,creds->session.keyvalue.data,
+                                 creds->session.keyvalue.length,session_key) );
+#else
+    return( _kafs_derive_des_key(creds,session_key) );
+#endif
+}
+
+/* ========================================================================== */
+
+void bench_kdf(void)
+{
+    unsigned char   key[64];
+    unsigned char   ticket[BENCH_TICKET_LEN];
+    unsigned char   session_key[8];
+    krb5_creds      creds;
+
+    for(const struct bench_enctype* p_et = enctypes; p_et->name != NULL; p_et++){
+        char name[128];
+        snprintf(name,sizeof(name),"kdf.%s",p_et->name);
+        if( ! selected(name) ) continue;
+
+        struct bench_samples samples;
+        memset(&samples,0,sizeof(samples));
+        unsigned int seed = 1;
+
+        for(int i=0; i < niterations; i++){
+            bench_fill_creds(&creds,p_et->enctype,key,p_et->keylen,ticket,&seed);
+            long start = bench_now_ns();
+            int  ret = derive_key(&creds,session_key);
+            bench_add(&samples,bench_now_ns() - start);
+            if( ret != 0 ) samples.failed++;
+        }
+        report(name,&samples);
+    }
+}
+
+/* ========================================================================== */
+
+void bench_config(const char* variant,int ncells,int nservdb,int iterations)
+{
+    struct bench_config cfg;
+    bench_setup_config(&cfg,work_dir,variant,"bench.test",NULL,ncells,nservdb,3);
+
+    char name[128];
+    struct bench_samples samples;
+
+    snprintf(name,sizeof(name),"config.these_cells.%s",variant);
+    if( selected(name) ){
+        memset(&samples,0,sizeof(samples));
+        for(int i=0; i < iterations; i++){
+            long   start = bench_now_ns();
+            char** p_cells = kafs_get_these_cells();
+            kafs_free_these_cells(p_cells);
+            bench_add(&samples,bench_now_ns() - start);
+            if( p_cells == NULL ) samples.failed++;
+        }
+        report(name,&samples);
+    }
+
+    /* the last cell is the worst case */
+    char cell[64];
+    snprintf(cell,sizeof(cell),"cell%05d.bench.test",nservdb-1);
+
+    snprintf(name,sizeof(name),"config.vls.%s",variant);
+    if( selected(name) ){
+        memset(&samples,0,sizeof(samples));
+        for(int i=0; i < iterations; i++){
+            long   start = bench_now_ns();
+            char** p_vls = kafs_get_vls(cell);
+            bench_add(&samples,bench_now_ns() - start);
+            if( (p_vls == NULL) || (p_vls[0] == NULL) ) samples.failed++;
+            kafs_free_vls(p_vls);
+        }
+        report(name,&samples);
+    }
+
+    bench_cleanup_config(&cfg);
+}
+
+/* ========================================================================== */
+
+void bench_settoken(void)
+{
+    unsigned char   key[32];
+    unsigned char   ticket[BENCH_TICKET_LEN];
+    krb5_creds      creds;
+    unsigned int    seed = 1;
+
+    memset(ticket,0x5a,sizeof(ticket));
+
+    /* token replaced in the same cell */
+    if( selected("settoken.replace") ){
+        struct bench_samples samples;
+        memset(&samples,0,sizeof(samples));
+        for(int i=0; i < niterations; i++){
+            bench_fill_creds(&creds,18,key,sizeof(key),ticket,&seed);
+            long start = bench_now_ns();
+            int  ret = _kafs_settoken_rxkad(NULL,"bench.test",&creds);
+            bench_add(&samples,bench_now_ns() - start);
+            if( ret != 0 ) samples.failed++;
+        }
+        report("settoken.replace",&samples);
+        k_unlog();
+    }
+
+    /* login and logout with several cells */
+    if( selected("keyring.install_unlog") ){
+        struct bench_samples samples;
+        memset(&samples,0,sizeof(samples));
+        for(int i=0; i < niterations; i++){
+            long start = bench_now_ns();
+            int  failed = 0;
+            for(int c=0; c < BENCH_NCELLS; c++){
+                char cell[64];
+                snprintf(cell,sizeof(cell),"cell%d.bench.test",c);
+                bench_fill_creds(&creds,18,key,sizeof(key),ticket,&seed);
+                if( _kafs_settoken_rxkad(NULL,cell,&creds) != 0 ) failed = 1;
+            }
+            if( k_unlog() != 0 ) failed = 1;
+            bench_add(&samples,bench_now_ns() - start);
+            if( failed ) samples.failed++;
+        }
+        report("keyring.install_unlog",&samples);
+    }
+}
+
+/* ========================================================================== */
+
+int main(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt_long(argc, argv, "hmKn:b:", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'h':
+                print_usage();
+                return(0);
+            case '?':
+            default:
+                print_usage();
+                return(1);
+            case 'm':
+                machine = 1;
+                break;
+            case 'K':
+                kernel_keys = 1;
+                break;
+            case 'n':
+                niterations = atoi(optarg);
+                break;
+            case 'b':
+                filter = optarg;
+                break;
+        }
+    }
+
+    if( niterations <= 0 ) errx(1,"Number of iterations must be positive");
+
+    _kafs_backend = kernel_keys ? &_kafs_sys_backend : &_kafs_mem_backend;
+
+    if( mkdtemp(work_dir) == NULL ) err(1,"Unable to create working directory");
+
+    /* tokens go to own PAG */
+    if( k_setpag() != 0 ) err(1,"Unable to create PAG");
+
+    if( ! machine ){
+        printf("# keyrings: %s, iterations: %d, ticket: %d B\n",_kafs_backend->name,niterations,BENCH_TICKET_LEN);
+    }
+    bench_report_header(stdout,machine);
+
+    int nhuge = niterations / 10 > 0 ? niterations / 10 : 1;
+
+    bench_kdf();
+    bench_config("realistic",5,200,niterations);
+    bench_config("huge",20000,20000,nhuge);
+    bench_settoken();
+
+    k_revoke_pag();
+    rmdir(work_dir);
+
+    return(0);
+}
+
+/* ========================================================================== */
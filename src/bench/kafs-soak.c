@@ -0,0 +1,337 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * Soak test of long-running libkafs users.
+ *
+ * The program repeats what a renewal daemon does over days: configuration parsing,
+ * realm lookups, token installation, krb5_afslog_ex() from a MEMORY ccache with
+ * prepared afs/<cell> tickets, and k_unlog(), all with one krb5 context. Heap in use,
+ * RSS, and open file descriptors are sampled after every interval. The first interval
+ * is a warm-up and provides the baseline, the run fails if any of the values grows
+ * beyond the limit.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <getopt.h>
+#include <time.h>
+#include <dirent.h>
+#include <malloc.h>
+#include <linux/limits.h>
+#include <krb5.h>
+
+#include <kafs-user.h>
+#include <kafs_locl.h>
+
+#include "bench.h"
+#include "bench-kafs.h"
+
+/* ========================================================================== */
+
+int              machine        = 0;
+int              kernel_keys    = 0;
+long             duration       = 3600;     /* s */
+long             interval       = 60;       /* s */
+long             limit          = 512;      /* KiB */
+char             work_dir[]     = "/tmp/kafs-soak.XXXXXX";
+
+struct option longopts[] = {
+   { "machine", no_argument,       NULL,     'm' },
+   { 0, 0, 0, 0 }
+};
+
+#define SOAK_NCELLS         5
+#define SOAK_REALM          "SOAK.TEST"
+
+struct bench_config config;
+
+/* resources of the process */
+struct soak_usage {
+    long    heap;       /* bytes allocated by malloc */
+    long    rss;        /* bytes */
+    long    fds;
+};
+
+/* ========================================================================== */
+
+void print_usage(void)
+{
+    printf("\n");
+    printf("Soak test of libkafs, it fails if memory or file descriptors grow.\n");
+    printf("\n");
+    printf("Usage: kafs-soak [-hmK] [-t SECONDS] [-i SECONDS] [-l KIB]\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("   -h   Print this help.\n");
+    printf("   -m   Machine-readable output (--machine).\n");
+    printf("   -t   Duration of the test (default: %ld s).\n",duration);
+    printf("   -i   Sampling interval, the first one is a warm-up (default: %ld s).\n",interval);
+    printf("   -l   Allowed growth of heap and RSS (default: %ld KiB).\n",limit);
+    printf("   -K   Use kernel keyrings (requires kAFS for rxrpc keys).\n");
+    printf("\n");
+}
+
+/* ========================================================================== */
+
+void get_usage(struct soak_usage* usage)
+{
+    struct mallinfo2 mi = mallinfo2();
+    usage->heap = mi.uordblks + mi.hblkhd;
+
+    usage->rss = 0;
+    FILE* p_f = fopen("/proc/self/statm","r");
+    if( p_f != NULL ){
+        long size, rss;
+        if( fscanf(p_f,"%ld %ld",&size,&rss) == 2 ) usage->rss = rss * sysconf(_SC_PAGESIZE);
+        fclose(p_f);
+    }
+
+    /* without the descriptor of the directory */
+    usage->fds = -1;
+    DIR* p_dir = opendir("/proc/self/fd");
+    if( p_dir != NULL ){
+        while( readdir(p_dir) != NULL ) usage->fds++;
+        closedir(p_dir);
+        usage->fds -= 2;
+    }
+}
+
+/* ========================================================================== */
+
+/* MEMORY ccache with afs/<cell> tickets, krb5_afslog_ex() finds them without KDC */
+krb5_ccache create_ccache(krb5_context ctx)
+{
+    krb5_ccache     id;
+    krb5_principal  client;
+    unsigned char   key[32];
+    unsigned char   ticket[BENCH_TICKET_LEN];
+    unsigned int    seed = 1;
+
+    memset(ticket,0x5a,sizeof(ticket));
+
+    if( krb5_cc_new_unique(ctx,"MEMORY",NULL,&id) != 0 ) errx(1,"Unable to create ccache");
+    if( krb5_parse_name(ctx,"soak@" SOAK_REALM,&client) != 0 ) errx(1,"Unable to parse principal");
+    if( krb5_cc_initialize(ctx,id,client) != 0 ) errx(1,"Unable to initialize ccache");
+
+    for(int i=0; i < SOAK_NCELLS; i++){
+        char        princ[128];
+        krb5_creds  creds;
+        snprintf(princ,sizeof(princ),"afs/cell%05d.soak.test@" SOAK_REALM,i);
+        bench_fill_creds(&creds,18,key,sizeof(key),ticket,&seed);
+        creds.client = client;
+        if( krb5_parse_name(ctx,princ,&creds.server) != 0 ) errx(1,"Unable to parse principal");
+        if( krb5_cc_store_cred(ctx,id,&creds) != 0 ) errx(1,"Unable to store ticket");
+        krb5_free_principal(ctx,creds.server);
+    }
+
+    krb5_free_principal(ctx,client);
+    return(id);
+}
+
+/* ========================================================================== */
+
+/* one refresh, return number of failed operations */
+int soak_round(krb5_context ctx,krb5_ccache id,unsigned int* seed)
+{
+    int failed = 0;
+
+    /* configuration */
+    char** p_cells = kafs_get_these_cells();
+    if( p_cells == NULL ) return(1);
+
+    for(char** p_ic = p_cells; *p_ic != NULL; p_ic++){
+        char** p_vls = kafs_get_vls(*p_ic);
+        if( (p_vls == NULL) || (p_vls[0] == NULL) ) failed++;
+        kafs_free_vls(p_vls);
+
+        char* p_realm;
+        if( _kafs_lookup_cell_realm(*p_ic,&p_realm) != 0 ){
+            failed++;
+        } else {
+            free(p_realm);
+        }
+    }
+
+    char** p_ucells = kafs_get_user_cells(NULL);
+    if( p_ucells == NULL ) failed++;
+    kafs_free_these_cells(p_ucells);
+
+    char* p_this = kafs_get_this_cell();
+    if( p_this == NULL ) failed++;
+    free(p_this);
+
+    /* learned realms */
+    _kafs_learn_cell_realm("learned.soak.test",SOAK_REALM);
+    _kafs_forget_cell_realm("learned.soak.test");
+
+    /* tokens with single DES keys, which do not need KDF */
+    unsigned char   key[8];
+    unsigned char   ticket[BENCH_TICKET_LEN];
+    krb5_creds      creds;
+
+    memset(ticket,0x5a,sizeof(ticket));
+    for(char** p_ic = p_cells; *p_ic != NULL; p_ic++){
+        bench_fill_creds(&creds,1,key,sizeof(key),ticket,seed);
+        if( _kafs_settoken_rxkad(ctx,*p_ic,&creds) != 0 ) failed++;
+
+        time_t expiry;
+        if( _kafs_get_token_expiry(*p_ic,&expiry) != 0 ) failed++;
+    }
+    kafs_free_these_cells(p_cells);
+
+    /* the whole afslog with worker threads */
+    struct kafs_afslog_opts opts;
+    memset(&opts,0,sizeof(opts));
+    opts.realm = SOAK_REALM;
+
+    struct kafs_afslog_result*  results = NULL;
+    int                         nresults = 0;
+    krb5_afslog_ex(ctx,id,&opts,&results,&nresults);
+    for(int i=0; i < nresults; i++){
+        if( results[i].state != KAFS_AFSLOG_OK ) failed++;
+    }
+    kafs_free_afslog_results(results,nresults);
+
+    if( k_unlog() != 0 ) failed++;
+
+    return(failed);
+}
+
+/* ========================================================================== */
+
+void report_header(void)
+{
+    if( machine ) return;
+
+    printf("# Time[s]     Rounds   Failed  Heap[KiB]   RSS[KiB]    FDs\n");
+    printf("# ------- ---------- -------- ---------- ---------- ------\n");
+}
+
+/* ========================================================================== */
+
+void report(long elapsed,long rounds,long failed,const struct soak_usage* usage)
+{
+    if( machine ){
+        printf("soak elapsed_s=%ld rounds=%ld failed=%ld heap_kib=%ld rss_kib=%ld fds=%ld\n",
+               elapsed,rounds,failed,usage->heap/1024,usage->rss/1024,usage->fds);
+    } else {
+        printf("%9ld %10ld %8ld %10ld %10ld %6ld\n",
+               elapsed,rounds,failed,usage->heap/1024,usage->rss/1024,usage->fds);
+    }
+    fflush(stdout);
+}
+
+/* ========================================================================== */
+
+int main(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt_long(argc, argv, "hmKt:i:l:", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'h':
+                print_usage();
+                return(0);
+            case '?':
+            default:
+                print_usage();
+                return(1);
+            case 'm':
+                machine = 1;
+                break;
+            case 'K':
+                kernel_keys = 1;
+                break;
+            case 't':
+                duration = atol(optarg);
+                break;
+            case 'i':
+                interval = atol(optarg);
+                break;
+            case 'l':
+                limit = atol(optarg);
+                break;
+        }
+    }
+
+    if( (duration <= 0) || (interval <= 0) ) errx(1,"Duration and interval must be positive");
+    if( duration < 2*interval ) errx(1,"Duration must be at least two intervals");
+    if( limit < 0 ) errx(1,"Limit must not be negative");
+
+    _kafs_backend = kernel_keys ? &_kafs_sys_backend : &_kafs_mem_backend;
+
+    if( mkdtemp(work_dir) == NULL ) err(1,"Unable to create working directory");
+    bench_setup_config(&config,work_dir,NULL,"soak.test",SOAK_REALM,SOAK_NCELLS,SOAK_NCELLS,2);
+
+    /* tokens go to own PAG */
+    if( k_setpag() != 0 ) err(1,"Unable to create PAG");
+
+    krb5_context ctx;
+    if( krb5_init_context(&ctx) != 0 ) errx(1,"Unable to init krb5 context");
+    krb5_ccache id = create_ccache(ctx);
+
+    if( ! machine ){
+        printf("# keyrings: %s, duration: %ld s, interval: %ld s, limit: %ld KiB\n",
+               _kafs_backend->name,duration,interval,limit);
+    }
+    report_header();
+
+    struct soak_usage   base, usage;
+    long                rounds = 0, failed = 0;
+    long                start = bench_now_ns() / 1000000000L;
+    long                next = start + interval;
+    long                now = start;
+    unsigned int        seed = 1;
+    int                 have_base = 0;
+
+    while( now - start < duration ){
+        failed += soak_round(ctx,id,&seed);
+        rounds++;
+
+        now = bench_now_ns() / 1000000000L;
+        if( now < next ) continue;
+        next += interval;
+
+        get_usage(&usage);
+        report(now - start,rounds,failed,&usage);
+        if( ! have_base ){
+            base = usage;
+            have_base = 1;
+        }
+    }
+
+    krb5_cc_destroy(ctx,id);
+    krb5_free_context(ctx);
+    k_revoke_pag();
+    bench_cleanup_config(&config);
+    rmdir(work_dir);
+
+    get_usage(&usage);
+
+    int ret = 0;
+    if( usage.heap - base.heap > limit*1024 ){
+        warnx("Heap grew by %ld KiB",(usage.heap - base.heap)/1024);
+        ret = 1;
+    }
+    if( usage.rss - base.rss > limit*1024 ){
+        warnx("RSS grew by %ld KiB",(usage.rss - base.rss)/1024);
+        ret = 1;
+    }
+    if( usage.fds > base.fds ){
+        warnx("Number of open files grew by %ld",usage.fds - base.fds);
+        ret = 1;
+    }
+
+    if( ! machine ) printf("# %s\n",ret == 0 ? "passed" : "FAILED");
+    return(ret);
+}
+
+/* ========================================================================== */
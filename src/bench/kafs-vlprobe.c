@@ -0,0 +1,316 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * Benchmark of VL server probing used by kafs-init --probe.
+ *
+ * A child process emulates VL servers on loopback addresses 127.0.X.Y, all bound to
+ * the same UDP port. Every server answers Rx version requests after its own delay,
+ * some of them never answer. Each round probes all servers and checks that answering
+ * servers are ordered by their delays, silent servers are unreachable, and the whole
+ * probe finishes within the documented bound of twice the timeout.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "vlprobe.h"
+#include "bench.h"
+
+/* ========================================================================== */
+
+int              machine        = 0;
+int              nrounds        = 10;
+int              nservers       = 400;
+int              silent         = 25;       /* % */
+int              timeout        = 200;      /* ms */
+
+struct option longopts[] = {
+   { "machine", no_argument,       NULL,     'm' },
+   { 0, 0, 0, 0 }
+};
+
+/* slack for scheduling of the responder and the probing process */
+#define VLPROBE_SLACK       50          /* ms */
+
+struct responder {
+    int     fd;
+    long    delay;      /* ms, -1 for silent server */
+    char    addr[32];
+};
+
+/* delayed answer */
+struct answer {
+    int                     fd;
+    long                    due;        /* ns */
+    struct sockaddr_in      peer;
+    unsigned char           packet[64];
+    size_t                  len;
+};
+
+struct responder*   responders = NULL;
+
+/* ========================================================================== */
+
+void print_usage(void)
+{
+    printf("\n");
+    printf("Benchmark of VL server probing against loopback responders.\n");
+    printf("\n");
+    printf("Usage: kafs-vlprobe [-hm] [-n SERVERS] [-r ROUNDS] [-s PERCENT] [-t MS]\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("   -h   Print this help.\n");
+    printf("   -m   Machine-readable output (--machine).\n");
+    printf("   -n   Number of servers (default: %d).\n",nservers);
+    printf("   -r   Number of rounds (default: %d).\n",nrounds);
+    printf("   -s   Percentage of servers that never answer (default: %d).\n",silent);
+    printf("   -t   Probe timeout (default: %d ms).\n",timeout);
+    printf("\n");
+}
+
+/* ========================================================================== */
+
+/* bind all servers to the same port on different loopback addresses, return the port */
+int setup_responders(void)
+{
+    int port = 0;
+
+    responders = calloc(nservers,sizeof(struct responder));
+    if( responders == NULL ) errx(1,"Unable to allocate servers");
+
+    for(int i=0; i < nservers; i++){
+        struct responder* p_r = &responders[i];
+        snprintf(p_r->addr,sizeof(p_r->addr),"127.0.%d.%d",1 + i / 250,1 + i % 250);
+
+        /* delays are spread over the first half of the timeout in steps of 5 ms */
+        p_r->delay = (i * 37) % 100 < silent ? -1 : (i * 7) % (timeout / 10 + 1) * 5;
+
+        struct sockaddr_in sa;
+        memset(&sa,0,sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_port   = htons(port);
+        inet_pton(AF_INET,p_r->addr,&sa.sin_addr);
+
+        p_r->fd = socket(AF_INET,SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
+        if( p_r->fd == -1 ) err(1,"Unable to create socket");
+        if( bind(p_r->fd,(struct sockaddr*)&sa,sizeof(sa)) == -1 ) err(1,"Unable to bind '%s'",p_r->addr);
+
+        if( port == 0 ){
+            socklen_t len = sizeof(sa);
+            if( getsockname(p_r->fd,(struct sockaddr*)&sa,&len) == -1 ) err(1,"Unable to get port");
+            port = ntohs(sa.sin_port);
+        }
+    }
+
+    return(port);
+}
+
+/* ========================================================================== */
+
+/* answer version requests after the delay of each server, never returns */
+void run_responders(void)
+{
+    struct pollfd*  pfds = calloc(nservers,sizeof(struct pollfd));
+    struct answer*  answers = calloc(nservers,sizeof(struct answer));
+    int             nanswers = 0;
+
+    if( (pfds == NULL) || (answers == NULL) ) errx(1,"Unable to allocate responders");
+
+    for(int i=0; i < nservers; i++){
+        pfds[i].fd     = responders[i].fd;
+        pfds[i].events = POLLIN;
+    }
+
+    for(;;){
+        long now = bench_now_ns();
+        long wait = -1;
+
+        /* send due answers */
+        for(int i=0; i < nanswers; ){
+            if( answers[i].due <= now ){
+                sendto(answers[i].fd,answers[i].packet,answers[i].len,0,
+                       (struct sockaddr*)&answers[i].peer,sizeof(answers[i].peer));
+                answers[i] = answers[--nanswers];
+                continue;
+            }
+            long ms = (answers[i].due - now + 999999) / 1000000;
+            if( (wait == -1) || (ms < wait) ) wait = ms;
+            i++;
+        }
+
+        if( poll(pfds,nservers,(int)wait) <= 0 ) continue;
+
+        now = bench_now_ns();
+        for(int i=0; i < nservers; i++){
+            if( pfds[i].revents == 0 ) continue;
+
+            struct answer   answer;
+            socklen_t       plen = sizeof(answer.peer);
+            ssize_t         len = recvfrom(pfds[i].fd,answer.packet,sizeof(answer.packet),0,
+                                           (struct sockaddr*)&answer.peer,&plen);
+            if( len <= 0 ) continue;
+            if( (responders[i].delay < 0) || (nanswers >= nservers) ) continue;
+
+            /* the request header with the client-initiated flag cleared is a valid answer */
+            answer.packet[21] &= ~1;
+            answer.fd   = pfds[i].fd;
+            answer.len  = len;
+            answer.due  = now + responders[i].delay * 1000000L;
+            answers[nanswers++] = answer;
+        }
+    }
+}
+
+/* ========================================================================== */
+
+/* probe all servers once, return number of failed checks */
+int probe_round(struct vl_probe_opts* opts,struct vl_server* servers,long* elapsed,int* nskipped)
+{
+    for(int i=0; i < nservers; i++){
+        servers[i].addr  = responders[i].addr;
+        servers[i].rtt   = VL_RTT_UNKNOWN;
+        servers[i].order = i;
+    }
+
+    long start = bench_now_ns();
+    vl_probe(servers,nservers,opts);
+    *elapsed = bench_now_ns() - start;
+
+    int failed = 0;
+    if( *elapsed > (2L*timeout + VLPROBE_SLACK) * 1000000L ){
+        warnx("Probing took %ld ms, the limit is %d ms",*elapsed / 1000000,2*timeout);
+        failed++;
+    }
+
+    *nskipped = 0;
+    for(int i=0; i < nservers; i++){
+        long delay = responders[servers[i].order].delay;
+        if( servers[i].rtt == VL_RTT_UNKNOWN ){
+            (*nskipped)++;
+        } else if( (delay < 0) && (servers[i].rtt != VL_RTT_UNREACHABLE) ){
+            warnx("Silent server '%s' has RTT %ld us",servers[i].addr,servers[i].rtt);
+            failed++;
+        } else if( (delay >= 0) && (servers[i].rtt < delay * 1000) ){
+            warnx("Server '%s' with delay %ld ms has RTT %ld us",servers[i].addr,delay,servers[i].rtt);
+            failed++;
+        }
+    }
+
+    /* measured servers must be ordered by their delays */
+    vl_sort(servers,nservers);
+    for(int i=1; i < nservers; i++){
+        if( (servers[i-1].rtt < 0) || (servers[i].rtt < 0) ) continue;
+        long prev = responders[servers[i-1].order].delay;
+        long curr = responders[servers[i].order].delay;
+        if( prev > curr ){
+            warnx("Server '%s' (%ld ms) is ordered before '%s' (%ld ms)",
+                  servers[i-1].addr,prev,servers[i].addr,curr);
+            failed++;
+        }
+    }
+
+    return(failed);
+}
+
+/* ========================================================================== */
+
+int main(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt_long(argc, argv, "hmn:r:s:t:", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'h':
+                print_usage();
+                return(0);
+            case '?':
+            default:
+                print_usage();
+                return(1);
+            case 'm':
+                machine = 1;
+                break;
+            case 'n':
+                nservers = atoi(optarg);
+                break;
+            case 'r':
+                nrounds = atoi(optarg);
+                break;
+            case 's':
+                silent = atoi(optarg);
+                break;
+            case 't':
+                timeout = atoi(optarg);
+                break;
+        }
+    }
+
+    if( (nservers <= 0) || (nservers > 250*250) ) errx(1,"Number of servers must be in range 1-62500");
+    if( nrounds <= 0 ) errx(1,"Number of rounds must be positive");
+    if( (silent < 0) || (silent > 100) ) errx(1,"Percentage of silent servers must be in range 0-100");
+    if( timeout < 2*VLPROBE_SLACK ) errx(1,"Timeout must be at least %d ms",2*VLPROBE_SLACK);
+
+    int port = setup_responders();
+
+    pid_t pid = fork();
+    if( pid == -1 ) err(1,"Unable to fork responder");
+    if( pid == 0 ) run_responders();
+    for(int i=0; i < nservers; i++) close(responders[i].fd);
+
+    struct vl_probe_opts    opts = { 0, port, timeout };
+    struct vl_server*       servers = calloc(nservers,sizeof(struct vl_server));
+    struct bench_samples    samples;
+    long                    nskipped = 0;
+
+    if( servers == NULL ) errx(1,"Unable to allocate servers");
+    memset(&samples,0,sizeof(samples));
+
+    if( ! machine ){
+        printf("# servers: %d, silent: %d %%, timeout: %d ms, max in flight: %d\n",
+               nservers,silent,timeout,VL_PROBE_MAX_INFLIGHT);
+    }
+    bench_report_header(stdout,machine);
+
+    for(int i=0; i < nrounds; i++){
+        long elapsed;
+        int  skipped;
+        int  failed = probe_round(&opts,servers,&elapsed,&skipped);
+        bench_add(&samples,elapsed);
+        if( failed ) samples.failed++;
+        nskipped += skipped;
+    }
+    bench_report(stdout,machine,"vlprobe.rx",&samples,0);
+
+    kill(pid,SIGTERM);
+    waitpid(pid,NULL,0);
+
+    int ret = samples.failed > 0 ? 1 : 0;
+    if( machine ){
+        printf("vlprobe skipped=%ld\n",nskipped);
+    } else {
+        printf("# %ld server(s) not probed within the timeout\n",nskipped);
+        printf("# %s\n",ret == 0 ? "passed" : "FAILED");
+    }
+
+    bench_free(&samples);
+    free(servers);
+    free(responders);
+    return(ret);
+}
+
+/* ========================================================================== */
@@ -0,0 +1,436 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * PAM login storm benchmark.
+ *
+ * Worker processes drive a PAM service through full login cycles
+ * (authenticate, setcred, open_session, close_session, delete_cred) for
+ * simulated users and report latency of individual phases. Each cycle
+ * starts in a new anonymous session keyring as sshd does.
+ *
+ * Optionally, KDC traffic is routed through an UDP proxy, which can delay
+ * or drop requests. See contrib/bench/pam-storm.sh for the setup with a local KDC.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <getopt.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <keyutils.h>
+#include <security/pam_appl.h>
+
+#include "bench.h"
+
+/* ========================================================================== */
+
+#define PHASE_AUTH      0
+#define PHASE_SETCRED   1
+#define PHASE_OPEN      2
+#define PHASE_CLOSE     3
+#define PHASE_DELCRED   4
+#define PHASE_CYCLE     5
+#define NPHASES         6
+
+const char* phase_names[NPHASES] = {
+    "authenticate", "setcred", "open_session", "close_session", "delete_cred", "cycle"
+};
+
+/* one sample sent from workers to the parent, smaller than PIPE_BUF */
+struct storm_sample {
+    int     phase;
+    int     failed;
+    long    elapsed;
+};
+
+/* ========================================================================== */
+
+int              machine        = 0;
+const char*      service        = "kafs-storm";
+const char*      user_prefix    = "storm";
+int              nusers         = 10;
+const char*      ccache_fmt     = "FILE:/tmp/krb5cc_%s";
+const char*      password       = NULL;
+int              nworkers       = 4;
+int              niterations    = 100;
+int              proxy_port     = 0;
+int              kdc_port       = 0;
+long             kdc_latency    = 0;
+long             kdc_jitter     = 0;
+int              kdc_drop       = 0;
+
+struct option longopts[] = {
+   { "machine", no_argument,       NULL,     'm' },
+   { 0, 0, 0, 0 }
+};
+
+/* ========================================================================== */
+
+void print_usage(void)
+{
+    printf("\n");
+    printf("Drive PAM service through login cycles for simulated users and report latency per phase.\n");
+    printf("\n");
+    printf("Usage: pam-storm [-hm] [-s SERVICE] [-u PREFIX] [-n USERS] [-c CCACHE] [-P PASSWORD]\n");
+    printf("                 [-w WORKERS] [-i ITERATIONS] [-x PORT:KDCPORT] [-l MS] [-J MS] [-f PERCENT]\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("   -h   Print this help.\n");
+    printf("   -m   Machine-readable output (--machine).\n");
+    printf("   -s   PAM service (default: kafs-storm).\n");
+    printf("   -u   User name prefix, users are PREFIX0001 .. PREFIXnnnn (default: storm).\n");
+    printf("   -n   Number of users (default: 10).\n");
+    printf("   -c   KRB5CCNAME pattern, %%s is replaced by user name (default: FILE:/tmp/krb5cc_%%s).\n");
+    printf("   -P   Password provided to the PAM conversation (e.g. for pam_krb5).\n");
+    printf("   -w   Number of concurrent workers (default: 4).\n");
+    printf("   -i   Number of login cycles per worker (default: 100).\n");
+    printf("   -x   Run UDP KDC proxy on PORT forwarding to KDCPORT on localhost.\n");
+    printf("   -l   Delay KDC requests by MS milliseconds (requires -x).\n");
+    printf("   -J   Add random jitter up to MS milliseconds (requires -x).\n");
+    printf("   -f   Drop PERCENT of KDC requests (requires -x).\n");
+    printf("\n");
+}
+
+/* ========================================================================== */
+
+struct proxy_request {
+    int                 sock;
+    struct sockaddr_in  client;
+    char                data[65536];
+    ssize_t             len;
+    long                delay;
+};
+
+/* ========================================================================== */
+
+void* proxy_request_thread(void* p_data)
+{
+    struct proxy_request* p_req = p_data;
+
+    if( p_req->delay > 0 ){
+        struct timespec ts;
+        ts.tv_sec  = p_req->delay / 1000;
+        ts.tv_nsec = (p_req->delay % 1000) * 1000000L;
+        nanosleep(&ts,NULL);
+    }
+
+    int kdc = socket(AF_INET,SOCK_DGRAM,0);
+    if( kdc >= 0 ){
+        struct sockaddr_in addr;
+        memset(&addr,0,sizeof(addr));
+        addr.sin_family         = AF_INET;
+        addr.sin_port           = htons(kdc_port);
+        addr.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+
+        if( sendto(kdc,p_req->data,p_req->len,0,(struct sockaddr*)&addr,sizeof(addr)) == p_req->len ){
+            struct pollfd pfd = { .fd = kdc, .events = POLLIN };
+            if( poll(&pfd,1,10000) == 1 ){
+                ssize_t len = recv(kdc,p_req->data,sizeof(p_req->data),0);
+                if( len > 0 ){
+                    sendto(p_req->sock,p_req->data,len,0,(struct sockaddr*)&p_req->client,sizeof(p_req->client));
+                }
+            }
+        }
+        close(kdc);
+    }
+
+    free(p_req);
+    return(NULL);
+}
+
+/* ========================================================================== */
+
+void run_proxy(void)
+{
+    int sock = socket(AF_INET,SOCK_DGRAM,0);
+    if( sock < 0 ) err(1,"Unable to create proxy socket");
+
+    struct sockaddr_in addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sin_family         = AF_INET;
+    addr.sin_port           = htons(proxy_port);
+    addr.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+
+    if( bind(sock,(struct sockaddr*)&addr,sizeof(addr)) != 0 ) err(1,"Unable to bind proxy to port %d",proxy_port);
+
+    unsigned int seed = getpid();
+
+    for(;;){
+        struct proxy_request* p_req = malloc(sizeof(struct proxy_request));
+        if( p_req == NULL ) err(1,"Unable to allocate proxy request");
+
+        socklen_t alen = sizeof(p_req->client);
+        p_req->sock = sock;
+        p_req->len  = recvfrom(sock,p_req->data,sizeof(p_req->data),0,(struct sockaddr*)&p_req->client,&alen);
+        if( p_req->len <= 0 ){
+            free(p_req);
+            continue;
+        }
+
+        /* injected failure - the client has to retry */
+        if( (kdc_drop > 0) && (rand_r(&seed) % 100 < kdc_drop) ){
+            free(p_req);
+            continue;
+        }
+
+        p_req->delay = kdc_latency;
+        if( kdc_jitter > 0 ) p_req->delay += rand_r(&seed) % (kdc_jitter + 1);
+
+        pthread_t       tid;
+        pthread_attr_t  attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+        if( pthread_create(&tid,&attr,proxy_request_thread,p_req) != 0 ){
+            free(p_req);
+        }
+        pthread_attr_destroy(&attr);
+    }
+}
+
+/* ========================================================================== */
+
+int storm_conv(int nmsg,const struct pam_message** msg,struct pam_response** resp,void* data)
+{
+    struct pam_response* p_resp = calloc(nmsg,sizeof(struct pam_response));
+    if( p_resp == NULL ) return(PAM_BUF_ERR);
+
+    for(int i=0; i < nmsg; i++){
+        switch(msg[i]->msg_style){
+            case PAM_PROMPT_ECHO_OFF:
+            case PAM_PROMPT_ECHO_ON:
+                if( password == NULL ){
+                    for(int j=0; j < i; j++) free(p_resp[j].resp);
+                    free(p_resp);
+                    return(PAM_CONV_ERR);
+                }
+                p_resp[i].resp = strdup(password);
+                break;
+            default:
+                break;
+        }
+    }
+
+    *resp = p_resp;
+    return(PAM_SUCCESS);
+}
+
+/* ========================================================================== */
+
+void send_sample(int fd,int phase,int failed,long elapsed)
+{
+    struct storm_sample sample;
+    sample.phase    = phase;
+    sample.failed   = failed;
+    sample.elapsed  = elapsed;
+    if( write(fd,&sample,sizeof(sample)) != sizeof(sample) ) err(1,"Unable to send sample");
+}
+
+/* ========================================================================== */
+
+void run_worker(int worker,int fd)
+{
+    struct pam_conv conv = { storm_conv, NULL };
+
+    for(int it=0; it < niterations; it++){
+        char user[256];
+        char ccname[1024];
+
+        snprintf(user,sizeof(user),"%s%04d",user_prefix,1 + (worker + it*nworkers) % nusers);
+        snprintf(ccname,sizeof(ccname),"KRB5CCNAME=");
+        snprintf(ccname + strlen(ccname),sizeof(ccname) - strlen(ccname),ccache_fmt,user);
+
+        /* fresh anonymous session as after fork in sshd */
+        keyctl_join_session_keyring(NULL);
+
+        pam_handle_t*   pamh = NULL;
+        long            start = bench_now_ns();
+        long            phase;
+        int             ret;
+        int             failed = 0;
+
+        ret = pam_start(service,user,&conv,&pamh);
+        if( ret != PAM_SUCCESS ) errx(1,"Unable to start PAM service '%s'",service);
+
+        pam_putenv(pamh,ccname);
+
+        phase = bench_now_ns();
+        ret = pam_authenticate(pamh,0);
+        send_sample(fd,PHASE_AUTH,ret != PAM_SUCCESS,bench_now_ns() - phase);
+        failed |= ret != PAM_SUCCESS;
+
+        phase = bench_now_ns();
+        ret = pam_setcred(pamh,PAM_ESTABLISH_CRED);
+        send_sample(fd,PHASE_SETCRED,ret != PAM_SUCCESS,bench_now_ns() - phase);
+        failed |= ret != PAM_SUCCESS;
+
+        phase = bench_now_ns();
+        ret = pam_open_session(pamh,0);
+        send_sample(fd,PHASE_OPEN,ret != PAM_SUCCESS,bench_now_ns() - phase);
+        failed |= ret != PAM_SUCCESS;
+
+        phase = bench_now_ns();
+        ret = pam_close_session(pamh,0);
+        send_sample(fd,PHASE_CLOSE,ret != PAM_SUCCESS,bench_now_ns() - phase);
+        failed |= ret != PAM_SUCCESS;
+
+        phase = bench_now_ns();
+        ret = pam_setcred(pamh,PAM_DELETE_CRED);
+        send_sample(fd,PHASE_DELCRED,ret != PAM_SUCCESS,bench_now_ns() - phase);
+        failed |= ret != PAM_SUCCESS;
+
+        pam_end(pamh,failed ? PAM_SYSTEM_ERR : PAM_SUCCESS);
+
+        send_sample(fd,PHASE_CYCLE,failed,bench_now_ns() - start);
+    }
+}
+
+/* ========================================================================== */
+
+int main(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt_long(argc, argv, "hms:u:n:c:P:w:i:x:l:J:f:", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'h':
+                print_usage();
+                return(0);
+            case '?':
+            default:
+                print_usage();
+                return(1);
+            case 'm':
+                machine = 1;
+                break;
+            case 's':
+                service = optarg;
+                break;
+            case 'u':
+                user_prefix = optarg;
+                break;
+            case 'n':
+                nusers = atoi(optarg);
+                break;
+            case 'c':
+                ccache_fmt = optarg;
+                break;
+            case 'P':
+                password = optarg;
+                break;
+            case 'w':
+                nworkers = atoi(optarg);
+                break;
+            case 'i':
+                niterations = atoi(optarg);
+                break;
+            case 'x':
+                if( sscanf(optarg,"%d:%d",&proxy_port,&kdc_port) != 2 ) errx(1,"Invalid proxy specification '%s'",optarg);
+                break;
+            case 'l':
+                kdc_latency = atol(optarg);
+                break;
+            case 'J':
+                kdc_jitter = atol(optarg);
+                break;
+            case 'f':
+                kdc_drop = atoi(optarg);
+                break;
+        }
+    }
+
+    if( (nusers <= 0) || (nworkers <= 0) || (niterations <= 0) ) errx(1,"Users, workers and iterations must be positive");
+
+    /* the proxy runs in own process so that workers are forked from a single-threaded process */
+    pid_t proxy = 0;
+    if( proxy_port > 0 ){
+        proxy = fork();
+        if( proxy < 0 ) err(1,"Unable to fork KDC proxy");
+        if( proxy == 0 ){
+            run_proxy();
+            _exit(0);
+        }
+    }
+
+    int fds[2];
+    if( pipe(fds) != 0 ) err(1,"Unable to create pipe");
+
+    pid_t* workers = calloc(nworkers,sizeof(pid_t));
+    if( workers == NULL ) errx(1,"Unable to allocate workers");
+
+    long start = bench_now_ns();
+
+    for(int w=0; w < nworkers; w++){
+        pid_t pid = fork();
+        if( pid < 0 ) err(1,"Unable to fork worker");
+        workers[w] = pid;
+        if( pid == 0 ){
+            close(fds[0]);
+            run_worker(w,fds[1]);
+            close(fds[1]);
+            _exit(0);
+        }
+    }
+    close(fds[1]);
+
+    /* collect samples */
+    struct bench_samples samples[NPHASES];
+    memset(samples,0,sizeof(samples));
+
+    struct storm_sample sample;
+    while( read(fds[0],&sample,sizeof(sample)) == sizeof(sample) ){
+        if( (sample.phase < 0) || (sample.phase >= NPHASES) ) continue;
+        if( bench_add(&samples[sample.phase],sample.elapsed) != 0 ) errx(1,"Unable to store sample");
+        if( sample.failed ) samples[sample.phase].failed++;
+    }
+    close(fds[0]);
+
+    int status;
+    int failed = 0;
+    for(int w=0; w < nworkers; w++){
+        if( (waitpid(workers[w],&status,0) < 0) || ! WIFEXITED(status) || (WEXITSTATUS(status) != 0) ) failed++;
+    }
+    free(workers);
+
+    long elapsed = bench_now_ns() - start;
+
+    if( proxy > 0 ){
+        kill(proxy,SIGTERM);
+        waitpid(proxy,&status,0);
+    }
+
+    /* report */
+    if( ! machine ){
+        printf("# service: %s, users: %d, workers: %d, cycles: %d, wall time: %.3f s\n",
+               service,nusers,nworkers,nworkers*niterations,elapsed/1e9);
+        if( proxy_port > 0 ){
+            printf("# KDC proxy: latency %ld ms, jitter %ld ms, drop %d %%\n",kdc_latency,kdc_jitter,kdc_drop);
+        }
+    }
+    bench_report_header(stdout,machine);
+    for(int i=0; i < NPHASES; i++){
+        char name[64];
+        snprintf(name,sizeof(name),"pam_storm.%s",phase_names[i]);
+        /* throughput of the whole storm, not of individual phases */
+        bench_report(stdout,machine,name,&samples[i],i == PHASE_CYCLE ? elapsed : 0);
+        bench_free(&samples[i]);
+    }
+
+    return(failed ? 1 : 0);
+}
+
+/* ========================================================================== */
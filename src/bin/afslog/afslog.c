@@ -43,38 +43,271 @@
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <time.h>
+#include <unistd.h>
 
 /* ========================================================================== */
 
 int              verbose        = 0;
+int              summary        = 0;
 char*            cache_name     = NULL;
 char*            realm          = NULL;
+long             timeout        = 0;
+long             min_lifetime   = 0;
+int              concurrency    = 1;
+int              all_cells      = 0;
+int              use_cache      = 0;
+int              print_stats    = 0;
+int              renew          = 0;
 
 struct option longopts[] = {
    { "cache",   required_argument, NULL,     'c' },
    { "realm",   required_argument, NULL,     'k' },
+   { "token-cache", no_argument,   NULL,     'u' },
+   { "stats",   no_argument,       NULL,     'S' },
+   { "renew-collection", no_argument, NULL,  'R' },
    { 0, 0, 0, 0 }
 };
 
+const char* state_names[] = { "OK", "SKIPPED", "FAILED", "TIMEOUT", "CACHED" };
+
+/* collection renewal */
+#define RENEW_MARGIN    300         /* s, refresh tokens this time before they expire */
+#define MIN_WAKEUP      60          /* s */
+#define MAX_WAKEUP      7200        /* s */
+
 /* ========================================================================== */
 
 void print_usage(void)
 {
     printf("\n");
-    printf("Obtain AFS tokens. If no cell names are provided, they are read from ThisCell and TheseCells.\n");
+    printf("Obtain AFS tokens. If no cell names are provided, they are read from ThisCell and TheseCells\n");
+    printf("narrowed by ~/.config/kafs/cells or UserCells.\n");
     printf("\n");
-    printf("Usage: afslog [-vdh] [-r REALM] [cell1 [cell2 ...]]\n");
+    printf("Usage: afslog [-vdhsauSR] [-r REALM] [-t TIMEOUT] [-l LIFETIME] [-j NUM] [cell1 [cell2 ...]]\n");
     printf("\n");
     printf("Options:\n");
     printf("   -h   Print this help.\n");
     printf("   -v   Print kAFS-user version.\n");
     printf("   -d   Be more verbose.\n");
+    printf("   -s   Print per-cell summary.\n");
     printf("   -r   Specify AFS server realm.\n");
+    printf("   -t   Do not start new cells after TIMEOUT seconds.\n");
+    printf("   -l   Keep tokens, which are valid at least LIFETIME seconds.\n");
+    printf("   -j   Process up to NUM cells in parallel.\n");
+    printf("   -a   Use all cells from ThisCell and TheseCells regardless of the user selection.\n");
+    printf("   -u   Install still valid tokens of the same principal from the persistent token cache\n");
+    printf("        before contacting KDC (--token-cache).\n");
+    printf("   -S   Print libkafs statistics of obtaining tokens (--stats).\n");
+    printf("   -R   Stay running, renew TGTs in all ccaches of the ccache collection when they pass half\n");
+    printf("        of their lifetime, and refresh only tokens expiring before the next wakeup, which is\n");
+    printf("        the earliest TGT renewal or token expiry (--renew-collection, -l is ignored).\n");
     printf("\n");
 }
 
 /* ========================================================================== */
 
+/* obtain tokens, the earliest expiry of valid tokens is returned in expiry, return number of failed cells */
+int get_tokens(krb5_context ctx,krb5_ccache ccache,const struct kafs_afslog_opts* opts,time_t* expiry)
+{
+    struct kafs_afslog_result*  results  = NULL;
+    int                         nresults = 0;
+    int                         failed   = 0;
+
+    *expiry = 0;
+
+    krb5_error_code ret = krb5_afslog_ex(ctx, ccache, opts, &results, &nresults);
+    if( (ret != 0) && (nresults == 0) ) failed++;
+
+    if( summary ) {
+        printf("# Cell                           Realm                          State     Time [ms] Expire\n");
+        printf("# ------------------------------ ------------------------------ -------- ---------- -------------------\n");
+    }
+    for(int i=0; i < nresults; i++){
+        if( (results[i].state == KAFS_AFSLOG_FAILED) || (results[i].state == KAFS_AFSLOG_TIMEOUT) ) {
+            failed++;
+        } else if( (results[i].expiry != 0) && ((*expiry == 0) || (results[i].expiry < *expiry)) ) {
+            *expiry = results[i].expiry;
+        }
+        if( summary ) {
+            char exp[32] = "-";
+            if( results[i].expiry != 0 ){
+                strftime(exp,sizeof(exp),"%Y-%m-%d %H:%M:%S",localtime(&results[i].expiry));
+            }
+            printf("%-32s %-30s %-8s %10ld %s\n",results[i].cell,results[i].realm ? results[i].realm : "-",
+                   state_names[results[i].state],results[i].elapsed,exp);
+        }
+    }
+    kafs_free_afslog_results(results,nresults);
+
+    return(failed);
+}
+
+/* ========================================================================== */
+
+/* renew the local TGT of the ccache when it is past half of its lifetime,
+   return the time of its next renewal, 0 if it cannot be renewed, or -1 on failure */
+time_t renew_ccache(krb5_context ctx,krb5_ccache ccache)
+{
+    krb5_creds      in_creds;
+    krb5_creds*     p_creds;
+    krb5_principal  client;
+
+    if( krb5_cc_get_principal(ctx, ccache, &client) != 0 ) return(0);
+
+    /* krbtgt/REALM@REALM of the client realm */
+    char* p_cname;
+    if( krb5_unparse_name(ctx, client, &p_cname) != 0 ) {
+        krb5_free_principal(ctx, client);
+        return(0);
+    }
+    char*           p_realm = strrchr(p_cname, '@');
+    krb5_error_code ret = KRB5_PARSE_MALFORMED;
+    memset(&in_creds, 0, sizeof(in_creds));
+    in_creds.client = client;
+    if( p_realm != NULL ) {
+        p_realm++;
+        ret = krb5_build_principal(ctx, &in_creds.server, strlen(p_realm), p_realm, "krbtgt", p_realm, NULL);
+    }
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    krb5_free_unparsed_name(ctx, p_cname);
+#pragma GCC diagnostic pop
+    if( ret != 0 ) {
+        krb5_free_principal(ctx, client);
+        return(0);
+    }
+
+    ret = krb5_get_credentials(ctx, KRB5_GC_CACHED, ccache, &in_creds, &p_creds);
+    krb5_free_principal(ctx, in_creds.server);
+    if( ret != 0 ) {
+        krb5_free_principal(ctx, client);
+        return(0);
+    }
+
+    krb5_ticket_times times = p_creds->times;
+    krb5_free_creds(ctx, p_creds);
+    if( times.starttime == 0 ) times.starttime = times.authtime;
+
+    time_t now  = time(NULL);
+    time_t half = times.starttime + (times.endtime - times.starttime) / 2 + 1;
+    if( now < half ) {
+        krb5_free_principal(ctx, client);
+        return(half);
+    }
+
+    /* not renewable, it will simply expire */
+    if( times.renew_till <= times.endtime ) {
+        krb5_free_principal(ctx, client);
+        return(0);
+    }
+
+    krb5_creds new_creds;
+    ret = krb5_get_renewed_creds(ctx, &new_creds, client, ccache, NULL);
+    if( ret == 0 ) {
+        ret = krb5_cc_initialize(ctx, ccache, client);
+        if( ret == 0 ) ret = krb5_cc_store_cred(ctx, ccache, &new_creds);
+        times = new_creds.times;
+        krb5_free_cred_contents(ctx, &new_creds);
+    }
+    krb5_free_principal(ctx, client);
+
+    if( ret != 0 ) {
+        const char* p_msg = krb5_get_error_message(ctx, ret);
+        warnx("Unable to renew TGT in %s:%s: %s", krb5_cc_get_type(ctx, ccache), krb5_cc_get_name(ctx, ccache), p_msg);
+        krb5_free_error_message(ctx, p_msg);
+        return(-1);
+    }
+    if( verbose ) warnx("TGT in %s:%s renewed", krb5_cc_get_type(ctx, ccache), krb5_cc_get_name(ctx, ccache));
+
+    if( times.starttime == 0 ) times.starttime = times.authtime;
+    return(times.starttime + (times.endtime - times.starttime) / 2 + 1);
+}
+
+/* ========================================================================== */
+
+/* renew TGTs in all ccaches of the collection of the ccache, return the earliest next renewal (0 - none),
+   failed is incremented for each failed renewal */
+time_t renew_collection(krb5_context ctx,krb5_ccache ccache,int* failed)
+{
+    const char* p_type  = krb5_cc_get_type(ctx, ccache);
+    time_t      next    = 0;
+    int         own     = 0;
+
+    krb5_cccol_cursor cursor;
+    if( krb5_cc_support_switch(ctx, p_type) && (krb5_cccol_cursor_new(ctx, &cursor) == 0) ) {
+        krb5_ccache cache;
+        while( (krb5_cccol_cursor_next(ctx, cursor, &cache) == 0) && (cache != NULL) ) {
+            /* only the collection of our ccache */
+            if( strcmp(krb5_cc_get_type(ctx, cache), p_type) != 0 ) {
+                krb5_cc_close(ctx, cache);
+                continue;
+            }
+            if( strcmp(krb5_cc_get_name(ctx, cache), krb5_cc_get_name(ctx, ccache)) == 0 ) own = 1;
+
+            time_t when = renew_ccache(ctx, cache);
+            krb5_cc_close(ctx, cache);
+            if( when == -1 ) {
+                (*failed)++;
+            } else if( (when > 0) && ((next == 0) || (when < next)) ) {
+                next = when;
+            }
+        }
+        krb5_cccol_cursor_free(ctx, &cursor);
+    }
+
+    /* types without collections, e.g. FILE */
+    if( ! own ) {
+        time_t when = renew_ccache(ctx, ccache);
+        if( when == -1 ) {
+            (*failed)++;
+        } else if( (when > 0) && ((next == 0) || (when < next)) ) {
+            next = when;
+        }
+    }
+
+    return(next);
+}
+
+/* ========================================================================== */
+
+/* renew the collection and refresh tokens forever */
+void renew_loop(krb5_context ctx,krb5_ccache ccache,struct kafs_afslog_opts* opts)
+{
+    long delay = 1;     /* s, back off while the KDC is not available */
+
+    for(;;) {
+        int     failed = 0;
+        time_t  next   = renew_collection(ctx, ccache, &failed);
+        time_t  now    = time(NULL);
+
+        if( (next == 0) || (next > now + MAX_WAKEUP) ) next = now + MAX_WAKEUP;
+
+        /* tokens valid until the next wakeup are kept */
+        time_t expiry;
+        opts->min_lifetime = next - now + RENEW_MARGIN;
+        failed += get_tokens(ctx, ccache, opts, &expiry);
+
+        /* wake up before the earliest token expires, tokens expiring sooner are limited by the TGT */
+        if( (expiry - RENEW_MARGIN > now + MIN_WAKEUP) && (expiry - RENEW_MARGIN < next) ) next = expiry - RENEW_MARGIN;
+
+        if( failed > 0 ) {
+            if( delay == 1 ) warnx("Unable to renew tickets or refresh tokens, retrying");
+            if( delay < MAX_WAKEUP ) delay += delay / 2 + 1;
+            if( now + delay < next ) next = now + delay;
+        } else {
+            delay = 1;
+        }
+        if( next < now + 1 ) next = now + 1;
+
+        if( verbose ) warnx("Next wakeup in %ld s", (long)(next - now));
+        fflush(stdout);
+        sleep(next - now);
+    }
+}
+
+/* ========================================================================== */
+
 int main(int argc, char **argv)
 {
     krb5_error_code ret = 0;
@@ -82,7 +315,7 @@ int main(int argc, char **argv)
     krb5_ccache     ccache = NULL;
     int             c;
 
-    while ((c = getopt_long(argc, argv, "hvdr:c:", longopts, NULL)) != -1) {
+    while ((c = getopt_long(argc, argv, "hvdsauSRr:c:t:l:j:", longopts, NULL)) != -1) {
         switch (c) {
             case 'h':
                 print_usage();
@@ -104,6 +337,30 @@ int main(int argc, char **argv)
             case 'r':
                 realm = optarg;
                 break;
+            case 's':
+                summary = 1;
+                break;
+            case 't':
+                timeout = atol(optarg);
+                break;
+            case 'l':
+                min_lifetime = atol(optarg);
+                break;
+            case 'j':
+                concurrency = atoi(optarg);
+                break;
+            case 'a':
+                all_cells = 1;
+                break;
+            case 'u':
+                use_cache = 1;
+                break;
+            case 'S':
+                print_stats = 1;
+                break;
+            case 'R':
+                renew = 1;
+                break;
         }
     }
 
@@ -124,19 +381,41 @@ int main(int argc, char **argv)
 
     /* afslog */
 
-    int num = 0;
-    int failed = 0;
+    struct kafs_afslog_opts     opts;
+    char**                      cells    = NULL;
 
-    for(; optind < argc; optind++){
-        if( verbose ) warnx("Getting tokens for cell \"%s\"", argv[optind]);
-        ret = krb5_afslog(ctx, ccache, argv[optind], realm);
-        if( ret ) failed++;
-        num++;
-    }
-    if( num == 0 ) {
+    memset(&opts,0,sizeof(opts));
+    opts.realm          = realm;
+    opts.timeout        = timeout * 1000;
+    opts.min_lifetime   = min_lifetime;
+    opts.concurrency    = concurrency;
+    opts.use_cache      = use_cache;
+
+    if( optind < argc ) {
+        opts.cells = (const char**)&argv[optind];
+        if( verbose ) warnx("Getting tokens for %d cell(s)", argc - optind);
+    } else if( all_cells ) {
         if( verbose ) warnx("Getting tokens for default cells");
-        ret = krb5_afslog(ctx, ccache, NULL, realm);
-        if( ret ) failed++;
+    } else {
+        cells = kafs_get_user_cells(NULL);
+        opts.cells = (const char**)cells;
+        if( verbose ) warnx("Getting tokens for user cells");
+    }
+
+    if( renew ) renew_loop(ctx, ccache, &opts);
+
+    /* only the work done for tokens */
+    kafs_reset_stats();
+
+    time_t expiry;
+    int failed = get_tokens(ctx, ccache, &opts, &expiry);
+    kafs_free_these_cells(cells);
+
+    if( print_stats ){
+        struct kafs_stats stats;
+        kafs_get_stats(&stats);
+        printf("\n");
+        kafs_print_stats(&stats);
     }
 
     /* clean-up */
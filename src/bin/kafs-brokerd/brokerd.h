@@ -0,0 +1,64 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+#ifndef __KAFS_BROKERD_H__
+#define __KAFS_BROKERD_H__
+
+#include <sys/types.h>
+#include <time.h>
+#include <krb5.h>
+#include <kafs-user.h>
+
+/* ============================================================================= */
+
+#define BD_DEF_WORKERS          8           /* concurrently served requests */
+#define BD_MAX_QUEUE            256         /* accepted connections waiting for a worker */
+#define BD_REQ_TIMEOUT          10          /* s, limit for reading the request */
+#define BD_MAX_REQUEST          65536       /* the longest request in bytes */
+#define BD_MAX_CCACHE           1048576     /* the largest ccache file handed over by the client */
+
+#define BD_MAX_TIMEOUT          60000       /* ms, upper limit of the client timeout */
+#define BD_MAX_CONCURRENCY      16          /* upper limit of the client concurrency */
+#define BD_NEG_TTL              300         /* s, cells unknown to KDC */
+#define BD_NEG_TTL_UNREACH      30          /* s, unreachable KDC or unresolvable realm */
+
+/* ============================================================================= */
+
+/* parsed request */
+struct bd_request {
+    key_serial_t        keyring;
+    long                timeout;
+    long                min_lifetime;
+    int                 concurrency;
+    int                 use_cache;
+    char*               realm;
+    char**              cells;                  /* NULL terminated, NULL -> TheseCells and ThisCell */
+    char**              realms;                 /* per cell, NULL items for "-" */
+    int                 ncells;
+    int                 ccfd;                   /* ccache handed over by the client, -1 if none */
+};
+
+/* ============================================================================= */
+
+/* request.c */
+
+/* serve one connection, the peer uid is taken from the socket,
+   the context is kept by the worker across requests */
+void bd_serve(krb5_context ctx,int fd);
+
+/* release the cell list and the negative cache */
+void bd_cleanup(void);
+
+/* ============================================================================= */
+
+/* kafs-brokerd.c */
+
+extern int verbose;
+
+long now_ms(void);
+
+/* ============================================================================= */
+
+#endif /* __KAFS_BROKERD_H__ */
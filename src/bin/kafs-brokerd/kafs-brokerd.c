@@ -0,0 +1,273 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * Broker of AFS tokens.
+ *
+ * Clients (pam_kafs_session, see krb5_afslog_broker()) connect to the local unix socket,
+ * which is usually activated by systemd, and pass a copy of their ccache and ID of the token
+ * keyring. Accepted connections are queued and served by a fixed pool of worker threads,
+ * each one keeps its krb5 context warm. The cell database, learned realms, and the negative
+ * cache of failed cells are shared by all requests for the whole life of the broker.
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <krb5.h>
+
+#include "brokerd.h"
+
+/* ========================================================================== */
+
+int              verbose        = 0;
+int              nworkers       = BD_DEF_WORKERS;
+const char*      socket_path    = _PATH_KAFS_BROKERD_SOCKET;
+int              own_socket     = 0;    /* the socket is not managed by systemd */
+
+volatile sig_atomic_t   terminate   = 0;
+
+struct option longopts[] = {
+   { "workers",         required_argument, NULL,     'w' },
+   { "socket",          required_argument, NULL,     's' },
+   { 0, 0, 0, 0 }
+};
+
+/* ========================================================================== */
+
+/* accepted connections waiting for a worker */
+int                 queue[BD_MAX_QUEUE];
+int                 queue_head  = 0;
+int                 queue_len   = 0;
+int                 stopping    = 0;
+pthread_mutex_t     queue_lock  = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t      queue_cond  = PTHREAD_COND_INITIALIZER;
+
+/* ========================================================================== */
+
+void print_usage(void)
+{
+    printf("\n");
+    printf("Create AFS tokens on behalf of local clients, e.g. pam_kafs_session.\n");
+    printf("\n");
+    printf("Usage: kafs-brokerd [-vdh] [-w N] [-s PATH]\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("   -h   Print this help.\n");
+    printf("   -v   Print kAFS-user version.\n");
+    printf("   -d   Be more verbose.\n");
+    printf("   -w   Number of concurrently served requests (--workers, default: %d).\n",BD_DEF_WORKERS);
+    printf("   -s   Listen on the socket if not activated by systemd (--socket, default: %s).\n",_PATH_KAFS_BROKERD_SOCKET);
+    printf("\n");
+}
+
+/* ========================================================================== */
+
+long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return(ts.tv_sec*1000 + ts.tv_nsec/1000000);
+}
+
+/* ========================================================================== */
+
+void handle_signal(int signum)
+{
+    terminate = 1;
+}
+
+/* ========================================================================== */
+
+/* the socket passed by systemd or a new one */
+int open_socket(void)
+{
+    const char* p_pid = getenv("LISTEN_PID");
+    const char* p_fds = getenv("LISTEN_FDS");
+    if( (p_pid != NULL) && (p_fds != NULL) && (atol(p_pid) == getpid()) && (atoi(p_fds) >= 1) ){
+        /* SD_LISTEN_FDS_START */
+        int fd = 3;
+        fcntl(fd,F_SETFD,FD_CLOEXEC);
+        unsetenv("LISTEN_PID");
+        unsetenv("LISTEN_FDS");
+        if( verbose ) printf("socket activated by systemd\n");
+        return(fd);
+    }
+
+    struct sockaddr_un sa;
+    memset(&sa,0,sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if( strlen(socket_path) >= sizeof(sa.sun_path) ) errx(1, "Socket path '%s' is too long",socket_path);
+    strcpy(sa.sun_path,socket_path);
+
+    int fd = socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0);
+    if( fd == -1 ) err(1, "Unable to create socket");
+
+    unlink(socket_path);
+    if( bind(fd,(struct sockaddr*)&sa,sizeof(sa)) != 0 ) err(1, "Unable to bind socket '%s'",socket_path);
+
+    /* anybody can ask, requests are served under the uid of the peer */
+    if( chmod(socket_path,0666) != 0 ) err(1, "Unable to set mode of socket '%s'",socket_path);
+    if( listen(fd,SOMAXCONN) != 0 ) err(1, "Unable to listen on socket '%s'",socket_path);
+
+    if( verbose ) printf("listening on %s\n",socket_path);
+    own_socket = 1;
+    return(fd);
+}
+
+/* ========================================================================== */
+
+void* worker(void* p_data)
+{
+    krb5_context    ctx;
+    krb5_error_code kerr = krb5_init_context(&ctx);
+    if( kerr != 0 ){
+        warnx("Unable to init krb5 context (%d)",kerr);
+        return(NULL);
+    }
+
+    for(;;){
+        pthread_mutex_lock(&queue_lock);
+        while( (queue_len == 0) && (! stopping) ) pthread_cond_wait(&queue_cond,&queue_lock);
+        if( queue_len == 0 ){
+            pthread_mutex_unlock(&queue_lock);
+            break;
+        }
+        int fd = queue[queue_head];
+        queue_head = (queue_head + 1) % BD_MAX_QUEUE;
+        queue_len--;
+        pthread_mutex_unlock(&queue_lock);
+
+        bd_serve(ctx,fd);
+        close(fd);
+    }
+
+    krb5_free_context(ctx);
+    return(NULL);
+}
+
+/* ========================================================================== */
+
+void run(int lfd)
+{
+    sigset_t set, oldset;
+    sigemptyset(&set);
+    sigaddset(&set,SIGTERM);
+    sigaddset(&set,SIGINT);
+    /* workers inherit the mask */
+    sigprocmask(SIG_BLOCK,&set,&oldset);
+    signal(SIGPIPE,SIG_IGN);
+
+    /* signals are delivered only within ppoll */
+    struct sigaction sa;
+    memset(&sa,0,sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM,&sa,NULL);
+    sigaction(SIGINT,&sa,NULL);
+
+    pthread_t* threads = calloc(nworkers,sizeof(pthread_t));
+    if( threads == NULL ) errx(1, "Unable to allocate workers");
+    for(int i=0; i < nworkers; i++){
+        errno = pthread_create(&threads[i],NULL,worker,NULL);
+        if( errno != 0 ) err(1, "Unable to start worker");
+    }
+
+    while( ! terminate ){
+        struct pollfd pfd = { lfd, POLLIN, 0 };
+        if( ppoll(&pfd,1,NULL,&oldset) <= 0 ) continue;
+
+        int fd = accept4(lfd,NULL,NULL,SOCK_CLOEXEC);
+        if( fd == -1 ) continue;
+
+        pthread_mutex_lock(&queue_lock);
+        if( queue_len < BD_MAX_QUEUE ){
+            queue[(queue_head + queue_len) % BD_MAX_QUEUE] = fd;
+            queue_len++;
+            fd = -1;
+            pthread_cond_signal(&queue_cond);
+        }
+        pthread_mutex_unlock(&queue_lock);
+
+        /* overloaded, the client falls back to its own processing */
+        if( fd != -1 ){
+            if( verbose ) printf("queue is full, connection dropped\n");
+            close(fd);
+        }
+    }
+
+    /* finish queued requests */
+    pthread_mutex_lock(&queue_lock);
+    stopping = 1;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+
+    for(int i=0; i < nworkers; i++){
+        pthread_join(threads[i],NULL);
+    }
+    free(threads);
+    bd_cleanup();
+}
+
+/* ========================================================================== */
+
+int main(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt_long(argc, argv, "hvdw:s:", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'h':
+                print_usage();
+                return(0);
+            case '?':
+            default:
+                print_usage();
+                return(1);
+            case 'v':
+                kafs_print_version(NULL);
+                return(0);
+            case 'd':
+                verbose = 1;
+                kafs_set_verbose(1);
+                break;
+            case 'w':
+                nworkers = atoi(optarg);
+                if( nworkers <= 0 ) errx(1, "Number of workers must be positive");
+                break;
+            case 's':
+                socket_path = optarg;
+                break;
+        }
+    }
+
+    if( geteuid() != 0 ) errx(1, "kafs-brokerd must be started by root");
+    if( ! k_hasafs() ) errx(1, "AFS does not seem to be present on this machine");
+
+    /* messages of workers */
+    setvbuf(stdout,NULL,_IOLBF,0);
+
+    int lfd = open_socket();
+    run(lfd);
+    close(lfd);
+    if( own_socket ) unlink(socket_path);
+
+    return 0;
+}
+
+/* ========================================================================== */
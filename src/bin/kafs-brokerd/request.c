@@ -0,0 +1,682 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * Requests of kafs-brokerd.
+ *
+ * The request is served by the worker thread under the fsuid and fsgid of the peer,
+ * so the kernel checks access to the token keyring and charges the key quota as if
+ * the client installed tokens itself. fsuid and fsgid are per thread.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <keyutils.h>
+#include <sys/fsuid.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <krb5.h>
+
+#include "brokerd.h"
+
+/* ========================================================================== */
+
+/* TheseCells and ThisCell, reloaded when one of the files changes */
+struct bd_stamp {
+    ino_t               ino;
+    off_t               size;
+    struct timespec     mtime;
+};
+
+char**              these_cells     = NULL;
+struct bd_stamp     these_stamp[2];
+pthread_mutex_t     cells_lock      = PTHREAD_MUTEX_INITIALIZER;
+
+/* cells, which recently failed for reasons not related to the user */
+struct bd_neg {
+    char*               key;            /* cell and realm */
+    krb5_error_code     status;
+    long                until;          /* now_ms() units */
+};
+
+struct bd_neg*      neg             = NULL;
+int                 nneg            = 0;
+pthread_mutex_t     neg_lock        = PTHREAD_MUTEX_INITIALIZER;
+
+/* ========================================================================== */
+
+void get_stamp(const char* p_path,struct bd_stamp* p_stamp)
+{
+    struct stat st;
+    memset(p_stamp,0,sizeof(struct bd_stamp));
+    if( stat(p_path,&st) != 0 ) return;
+    p_stamp->ino    = st.st_ino;
+    p_stamp->size   = st.st_size;
+    p_stamp->mtime  = st.st_mtim;
+}
+
+/* ========================================================================== */
+
+/* return a copy of TheseCells and ThisCell, it must be freed by kafs_free_these_cells */
+char** get_these_cells(void)
+{
+    struct bd_stamp stamp[2];
+    get_stamp(_PATH_KAFS_USER_THESECELLS,&stamp[0]);
+    get_stamp(_PATH_KAFS_USER_THISCELL,&stamp[1]);
+
+    pthread_mutex_lock(&cells_lock);
+
+    if( (these_cells == NULL) || (memcmp(stamp,these_stamp,sizeof(stamp)) != 0) ){
+        char** cells = kafs_get_these_cells();
+        if( cells != NULL ){
+            if( these_cells != NULL ) kafs_free_these_cells(these_cells);
+            these_cells = cells;
+            memcpy(these_stamp,stamp,sizeof(stamp));
+            if( verbose ) printf("cells reloaded\n");
+        }
+    }
+
+    char* empty[1] = { NULL };
+    char** cells = kafs_dup_list(these_cells != NULL ? these_cells : empty,-1);
+
+    pthread_mutex_unlock(&cells_lock);
+    return(cells);
+}
+
+/* ========================================================================== */
+
+/* negative cache key, failures are remembered per peer and the realm of its principal,
+   so a peer with a forged ccache cannot make cells fail for others */
+char* neg_key(uid_t uid,const char* client_realm,const char* cell,const char* realm)
+{
+    char* p_key = NULL;
+    if( asprintf(&p_key,"%u %s %s %s",(unsigned)uid,client_realm ? client_realm : "-",cell,realm ? realm : "-") == -1 ) return(NULL);
+    return(p_key);
+}
+
+/* ========================================================================== */
+
+/* return 1 and the status if the cell recently failed */
+int neg_lookup(const char* p_key,krb5_error_code* p_status)
+{
+    int found = 0;
+    long now = now_ms();
+
+    pthread_mutex_lock(&neg_lock);
+    for(int i=0; i < nneg; i++){
+        if( strcmp(neg[i].key,p_key) != 0 ) continue;
+        if( neg[i].until > now ){
+            *p_status = neg[i].status;
+            found = 1;
+        }
+        break;
+    }
+    pthread_mutex_unlock(&neg_lock);
+
+    return(found);
+}
+
+/* ========================================================================== */
+
+/* remember the failure or forget the cell if ttl is zero */
+void neg_update(const char* p_key,krb5_error_code status,long ttl)
+{
+    long now = now_ms();
+
+    pthread_mutex_lock(&neg_lock);
+
+    /* drop expired entries and the cell */
+    int j = 0;
+    for(int i=0; i < nneg; i++){
+        if( (neg[i].until <= now) || (strcmp(neg[i].key,p_key) == 0) ){
+            free(neg[i].key);
+            continue;
+        }
+        neg[j++] = neg[i];
+    }
+    nneg = j;
+
+    if( ttl > 0 ){
+        struct bd_neg* p_new = realloc(neg,(nneg + 1)*sizeof(struct bd_neg));
+        if( p_new != NULL ){
+            neg = p_new;
+            neg[nneg].key = strdup(p_key);
+            if( neg[nneg].key != NULL ){
+                neg[nneg].status = status;
+                neg[nneg].until  = now + ttl*1000;
+                nneg++;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&neg_lock);
+}
+
+/* ========================================================================== */
+
+/* failures worth remembering, they do not depend on the ticket of the user */
+long neg_ttl(krb5_error_code status)
+{
+    switch(status){
+        case KRB5KDC_ERR_S_PRINCIPAL_UNKNOWN:
+            return(BD_NEG_TTL);
+        case KRB5_KDC_UNREACH:
+        case KRB5_REALM_UNKNOWN:
+        case KRB5_REALM_CANT_RESOLVE:
+            return(BD_NEG_TTL_UNREACH);
+        default:
+            return(0);
+    }
+}
+
+/* ========================================================================== */
+
+void bd_cleanup(void)
+{
+    if( these_cells != NULL ) kafs_free_these_cells(these_cells);
+    these_cells = NULL;
+
+    for(int i=0; i < nneg; i++) free(neg[i].key);
+    free(neg);
+    neg  = NULL;
+    nneg = 0;
+}
+
+/* ========================================================================== */
+
+void free_request(struct bd_request* p_req)
+{
+    for(int i=0; i < p_req->ncells; i++){
+        free(p_req->cells[i]);
+        free(p_req->realms[i]);
+    }
+    free(p_req->cells);
+    free(p_req->realms);
+    free(p_req->realm);
+    if( p_req->ccfd != -1 ) close(p_req->ccfd);
+}
+
+/* ========================================================================== */
+
+/* read the whole request terminated by END and the passed descriptor */
+char* recv_request(int fd,int* p_ccfd)
+{
+    char*   p_buf = malloc(BD_MAX_REQUEST + 1);
+    size_t  len = 0;
+
+    if( p_buf == NULL ) return(NULL);
+
+    while( len < BD_MAX_REQUEST ){
+        union {
+            char            buf[CMSG_SPACE(sizeof(int))];
+            struct cmsghdr  align;
+        } ctrl;
+
+        struct iovec    iov = { p_buf + len, BD_MAX_REQUEST - len };
+        struct msghdr   msg;
+        memset(&msg,0,sizeof(msg));
+        msg.msg_iov         = &iov;
+        msg.msg_iovlen      = 1;
+        msg.msg_control     = ctrl.buf;
+        msg.msg_controllen  = sizeof(ctrl.buf);
+
+        ssize_t ret = recvmsg(fd,&msg,MSG_CMSG_CLOEXEC);
+        if( ret == -1 ){
+            if( errno == EINTR ) continue;
+            break;
+        }
+        if( ret == 0 ) break;
+
+        for(struct cmsghdr* p_cmsg = CMSG_FIRSTHDR(&msg); p_cmsg; p_cmsg = CMSG_NXTHDR(&msg,p_cmsg)){
+            if( (p_cmsg->cmsg_level != SOL_SOCKET) || (p_cmsg->cmsg_type != SCM_RIGHTS) ) continue;
+            int nfds = (p_cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for(int i=0; i < nfds; i++){
+                int ccfd;
+                memcpy(&ccfd,CMSG_DATA(p_cmsg) + i*sizeof(int),sizeof(int));
+                if( *p_ccfd == -1 ){
+                    *p_ccfd = ccfd;
+                } else {
+                    close(ccfd);
+                }
+            }
+        }
+
+        len += ret;
+        p_buf[len] = '\0';
+        if( (len >= 5) && (strcmp(p_buf + len - 5,"\nEND\n") == 0) ) return(p_buf);
+    }
+
+    free(p_buf);
+    return(NULL);
+}
+
+/* ========================================================================== */
+
+int add_cell(struct bd_request* p_req,const char* cell,const char* realm)
+{
+    char** cells = realloc(p_req->cells,(p_req->ncells + 2)*sizeof(char*));
+    if( cells == NULL ) return(-1);
+    p_req->cells = cells;
+
+    char** realms = realloc(p_req->realms,(p_req->ncells + 2)*sizeof(char*));
+    if( realms == NULL ) return(-1);
+    p_req->realms = realms;
+
+    cells[p_req->ncells]  = strdup(cell);
+    realms[p_req->ncells] = strcmp(realm,"-") != 0 ? strdup(realm) : NULL;
+    cells[p_req->ncells + 1]  = NULL;
+    realms[p_req->ncells + 1] = NULL;
+    p_req->ncells++;
+
+    if( (cells[p_req->ncells - 1] == NULL) ||
+        ((realms[p_req->ncells - 1] == NULL) && (strcmp(realm,"-") != 0)) ) return(-1);
+    return(0);
+}
+
+/* ========================================================================== */
+
+/* return 0 or errno */
+int parse_request(char* p_buf,struct bd_request* p_req)
+{
+    char*   p_save = NULL;
+    int     afslog = 0;
+
+    for(char* p_line = strtok_r(p_buf,"\n",&p_save); p_line; p_line = strtok_r(NULL,"\n",&p_save)){
+        char word1[_KAFS_BROKERD_MAX_LINE];
+        char word2[_KAFS_BROKERD_MAX_LINE];
+
+        if( strlen(p_line) >= _KAFS_BROKERD_MAX_LINE ) return(EPROTO);
+
+        /* use_cache is not sent by older clients */
+        if( sscanf(p_line,"AFSLOG %d %ld %ld %d %d",&p_req->keyring,&p_req->timeout,
+                   &p_req->min_lifetime,&p_req->concurrency,&p_req->use_cache) >= 4 ){
+            afslog = 1;
+            continue;
+        }
+        if( sscanf(p_line,"REALM %s",word1) == 1 ){
+            free(p_req->realm);
+            p_req->realm = strdup(word1);
+            if( p_req->realm == NULL ) return(ENOMEM);
+            continue;
+        }
+        if( sscanf(p_line,"CELL %s %s",word1,word2) == 2 ){
+            if( add_cell(p_req,word1,word2) != 0 ) return(ENOMEM);
+            continue;
+        }
+        if( strcmp(p_line,"END") == 0 ) break;
+        return(EPROTO);
+    }
+
+    if( ! afslog ) return(EPROTO);
+
+    /* the client must not hold the worker longer than the broker allows */
+    if( (p_req->timeout <= 0) || (p_req->timeout > BD_MAX_TIMEOUT) ) p_req->timeout = BD_MAX_TIMEOUT;
+    if( p_req->min_lifetime < 0 ) p_req->min_lifetime = 0;
+    if( p_req->concurrency < 1 ) p_req->concurrency = 1;
+    if( p_req->concurrency > BD_MAX_CONCURRENCY ) p_req->concurrency = BD_MAX_CONCURRENCY;
+    return(0);
+}
+
+/* ========================================================================== */
+
+/* the keyring must belong to the peer and it must be writable by it,
+   the thread already runs under the peer fsuid, so foreign keyrings cannot be described */
+int check_keyring(key_serial_t keyring,uid_t uid)
+{
+    char* p_desc = NULL;
+    if( keyctl_describe_alloc(keyring,&p_desc) == -1 ) return(errno);
+
+    unsigned int    kuid, kgid;
+    key_perm_t      perm;
+    int             ret = 0;
+
+    if( (strncmp(p_desc,"keyring;",8) != 0) ||
+        (sscanf(p_desc + 8,"%u;%u;%x;",&kuid,&kgid,&perm) != 3) ){
+        ret = EINVAL;
+    } else if( (kuid != uid) || ((perm & (KEY_USR_WRITE|KEY_USR_SEARCH)) != (KEY_USR_WRITE|KEY_USR_SEARCH)) ){
+        ret = EACCES;
+    }
+
+    free(p_desc);
+    return(ret);
+}
+
+/* ========================================================================== */
+
+int send_all(int fd,const char* p_buf,size_t len)
+{
+    while( len > 0 ){
+        ssize_t ret = send(fd,p_buf,len,MSG_NOSIGNAL);
+        if( ret == -1 ){
+            if( errno == EINTR ) continue;
+            return(-1);
+        }
+        p_buf += ret;
+        len   -= ret;
+    }
+    return(0);
+}
+
+/* ========================================================================== */
+
+void send_reply(int fd,const struct kafs_afslog_result* results,int nresults,krb5_error_code kerr,int error)
+{
+    char*   p_buf = NULL;
+    size_t  len = 0;
+    FILE*   p_fout = open_memstream(&p_buf,&len);
+    if( p_fout == NULL ) return;
+
+    for(int i=0; i < nresults; i++){
+        fprintf(p_fout,"RESULT %d %d %d %ld %ld %s %s\n",results[i].state,results[i].status,results[i].error,
+                results[i].elapsed,(long)results[i].expiry,results[i].cell,
+                results[i].realm ? results[i].realm : "-");
+    }
+    fprintf(p_fout,"DONE %d %d\n",kerr,error);
+
+    if( fclose(p_fout) == 0 ) send_all(fd,p_buf,len);
+    free(p_buf);
+}
+
+/* ========================================================================== */
+
+/* copy the ccache handed over by the peer into a memory ccache, only a regular file of the peer
+   is read and only up to BD_MAX_CCACHE bytes, so a pipe, a FIFO, or a device cannot block the worker */
+krb5_error_code open_ccache(krb5_context ctx,int ccfd,uid_t uid,krb5_ccache* p_id)
+{
+    struct stat st;
+    if( fstat(ccfd,&st) != 0 ) return(-1);
+    if( ! S_ISREG(st.st_mode) || (st.st_uid != uid) ){
+        errno = EACCES;
+        return(-1);
+    }
+
+    char* p_buf = malloc(BD_MAX_CCACHE + 1);
+    if( p_buf == NULL ){
+        errno = ENOMEM;
+        return(-1);
+    }
+
+    /* pread does not move the file offset shared with the peer */
+    size_t len = 0;
+    while( len <= BD_MAX_CCACHE ){
+        ssize_t ret = pread(ccfd,p_buf + len,BD_MAX_CCACHE + 1 - len,len);
+        if( ret == -1 ){
+            if( errno == EINTR ) continue;
+            free(p_buf);
+            return(-1);
+        }
+        if( ret == 0 ) break;
+        len += ret;
+    }
+    if( len > BD_MAX_CCACHE ){
+        free(p_buf);
+        errno = EFBIG;
+        return(-1);
+    }
+
+    /* the FILE ccache is parsed from a private copy */
+    int memfd = memfd_create("kafs-brokerd",MFD_CLOEXEC);
+    if( memfd == -1 ){
+        free(p_buf);
+        return(-1);
+    }
+    size_t done = 0;
+    while( done < len ){
+        ssize_t ret = write(memfd,p_buf + done,len - done);
+        if( ret == -1 ){
+            if( errno == EINTR ) continue;
+            break;
+        }
+        done += ret;
+    }
+    free(p_buf);
+    if( done < len ){
+        close(memfd);
+        return(-1);
+    }
+
+    char ccname[64];
+    snprintf(ccname,sizeof(ccname),"FILE:/proc/self/fd/%d",memfd);
+
+    krb5_ccache     file;
+    krb5_principal  princ;
+    krb5_error_code kerr = krb5_cc_resolve(ctx,ccname,&file);
+    if( kerr != 0 ){
+        close(memfd);
+        return(kerr);
+    }
+
+    kerr = krb5_cc_get_principal(ctx,file,&princ);
+    if( kerr == 0 ){
+        kerr = krb5_cc_new_unique(ctx,"MEMORY",NULL,p_id);
+        if( kerr == 0 ){
+            kerr = krb5_cc_initialize(ctx,*p_id,princ);
+            if( kerr == 0 ) kerr = krb5_cc_copy_creds(ctx,file,*p_id);
+            if( kerr != 0 ) krb5_cc_destroy(ctx,*p_id);
+        }
+        krb5_free_principal(ctx,princ);
+    }
+
+    krb5_cc_close(ctx,file);
+    close(memfd);
+    return(kerr);
+}
+
+/* ========================================================================== */
+
+/* free principal name returned by krb5_unparse_name */
+void free_cname(krb5_context ctx,char* p_cname)
+{
+    if( p_cname == NULL ) return;
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    krb5_free_unparsed_name(ctx,p_cname);
+#pragma GCC diagnostic pop
+}
+
+/* ========================================================================== */
+
+/* create tokens for cells, which are not in the negative cache */
+krb5_error_code afslog(krb5_context ctx,const struct bd_request* p_req,uid_t uid,
+                       struct kafs_afslog_result** p_results,int* p_nresults)
+{
+    krb5_ccache     id;
+    krb5_error_code kerr = open_ccache(ctx,p_req->ccfd,uid,&id);
+    if( kerr != 0 ) return(kerr);
+
+    /* realm of the client principal for the negative cache */
+    krb5_principal  princ = NULL;
+    char*           p_cname = NULL;
+    const char*     p_crealm = NULL;
+    if( (krb5_cc_get_principal(ctx,id,&princ) == 0) && (krb5_unparse_name(ctx,princ,&p_cname) == 0) ){
+        p_crealm = strrchr(p_cname,'@');
+        if( p_crealm != NULL ) p_crealm++;
+    }
+    if( princ != NULL ) krb5_free_principal(ctx,princ);
+
+    char**  cells = p_req->cells;
+    int     ncells = p_req->ncells;
+    char**  own_cells = NULL;
+    if( cells == NULL ){
+        own_cells = get_these_cells();
+        if( own_cells == NULL ){
+            free_cname(ctx,p_cname);
+            krb5_cc_destroy(ctx,id);
+            errno = ENOMEM;
+            return(-1);
+        }
+        cells = own_cells;
+        for(ncells = 0; cells[ncells] != NULL; ncells++);
+    }
+
+    struct kafs_afslog_result*  results = calloc(ncells + 1,sizeof(struct kafs_afslog_result));
+    const char**                todo_cells = calloc(ncells + 1,sizeof(char*));
+    const char**                todo_realms = calloc(ncells + 1,sizeof(char*));
+    char**                      keys = calloc(ncells + 1,sizeof(char*));
+    int*                        todo_index = calloc(ncells + 1,sizeof(int));
+    int                         ntodo = 0;
+
+    kerr = -1;
+    errno = ENOMEM;
+    if( (results == NULL) || (todo_cells == NULL) || (todo_realms == NULL) || (keys == NULL) || (todo_index == NULL) ){
+        goto cleanup;
+    }
+
+    for(int i=0; i < ncells; i++){
+        const char* p_realm = (p_req->realms != NULL) && (p_req->realms[i] != NULL) ? p_req->realms[i] : p_req->realm;
+
+        results[i].cell = strdup(cells[i]);
+        keys[i] = neg_key(uid,p_crealm,cells[i],p_realm);
+        if( (results[i].cell == NULL) || (keys[i] == NULL) ) goto cleanup;
+
+        if( neg_lookup(keys[i],&results[i].status) ){
+            results[i].state = KAFS_AFSLOG_FAILED;
+            if( verbose ) printf("cell %s skipped, it failed recently (%d)\n",cells[i],results[i].status);
+            continue;
+        }
+        todo_cells[ntodo]   = cells[i];
+        todo_realms[ntodo]  = p_realm;
+        todo_index[ntodo]   = i;
+        ntodo++;
+    }
+
+    kerr = 0;
+    if( ntodo > 0 ){
+        struct kafs_afslog_opts opts;
+        memset(&opts,0,sizeof(opts));
+        opts.cells          = todo_cells;
+        opts.realms         = todo_realms;
+        opts.timeout        = p_req->timeout;
+        opts.min_lifetime   = p_req->min_lifetime;
+        opts.concurrency    = p_req->concurrency;
+        opts.use_cache      = p_req->use_cache;
+
+        struct kafs_afslog_result*  done = NULL;
+        int                         ndone = 0;
+        kerr = krb5_afslog_ex(ctx,id,&opts,&done,&ndone);
+
+        for(int j=0; (j < ndone) && (j < ntodo); j++){
+            int i = todo_index[j];
+            free(results[i].cell);
+            results[i] = done[j];
+            done[j].cell  = NULL;
+            done[j].realm = NULL;
+
+            long ttl = results[i].state == KAFS_AFSLOG_FAILED ? neg_ttl(results[i].status) : 0;
+            if( (ttl > 0) || (results[i].state != KAFS_AFSLOG_TIMEOUT) ){
+                neg_update(keys[i],results[i].status,ttl);
+            }
+        }
+        kafs_free_afslog_results(done,ndone);
+    }
+
+    /* the first failure including the cached ones */
+    if( kerr == 0 ){
+        for(int i=0; i < ncells; i++){
+            if( results[i].state == KAFS_AFSLOG_FAILED ){
+                kerr = results[i].status;
+                if( kerr == -1 ) errno = results[i].error;
+                break;
+            }
+        }
+    }
+
+    *p_results  = results;
+    *p_nresults = ncells;
+    results = NULL;
+
+cleanup:
+    if( results != NULL ) kafs_free_afslog_results(results,ncells);
+    for(int i=0; (keys != NULL) && (i < ncells); i++) free(keys[i]);
+    free(keys);
+    free(todo_cells);
+    free(todo_realms);
+    free(todo_index);
+    if( own_cells != NULL ) kafs_free_these_cells(own_cells);
+    free_cname(ctx,p_cname);
+    krb5_cc_destroy(ctx,id);
+    return(kerr);
+}
+
+/* ========================================================================== */
+
+void bd_serve(krb5_context ctx,int fd)
+{
+    struct ucred    cred;
+    socklen_t       len = sizeof(cred);
+
+    if( getsockopt(fd,SOL_SOCKET,SO_PEERCRED,&cred,&len) != 0 ){
+        if( verbose ) printf("unable to get peer credentials: %s\n",strerror(errno));
+        return;
+    }
+
+    struct timeval tv = { BD_REQ_TIMEOUT, 0 };
+    setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+    setsockopt(fd,SOL_SOCKET,SO_SNDTIMEO,&tv,sizeof(tv));
+
+    struct bd_request req;
+    memset(&req,0,sizeof(req));
+    req.ccfd = -1;
+
+    char* p_buf = recv_request(fd,&req.ccfd);
+    if( p_buf == NULL ){
+        if( verbose ) printf("pid %d: incomplete request\n",cred.pid);
+        free_request(&req);
+        return;
+    }
+
+    int error = parse_request(p_buf,&req);
+    free(p_buf);
+    if( (error == 0) && (req.ccfd == -1) ) error = EPROTO;
+    if( error != 0 ){
+        if( verbose ) printf("pid %d: invalid request: %s\n",cred.pid,strerror(error));
+        send_reply(fd,NULL,0,-1,error);
+        free_request(&req);
+        return;
+    }
+
+    /* serve the request as the peer */
+    setfsgid(cred.gid);
+    setfsuid(cred.uid);
+    if( ((uid_t)setfsuid(-1) != cred.uid) || ((gid_t)setfsgid(-1) != cred.gid) ){
+        error = EPERM;
+    } else {
+        error = check_keyring(req.keyring,cred.uid);
+    }
+
+    struct kafs_afslog_result*  results = NULL;
+    int                         nresults = 0;
+    krb5_error_code             kerr = -1;
+
+    if( error == 0 ){
+        long start = now_ms();
+        kafs_set_token_keyring(req.keyring);
+        kerr = afslog(ctx,&req,cred.uid,&results,&nresults);
+        if( kerr == -1 ) error = errno;
+        kafs_set_token_keyring(KEY_SPEC_SESSION_KEYRING);
+        if( verbose ){
+            printf("pid %d (uid %u): %d cells, status %d, %ld ms\n",cred.pid,cred.uid,nresults,kerr,now_ms() - start);
+        }
+    } else if( verbose ){
+        printf("pid %d (uid %u): keyring %d refused: %s\n",cred.pid,cred.uid,req.keyring,strerror(error));
+    }
+
+    setfsuid(0);
+    setfsgid(0);
+
+    send_reply(fd,results,nresults,kerr,error);
+
+    kafs_free_afslog_results(results,nresults);
+    free_request(&req);
+}
+
+/* ========================================================================== */
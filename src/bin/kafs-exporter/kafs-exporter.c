@@ -0,0 +1,662 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * Export AFS tokens of all users on the node in the Prometheus text format.
+ *
+ * /proc/keys shows only keys, which the reader can view, and root has no exception.
+ * Users owning keys are taken from /proc/key-users and /proc/keys is then read once
+ * for each of them with the file system uid switched to the user. Each read is a single
+ * streaming pass aggregating rxrpc afs@<cell> keys by owner, cell, and remaining lifetime
+ * without per-key allocations.
+ *
+ * The kernel walks all keys of the node for every read, so a scrape costs owners x keys.
+ * The number of owners read per scrape is therefore capped (--max-users), the skipped
+ * ones are reported by kafs_exporter_users_skipped.
+ */
+
+#define _GNU_SOURCE
+#include <kafs-core.h>
+#include <getopt.h>
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/fsuid.h>
+#include <sys/socket.h>
+
+/* ========================================================================== */
+
+#define _KAFS_PROC_KEY_USERS    "/proc/key-users"
+
+#define EXPORTER_DEF_ADDRESS    "127.0.0.1"
+#define EXPORTER_HTTP_TIMEOUT   2           /* s, to receive the request, and to send the response */
+#define EXPORTER_MAX_USERS      1000
+#define EXPORTER_MAX_REQUEST    4096
+
+/* upper bounds of remaining lifetime buckets in seconds, 0 is for expired tokens */
+static const long buckets[] = { 0, 300, 900, 3600, 14400, 86400 };
+#define NBUCKETS    ((int)(sizeof(buckets)/sizeof(buckets[0])))
+
+#define CELL_MAX    256
+#define AGG_BUCKETS 1024
+
+/* ========================================================================== */
+
+int              verbose        = 0;
+int              with_uid       = 1;
+uid_t            min_uid        = 0;
+int              max_users      = EXPORTER_MAX_USERS;
+long             interval       = 0;
+const char*      output         = NULL;
+int              port           = 0;
+const char*      address        = EXPORTER_DEF_ADDRESS;
+
+volatile sig_atomic_t   terminate   = 0;
+
+struct option longopts[] = {
+   { "output",          required_argument, NULL,     'o' },
+   { "interval",        required_argument, NULL,     'i' },
+   { "port",            required_argument, NULL,     'p' },
+   { "address",         required_argument, NULL,     'a' },
+   { "min-uid",         required_argument, NULL,     'u' },
+   { "max-users",       required_argument, NULL,     'm' },
+   { "no-uid",          no_argument,       NULL,     'U' },
+   { 0, 0, 0, 0 }
+};
+
+/* tokens of one owner and cell */
+struct agg_entry {
+    struct agg_entry*   next;
+    uid_t               uid;
+    unsigned long       counts[NBUCKETS+1];     /* not cumulative, the last one is for longer lifetimes */
+    unsigned long       total;
+    double              sum;                    /* remaining lifetime, rounded down by /proc/keys */
+    char                cell[CELL_MAX];
+};
+
+/* owner of keys from /proc/key-users */
+struct key_user {
+    uid_t               uid;
+    long                nkeys;
+    long                maxkeys;
+    long                nbytes;
+    long                maxbytes;
+};
+
+struct scrape {
+    struct agg_entry*   table[AGG_BUCKETS];
+    struct key_user*    users;
+    int                 nusers;
+    int                 nerrors;                /* users, whose keys could not be read */
+    int                 nskipped;               /* users over max_users */
+    unsigned long       nkeys;                  /* lines of /proc/keys read */
+    double              duration;
+};
+
+/* ========================================================================== */
+
+void print_usage(void)
+{
+    printf("\n");
+    printf("Export AFS tokens of all users on the node in the Prometheus text format.\n");
+    printf("Without -o and -p, metrics are printed to the standard output once.\n");
+    printf("\n");
+    printf("Usage: kafs-exporter [-vdhU] [-o FILE] [-i S] [-p PORT] [-a ADDR] [-u UID] [-m N]\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("   -h   Print this help.\n");
+    printf("   -v   Print kAFS-user version.\n");
+    printf("   -d   Be more verbose.\n");
+    printf("   -o   Write metrics into the file for the textfile collector (--output).\n");
+    printf("   -i   Rewrite the file each given number of seconds (--interval, default: only once).\n");
+    printf("   -p   Serve metrics by HTTP on the port (--port).\n");
+    printf("   -a   Listen on the address (--address, default: %s).\n",EXPORTER_DEF_ADDRESS);
+    printf("   -u   Ignore tokens of users with lower uid (--min-uid, default: 0).\n");
+    printf("   -m   Read keys of at most N users per scrape (--max-users, default: %d).\n",EXPORTER_MAX_USERS);
+    printf("   -U   Aggregate tokens of all users, i.e. without the uid label (--no-uid).\n");
+    printf("\n");
+}
+
+/* ========================================================================== */
+
+void handle_signal(int signum)
+{
+    terminate = 1;
+}
+
+/* ========================================================================== */
+
+double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return(ts.tv_sec + ts.tv_nsec/1e9);
+}
+
+/* ========================================================================== */
+
+/* remaining lifetime from the timeout column, which is rounded down to s, m, h, d or w,
+   the precision is the length of the interval hidden by the rounding,
+   return -1 for keys without expiration */
+long parse_timeout(const char* exp,long* precision)
+{
+    long    value = 0;
+    char    unit = 0;
+
+    *precision = 1;
+    if( strcmp(exp,"perm") == 0 ) return(-1);
+    if( strcmp(exp,"expd") == 0 ) return(0);
+    if( sscanf(exp,"%ld%c",&value,&unit) != 2 ) return(-1);
+    switch(unit){
+        case 'w': value *= 7;   *precision *= 7;
+        /* fall through */
+        case 'd': value *= 24;  *precision *= 24;
+        /* fall through */
+        case 'h': value *= 60;  *precision *= 60;
+        /* fall through */
+        case 'm': value *= 60;  *precision *= 60;
+        /* fall through */
+        case 's':
+            return(value);
+    }
+    return(-1);
+}
+
+/* ========================================================================== */
+
+unsigned hash_entry(uid_t uid,const char* cell)
+{
+    unsigned h = 2166136261u ^ uid;
+    for(const char* p_c = cell; *p_c; p_c++){
+        h = (h ^ (unsigned char)*p_c) * 16777619u;
+    }
+    return(h % AGG_BUCKETS);
+}
+
+/* ========================================================================== */
+
+/* tokens are counted in buckets by the longest possible lifetime, e.g. 1h means up to 7199 s,
+   so le="3600" contains only tokens surely expiring within an hour */
+void add_token(struct scrape* p_scr,uid_t uid,const char* cell,long left,long precision)
+{
+    if( ! with_uid ) uid = 0;
+
+    unsigned h = hash_entry(uid,cell);
+    struct agg_entry* p_ent;
+    for(p_ent = p_scr->table[h]; p_ent; p_ent = p_ent->next){
+        if( (p_ent->uid == uid) && (strcmp(p_ent->cell,cell) == 0) ) break;
+    }
+    if( p_ent == NULL ){
+        p_ent = calloc(1,sizeof(struct agg_entry));
+        if( p_ent == NULL ) return;
+        p_ent->uid = uid;
+        snprintf(p_ent->cell,CELL_MAX,"%s",cell);
+        p_ent->next = p_scr->table[h];
+        p_scr->table[h] = p_ent;
+    }
+
+    int b;
+    long longest = left ? left + precision - 1 : 0;
+    for(b=0; b < NBUCKETS; b++){
+        if( longest <= buckets[b] ) break;
+    }
+    p_ent->counts[b]++;
+    p_ent->total++;
+    p_ent->sum += left;
+}
+
+/* ========================================================================== */
+
+/* read the owners of keys */
+int read_key_users(struct scrape* p_scr)
+{
+    FILE* p_fin = fopen(_KAFS_PROC_KEY_USERS,"r");
+    if( p_fin == NULL ) return(-1);
+
+    int     maxusers = 0;
+    char    line[256];
+
+    /* uid: usage nkeys/ninstantiated qnkeys/maxkeys qnbytes/maxbytes */
+    while( fgets(line,sizeof(line),p_fin) != NULL ){
+        struct key_user user;
+        unsigned int    uid;
+        if( sscanf(line,"%u: %*d %*d/%*d %ld/%ld %ld/%ld",&uid,&user.nkeys,&user.maxkeys,&user.nbytes,&user.maxbytes) != 5 ){
+            continue;
+        }
+        user.uid = uid;
+        if( p_scr->nusers == maxusers ){
+            maxusers = maxusers ? 2*maxusers : 64;
+            struct key_user* p_new = realloc(p_scr->users,maxusers*sizeof(struct key_user));
+            if( p_new == NULL ) break;
+            p_scr->users = p_new;
+        }
+        p_scr->users[p_scr->nusers++] = user;
+    }
+
+    fclose(p_fin);
+    return(0);
+}
+
+/* ========================================================================== */
+
+/* read AFS tokens of the user */
+int read_user_keys(struct scrape* p_scr,uid_t uid)
+{
+    /* permission to view the keys is checked against the file system uid */
+    setfsuid(uid);
+    if( (uid_t)setfsuid(uid) != uid ){
+        setfsuid(0);
+        return(-1);
+    }
+    FILE* p_fk = fopen(_KAFS_PROC_KEYS,"r");
+    if( p_fk == NULL ){
+        setfsuid(0);
+        return(-1);
+    }
+
+    /* serial flags usage timeout perm uid gid type description: summary */
+    char line[LINE_MAX];
+    while( fgets(line,sizeof(line),p_fk) != NULL ){
+        p_scr->nkeys++;
+
+        char            exp[32];
+        unsigned int    kuid;
+        char            type[32];
+        char            cell[CELL_MAX];
+        if( sscanf(line,"%*x %*s %*s %31s %*s %u %*s %31s afs@%255[^:\n]",exp,&kuid,type,cell) != 4 ) continue;
+        if( (kuid != uid) || (strcmp(type,_KAFS_KEY_SPEC_RXRPC_TYPE) != 0) ) continue;
+
+        long precision;
+        long left = parse_timeout(exp,&precision);
+        if( left < 0 ) continue;
+        add_token(p_scr,uid,cell,left,precision);
+    }
+
+    fclose(p_fk);
+    setfsuid(0);
+    return(0);
+}
+
+/* ========================================================================== */
+
+void scrape(struct scrape* p_scr)
+{
+    memset(p_scr,0,sizeof(struct scrape));
+    double start = now_s();
+
+    if( read_key_users(p_scr) != 0 ){
+        warn("Unable to read '%s'",_KAFS_PROC_KEY_USERS);
+        p_scr->nerrors++;
+    }
+
+    int nread = 0;
+    for(int i=0; i < p_scr->nusers; i++){
+        if( p_scr->users[i].uid < min_uid ) continue;
+        /* every read of /proc/keys walks all keys of the node */
+        if( nread >= max_users ){
+            p_scr->nskipped++;
+            continue;
+        }
+        nread++;
+        if( read_user_keys(p_scr,p_scr->users[i].uid) != 0 ){
+            if( verbose ) warn("Unable to read keys of uid %u",p_scr->users[i].uid);
+            p_scr->nerrors++;
+        }
+    }
+
+    p_scr->duration = now_s() - start;
+}
+
+/* ========================================================================== */
+
+void free_scrape(struct scrape* p_scr)
+{
+    for(int h=0; h < AGG_BUCKETS; h++){
+        struct agg_entry* p_ent = p_scr->table[h];
+        while( p_ent ){
+            struct agg_entry* p_next = p_ent->next;
+            free(p_ent);
+            p_ent = p_next;
+        }
+        p_scr->table[h] = NULL;
+    }
+    free(p_scr->users);
+    p_scr->users = NULL;
+    p_scr->nusers = 0;
+}
+
+/* ========================================================================== */
+
+/* label values are escaped according to the text format */
+void print_label(FILE* p_fout,const char* name,const char* value)
+{
+    fprintf(p_fout,"%s=\"",name);
+    for(const char* p_c = value; *p_c; p_c++){
+        if( (*p_c == '\\') || (*p_c == '"') ) fputc('\\',p_fout);
+        fputc(*p_c,p_fout);
+    }
+    fputc('"',p_fout);
+}
+
+/* ========================================================================== */
+
+void print_labels(FILE* p_fout,const struct agg_entry* p_ent)
+{
+    if( with_uid ) fprintf(p_fout,"uid=\"%u\",",p_ent->uid);
+    print_label(p_fout,"cell",p_ent->cell);
+}
+
+/* ========================================================================== */
+
+void print_metrics(FILE* p_fout,const struct scrape* p_scr)
+{
+    fprintf(p_fout,"# HELP kafs_token_lifetime_seconds Remaining lifetime of AFS tokens (rounded down by /proc/keys).\n");
+    fprintf(p_fout,"# TYPE kafs_token_lifetime_seconds histogram\n");
+    for(int h=0; h < AGG_BUCKETS; h++){
+        for(const struct agg_entry* p_ent = p_scr->table[h]; p_ent; p_ent = p_ent->next){
+            unsigned long count = 0;
+            for(int b=0; b < NBUCKETS; b++){
+                count += p_ent->counts[b];
+                fprintf(p_fout,"kafs_token_lifetime_seconds_bucket{");
+                print_labels(p_fout,p_ent);
+                fprintf(p_fout,",le=\"%ld\"} %lu\n",buckets[b],count);
+            }
+            fprintf(p_fout,"kafs_token_lifetime_seconds_bucket{");
+            print_labels(p_fout,p_ent);
+            fprintf(p_fout,",le=\"+Inf\"} %lu\n",p_ent->total);
+            fprintf(p_fout,"kafs_token_lifetime_seconds_sum{");
+            print_labels(p_fout,p_ent);
+            fprintf(p_fout,"} %.0f\n",p_ent->sum);
+            fprintf(p_fout,"kafs_token_lifetime_seconds_count{");
+            print_labels(p_fout,p_ent);
+            fprintf(p_fout,"} %lu\n",p_ent->total);
+        }
+    }
+
+    if( with_uid ){
+        fprintf(p_fout,"# HELP kafs_key_user_keys Keys owned by the user.\n");
+        fprintf(p_fout,"# TYPE kafs_key_user_keys gauge\n");
+        for(int i=0; i < p_scr->nusers; i++){
+            fprintf(p_fout,"kafs_key_user_keys{uid=\"%u\"} %ld\n",p_scr->users[i].uid,p_scr->users[i].nkeys);
+        }
+        fprintf(p_fout,"# HELP kafs_key_user_max_keys Quota of keys of the user.\n");
+        fprintf(p_fout,"# TYPE kafs_key_user_max_keys gauge\n");
+        for(int i=0; i < p_scr->nusers; i++){
+            fprintf(p_fout,"kafs_key_user_max_keys{uid=\"%u\"} %ld\n",p_scr->users[i].uid,p_scr->users[i].maxkeys);
+        }
+        fprintf(p_fout,"# HELP kafs_key_user_bytes Size of keys owned by the user.\n");
+        fprintf(p_fout,"# TYPE kafs_key_user_bytes gauge\n");
+        for(int i=0; i < p_scr->nusers; i++){
+            fprintf(p_fout,"kafs_key_user_bytes{uid=\"%u\"} %ld\n",p_scr->users[i].uid,p_scr->users[i].nbytes);
+        }
+        fprintf(p_fout,"# HELP kafs_key_user_max_bytes Quota of key sizes of the user.\n");
+        fprintf(p_fout,"# TYPE kafs_key_user_max_bytes gauge\n");
+        for(int i=0; i < p_scr->nusers; i++){
+            fprintf(p_fout,"kafs_key_user_max_bytes{uid=\"%u\"} %ld\n",p_scr->users[i].uid,p_scr->users[i].maxbytes);
+        }
+    }
+
+    fprintf(p_fout,"# HELP kafs_exporter_keys_read Lines of /proc/keys read by the scrape.\n");
+    fprintf(p_fout,"# TYPE kafs_exporter_keys_read gauge\n");
+    fprintf(p_fout,"kafs_exporter_keys_read %lu\n",p_scr->nkeys);
+    fprintf(p_fout,"# HELP kafs_exporter_errors Users, whose keys could not be read.\n");
+    fprintf(p_fout,"# TYPE kafs_exporter_errors gauge\n");
+    fprintf(p_fout,"kafs_exporter_errors %d\n",p_scr->nerrors);
+    fprintf(p_fout,"# HELP kafs_exporter_users_skipped Users, whose keys were not read due to --max-users.\n");
+    fprintf(p_fout,"# TYPE kafs_exporter_users_skipped gauge\n");
+    fprintf(p_fout,"kafs_exporter_users_skipped %d\n",p_scr->nskipped);
+    fprintf(p_fout,"# HELP kafs_exporter_scrape_duration_seconds Duration of the scrape.\n");
+    fprintf(p_fout,"# TYPE kafs_exporter_scrape_duration_seconds gauge\n");
+    fprintf(p_fout,"kafs_exporter_scrape_duration_seconds %.6f\n",p_scr->duration);
+}
+
+/* ========================================================================== */
+
+/* the file is replaced atomically, so the collector never reads it partially */
+int write_metrics(const char* path)
+{
+    char tmp[PATH_MAX];
+    if( snprintf(tmp,sizeof(tmp),"%s.tmp",path) >= (int)sizeof(tmp) ){
+        errno = ENAMETOOLONG;
+        return(-1);
+    }
+
+    FILE* p_fout = fopen(tmp,"we");
+    if( p_fout == NULL ) return(-1);
+
+    struct scrape scr;
+    scrape(&scr);
+    print_metrics(p_fout,&scr);
+    free_scrape(&scr);
+
+    if( fclose(p_fout) != 0 ){
+        unlink(tmp);
+        return(-1);
+    }
+    if( rename(tmp,path) != 0 ){
+        unlink(tmp);
+        return(-1);
+    }
+    return(0);
+}
+
+/* ========================================================================== */
+
+/* wait until the non-blocking socket is ready, return -1 after the deadline */
+int wait_fd(int fd,short events,double deadline)
+{
+    for(;;){
+        double left = deadline - now_s();
+        if( left <= 0 ) return(-1);
+        struct pollfd pfd = { fd, events, 0 };
+        int ret = poll(&pfd,1,(int)(left*1000) + 1);
+        if( ret > 0 ) return(0);
+        if( (ret == -1) && (errno != EINTR) ) return(-1);
+    }
+}
+
+/* ========================================================================== */
+
+int write_all(int fd,const char* p_buf,size_t len,double deadline)
+{
+    while( len > 0 ){
+        ssize_t ret = write(fd,p_buf,len);
+        if( ret == -1 ){
+            if( errno == EINTR ) continue;
+            if( (errno == EAGAIN) && (wait_fd(fd,POLLOUT,deadline) == 0) ) continue;
+            return(-1);
+        }
+        p_buf += ret;
+        len -= ret;
+    }
+    return(0);
+}
+
+/* ========================================================================== */
+
+/* the server is single threaded, so a slow client must not hold it longer than the deadline */
+void serve_client(int fd)
+{
+    double deadline = now_s() + EXPORTER_HTTP_TIMEOUT;
+
+    /* only the request line is needed, but the whole header is read */
+    char    req[EXPORTER_MAX_REQUEST];
+    size_t  len = 0;
+    while( len < sizeof(req) - 1 ){
+        ssize_t ret = read(fd,req + len,sizeof(req) - 1 - len);
+        if( ret == -1 ){
+            if( errno == EINTR ) continue;
+            if( (errno == EAGAIN) && (wait_fd(fd,POLLIN,deadline) == 0) ) continue;
+            return;
+        }
+        if( ret == 0 ) break;
+        len += ret;
+        req[len] = '\0';
+        if( strstr(req,"\r\n\r\n") || strstr(req,"\n\n") ) break;
+    }
+    req[len] = '\0';
+
+    if( (strncmp(req,"GET /metrics ",13) != 0) && (strncmp(req,"GET / ",6) != 0) ){
+        const char* p_resp = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        write_all(fd,p_resp,strlen(p_resp),deadline);
+        return;
+    }
+
+    char*   p_body = NULL;
+    size_t  blen = 0;
+    FILE*   p_fout = open_memstream(&p_body,&blen);
+    if( p_fout == NULL ) return;
+
+    struct scrape scr;
+    scrape(&scr);
+    print_metrics(p_fout,&scr);
+    free_scrape(&scr);
+    fclose(p_fout);
+
+    char head[256];
+    int  hlen = snprintf(head,sizeof(head),
+                    "HTTP/1.0 200 OK\r\n"
+                    "Content-Type: text/plain; version=0.0.4\r\n"
+                    "Content-Length: %zu\r\n"
+                    "Connection: close\r\n\r\n",blen);
+    /* the time of the scrape is not charged to the client */
+    deadline = now_s() + EXPORTER_HTTP_TIMEOUT;
+    if( write_all(fd,head,hlen,deadline) == 0 ){
+        write_all(fd,p_body,blen,deadline);
+    }
+    free(p_body);
+}
+
+/* ========================================================================== */
+
+/* single threaded, scrapes are serialized */
+void serve_http(void)
+{
+    struct sockaddr_storage sa;
+    socklen_t               salen;
+    memset(&sa,0,sizeof(sa));
+
+    struct sockaddr_in*     p_sa4 = (struct sockaddr_in*)&sa;
+    struct sockaddr_in6*    p_sa6 = (struct sockaddr_in6*)&sa;
+    if( inet_pton(AF_INET,address,&p_sa4->sin_addr) == 1 ){
+        p_sa4->sin_family   = AF_INET;
+        p_sa4->sin_port     = htons(port);
+        salen = sizeof(struct sockaddr_in);
+    } else if( inet_pton(AF_INET6,address,&p_sa6->sin6_addr) == 1 ){
+        p_sa6->sin6_family  = AF_INET6;
+        p_sa6->sin6_port    = htons(port);
+        salen = sizeof(struct sockaddr_in6);
+    } else {
+        errx(1, "Invalid listen address '%s'",address);
+    }
+
+    int lfd = socket(sa.ss_family,SOCK_STREAM|SOCK_CLOEXEC,0);
+    if( lfd == -1 ) err(1, "Unable to create socket");
+    int one = 1;
+    setsockopt(lfd,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+    if( bind(lfd,(struct sockaddr*)&sa,salen) != 0 ) err(1, "Unable to bind to %s:%d",address,port);
+    if( listen(lfd,16) != 0 ) err(1, "Unable to listen");
+
+    while( ! terminate ){
+        int fd = accept4(lfd,NULL,NULL,SOCK_CLOEXEC|SOCK_NONBLOCK);
+        if( fd == -1 ){
+            if( errno == EINTR ) continue;
+            err(1, "Unable to accept connection");
+        }
+        serve_client(fd);
+        close(fd);
+    }
+    close(lfd);
+}
+
+/* ========================================================================== */
+
+int main(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt_long(argc, argv, "hvdo:i:p:a:u:m:U", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'h':
+                print_usage();
+                return(0);
+            case '?':
+            default:
+                print_usage();
+                return(1);
+            case 'v':
+                kafs_print_version(NULL);
+                return(0);
+            case 'd':
+                verbose = 1;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'i':
+                interval = atol(optarg);
+                if( interval <= 0 ) errx(1, "Interval must be positive");
+                break;
+            case 'p':
+                port = atoi(optarg);
+                if( (port <= 0) || (port > 65535) ) errx(1, "Invalid port");
+                break;
+            case 'a':
+                address = optarg;
+                break;
+            case 'u':
+                min_uid = atol(optarg);
+                break;
+            case 'm':
+                max_users = atoi(optarg);
+                if( max_users <= 0 ) errx(1, "Maximum number of users must be positive");
+                break;
+            case 'U':
+                with_uid = 0;
+                break;
+        }
+    }
+
+    if( (output != NULL) && (port != 0) ) errx(1, "Options -o and -p are mutually exclusive");
+    if( (interval != 0) && (output == NULL) ) errx(1, "Option -i requires -o");
+    if( geteuid() != 0 ) warnx("Not running as root, only own keys are exported");
+
+    struct sigaction sa;
+    memset(&sa,0,sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM,&sa,NULL);
+    sigaction(SIGINT,&sa,NULL);
+    signal(SIGPIPE,SIG_IGN);
+
+    if( port != 0 ){
+        serve_http();
+        return(0);
+    }
+
+    if( output == NULL ){
+        struct scrape scr;
+        scrape(&scr);
+        print_metrics(stdout,&scr);
+        free_scrape(&scr);
+        return(0);
+    }
+
+    do {
+        if( write_metrics(output) != 0 ) warn("Unable to write '%s'",output);
+        if( interval ) sleep(interval);
+    } while( interval && ! terminate );
+
+    return(0);
+}
@@ -35,118 +35,751 @@
  * SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE
 #include <ctype.h>
-#include <krb5.h>
-#include <kafs-user.h>
-#include <getarg.h>
+#include <kafs-core.h>
+#include <getopt.h>
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "vlprobe.h"
 
 /* ========================================================================== */
-int              help_flag;
-int              version_flag;
-int              verbose;
 
-struct getargs args[] = {
-    { "verbose",'v', arg_flag, &verbose, NULL, NULL },
-    { "version", 0,  arg_flag, &version_flag, NULL, NULL },
-    { "help",	'h', arg_flag, &help_flag, NULL, NULL },
+int              verbose        = 0;
+int              watch          = 0;
+int              probe          = 0;
+const char*      cache_path     = _PATH_KAFS_USER_VLRTT;
+const char*      hosts_path     = _PATH_KAFS_USER_VLHOSTS;
+int              resolve_timeout = VL_RESOLVE_TIMEOUT;
+
+struct vl_probe_opts probe_opts = { 0, VL_PORT, VL_PROBE_TIMEOUT };
+
+volatile sig_atomic_t   terminate   = 0;
+volatile sig_atomic_t   reload      = 0;
+
+struct option longopts[] = {
+   { "verbose",         no_argument,       NULL,     'v' },
+   { "version",         no_argument,       NULL,     'V' },
+   { "watch",           no_argument,       NULL,     'w' },
+   { "probe",           no_argument,       NULL,     'p' },
+   { "probe-tcp",       no_argument,       NULL,     'T' },
+   { "probe-timeout",   required_argument, NULL,     't' },
+   { "probe-port",      required_argument, NULL,     'P' },
+   { "cache",           required_argument, NULL,     'c' },
+   { "resolve-timeout", required_argument, NULL,     'R' },
+   { "hosts-cache",     required_argument, NULL,     'H' },
+   { 0, 0, 0, 0 }
+};
+
+/* cell definition, vls is NULL for cells read from kAFS */
+struct cell_def {
+    char*   name;
+    char**  vls;    /* NULL terminated list of VL servers from CellServDB */
+    char**  addrs;  /* NULL terminated list of VL server addresses written to kAFS */
+};
+
+struct cell_list {
+    struct cell_def*    cells;
+    int                 ncells;
 };
 
-static int num_args = sizeof(args) / sizeof(args[0]);
+/* time without further changes before they are applied */
+#define WATCH_SETTLE_MS     500
 
 /* ========================================================================== */
 
-void usage(int ecode)
+void print_usage(void)
 {
-    arg_printusage(args, num_args, NULL, NULL);
-    exit(ecode);
+    printf("\n");
+    printf("Populate kAFS cell database from CellServDB, TheseCells, and ThisCell.\n");
+    printf("Only cells missing in kAFS are added.\n");
+    printf("\n");
+    printf("Usage: kafs-init [-vVhwpT] [-t MS] [-P PORT] [-c FILE] [-R MS] [-H FILE]\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("   -h   Print this help.\n");
+    printf("   -v   Be more verbose (--verbose).\n");
+    printf("   -V   Print kAFS-user version (--version).\n");
+    printf("   -w   Keep running and apply changes of files in %s (--watch).\n",_PATH_KAFS_USER_ETC);
+    printf("        SIGHUP forces the configuration to be applied.\n");
+    printf("   -p   Probe VL servers of added cells and order them by RTT (--probe).\n");
+    printf("        Without probing, the order from previous probes is used if available.\n");
+    printf("   -T   Probe by TCP connect instead of Rx version request (--probe-tcp).\n");
+    printf("   -t   Probe timeout in ms (--probe-timeout, default: %d).\n",VL_PROBE_TIMEOUT);
+    printf("   -P   Probed port (--probe-port, default: %d).\n",VL_PORT);
+    printf("   -c   Cache of probe results (--cache, default: %s).\n",_PATH_KAFS_USER_VLRTT);
+    printf("   -R   Timeout for resolution of VL server host names in ms (--resolve-timeout, default: %d).\n",VL_RESOLVE_TIMEOUT);
+    printf("   -H   Cache of resolved host names (--hosts-cache, default: %s).\n",_PATH_KAFS_USER_VLHOSTS);
+    printf("\n");
 }
 
 /* ========================================================================== */
 
-int main(int argc, char **argv)
+void free_cell_list(struct cell_list* list)
 {
-    int optidx = 0;
+    for(int i=0; i < list->ncells; i++){
+        free(list->cells[i].name);
+        kafs_free_vls(list->cells[i].vls);
+        kafs_free_vls(list->cells[i].addrs);
+    }
+    free(list->cells);
+    list->cells  = NULL;
+    list->ncells = 0;
+}
 
-    if( getarg(args, num_args, argc, argv, &optidx) ) usage(1);
+/* ========================================================================== */
 
-    if( help_flag ) usage(0);
+/* name and vls are taken over, they are released on failure */
+int add_cell(struct cell_list* list,char* name,char** vls)
+{
+    struct cell_def* p_cells = realloc(list->cells,(list->ncells+1)*sizeof(struct cell_def));
+    if( p_cells == NULL ){
+        free(name);
+        kafs_free_vls(vls);
+        errno = ENOMEM;
+        return(-1);
+    }
+    list->cells = p_cells;
+    list->cells[list->ncells].name  = name;
+    list->cells[list->ncells].vls   = vls;
+    list->cells[list->ncells].addrs = NULL;
+    list->ncells++;
+    return(0);
+}
+
+/* ========================================================================== */
 
-    if( version_flag ) {
-        kafs_print_version(NULL);
-        exit(0);
+struct cell_def* find_cell(struct cell_list* list,const char* name)
+{
+    for(int i=0; i < list->ncells; i++){
+        if( strcmp(list->cells[i].name,name) == 0 ) return(&list->cells[i]);
     }
+    return(NULL);
+}
 
-    if( verbose ) kafs_set_verbose(1);
+/* ========================================================================== */
 
-    if( ! k_hasafs() ) errx(1, "AFS does not seem to be present on this machine");
+/* join VL server addresses as written to kAFS, IPv6 addresses are in [], NULL if there are none */
+char* join_vls(char** p_vls)
+{
+    size_t len = 0;
+    for(char** p_pv = p_vls; *p_pv; p_pv++) len += strlen(*p_pv) + 3;
+    if( len == 0 ) return(NULL);
+
+    char* p_joined = malloc(len);
+    if( p_joined == NULL ) return(NULL);
 
-/* populate kAFS system - cells */
+    char* p_end = p_joined;
+    for(char** p_pv = p_vls; *p_pv; p_pv++){
+        if( p_end != p_joined ) *p_end++ = ':';
+        if( strchr(*p_pv,':') != NULL ){
+            *p_end++ = '[';
+            p_end = stpcpy(p_end,*p_pv);
+            *p_end++ = ']';
+            *p_end = '\0';
+        } else {
+            p_end = stpcpy(p_end,*p_pv);
+        }
+    }
+    return(p_joined);
+}
+
+/* ========================================================================== */
+
+/* cells from TheseCells and ThisCell with VL servers from CellServDB */
+int read_config(struct cell_list* config)
+{
     char** p_cells = kafs_get_these_cells();
     if( p_cells == NULL ){
         return(0); /* no cells */
     }
 
-    int err = 0;
-    char** p_pc = p_cells;
-    while( *p_pc ){
-        /* get cell VLS */
+    for(char** p_pc = p_cells; *p_pc; p_pc++){
         char** p_vls = kafs_get_vls(*p_pc);
-        if( p_vls != NULL ){
-            char** p_pv = p_vls;
-
-            FILE* p_fcells = fopen(_KAFS_PROC_CELLS,"w");
-            if( p_fcells == NULL ){
-                kafs_free_vls(p_vls);
-                kafs_free_these_cells(p_cells);
-                errx(1, "Unable to open kAFS proc cell database file '%s'",_KAFS_PROC_CELLS);
+        if( (p_vls == NULL) || (p_vls[0] == NULL) ){
+            kafs_free_vls(p_vls);
+            if( verbose ) printf("skip %s (no VL servers in CellServDB)\n",*p_pc);
+            continue;
+        }
+        char* p_name = strdup(*p_pc);
+        if( (p_name == NULL) || (add_cell(config,p_name,p_vls) != 0) ){
+            if( p_name == NULL ) kafs_free_vls(p_vls);
+            kafs_free_these_cells(p_cells);
+            free_cell_list(config);
+            return(-1);
+        }
+    }
+
+    kafs_free_these_cells(p_cells);
+    return(0);
+}
+
+/* ========================================================================== */
+
+/* cells known to kAFS, the first line is a header and the name is the last column */
+int read_kernel_cells(struct cell_list* kernel)
+{
+    FILE* p_fcells = fopen(_KAFS_PROC_CELLS,"r");
+    if( p_fcells == NULL ) return(-1);
+
+    char  buff[LINE_MAX];
+    int   first = 1;
+    while( fgets(buff,sizeof(buff),p_fcells) != NULL ){
+        if( first ){
+            first = 0;
+            continue;
+        }
+        char* p_name = NULL;
+        char* p_save = NULL;
+        for(char* p_tok = strtok_r(buff," \t\n",&p_save); p_tok; p_tok = strtok_r(NULL," \t\n",&p_save)){
+            p_name = p_tok;
+        }
+        if( p_name == NULL ) continue;
+        p_name = strdup(p_name);
+        if( (p_name == NULL) || (add_cell(kernel,p_name,NULL) != 0) ){
+            fclose(p_fcells);
+            free_cell_list(kernel);
+            errno = ENOMEM;
+            return(-1);
+        }
+    }
+
+    fclose(p_fcells);
+    return(0);
+}
+
+/* ========================================================================== */
+
+/* set root cell if it differs from the current one, this must be done after celldb is populated */
+int apply_root_cell(void)
+{
+    char* p_tcell = kafs_get_this_cell();
+    if( p_tcell == NULL ) return(0);
+
+    char  current[NAME_MAX+2];
+    current[0] = '\0';
+    FILE* p_froot = fopen(_KAFS_PROC_ROOT_CELL,"r");
+    if( p_froot != NULL ){
+        if( fgets(current,sizeof(current),p_froot) == NULL ) current[0] = '\0';
+        fclose(p_froot);
+    }
+    char* pos = strchr(current,'\n');
+    if( pos != NULL ) *pos = '\0';
+
+    if( strcmp(current,p_tcell) == 0 ){
+        free(p_tcell);
+        return(0);
+    }
+
+    int fd = open(_KAFS_PROC_ROOT_CELL,O_WRONLY);
+    if( fd == -1 ){
+        warn("Unable to open kAFS proc root cell file '%s'",_KAFS_PROC_ROOT_CELL);
+        free(p_tcell);
+        return(-1);
+    }
+
+    char*   line;
+    int     len = asprintf(&line,"%s\n",p_tcell);
+    int     ret = 0;
+    if( len == -1 ){
+        warnx("Unable to allocate root cell record");
+        ret = -1;
+    } else {
+        if( verbose ) printf("rootcell %s",line);
+        if( write(fd,line,len) != len ){
+            warn("Unable to write root cell into '%s'",_KAFS_PROC_ROOT_CELL);
+            ret = -1;
+        }
+        free(line);
+    }
+
+    close(fd);
+    free(p_tcell);
+    return(ret);
+}
+
+/* ========================================================================== */
+
+/* the same VL servers regardless of their order */
+int same_vls(char** p_vls1,char** p_vls2)
+{
+    int n1 = 0;
+    int n2 = 0;
+    while( p_vls1[n1] ) n1++;
+    while( p_vls2[n2] ) n2++;
+    if( n1 != n2 ) return(0);
+
+    for(char** p_pv1 = p_vls1; *p_pv1; p_pv1++){
+        char** p_pv2 = p_vls2;
+        while( *p_pv2 && (strcmp(*p_pv1,*p_pv2) != 0) ) p_pv2++;
+        if( *p_pv2 == NULL ) return(0);
+    }
+    return(1);
+}
+
+/* ========================================================================== */
+
+/* resolve host names of VL servers in parallel and set addresses of cells */
+void resolve_vls(struct cell_def** p_cells,int ncells)
+{
+    int nentries = 0;
+    for(int i=0; i < ncells; i++){
+        for(char** p_pv = p_cells[i]->vls; *p_pv; p_pv++) nentries++;
+    }
+
+    struct vl_host* hosts = calloc(nentries+1,sizeof(struct vl_host));
+    if( hosts == NULL ){
+        warnx("Unable to allocate VL server host names");
+        return;
+    }
+
+    /* unique host names */
+    int nhosts = 0;
+    for(int i=0; i < ncells; i++){
+        for(char** p_pv = p_cells[i]->vls; *p_pv; p_pv++){
+            if( vl_is_address(*p_pv) ) continue;
+            int k;
+            for(k=0; k < nhosts; k++){
+                if( strcmp(hosts[k].name,*p_pv) == 0 ) break;
+            }
+            if( k < nhosts ) continue;
+            hosts[nhosts++].name = *p_pv;
+        }
+    }
+
+    if( nhosts > 0 ){
+        int nresolved = vl_resolve(hosts,nhosts,resolve_timeout);
+        if( (nresolved > 0) && (vl_hosts_cache_save(hosts,nhosts,hosts_path) != 0) ){
+            warn("Unable to save resolved host names into '%s'",hosts_path);
+        }
+        if( nresolved < nhosts ){
+            vl_hosts_cache_load(hosts,nhosts,hosts_path);
+        }
+        for(int k=0; k < nhosts; k++){
+            if( hosts[k].addrs == NULL ){
+                warnx("Unable to resolve VL server '%s'",hosts[k].name);
+            } else if( verbose ){
+                printf("resolve %s",hosts[k].name);
+                for(char** p_pa = hosts[k].addrs; *p_pa; p_pa++) printf(" %s",*p_pa);
+                printf("\n");
+            }
+        }
+    }
+
+    /* addresses in CellServDB order */
+    for(int i=0; i < ncells; i++){
+        int     maddrs = nentries;
+        char**  addrs  = calloc(maddrs+1,sizeof(char*));
+        int     naddrs = 0;
+        if( addrs == NULL ) continue;
+
+        for(char** p_pv = p_cells[i]->vls; *p_pv; p_pv++){
+            char*   single[2] = { *p_pv, NULL };
+            char**  p_src = single;
+            if( ! vl_is_address(*p_pv) ){
+                int k = 0;
+                while( strcmp(hosts[k].name,*p_pv) != 0 ) k++;
+                if( hosts[k].addrs == NULL ) continue;
+                p_src = hosts[k].addrs;
             }
-            int first = 1;
-            while( *p_pv ){
-                if( first ){
-                    if( verbose ) printf("add %s %s",*p_pc,*p_pv);
-                    if( fprintf(p_fcells,"add %s %s",*p_pc,*p_pv) < 0 ) err = 1;
+            for(; *p_src; p_src++){
+                int j;
+                for(j=0; j < naddrs; j++){
+                    if( strcmp(addrs[j],*p_src) == 0 ) break;
+                }
+                if( j < naddrs ) continue;
+                /* a host name can have more addresses */
+                if( naddrs == maddrs ){
+                    char** p_new = realloc(addrs,(2*maddrs+1)*sizeof(char*));
+                    if( p_new == NULL ) break;
+                    addrs = p_new;
+                    maddrs *= 2;
+                }
+                addrs[naddrs] = *p_src;
+                addrs[++naddrs] = NULL;
+            }
+        }
+        /* the addresses are owned by hosts, make a copy freed by kafs_free_vls */
+        p_cells[i]->addrs = kafs_dup_list(addrs,naddrs);
+        free(addrs);
+    }
+
+    vl_free_hosts(hosts,nhosts);
+    free(hosts);
+}
+
+/* ========================================================================== */
+
+/* order VL servers of cells by RTT from probes or from the cache of previous probes */
+void order_vls(struct cell_def** p_cells,int ncells)
+{
+    int nservers = 0;
+    for(int i=0; i < ncells; i++){
+        if( p_cells[i]->addrs == NULL ) continue;
+        for(char** p_pv = p_cells[i]->addrs; *p_pv; p_pv++) nservers++;
+    }
+    if( nservers == 0 ) return;
+
+    struct vl_server* servers = calloc(nservers,sizeof(struct vl_server));
+    if( servers == NULL ){
+        warnx("Unable to allocate VL servers, CellServDB order is used");
+        return;
+    }
+
+    int k = 0;
+    for(int i=0; i < ncells; i++){
+        if( p_cells[i]->addrs == NULL ) continue;
+        for(int j=0; p_cells[i]->addrs[j]; j++){
+            servers[k].addr  = p_cells[i]->addrs[j];
+            servers[k].rtt   = VL_RTT_UNKNOWN;
+            servers[k].order = j;
+            k++;
+        }
+    }
+
+    int probed = 0;
+    if( probe ){
+        int nreachable = vl_probe(servers,nservers,&probe_opts);
+        if( verbose ){
+            for(int i=0; i < nservers; i++){
+                if( servers[i].rtt >= 0 ){
+                    printf("probe %s %ld us\n",servers[i].addr,servers[i].rtt);
                 } else {
-                    if( verbose ) printf(":%s",*p_pv);
-                    if( fprintf(p_fcells,":%s",*p_pv) < 0 ) err = 1;
+                    printf("probe %s %s\n",servers[i].addr,servers[i].rtt == VL_RTT_UNKNOWN ? "skipped" : "unreachable");
                 }
-                first = 0;
-                p_pv++;
             }
-            if( verbose ) printf("\n");
-            if( fprintf(p_fcells,"\n") < 0 ) err = 1;
-            if( fclose(p_fcells) != 0 ){
-                err = 1;
+        }
+        if( nreachable > 0 ){
+            probed = 1;
+            if( vl_cache_save(servers,nservers,cache_path) != 0 ){
+                warn("Unable to save probe results into '%s'",cache_path);
             }
-            kafs_free_vls(p_vls);
+        } else {
+            /* network is probably not ready yet */
+            warnx("No VL server responded, results of previous probes are used");
+            for(int i=0; i < nservers; i++) servers[i].rtt = VL_RTT_UNKNOWN;
         }
-        p_pc++;
     }
+    if( ! probed ) vl_cache_load(servers,nservers,cache_path);
 
-    kafs_free_these_cells(p_cells);
+    /* servers of each cell are sorted in place */
+    k = 0;
+    for(int i=0; i < ncells; i++){
+        if( p_cells[i]->addrs == NULL ) continue;
+        int n = 0;
+        while( p_cells[i]->addrs[n] ) n++;
+        vl_sort(&servers[k],n);
+        for(int j=0; j < n; j++){
+            p_cells[i]->addrs[j] = (char*)servers[k+j].addr;
+        }
+        k += n;
+    }
+
+    free(servers);
+}
+
+/* ========================================================================== */
 
-    if( err != 0 ){
-       errx(1, "Some cell was not writted into '%s'",_KAFS_PROC_CELLS);
+/* add cells missing in kAFS, applied keeps definitions from the previous run,
+   kAFS can neither update VL servers of existing cells nor remove them */
+int apply_config(struct cell_list* applied)
+{
+    struct cell_list config = { NULL, 0 };
+    struct cell_list kernel = { NULL, 0 };
+
+    if( read_config(&config) != 0 ){
+        warn("Unable to read cell configuration");
+        return(-1);
+    }
+    if( read_kernel_cells(&kernel) != 0 ){
+        warn("Unable to read kAFS proc cell database file '%s'",_KAFS_PROC_CELLS);
+        free_cell_list(&config);
+        return(-1);
     }
 
-/* populate kAFS system - rootcell, this must be done after celldb is populated  */
-    char* p_tcell = kafs_get_this_cell();
-    if( p_tcell ){
-        FILE* p_fcells = fopen(_KAFS_PROC_ROOT_CELL,"w");
-        if( p_fcells == NULL ){
-            free(p_tcell);
-            errx(1, "Unable to open kAFS proc root cell file '%s'",_KAFS_PROC_ROOT_CELL);
+    int ret     = 0;
+    int nadded  = 0;
+    int nadd    = 0;
+    int fd      = -1;
+
+    struct cell_def** p_add = calloc(config.ncells+1,sizeof(struct cell_def*));
+    if( p_add == NULL ){
+        warnx("Unable to allocate list of added cells");
+        free_cell_list(&config);
+        free_cell_list(&kernel);
+        return(-1);
+    }
+
+    for(int i=0; i < config.ncells; i++){
+        struct cell_def* p_cell = &config.cells[i];
+
+        if( find_cell(&kernel,p_cell->name) != NULL ){
+            struct cell_def* p_prev = find_cell(applied,p_cell->name);
+            if( (p_prev != NULL) && ! same_vls(p_prev->vls,p_cell->vls) ){
+                warnx("VL servers of cell '%s' changed, kAFS applies them only after the kafs module is reloaded",p_cell->name);
+            }
+            continue;
         }
-        if( fprintf(p_fcells,"%s\n",p_tcell) < 0 ) {
-            fclose(p_fcells);
-            free(p_tcell);
-            errx(1, "Unable to write root cell into '%s'",_KAFS_PROC_ROOT_CELL);
+        p_add[nadd++] = p_cell;
+    }
+
+    resolve_vls(p_add,nadd);
+    order_vls(p_add,nadd);
+
+    for(int i=0; i < nadd; i++){
+        struct cell_def* p_cell = p_add[i];
+
+        /* one open for all records, each record must be written by a single write */
+        if( fd == -1 ){
+            fd = open(_KAFS_PROC_CELLS,O_WRONLY);
+            if( fd == -1 ){
+                warn("Unable to open kAFS proc cell database file '%s'",_KAFS_PROC_CELLS);
+                ret = -1;
+                break;
+            }
         }
-        fclose(p_fcells);
-        free(p_tcell);
+
+        if( (p_cell->addrs == NULL) || (p_cell->addrs[0] == NULL) ){
+            warnx("No address of VL servers of cell '%s'",p_cell->name);
+            ret = -1;
+            continue;
+        }
+
+        char*   line = NULL;
+        char*   p_vls = join_vls(p_cell->addrs);
+        int     len = p_vls ? asprintf(&line,"add %s %s\n",p_cell->name,p_vls) : -1;
+        free(p_vls);
+        if( len == -1 ){
+            warnx("Unable to allocate record for cell '%s'",p_cell->name);
+            ret = -1;
+            continue;
+        }
+        if( verbose ) printf("%s",line);
+        ssize_t wlen = write(fd,line,len);
+        if( (wlen == -1) ? (errno != EEXIST) : (wlen != len) ){
+            warn("Unable to add cell '%s' into '%s'",p_cell->name,_KAFS_PROC_CELLS);
+            ret = -1;
+        } else {
+            nadded++;
+        }
+        free(line);
+    }
+    if( fd != -1 ) close(fd);
+    free(p_add);
+
+    if( verbose ){
+        for(int i=0; i < kernel.ncells; i++){
+            if( find_cell(&config,kernel.cells[i].name) == NULL ){
+                printf("keep %s (not configured)\n",kernel.cells[i].name);
+            }
+        }
+        printf("%d cell(s) added, %d cell(s) configured\n",nadded,config.ncells);
+    }
+
+    if( apply_root_cell() != 0 ) ret = -1;
+
+    free_cell_list(&kernel);
+    free_cell_list(applied);
+    *applied = config;
+
+    fflush(stdout);
+    return(ret);
+}
+
+/* ========================================================================== */
+
+void handle_signal(int signum)
+{
+    if( signum == SIGHUP ){
+        reload = 1;
+    } else {
+        terminate = 1;
+    }
+}
+
+/* ========================================================================== */
+
+/* is the inotify event related to configuration files? */
+int is_config_event(const struct inotify_event* p_ev)
+{
+    if( p_ev->mask & (IN_IGNORED|IN_DELETE_SELF|IN_MOVE_SELF) ){
+        errx(1, "Configuration directory '%s' was removed",_PATH_KAFS_USER_ETC);
+    }
+    if( p_ev->len == 0 ) return(0);
+
+    const char* fns[] = {
+                _PATH_KAFS_USER_THISCELL,
+                _PATH_KAFS_USER_THESECELLS,
+                _PATH_KAFS_USER_CELLSERVDB,
+                NULL };
+
+    for(const char** fn = fns; *fn != NULL; fn++){
+        if( strcmp(p_ev->name,*fn + strlen(_PATH_KAFS_USER_ETC)) == 0 ) return(1);
+    }
+    return(0);
+}
+
+/* ========================================================================== */
+
+/* wait for events, return 1 if a configuration file was changed, 0 on timeout or signal,
+ * signals are delivered only while waiting with the mask p_mask */
+int read_events(int fd,int timeout,const sigset_t* p_mask)
+{
+    struct pollfd   pfd = { fd, POLLIN, 0 };
+    struct timespec ts = { timeout / 1000, (timeout % 1000) * 1000000L };
+
+    int ret = ppoll(&pfd,1,timeout < 0 ? NULL : &ts,p_mask);
+    if( ret == -1 ){
+        if( errno == EINTR ) return(0);
+        err(1, "Unable to wait for inotify events");
+    }
+    if( ret == 0 ) return(0);
+
+    char    buff[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len = read(fd,buff,sizeof(buff));
+    if( len == -1 ){
+        if( (errno == EINTR) || (errno == EAGAIN) ) return(0);
+        err(1, "Unable to read inotify events");
+    }
+
+    int changed = 0;
+    for(char* p_buff = buff; p_buff < buff + len; ){
+        const struct inotify_event* p_ev = (const struct inotify_event*)p_buff;
+        if( is_config_event(p_ev) ) changed = 1;
+        p_buff += sizeof(struct inotify_event) + p_ev->len;
+    }
+    return(changed);
+}
+
+/* ========================================================================== */
+
+void watch_config(struct cell_list* applied)
+{
+    int fd = inotify_init1(IN_CLOEXEC|IN_NONBLOCK);
+    if( fd == -1 ) err(1, "Unable to initialize inotify");
+
+    /* editors usually replace files, so the directory is watched */
+    if( inotify_add_watch(fd,_PATH_KAFS_USER_ETC,
+                          IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVED_FROM|IN_DELETE|IN_DELETE_SELF|IN_MOVE_SELF) == -1 ){
+        err(1, "Unable to watch '%s'",_PATH_KAFS_USER_ETC);
+    }
+
+    sigset_t set, oldset;
+    sigemptyset(&set);
+    sigaddset(&set,SIGTERM);
+    sigaddset(&set,SIGINT);
+    sigaddset(&set,SIGHUP);
+    sigprocmask(SIG_BLOCK,&set,&oldset);
+
+    /* signals are delivered only within ppoll, so the flags cannot change between test and wait */
+    struct sigaction sa;
+    memset(&sa,0,sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM,&sa,NULL);
+    sigaction(SIGINT,&sa,NULL);
+    sigaction(SIGHUP,&sa,NULL);
+
+    /* changes done before the watch was set */
+    apply_config(applied);
+
+    while( ! terminate ){
+        int changed = read_events(fd,-1,&oldset);
+        if( ! changed && ! reload ) continue;
+
+        /* wait until files are settled */
+        while( ! terminate && (read_events(fd,WATCH_SETTLE_MS,&oldset) || reload) ){
+            reload = 0;
+        }
+        if( terminate ) break;
+
+        if( verbose ){
+            printf("configuration changed\n");
+        }
+        apply_config(applied);
+    }
+
+    close(fd);
+    sigprocmask(SIG_SETMASK,&oldset,NULL);
+}
+
+/* ========================================================================== */
+
+int main(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt_long(argc, argv, "hvVwpTt:P:c:R:H:", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'h':
+                print_usage();
+                return(0);
+            case '?':
+            default:
+                print_usage();
+                return(1);
+            case 'V':
+                kafs_print_version(NULL);
+                return(0);
+            case 'v':
+                verbose = 1;
+                kafs_set_verbose(1);
+                break;
+            case 'w':
+                watch = 1;
+                break;
+            case 'p':
+                probe = 1;
+                break;
+            case 'T':
+                probe_opts.tcp = 1;
+                break;
+            case 't':
+                probe_opts.timeout = atoi(optarg);
+                if( probe_opts.timeout <= 0 ) errx(1, "Probe timeout must be positive");
+                break;
+            case 'P':
+                probe_opts.port = atoi(optarg);
+                if( (probe_opts.port <= 0) || (probe_opts.port > 65535) ) errx(1, "Invalid probe port");
+                break;
+            case 'c':
+                cache_path = optarg;
+                break;
+            case 'R':
+                resolve_timeout = atoi(optarg);
+                if( resolve_timeout <= 0 ) errx(1, "Resolve timeout must be positive");
+                break;
+            case 'H':
+                hosts_path = optarg;
+                break;
+        }
+    }
+
+    if( ! k_hasafs() ) errx(1, "AFS does not seem to be present on this machine");
+
+    struct cell_list applied = { NULL, 0 };
+
+    if( watch ){
+        watch_config(&applied);
+        free_cell_list(&applied);
+        return(0);
+    }
+
+    int ret = apply_config(&applied);
+    free_cell_list(&applied);
+
+    if( ret != 0 ){
+        errx(1, "Some cell was not written into '%s'",_KAFS_PROC_CELLS);
     }
 
     return 0;
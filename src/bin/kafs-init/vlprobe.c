@@ -0,0 +1,383 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * Measure RTT to VL servers.
+ *
+ * Rx probes are version requests (the same as used by rxdebug -version), which are
+ * answered by the Rx layer of the server without starting any call.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "vlprobe.h"
+
+/* ============================================================================= */
+
+#define RX_HEADER_SIZE              28
+#define RX_PACKET_TYPE_VERSION      13
+#define RX_CLIENT_INITIATED         1
+#define RX_LAST_PACKET              4
+
+#define RX_OFFSET_EPOCH             0
+#define RX_OFFSET_TYPE              20
+#define RX_OFFSET_FLAGS             21
+
+struct vl_probe {
+    struct vl_server*   server;
+    int                 fd;
+    long                start;
+};
+
+/* ============================================================================= */
+
+static long vl_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return(ts.tv_sec*1000000L + ts.tv_nsec/1000);
+}
+
+/* ============================================================================= */
+
+/* start probe, return 0 or -1 if the server cannot be probed */
+static int vl_probe_start(struct vl_probe* probe,const struct vl_probe_opts* opts,uint32_t epoch)
+{
+    struct addrinfo     hints;
+    struct addrinfo*    res;
+    char                port[16];
+
+    memset(&hints,0,sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = opts->tcp ? SOCK_STREAM : SOCK_DGRAM;
+    hints.ai_flags    = AI_NUMERICHOST | AI_NUMERICSERV;
+    snprintf(port,sizeof(port),"%d",opts->port);
+
+    if( getaddrinfo(probe->server->addr,port,&hints,&res) != 0 ) return(-1);
+
+    probe->fd = socket(res->ai_family,res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
+    if( probe->fd == -1 ){
+        freeaddrinfo(res);
+        return(-1);
+    }
+
+    probe->start = vl_now_us();
+    int ret = connect(probe->fd,res->ai_addr,res->ai_addrlen);
+    freeaddrinfo(res);
+
+    if( opts->tcp ){
+        if( (ret == -1) && (errno != EINPROGRESS) ) goto unreachable;
+        return(0);
+    }
+
+    if( ret == -1 ) goto unreachable;
+
+    unsigned char packet[RX_HEADER_SIZE];
+    memset(packet,0,sizeof(packet));
+    epoch = htonl(epoch);
+    memcpy(&packet[RX_OFFSET_EPOCH],&epoch,sizeof(epoch));
+    packet[RX_OFFSET_TYPE]  = RX_PACKET_TYPE_VERSION;
+    packet[RX_OFFSET_FLAGS] = RX_CLIENT_INITIATED | RX_LAST_PACKET;
+
+    if( send(probe->fd,packet,sizeof(packet),0) != sizeof(packet) ) goto unreachable;
+    return(0);
+
+unreachable:
+    close(probe->fd);
+    probe->fd = -1;
+    probe->server->rtt = VL_RTT_UNREACHABLE;
+    return(0);
+}
+
+/* ============================================================================= */
+
+/* handle poll event, return 1 if the probe is finished */
+static int vl_probe_event(struct vl_probe* probe,const struct vl_probe_opts* opts,uint32_t epoch,long now)
+{
+    if( opts->tcp ){
+        int         error = 0;
+        socklen_t   len = sizeof(error);
+        if( getsockopt(probe->fd,SOL_SOCKET,SO_ERROR,&error,&len) == -1 ) error = errno;
+        probe->server->rtt = (error == 0) ? now - probe->start : VL_RTT_UNREACHABLE;
+        return(1);
+    }
+
+    unsigned char packet[512];
+    ssize_t len = recv(probe->fd,packet,sizeof(packet),0);
+    if( len == -1 ){
+        if( (errno == EAGAIN) || (errno == EINTR) ) return(0);
+        /* ICMP port unreachable */
+        probe->server->rtt = VL_RTT_UNREACHABLE;
+        return(1);
+    }
+
+    uint32_t r_epoch;
+    if( len < RX_HEADER_SIZE ) return(0);
+    memcpy(&r_epoch,&packet[RX_OFFSET_EPOCH],sizeof(r_epoch));
+    if( (ntohl(r_epoch) != epoch) || (packet[RX_OFFSET_TYPE] != RX_PACKET_TYPE_VERSION) ) return(0);
+
+    probe->server->rtt = now - probe->start;
+    return(1);
+}
+
+/* ============================================================================= */
+
+int vl_probe(struct vl_server* servers,int nservers,const struct vl_probe_opts* opts)
+{
+    struct vl_probe probes[VL_PROBE_MAX_INFLIGHT];
+    struct pollfd   pfds[VL_PROBE_MAX_INFLIGHT];
+    uint32_t        epoch = (uint32_t)time(NULL);
+    long            timeout = opts->timeout*1000L;
+
+    /* free slots are refilled as probes finish, but no probe is started after
+     * the timeout, so probing takes at most twice the timeout */
+    long            last_start = vl_now_us() + timeout;
+    int             next = 0;
+    int             active = 0;
+
+    for(int i=0; i < VL_PROBE_MAX_INFLIGHT; i++) probes[i].fd = -1;
+
+    for(;;){
+        long now = vl_now_us();
+
+        for(int i=0; (i < VL_PROBE_MAX_INFLIGHT) && (next < nservers) && (now < last_start); i++){
+            if( probes[i].fd != -1 ) continue;
+            /* servers that cannot be probed do not occupy the slot */
+            while( (next < nservers) && (probes[i].fd == -1) ){
+                probes[i].server = &servers[next++];
+                vl_probe_start(&probes[i],opts,epoch);
+            }
+            if( probes[i].fd != -1 ) active++;
+        }
+        if( active == 0 ) break;
+
+        /* the earliest probe deadline */
+        long deadline = LONG_MAX;
+        for(int i=0; i < VL_PROBE_MAX_INFLIGHT; i++){
+            pfds[i].fd      = probes[i].fd;     /* negative fds are ignored */
+            pfds[i].events  = opts->tcp ? POLLOUT : POLLIN;
+            pfds[i].revents = 0;
+            if( (probes[i].fd != -1) && (probes[i].start + timeout < deadline) ){
+                deadline = probes[i].start + timeout;
+            }
+        }
+
+        int ret = 0;
+        if( deadline > now ){
+            ret = poll(pfds,VL_PROBE_MAX_INFLIGHT,(deadline - now + 999)/1000);
+            if( ret == -1 ){
+                if( errno == EINTR ) continue;
+                break;
+            }
+        }
+
+        now = vl_now_us();
+        for(int i=0; i < VL_PROBE_MAX_INFLIGHT; i++){
+            if( probes[i].fd == -1 ) continue;
+            if( (pfds[i].revents == 0) || (vl_probe_event(&probes[i],opts,epoch,now) == 0) ){
+                if( now < probes[i].start + timeout ) continue;
+                /* no response within timeout */
+                probes[i].server->rtt = VL_RTT_UNREACHABLE;
+            }
+            close(probes[i].fd);
+            probes[i].fd = -1;
+            active--;
+        }
+    }
+
+    /* poll failure */
+    for(int i=0; i < VL_PROBE_MAX_INFLIGHT; i++){
+        if( probes[i].fd == -1 ) continue;
+        probes[i].server->rtt = VL_RTT_UNREACHABLE;
+        close(probes[i].fd);
+    }
+
+    int nreachable = 0;
+    for(int i=0; i < nservers; i++){
+        if( servers[i].rtt >= 0 ) nreachable++;
+    }
+    return(nreachable);
+}
+
+/* ============================================================================= */
+
+/* cache line: address RTT[us] timestamp */
+static int vl_cache_parse(char* line,char** addr,long* rtt,long* stamp)
+{
+    char* p_save = NULL;
+    char* p_addr  = strtok_r(line," \t\n",&p_save);
+    char* p_rtt   = strtok_r(NULL," \t\n",&p_save);
+    char* p_stamp = strtok_r(NULL," \t\n",&p_save);
+    if( (p_addr == NULL) || (p_rtt == NULL) || (p_stamp == NULL) ) return(-1);
+
+    *addr   = p_addr;
+    *rtt    = strtol(p_rtt,NULL,10);
+    *stamp  = strtol(p_stamp,NULL,10);
+    return(0);
+}
+
+/* ============================================================================= */
+
+int vl_cache_load(struct vl_server* servers,int nservers,const char* path)
+{
+    FILE* p_f = fopen(path,"r");
+    if( p_f == NULL ) return(-1);
+
+    char    line[LINE_MAX];
+    long    now = time(NULL);
+
+    while( fgets(line,sizeof(line),p_f) != NULL ){
+        char*   addr;
+        long    rtt;
+        long    stamp;
+        if( vl_cache_parse(line,&addr,&rtt,&stamp) != 0 ) continue;
+        if( now - stamp > VL_CACHE_MAX_AGE ) continue;
+        if( (rtt < 0) && (rtt != VL_RTT_UNREACHABLE) ) continue;
+        for(int i=0; i < nservers; i++){
+            if( strcmp(servers[i].addr,addr) == 0 ) servers[i].rtt = rtt;
+        }
+    }
+
+    fclose(p_f);
+    return(0);
+}
+
+/* ============================================================================= */
+
+FILE* vl_cache_create(const char* path,char** p_tmp)
+{
+    if( asprintf(p_tmp,"%s.XXXXXX",path) == -1 ) return(NULL);
+
+    /* the cache directory is created on demand */
+    char* p_dir = strdup(path);
+    if( p_dir == NULL ){
+        free(*p_tmp);
+        return(NULL);
+    }
+    char* p_slash = strrchr(p_dir,'/');
+    if( p_slash != NULL ){
+        *p_slash = '\0';
+        if( (p_dir[0] != '\0') && (mkdir(p_dir,0755) == -1) && (errno != EEXIST) ){
+            free(p_dir);
+            free(*p_tmp);
+            return(NULL);
+        }
+    }
+    free(p_dir);
+
+    int fd = mkstemp(*p_tmp);
+    if( fd == -1 ){
+        free(*p_tmp);
+        return(NULL);
+    }
+    fchmod(fd,0644);
+    FILE* p_fout = fdopen(fd,"w");
+    if( p_fout == NULL ){
+        close(fd);
+        unlink(*p_tmp);
+        free(*p_tmp);
+        return(NULL);
+    }
+    return(p_fout);
+}
+
+/* ============================================================================= */
+
+int vl_cache_commit(FILE* p_fout,char* p_tmp,const char* path)
+{
+    int ret = 0;
+    if( fclose(p_fout) != 0 ){
+        unlink(p_tmp);
+        ret = -1;
+    } else if( rename(p_tmp,path) == -1 ){
+        unlink(p_tmp);
+        ret = -1;
+    }
+    free(p_tmp);
+    return(ret);
+}
+
+/* ============================================================================= */
+
+int vl_cache_save(const struct vl_server* servers,int nservers,const char* path)
+{
+    char* p_tmp;
+    FILE* p_fout = vl_cache_create(path,&p_tmp);
+    if( p_fout == NULL ) return(-1);
+
+    long now = time(NULL);
+
+    /* keep entries of servers not probed now */
+    FILE* p_fin = fopen(path,"r");
+    if( p_fin != NULL ){
+        char line[LINE_MAX];
+        while( fgets(line,sizeof(line),p_fin) != NULL ){
+            char*   addr;
+            long    rtt;
+            long    stamp;
+            if( vl_cache_parse(line,&addr,&rtt,&stamp) != 0 ) continue;
+            if( now - stamp > VL_CACHE_MAX_AGE ) continue;
+            int i;
+            for(i=0; i < nservers; i++){
+                if( (servers[i].rtt != VL_RTT_UNKNOWN) && (strcmp(servers[i].addr,addr) == 0) ) break;
+            }
+            if( i < nservers ) continue;
+            fprintf(p_fout,"%s %ld %ld\n",addr,rtt,stamp);
+        }
+        fclose(p_fin);
+    }
+
+    for(int i=0; i < nservers; i++){
+        if( servers[i].rtt == VL_RTT_UNKNOWN ) continue;
+        fprintf(p_fout,"%s %ld %ld\n",servers[i].addr,servers[i].rtt,now);
+    }
+
+    return(vl_cache_commit(p_fout,p_tmp,path));
+}
+
+/* ============================================================================= */
+
+static int vl_rank(long rtt)
+{
+    if( rtt >= 0 ) return(0);
+    if( rtt == VL_RTT_UNKNOWN ) return(1);
+    return(2);
+}
+
+/* ============================================================================= */
+
+static int vl_cmp(const void* p_a,const void* p_b)
+{
+    const struct vl_server* a = p_a;
+    const struct vl_server* b = p_b;
+
+    int ra = vl_rank(a->rtt);
+    int rb = vl_rank(b->rtt);
+    if( ra != rb ) return(ra - rb);
+    if( (ra == 0) && (a->rtt != b->rtt) ) return( a->rtt < b->rtt ? -1 : 1 );
+    return(a->order - b->order);
+}
+
+/* ============================================================================= */
+
+void vl_sort(struct vl_server* servers,int nservers)
+{
+    qsort(servers,nservers,sizeof(struct vl_server),vl_cmp);
+}
+
+/* ============================================================================= */
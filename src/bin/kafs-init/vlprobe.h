@@ -0,0 +1,84 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+#ifndef __KAFS_VLPROBE_H__
+#define __KAFS_VLPROBE_H__
+
+#include <stdio.h>
+#include <kafs-core.h>
+
+/* ============================================================================= */
+
+#define _PATH_KAFS_USER_VLRTT       _PATH_KAFS_USER_CACHE "vl-rtt"
+#define _PATH_KAFS_USER_VLHOSTS     _PATH_KAFS_USER_CACHE "vl-hosts"
+
+#define VL_PORT                     7003
+#define VL_PROBE_TIMEOUT            500         /* ms */
+#define VL_PROBE_MAX_INFLIGHT       256         /* number of concurrently probed servers */
+#define VL_CACHE_MAX_AGE            (7*86400)   /* s */
+#define VL_RESOLVE_TIMEOUT          2000        /* ms */
+
+/* special RTT values */
+#define VL_RTT_UNKNOWN              -1          /* not probed */
+#define VL_RTT_UNREACHABLE          -2          /* no response */
+
+struct vl_probe_opts {
+    int             tcp;        /* TCP connect instead of Rx version request */
+    int             port;
+    int             timeout;    /* ms */
+};
+
+struct vl_server {
+    const char*     addr;       /* numeric address from CellServDB */
+    long            rtt;        /* us or special RTT value */
+    int             order;      /* position in CellServDB */
+};
+
+struct vl_host {
+    const char*     name;       /* host name from CellServDB */
+    char**          addrs;      /* NULL terminated list of numeric addresses, NULL if not resolved */
+};
+
+/* ============================================================================= */
+
+/* probe servers concurrently and set their RTT, return number of reachable servers,
+ * probing takes at most twice the timeout, servers not probed by then stay VL_RTT_UNKNOWN */
+int vl_probe(struct vl_server* servers,int nservers,const struct vl_probe_opts* opts);
+
+/* set RTT of servers from the cache, unknown and expired entries are ignored */
+int vl_cache_load(struct vl_server* servers,int nservers,const char* path);
+
+/* merge RTT of probed servers into the cache */
+int vl_cache_save(const struct vl_server* servers,int nservers,const char* path);
+
+/* sort servers: measured by RTT, then not probed, then unreachable, otherwise keep CellServDB order */
+void vl_sort(struct vl_server* servers,int nservers);
+
+/* create temporary file for a new cache content, NULL on failure */
+FILE* vl_cache_create(const char* path,char** p_tmp);
+
+/* close and rename the temporary file to the cache, p_tmp is released */
+int vl_cache_commit(FILE* p_fout,char* p_tmp,const char* path);
+
+/* ============================================================================= */
+
+/* is the VL server a numeric IPv4 or IPv6 address? */
+int vl_is_address(const char* addr);
+
+/* resolve host names concurrently within timeout in ms, return number of resolved hosts */
+int vl_resolve(struct vl_host* hosts,int nhosts,int timeout);
+
+/* set addresses of unresolved hosts from the cache */
+int vl_hosts_cache_load(struct vl_host* hosts,int nhosts,const char* path);
+
+/* merge addresses of resolved hosts into the cache */
+int vl_hosts_cache_save(const struct vl_host* hosts,int nhosts,const char* path);
+
+/* release addresses of hosts */
+void vl_free_hosts(struct vl_host* hosts,int nhosts);
+
+/* ============================================================================= */
+
+#endif /* __KAFS_VLPROBE_H__ */
@@ -0,0 +1,287 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * Resolve host names of VL servers.
+ *
+ * All names are resolved at once by getaddrinfo_a() within a global deadline. Results
+ * are cached, the cache is used for names, which cannot be resolved (e.g. DNS is not
+ * reachable at boot yet).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "vlprobe.h"
+
+/* ============================================================================= */
+
+/* the request is owned by the resolver until it is finished or cancelled */
+struct vl_resolve_req {
+    struct gaicb        cb;
+    struct addrinfo     hints;
+    char                name[];
+};
+
+/* ============================================================================= */
+
+int vl_is_address(const char* addr)
+{
+    unsigned char buf[sizeof(struct in6_addr)];
+    return( (inet_pton(AF_INET,addr,buf) == 1) || (inet_pton(AF_INET6,addr,buf) == 1) );
+}
+
+/* ============================================================================= */
+
+/* append address if it is not present yet */
+static int vl_add_addr(char*** p_addrs,int* naddrs,const char* addr)
+{
+    for(int i=0; i < *naddrs; i++){
+        if( strcmp((*p_addrs)[i],addr) == 0 ) return(0);
+    }
+    char** p_new = realloc(*p_addrs,(*naddrs+2)*sizeof(char*));
+    if( p_new == NULL ) return(-1);
+    *p_addrs = p_new;
+    p_new[*naddrs] = strdup(addr);
+    if( p_new[*naddrs] == NULL ) return(-1);
+    (*naddrs)++;
+    p_new[*naddrs] = NULL;
+    return(0);
+}
+
+/* ============================================================================= */
+
+static void vl_free_addrs(char** addrs)
+{
+    if( addrs == NULL ) return;
+    for(char** p_pa = addrs; *p_pa; p_pa++) free(*p_pa);
+    free(addrs);
+}
+
+/* ============================================================================= */
+
+static char** vl_get_addrs(struct addrinfo* res)
+{
+    char**  addrs = NULL;
+    int     naddrs = 0;
+
+    for(struct addrinfo* p_ai = res; p_ai; p_ai = p_ai->ai_next){
+        char        addr[INET6_ADDRSTRLEN];
+        const void* p_src;
+        if( p_ai->ai_family == AF_INET ){
+            p_src = &((struct sockaddr_in*)p_ai->ai_addr)->sin_addr;
+        } else if( p_ai->ai_family == AF_INET6 ){
+            /* link-local addresses cannot be passed to kAFS */
+            if( ((struct sockaddr_in6*)p_ai->ai_addr)->sin6_scope_id != 0 ) continue;
+            p_src = &((struct sockaddr_in6*)p_ai->ai_addr)->sin6_addr;
+        } else {
+            continue;
+        }
+        if( inet_ntop(p_ai->ai_family,p_src,addr,sizeof(addr)) == NULL ) continue;
+        if( vl_add_addr(&addrs,&naddrs,addr) != 0 ){
+            vl_free_addrs(addrs);
+            return(NULL);
+        }
+    }
+    return(addrs);
+}
+
+/* ============================================================================= */
+
+int vl_resolve(struct vl_host* hosts,int nhosts,int timeout)
+{
+    if( nhosts == 0 ) return(0);
+
+    struct gaicb** p_cbs = calloc(nhosts,sizeof(struct gaicb*));
+    if( p_cbs == NULL ) return(0);
+
+    int npending = 0;
+    for(int i=0; i < nhosts; i++){
+        struct vl_resolve_req* p_req = calloc(1,sizeof(struct vl_resolve_req) + strlen(hosts[i].name) + 1);
+        if( p_req == NULL ) continue;
+        strcpy(p_req->name,hosts[i].name);
+        p_req->hints.ai_family      = AF_UNSPEC;
+        p_req->hints.ai_socktype    = SOCK_DGRAM;
+        p_req->cb.ar_name           = p_req->name;
+        p_req->cb.ar_request        = &p_req->hints;
+        p_cbs[i] = &p_req->cb;
+        npending++;
+    }
+
+    /* requests that could not be submitted stay NULL in the list */
+    if( getaddrinfo_a(GAI_NOWAIT,p_cbs,nhosts,NULL) != 0 ){
+        for(int i=0; i < nhosts; i++){
+            if( p_cbs[i] == NULL ) continue;
+            if( gai_error(p_cbs[i]) == EAI_INPROGRESS ) continue;
+            free(p_cbs[i]);
+            p_cbs[i] = NULL;
+            npending--;
+        }
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC,&deadline);
+    deadline.tv_sec  += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000L;
+    if( deadline.tv_nsec >= 1000000000L ){
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    int nresolved = 0;
+    while( npending > 0 ){
+        for(int i=0; i < nhosts; i++){
+            if( (p_cbs[i] == NULL) || (gai_error(p_cbs[i]) == EAI_INPROGRESS) ) continue;
+            if( gai_error(p_cbs[i]) == 0 ){
+                hosts[i].addrs = vl_get_addrs(p_cbs[i]->ar_result);
+                if( hosts[i].addrs != NULL ) nresolved++;
+                freeaddrinfo(p_cbs[i]->ar_result);
+            }
+            free(p_cbs[i]);
+            p_cbs[i] = NULL;
+            npending--;
+        }
+        if( npending == 0 ) break;
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC,&now);
+        struct timespec left;
+        left.tv_sec  = deadline.tv_sec - now.tv_sec;
+        left.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+        if( left.tv_nsec < 0 ){
+            left.tv_sec--;
+            left.tv_nsec += 1000000000L;
+        }
+        if( left.tv_sec < 0 ) break;
+
+        int ret = gai_suspend((const struct gaicb* const*)p_cbs,nhosts,&left);
+        if( (ret != 0) && (ret != EAI_ALLDONE) && (ret != EAI_INTR) ) break;
+    }
+
+    /* deadline expired */
+    for(int i=0; i < nhosts; i++){
+        if( p_cbs[i] == NULL ) continue;
+        int ret = gai_cancel(p_cbs[i]);
+        if( ret == EAI_NOTCANCELED ){
+            /* the lookup is still running and owns the request, it is leaked */
+            continue;
+        }
+        if( (ret == EAI_ALLDONE) && (gai_error(p_cbs[i]) == 0) ){
+            freeaddrinfo(p_cbs[i]->ar_result);
+        }
+        free(p_cbs[i]);
+    }
+
+    free(p_cbs);
+    return(nresolved);
+}
+
+/* ============================================================================= */
+
+/* cache line: name address,address,... timestamp */
+static int vl_hosts_cache_parse(char* line,char** name,char** addrs,long* stamp)
+{
+    char* p_save = NULL;
+    char* p_name  = strtok_r(line," \t\n",&p_save);
+    char* p_addrs = strtok_r(NULL," \t\n",&p_save);
+    char* p_stamp = strtok_r(NULL," \t\n",&p_save);
+    if( (p_name == NULL) || (p_addrs == NULL) || (p_stamp == NULL) ) return(-1);
+
+    *name   = p_name;
+    *addrs  = p_addrs;
+    *stamp  = strtol(p_stamp,NULL,10);
+    return(0);
+}
+
+/* ============================================================================= */
+
+int vl_hosts_cache_load(struct vl_host* hosts,int nhosts,const char* path)
+{
+    FILE* p_f = fopen(path,"r");
+    if( p_f == NULL ) return(-1);
+
+    /* stale addresses are better than none, so entries do not expire */
+    char line[LINE_MAX];
+    while( fgets(line,sizeof(line),p_f) != NULL ){
+        char*   name;
+        char*   addrs;
+        long    stamp;
+        if( vl_hosts_cache_parse(line,&name,&addrs,&stamp) != 0 ) continue;
+        for(int i=0; i < nhosts; i++){
+            if( (hosts[i].addrs != NULL) || (strcmp(hosts[i].name,name) != 0) ) continue;
+            int   naddrs = 0;
+            char* p_save = NULL;
+            for(char* p_addr = strtok_r(addrs,",",&p_save); p_addr; p_addr = strtok_r(NULL,",",&p_save)){
+                if( ! vl_is_address(p_addr) ) continue;
+                if( vl_add_addr(&hosts[i].addrs,&naddrs,p_addr) != 0 ) break;
+            }
+            break;
+        }
+    }
+
+    fclose(p_f);
+    return(0);
+}
+
+/* ============================================================================= */
+
+int vl_hosts_cache_save(const struct vl_host* hosts,int nhosts,const char* path)
+{
+    char* p_tmp;
+    FILE* p_fout = vl_cache_create(path,&p_tmp);
+    if( p_fout == NULL ) return(-1);
+
+    /* keep entries of hosts not resolved now */
+    FILE* p_fin = fopen(path,"r");
+    if( p_fin != NULL ){
+        char line[LINE_MAX];
+        while( fgets(line,sizeof(line),p_fin) != NULL ){
+            char*   name;
+            char*   addrs;
+            long    stamp;
+            if( vl_hosts_cache_parse(line,&name,&addrs,&stamp) != 0 ) continue;
+            int i;
+            for(i=0; i < nhosts; i++){
+                if( (hosts[i].addrs != NULL) && (strcmp(hosts[i].name,name) == 0) ) break;
+            }
+            if( i < nhosts ) continue;
+            fprintf(p_fout,"%s %s %ld\n",name,addrs,stamp);
+        }
+        fclose(p_fin);
+    }
+
+    long now = time(NULL);
+    for(int i=0; i < nhosts; i++){
+        if( (hosts[i].addrs == NULL) || (hosts[i].addrs[0] == NULL) ) continue;
+        fprintf(p_fout,"%s ",hosts[i].name);
+        for(char** p_pa = hosts[i].addrs; *p_pa; p_pa++){
+            fprintf(p_fout,"%s%s",p_pa == hosts[i].addrs ? "" : ",",*p_pa);
+        }
+        fprintf(p_fout," %ld\n",now);
+    }
+
+    return(vl_cache_commit(p_fout,p_tmp,path));
+}
+
+/* ============================================================================= */
+
+void vl_free_hosts(struct vl_host* hosts,int nhosts)
+{
+    for(int i=0; i < nhosts; i++){
+        vl_free_addrs(hosts[i].addrs);
+        hosts[i].addrs = NULL;
+    }
+}
+
+/* ============================================================================= */
@@ -0,0 +1,413 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * Discovery of users, their ccaches and PAGs.
+ *
+ * Users and ccaches are found in /proc/<pid>. Keyrings of other users are not visible
+ * even to root, so PAGs are listed by a helper process running under the user uid,
+ * which reads /proc/keys and contents of the session keyrings named as kAFS-user PAGs.
+ * The daemon reads output of helpers from non-blocking pipes in its main loop.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <limits.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "refreshd.h"
+
+/* ============================================================================= */
+
+#define RD_ENVIRON_MAX      65536
+
+/* AFS token found in /proc/keys */
+struct rd_token {
+    key_serial_t    serial;
+    time_t          expiry;
+};
+
+/* ============================================================================= */
+
+int rd_become_user(uid_t uid)
+{
+    struct passwd   pwd;
+    struct passwd*  p_pw = NULL;
+    char            buf[16384];
+
+    int ret = getpwuid_r(uid,&pwd,buf,sizeof(buf),&p_pw);
+    if( p_pw == NULL ){
+        errno = ret ? ret : ENOENT;
+        return(-1);
+    }
+
+    if( initgroups(p_pw->pw_name,p_pw->pw_gid) != 0 ) return(-1);
+    if( setresgid(p_pw->pw_gid,p_pw->pw_gid,p_pw->pw_gid) != 0 ) return(-1);
+    if( setresuid(uid,uid,uid) != 0 ) return(-1);
+
+    /* paranoia */
+    if( (geteuid() != uid) || (setuid(0) == 0) ){
+        errno = EPERM;
+        return(-1);
+    }
+
+    setenv("HOME",p_pw->pw_dir,1);
+    setenv("USER",p_pw->pw_name,1);
+    setenv("LOGNAME",p_pw->pw_name,1);
+    return(0);
+}
+
+/* ============================================================================= */
+
+/* get KRB5CCNAME from /proc/<pid>/environ, return NULL if it is not set */
+static char* rd_get_ccname(const char* pid)
+{
+    char path[PATH_MAX];
+    snprintf(path,sizeof(path),"/proc/%s/environ",pid);
+
+    int fd = open(path,O_RDONLY|O_CLOEXEC);
+    if( fd == -1 ) return(NULL);
+
+    char*   buf = malloc(RD_ENVIRON_MAX + 1);
+    size_t  len = 0;
+    if( buf != NULL ){
+        ssize_t ret;
+        while( (len < RD_ENVIRON_MAX) && ((ret = read(fd,buf + len,RD_ENVIRON_MAX - len)) > 0) ){
+            len += ret;
+        }
+    }
+    close(fd);
+    if( buf == NULL ) return(NULL);
+    buf[len] = '\0';
+
+    char* ccname = NULL;
+    for(char* p_var = buf; p_var < buf + len; p_var += strlen(p_var) + 1){
+        if( strncmp(p_var,"KRB5CCNAME=",11) == 0 ){
+            ccname = strdup(p_var + 11);
+            break;
+        }
+    }
+    free(buf);
+    return(ccname);
+}
+
+/* ============================================================================= */
+
+int rd_scan_procs(uid_t min_uid,rd_proc_func_t func,void* data)
+{
+    DIR* p_dir = opendir("/proc");
+    if( p_dir == NULL ) return(-1);
+
+    struct dirent* p_de;
+    while( (p_de = readdir(p_dir)) != NULL ){
+        if( (p_de->d_name[0] < '0') || (p_de->d_name[0] > '9') ) continue;
+
+        /* the directory is owned by the effective uid of the process */
+        struct stat st;
+        if( fstatat(dirfd(p_dir),p_de->d_name,&st,0) != 0 ) continue;
+        if( st.st_uid < min_uid ) continue;
+
+        char* ccname = rd_get_ccname(p_de->d_name);
+        func(st.st_uid,ccname,data);
+        free(ccname);
+    }
+
+    closedir(p_dir);
+    return(0);
+}
+
+/* ============================================================================= */
+
+/* convert the timeout column of /proc/keys, which is rounded down to s, m, h, d or w */
+static int rd_parse_timeout(const char* exp,time_t now,time_t* expiry)
+{
+    long    value = 0;
+    char    unit = 0;
+
+    if( strcmp(exp,"perm") == 0 ) return(-1);
+    if( strcmp(exp,"expd") == 0 ){
+        *expiry = now;
+        return(0);
+    }
+    if( sscanf(exp,"%ld%c",&value,&unit) != 2 ) return(-1);
+    switch(unit){
+        case 'w': value *= 7;
+        /* fall through */
+        case 'd': value *= 24;
+        /* fall through */
+        case 'h': value *= 60;
+        /* fall through */
+        case 'm': value *= 60;
+        /* fall through */
+        case 's':
+            *expiry = now + value;
+            return(0);
+    }
+    return(-1);
+}
+
+/* ============================================================================= */
+
+static int rd_cmp_token(const void* p_a,const void* p_b)
+{
+    key_serial_t a = ((const struct rd_token*)p_a)->serial;
+    key_serial_t b = ((const struct rd_token*)p_b)->serial;
+    return( (a > b) - (a < b) );
+}
+
+/* ============================================================================= */
+
+/* list PAGs of the current user, executed in the helper process */
+static void rd_list_pags(FILE* p_fout)
+{
+    FILE* p_fk = fopen(_KAFS_PROC_KEYS,"r");
+    if( p_fk == NULL ) return;
+
+    struct rd_token*    tokens = NULL;
+    size_t              ntokens = 0;
+    size_t              maxtokens = 0;
+    key_serial_t*       pags = NULL;
+    size_t              npags = 0;
+    size_t              maxpags = 0;
+
+    uid_t   uid = getuid();
+    time_t  now = time(NULL);
+    char    line[LINE_MAX];
+
+    /* serial flags usage timeout perm uid gid type description: summary */
+    while( fgets(line,sizeof(line),p_fk) != NULL ){
+        unsigned int    serial;
+        char            exp[32];
+        unsigned int    perm;
+        unsigned int    kuid;
+        char            type[32];
+        char            desc[LINE_MAX];
+        if( sscanf(line,"%x %*s %*s %31s %x %u %*s %31s %[^\n]",&serial,exp,&perm,&kuid,type,desc) != 6 ) continue;
+        if( kuid != uid ) continue;
+
+        if( strcmp(type,_KAFS_KEY_SPEC_RXRPC_TYPE) == 0 ){
+            if( strncmp(desc,"afs@",4) != 0 ) continue;
+            time_t expiry;
+            if( rd_parse_timeout(exp,now,&expiry) != 0 ) continue;
+            if( ntokens == maxtokens ){
+                maxtokens = maxtokens ? 2*maxtokens : 64;
+                struct rd_token* p_new = realloc(tokens,maxtokens*sizeof(struct rd_token));
+                if( p_new == NULL ) break;
+                tokens = p_new;
+            }
+            tokens[ntokens].serial = serial;
+            tokens[ntokens].expiry = expiry;
+            ntokens++;
+        } else if( strcmp(type,"keyring") == 0 ){
+            if( (strncmp(desc,_KAFS_LOCAL_SES_NAME ":",strlen(_KAFS_LOCAL_SES_NAME) + 1) != 0) &&
+                (strncmp(desc,_KAFS_SHARED_SES_NAME ":",strlen(_KAFS_SHARED_SES_NAME) + 1) != 0) ) continue;
+            /* tokens can be added only to PAGs writable by the owner (k_setpag_refreshable) */
+            if( (perm & (KEY_USR_WRITE | KEY_USR_SEARCH)) != (KEY_USR_WRITE | KEY_USR_SEARCH) ) continue;
+            if( npags == maxpags ){
+                maxpags = maxpags ? 2*maxpags : 64;
+                key_serial_t* p_new = realloc(pags,maxpags*sizeof(key_serial_t));
+                if( p_new == NULL ) break;
+                pags = p_new;
+            }
+            pags[npags++] = serial;
+        }
+    }
+    fclose(p_fk);
+
+    qsort(tokens,ntokens,sizeof(struct rd_token),rd_cmp_token);
+
+    for(size_t i=0; i < npags; i++){
+        key_serial_t*   keys;
+        long            len = keyctl_read_alloc(pags[i],(void**)&keys);
+        if( len < 0 ) continue;
+
+        int     count = 0;
+        time_t  expiry = 0;
+        for(long k=0; k < len / (long)sizeof(key_serial_t); k++){
+            struct rd_token     key = { keys[k], 0 };
+            struct rd_token*    p_tk = bsearch(&key,tokens,ntokens,sizeof(struct rd_token),rd_cmp_token);
+            if( p_tk == NULL ) continue;
+            if( (count == 0) || (p_tk->expiry < expiry) ) expiry = p_tk->expiry;
+            count++;
+        }
+        free(keys);
+
+        if( count > 0 ){
+            fprintf(p_fout,"%d %d %ld\n",pags[i],count,(long)expiry);
+        }
+    }
+
+    free(tokens);
+    free(pags);
+}
+
+/* ============================================================================= */
+
+int rd_scan_start(struct rd_scan* scan,uid_t uid)
+{
+    int fds[2];
+    if( pipe2(fds,O_CLOEXEC) != 0 ) return(-1);
+
+    /* the daemon must not wait for the helper, the write end stays blocking */
+    if( fcntl(fds[0],F_SETFL,O_NONBLOCK) != 0 ){
+        close(fds[0]);
+        close(fds[1]);
+        return(-1);
+    }
+
+    /* the child must not repeat buffered debug output */
+    kafs_flush_log();
+
+    pid_t pid = fork();
+    if( pid == -1 ){
+        close(fds[0]);
+        close(fds[1]);
+        return(-1);
+    }
+
+    if( pid == 0 ){
+        struct sigaction sa;
+        memset(&sa,0,sizeof(sa));
+        sa.sa_handler = SIG_DFL;
+        sigaction(SIGTERM,&sa,NULL);
+        sigaction(SIGINT,&sa,NULL);
+        sigaction(SIGHUP,&sa,NULL);
+        sigaction(SIGUSR1,&sa,NULL);
+        sigaction(SIGCHLD,&sa,NULL);
+
+        sigset_t set;
+        sigemptyset(&set);
+        sigprocmask(SIG_SETMASK,&set,NULL);
+        alarm(RD_SCAN_TIMEOUT);
+
+        close(fds[0]);
+        if( rd_become_user(uid) != 0 ) _exit(1);
+        FILE* p_fout = fdopen(fds[1],"w");
+        if( p_fout == NULL ) _exit(1);
+        rd_list_pags(p_fout);
+        kafs_flush_log();
+        _exit( fclose(p_fout) == 0 ? 0 : 1 );
+    }
+
+    close(fds[1]);
+
+    memset(scan,0,sizeof(struct rd_scan));
+    scan->pid = pid;
+    scan->fd  = fds[0];
+    scan->uid = uid;
+    return(0);
+}
+
+/* ============================================================================= */
+
+int rd_scan_read(struct rd_scan* scan,rd_pag_func_t func,void* data)
+{
+    for(;;){
+        ssize_t ret = read(scan->fd,scan->line + scan->len,sizeof(scan->line) - 1 - scan->len);
+        if( ret == -1 ){
+            if( errno == EINTR ) continue;
+            if( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) return(0);
+            break;
+        }
+        if( ret == 0 ) break;
+        scan->len += ret;
+        scan->line[scan->len] = '\0';
+
+        /* complete lines */
+        char* p_line = scan->line;
+        char* p_eol;
+        while( (p_eol = strchr(p_line,'\n')) != NULL ){
+            *p_eol = '\0';
+            int     serial;
+            int     ntokens;
+            long    expiry;
+            if( sscanf(p_line,"%d %d %ld",&serial,&ntokens,&expiry) == 3 ){
+                func(scan->uid,serial,ntokens,expiry,data);
+            }
+            p_line = p_eol + 1;
+        }
+        scan->len -= p_line - scan->line;
+        memmove(scan->line,p_line,scan->len);
+
+        /* too long line, the helper output is broken */
+        if( scan->len == sizeof(scan->line) - 1 ) break;
+    }
+
+    /* end of output, the helper is finishing or it was killed by its alarm */
+    close(scan->fd);
+    scan->fd = -1;
+
+    int status;
+    while( waitpid(scan->pid,&status,0) == -1 ){
+        if( errno != EINTR ) return(-1);
+    }
+    scan->pid = 0;
+    if( ! WIFEXITED(status) || (WEXITSTATUS(status) != 0) ){
+        errno = ECHILD;
+        return(-1);
+    }
+    return(1);
+}
+
+/* ============================================================================= */
+
+int rd_read_pag(key_serial_t serial,char*** cells)
+{
+    key_serial_t*   keys;
+    long            len = keyctl_read_alloc(serial,(void**)&keys);
+    if( len < 0 ) return(-1);
+
+    long    nkeys = len / (long)sizeof(key_serial_t);
+    char**  descs = calloc(nkeys + 1,sizeof(char*));
+    char**  names = calloc(nkeys + 1,sizeof(char*));
+    if( (descs == NULL) || (names == NULL) ){
+        free(descs);
+        free(names);
+        free(keys);
+        errno = ENOMEM;
+        return(-1);
+    }
+
+    /* type;uid;gid;perm;description */
+    int ncells = 0;
+    for(long k=0; k < nkeys; k++){
+        char* desc;
+        if( keyctl_describe_alloc(keys[k],&desc) < 0 ) continue;
+        char* p_desc = strrchr(desc,';');
+        if( (strncmp(desc,_KAFS_KEY_SPEC_RXRPC_TYPE ";",strlen(_KAFS_KEY_SPEC_RXRPC_TYPE) + 1) == 0) &&
+            (p_desc != NULL) && (strncmp(p_desc + 1,"afs@",4) == 0) ){
+            descs[ncells] = desc;
+            names[ncells] = p_desc + 5;
+            ncells++;
+            continue;
+        }
+        free(desc);
+    }
+    free(keys);
+
+    /* the list is one block as returned by kafs_get_these_cells */
+    *cells = kafs_dup_list(names,ncells);
+    for(int i=0; i < ncells; i++) free(descs[i]);
+    free(descs);
+    free(names);
+
+    if( *cells == NULL ){
+        errno = ENOMEM;
+        return(-1);
+    }
+    return(ncells);
+}
+
+/* ============================================================================= */
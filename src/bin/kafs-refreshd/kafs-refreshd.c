@@ -0,0 +1,806 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * Node-wide refresh of AFS tokens in PAGs.
+ *
+ * PAGs holding AFS tokens are periodically discovered, each one gets a timer set shortly
+ * before its earliest token expires. Timers are kept in a hashed timer wheel, expired
+ * ones are moved into a FIFO queue, which is served by a bounded pool of worker
+ * processes. Starts of workers are limited by a token bucket charged with the number
+ * of AFS tokens of the PAG, i.e. the number of afs/<cell> tickets requested from KDC.
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <krb5.h>
+
+#include "refreshd.h"
+
+/* ========================================================================== */
+
+int              verbose        = 0;
+long             lead           = RD_DEF_LEAD;
+long             scan_interval  = RD_DEF_SCAN;
+int              nworkers       = RD_DEF_WORKERS;
+double           rate           = RD_DEF_RATE;
+double           burst          = 0;
+uid_t            min_uid        = RD_DEF_MIN_UID;
+const char*      stats_path     = _PATH_KAFS_REFRESHD_STATS;
+
+volatile sig_atomic_t   terminate   = 0;
+volatile sig_atomic_t   rescan      = 0;
+volatile sig_atomic_t   report      = 0;
+
+struct option longopts[] = {
+   { "lead",            required_argument, NULL,     'l' },
+   { "scan-interval",   required_argument, NULL,     's' },
+   { "workers",         required_argument, NULL,     'w' },
+   { "rate",            required_argument, NULL,     'r' },
+   { "burst",           required_argument, NULL,     'b' },
+   { "min-uid",         required_argument, NULL,     'u' },
+   { "stats",           required_argument, NULL,     'S' },
+   { 0, 0, 0, 0 }
+};
+
+/* ========================================================================== */
+
+#define USER_BUCKETS    1024
+#define PAG_BUCKETS     8192
+
+struct worker {
+    pid_t           pid;        /* 0 if the slot is free */
+    int             fd;         /* result pipe */
+    struct rd_pag*  pag;
+};
+
+struct rd_user*     users[USER_BUCKETS];
+struct rd_pag*      pags[PAG_BUCKETS];
+unsigned            generation  = 0;
+unsigned long       nusers      = 0;
+unsigned long       npags       = 0;
+
+struct tw_wheel     wheel;
+
+struct rd_pag*      queue_head  = NULL;
+struct rd_pag*      queue_tail  = NULL;
+unsigned long       queue_len   = 0;
+
+struct worker*      workers     = NULL;
+int                 nrunning    = 0;
+
+struct rd_scan      scans[RD_MAX_SCANS];
+int                 nscans      = 0;
+int                 discovering = 0;    /* PAGs of users are being listed */
+int                 scan_bucket = 0;    /* the next user to be scanned */
+struct rd_user*     scan_user   = NULL;
+
+double              bucket      = 0;    /* available KDC requests */
+long                bucket_time = 0;    /* ms, the last refill */
+
+/* counters reported in the stats file */
+unsigned long       refreshed   = 0;
+unsigned long       failed      = 0;
+unsigned long       dropped     = 0;
+unsigned long       throttled   = 0;
+long                last_lag    = 0;    /* ms */
+long                max_lag     = 0;    /* ms */
+
+/* ========================================================================== */
+
+void print_usage(void)
+{
+    printf("\n");
+    printf("Refresh AFS tokens in PAGs of all users on the node before they expire.\n");
+    printf("\n");
+    printf("Usage: kafs-refreshd [-vdh] [-l S] [-s S] [-w N] [-r N] [-b N] [-u UID] [-S FILE]\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("   -h   Print this help.\n");
+    printf("   -v   Print kAFS-user version.\n");
+    printf("   -d   Be more verbose.\n");
+    printf("   -l   Refresh tokens this number of seconds before they expire (--lead, default: %d).\n",RD_DEF_LEAD);
+    printf("   -s   Interval of PAG discovery in seconds (--scan-interval, default: %d).\n",RD_DEF_SCAN);
+    printf("        SIGHUP forces the discovery.\n");
+    printf("   -w   Number of concurrently refreshed PAGs (--workers, default: %d).\n",RD_DEF_WORKERS);
+    printf("   -r   Maximum rate of KDC requests per second (--rate, default: %d).\n",RD_DEF_RATE);
+    printf("   -b   Maximum burst of KDC requests (--burst, default: the rate).\n");
+    printf("   -u   Ignore users with lower uid (--min-uid, default: %d).\n",RD_DEF_MIN_UID);
+    printf("   -S   Statistics in the Prometheus text format (--stats, default: %s).\n",_PATH_KAFS_REFRESHD_STATS);
+    printf("        SIGUSR1 prints them to the standard output.\n");
+    printf("\n");
+}
+
+/* ========================================================================== */
+
+long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return(ts.tv_sec*1000 + ts.tv_nsec/1000000);
+}
+
+/* ========================================================================== */
+
+void handle_signal(int signum)
+{
+    switch(signum){
+        case SIGHUP:
+            rescan = 1;
+            break;
+        case SIGUSR1:
+            report = 1;
+            break;
+        case SIGCHLD:
+            /* only interrupts ppoll */
+            break;
+        default:
+            terminate = 1;
+            break;
+    }
+}
+
+/* ========================================================================== */
+
+struct rd_user* find_user(uid_t uid)
+{
+    for(struct rd_user* p_user = users[uid % USER_BUCKETS]; p_user; p_user = p_user->next){
+        if( p_user->uid == uid ) return(p_user);
+    }
+    return(NULL);
+}
+
+/* ========================================================================== */
+
+void free_ccnames(struct rd_user* p_user)
+{
+    for(int i=0; p_user->ccnames[i]; i++){
+        free(p_user->ccnames[i]);
+        p_user->ccnames[i] = NULL;
+    }
+}
+
+/* ========================================================================== */
+
+struct rd_pag* find_pag(key_serial_t serial)
+{
+    for(struct rd_pag* p_pag = pags[(unsigned)serial % PAG_BUCKETS]; p_pag; p_pag = p_pag->next){
+        if( p_pag->serial == serial ) return(p_pag);
+    }
+    return(NULL);
+}
+
+/* ========================================================================== */
+
+void free_pag(struct rd_pag* p_pag)
+{
+    struct rd_pag** pp_pag = &pags[(unsigned)p_pag->serial % PAG_BUCKETS];
+    while( *pp_pag != p_pag ) pp_pag = &(*pp_pag)->next;
+    *pp_pag = p_pag->next;
+
+    tw_del(&wheel,&p_pag->timer);
+    free(p_pag);
+    npags--;
+}
+
+/* ========================================================================== */
+
+/* plan the refresh at the wall clock time */
+void schedule_pag(struct rd_pag* p_pag,time_t when)
+{
+    long now = now_ms();
+    long due = now + (when - time(NULL))*1000;
+    if( due < now ) due = now;
+
+    p_pag->state = RD_PAG_IDLE;
+    p_pag->due   = due;
+    tw_add(&wheel,&p_pag->timer,(due + RD_TICK_MS - 1) / RD_TICK_MS);
+}
+
+/* ========================================================================== */
+
+/* plan the next attempt after a failure with exponential backoff */
+void retry_pag(struct rd_pag* p_pag)
+{
+    long retry = RD_MAX_RETRY;
+    if( p_pag->failures < 16 ){
+        retry = (long)RD_DEF_RETRY << p_pag->failures;
+        if( retry > RD_MAX_RETRY ) retry = RD_MAX_RETRY;
+    }
+    p_pag->failures++;
+    schedule_pag(p_pag,time(NULL) + retry);
+}
+
+/* ========================================================================== */
+
+void expire_pag(struct tw_timer* p_timer,void* data)
+{
+    struct rd_pag* p_pag = (struct rd_pag*)p_timer;
+
+    p_pag->state = RD_PAG_QUEUED;
+    p_pag->qnext = NULL;
+    if( queue_tail ){
+        queue_tail->qnext = p_pag;
+    } else {
+        queue_head = p_pag;
+    }
+    queue_tail = p_pag;
+    queue_len++;
+}
+
+/* ========================================================================== */
+
+void dequeue_pag(struct rd_pag* p_pag)
+{
+    struct rd_pag*  p_prev = NULL;
+    for(struct rd_pag* p_item = queue_head; p_item; p_item = p_item->qnext){
+        if( p_item != p_pag ){
+            p_prev = p_item;
+            continue;
+        }
+        if( p_prev ){
+            p_prev->qnext = p_pag->qnext;
+        } else {
+            queue_head = p_pag->qnext;
+        }
+        if( queue_tail == p_pag ) queue_tail = p_prev;
+        queue_len--;
+        break;
+    }
+    p_pag->qnext = NULL;
+}
+
+/* ========================================================================== */
+
+void found_proc(uid_t uid,const char* ccname,void* data)
+{
+    struct rd_user* p_user = find_user(uid);
+    if( p_user == NULL ){
+        p_user = calloc(1,sizeof(struct rd_user));
+        if( p_user == NULL ) return;
+        p_user->uid = uid;
+        p_user->next = users[uid % USER_BUCKETS];
+        users[uid % USER_BUCKETS] = p_user;
+        nusers++;
+    }
+    if( p_user->generation != generation ){
+        free_ccnames(p_user);
+        p_user->generation = generation;
+    }
+
+    /* session, process, and thread keyrings of other processes are not reachable */
+    if( (ccname == NULL) || (strncmp(ccname,"MEMORY:",7) == 0) ||
+        ((strncmp(ccname,"KEYRING:",8) == 0) && (strncmp(ccname,"KEYRING:persistent:",19) != 0)) ) return;
+
+    int i;
+    for(i=0; p_user->ccnames[i]; i++){
+        if( strcmp(p_user->ccnames[i],ccname) == 0 ) return;
+    }
+    if( i < RD_MAX_CCACHES ){
+        p_user->ccnames[i] = strdup(ccname);
+    }
+}
+
+/* ========================================================================== */
+
+/* /proc/keys rounds the remaining time down to s, m, h, d or w,
+   so the expiry of discovered tokens is known only with this precision */
+long expiry_precision(time_t expiry)
+{
+    long left = expiry - time(NULL);
+    if( left < 60 ) return(1);
+    if( left < 3600 ) return(60);
+    if( left < 86400 ) return(3600);
+    if( left < 7*86400 ) return(86400);
+    return(7*86400);
+}
+
+/* ========================================================================== */
+
+void found_pag(uid_t uid,key_serial_t serial,int ntokens,time_t expiry,void* data)
+{
+    struct rd_pag* p_pag = find_pag(serial);
+    if( p_pag == NULL ){
+        p_pag = calloc(1,sizeof(struct rd_pag));
+        if( p_pag == NULL ) return;
+        p_pag->serial   = serial;
+        p_pag->uid      = uid;
+        p_pag->expiry   = expiry;
+        p_pag->next     = pags[(unsigned)serial % PAG_BUCKETS];
+        pags[(unsigned)serial % PAG_BUCKETS] = p_pag;
+        npags++;
+        schedule_pag(p_pag,expiry - lead);
+        if( verbose ){
+            printf("new PAG %d (uid: %u, tokens: %d, expires in %ld s)\n",serial,uid,ntokens,(long)(expiry - time(NULL)));
+        }
+    } else if( (p_pag->state == RD_PAG_IDLE) && (expiry > p_pag->expiry + expiry_precision(expiry)) ){
+        /* tokens were renewed by the user, e.g. by afslog.kafs */
+        p_pag->expiry   = expiry;
+        p_pag->failures = 0;
+        schedule_pag(p_pag,expiry - lead);
+    }
+    p_pag->ntokens      = ntokens;
+    p_pag->generation   = generation;
+}
+
+/* ========================================================================== */
+
+/* keep PAGs of the user, whose keyrings were not listed */
+void keep_pags(uid_t uid)
+{
+    for(int i=0; i < PAG_BUCKETS; i++){
+        for(struct rd_pag* p_pag = pags[i]; p_pag; p_pag = p_pag->next){
+            if( p_pag->uid == uid ) p_pag->generation = generation;
+        }
+    }
+}
+
+/* ========================================================================== */
+
+/* find users and their ccaches, PAGs are then listed incrementally by scan_users() */
+void discover(void)
+{
+    generation++;
+
+    if( rd_scan_procs(min_uid,found_proc,NULL) != 0 ){
+        warn("Unable to list processes");
+        return;
+    }
+
+    for(int b=0; b < USER_BUCKETS; b++){
+        struct rd_user** pp_user = &users[b];
+        while( *pp_user ){
+            struct rd_user* p_user = *pp_user;
+            if( p_user->generation != generation ){
+                /* no processes */
+                *pp_user = p_user->next;
+                free_ccnames(p_user);
+                free(p_user);
+                nusers--;
+                continue;
+            }
+            pp_user = &p_user->next;
+        }
+    }
+
+    /* users are not released until the discovery is finished */
+    discovering = 1;
+    scan_bucket = 0;
+    scan_user   = users[0];
+}
+
+/* ========================================================================== */
+
+/* forget PAGs without tokens or users, the running ones are handled when finished */
+void finish_discovery(void)
+{
+    discovering = 0;
+
+    for(int b=0; b < PAG_BUCKETS; b++){
+        struct rd_pag* p_pag = pags[b];
+        while( p_pag ){
+            struct rd_pag* p_next = p_pag->next;
+            if( (p_pag->generation != generation) && (p_pag->state != RD_PAG_RUNNING) ){
+                if( verbose ){
+                    printf("PAG %d is gone\n",p_pag->serial);
+                }
+                if( p_pag->state == RD_PAG_QUEUED ) dequeue_pag(p_pag);
+                free_pag(p_pag);
+                dropped++;
+            }
+            p_pag = p_next;
+        }
+    }
+}
+
+/* ========================================================================== */
+
+/* read output of running helpers and start helpers for further users,
+   the main loop is never blocked by slow keyrings of one user */
+void scan_users(void)
+{
+    for(int i=0; i < RD_MAX_SCANS; i++){
+        if( scans[i].pid == 0 ) continue;
+        int ret = rd_scan_read(&scans[i],found_pag,NULL);
+        if( ret == 0 ) continue;
+        if( ret == -1 ){
+            if( verbose ){
+                printf("unable to list PAGs of uid %u\n",scans[i].uid);
+            }
+            keep_pags(scans[i].uid);
+        }
+        nscans--;
+    }
+
+    if( ! discovering ) return;
+
+    while( nscans < RD_MAX_SCANS ){
+        while( (scan_user == NULL) && (++scan_bucket < USER_BUCKETS) ) scan_user = users[scan_bucket];
+        if( scan_user == NULL ) break;
+
+        int i;
+        for(i=0; scans[i].pid != 0; i++);
+        if( rd_scan_start(&scans[i],scan_user->uid) != 0 ){
+            warn("Unable to start helper for uid %u",scan_user->uid);
+            keep_pags(scan_user->uid);
+        } else {
+            nscans++;
+        }
+        scan_user = scan_user->next;
+    }
+
+    if( (scan_user == NULL) && (nscans == 0) ) finish_discovery();
+}
+
+/* ========================================================================== */
+
+/* refill the bucket, return ms until cost is available */
+long refill_bucket(long now,double cost)
+{
+    bucket += (now - bucket_time) * rate / 1000.0;
+    if( bucket > burst ) bucket = burst;
+    bucket_time = now;
+
+    if( bucket >= cost ) return(0);
+    return( (long)((cost - bucket) * 1000.0 / rate) + 1 );
+}
+
+/* ========================================================================== */
+
+/* start workers for queued PAGs, return ms until the bucket allows the next one or -1 */
+long dispatch(void)
+{
+    while( queue_head && (nrunning < nworkers) ){
+        struct rd_pag* p_pag = queue_head;
+        long now = now_ms();
+
+        /* larger PAGs must not be starved */
+        double cost = p_pag->ntokens > 0 ? p_pag->ntokens : 1;
+        if( cost > burst ) cost = burst;
+        long wait = refill_bucket(now,cost);
+        if( wait > 0 ){
+            throttled++;
+            return(wait);
+        }
+
+        struct rd_user* p_user = find_user(p_pag->uid);
+        char*           nocc[1] = { NULL };
+
+        int   w;
+        for(w=0; workers[w].pid != 0; w++);
+        int   fd;
+        pid_t pid = rd_refresh_start(p_pag,p_user ? p_user->ccnames : nocc,&fd);
+
+        dequeue_pag(p_pag);
+        if( pid == -1 ){
+            warn("Unable to start worker for PAG %d",p_pag->serial);
+            retry_pag(p_pag);
+            continue;
+        }
+
+        bucket -= cost;
+        last_lag = now - p_pag->due;
+        if( last_lag > max_lag ) max_lag = last_lag;
+
+        p_pag->state    = RD_PAG_RUNNING;
+        workers[w].pid  = pid;
+        workers[w].fd   = fd;
+        workers[w].pag  = p_pag;
+        nrunning++;
+    }
+    return(-1);
+}
+
+/* ========================================================================== */
+
+void finish_pag(struct rd_pag* p_pag,const struct rd_result* p_res)
+{
+    if( p_res->status == -1 ){
+        if( verbose ){
+            printf("PAG %d is gone\n",p_pag->serial);
+        }
+        free_pag(p_pag);
+        dropped++;
+        return;
+    }
+
+    time_t now = time(NULL);
+    if( (p_res->status == 0) && (p_res->expiry - lead > now) ){
+        if( verbose ){
+            printf("PAG %d refreshed (uid: %u, tokens: %d, expires in %ld s)\n",
+                   p_pag->serial,p_pag->uid,p_res->nok,(long)(p_res->expiry - now));
+        }
+        refreshed++;
+        p_pag->expiry   = p_res->expiry;
+        p_pag->failures = 0;
+        schedule_pag(p_pag,p_res->expiry - lead);
+        return;
+    }
+
+    /* failed, or the user TGT was not renewed, so the tokens were not extended */
+    if( verbose ){
+        printf("PAG %d not refreshed (uid: %u, status: %d, tokens: %d/%d)\n",
+               p_pag->serial,p_pag->uid,p_res->status,p_res->nok,p_res->nok + p_res->nfailed);
+    }
+    failed++;
+    if( p_res->expiry > p_pag->expiry ) p_pag->expiry = p_res->expiry;
+    retry_pag(p_pag);
+}
+
+/* ========================================================================== */
+
+void reap_workers(void)
+{
+    for(int w=0; w < nworkers; w++){
+        if( workers[w].pid == 0 ) continue;
+
+        int status;
+        if( waitpid(workers[w].pid,&status,WNOHANG) <= 0 ) continue;
+
+        struct rd_result result;
+        memset(&result,0,sizeof(result));
+        if( rd_refresh_result(workers[w].fd,&result) != 0 ){
+            result.status = 1;
+        }
+        close(workers[w].fd);
+
+        struct rd_pag* p_pag = workers[w].pag;
+        workers[w].pid = 0;
+        workers[w].pag = NULL;
+        nrunning--;
+
+        /* the PAG was not found by the last finished discovery */
+        if( ! discovering && (p_pag->generation != generation) ) result.status = -1;
+
+        finish_pag(p_pag,&result);
+    }
+}
+
+/* ========================================================================== */
+
+void print_stats(FILE* p_fout)
+{
+    long lag = queue_head ? now_ms() - queue_head->due : 0;
+
+    fprintf(p_fout,"# HELP kafs_refreshd_users Users with processes.\n");
+    fprintf(p_fout,"# TYPE kafs_refreshd_users gauge\n");
+    fprintf(p_fout,"kafs_refreshd_users %lu\n",nusers);
+    fprintf(p_fout,"# HELP kafs_refreshd_pags PAGs with AFS tokens.\n");
+    fprintf(p_fout,"# TYPE kafs_refreshd_pags gauge\n");
+    fprintf(p_fout,"kafs_refreshd_pags %lu\n",npags);
+    fprintf(p_fout,"# HELP kafs_refreshd_timers Planned refreshes.\n");
+    fprintf(p_fout,"# TYPE kafs_refreshd_timers gauge\n");
+    fprintf(p_fout,"kafs_refreshd_timers %lu\n",wheel.count);
+    fprintf(p_fout,"# HELP kafs_refreshd_queue_depth PAGs waiting for a worker.\n");
+    fprintf(p_fout,"# TYPE kafs_refreshd_queue_depth gauge\n");
+    fprintf(p_fout,"kafs_refreshd_queue_depth %lu\n",queue_len);
+    fprintf(p_fout,"# HELP kafs_refreshd_running PAGs being refreshed.\n");
+    fprintf(p_fout,"# TYPE kafs_refreshd_running gauge\n");
+    fprintf(p_fout,"kafs_refreshd_running %d\n",nrunning);
+    fprintf(p_fout,"# HELP kafs_refreshd_lag_seconds Delay of the oldest queued refresh.\n");
+    fprintf(p_fout,"# TYPE kafs_refreshd_lag_seconds gauge\n");
+    fprintf(p_fout,"kafs_refreshd_lag_seconds %.3f\n",lag/1000.0);
+    fprintf(p_fout,"# HELP kafs_refreshd_last_lag_seconds Delay of the last started refresh.\n");
+    fprintf(p_fout,"# TYPE kafs_refreshd_last_lag_seconds gauge\n");
+    fprintf(p_fout,"kafs_refreshd_last_lag_seconds %.3f\n",last_lag/1000.0);
+    fprintf(p_fout,"# HELP kafs_refreshd_max_lag_seconds The longest delay of a started refresh.\n");
+    fprintf(p_fout,"# TYPE kafs_refreshd_max_lag_seconds gauge\n");
+    fprintf(p_fout,"kafs_refreshd_max_lag_seconds %.3f\n",max_lag/1000.0);
+    fprintf(p_fout,"# HELP kafs_refreshd_refreshed_total Successful PAG refreshes.\n");
+    fprintf(p_fout,"# TYPE kafs_refreshd_refreshed_total counter\n");
+    fprintf(p_fout,"kafs_refreshd_refreshed_total %lu\n",refreshed);
+    fprintf(p_fout,"# HELP kafs_refreshd_failed_total Failed PAG refreshes.\n");
+    fprintf(p_fout,"# TYPE kafs_refreshd_failed_total counter\n");
+    fprintf(p_fout,"kafs_refreshd_failed_total %lu\n",failed);
+    fprintf(p_fout,"# HELP kafs_refreshd_dropped_total PAGs, which disappeared.\n");
+    fprintf(p_fout,"# TYPE kafs_refreshd_dropped_total counter\n");
+    fprintf(p_fout,"kafs_refreshd_dropped_total %lu\n",dropped);
+    fprintf(p_fout,"# HELP kafs_refreshd_throttled_total Refreshes delayed by the KDC rate limit.\n");
+    fprintf(p_fout,"# TYPE kafs_refreshd_throttled_total counter\n");
+    fprintf(p_fout,"kafs_refreshd_throttled_total %lu\n",throttled);
+}
+
+/* ========================================================================== */
+
+/* the file is replaced atomically, so collectors never read it partially */
+void write_stats(void)
+{
+    char tmp[PATH_MAX];
+    if( snprintf(tmp,sizeof(tmp),"%s.tmp",stats_path) >= (int)sizeof(tmp) ) return;
+
+    FILE* p_fout = fopen(tmp,"we");
+    if( p_fout == NULL ) return;
+    print_stats(p_fout);
+    if( fclose(p_fout) != 0 ){
+        unlink(tmp);
+        return;
+    }
+    if( rename(tmp,stats_path) != 0 ) unlink(tmp);
+}
+
+/* ========================================================================== */
+
+void stop_workers(void)
+{
+    for(int i=0; i < RD_MAX_SCANS; i++){
+        if( scans[i].pid == 0 ) continue;
+        kill(scans[i].pid,SIGTERM);
+        waitpid(scans[i].pid,NULL,0);
+        close(scans[i].fd);
+        scans[i].pid = 0;
+    }
+    nscans = 0;
+
+    for(int w=0; w < nworkers; w++){
+        if( workers[w].pid == 0 ) continue;
+        kill(workers[w].pid,SIGTERM);
+        waitpid(workers[w].pid,NULL,0);
+        close(workers[w].fd);
+        workers[w].pid = 0;
+    }
+    nrunning = 0;
+}
+
+/* ========================================================================== */
+
+void run(void)
+{
+    sigset_t set;
+    sigset_t oldset;
+    sigemptyset(&set);
+    sigaddset(&set,SIGTERM);
+    sigaddset(&set,SIGINT);
+    sigaddset(&set,SIGHUP);
+    sigaddset(&set,SIGUSR1);
+    sigaddset(&set,SIGCHLD);
+    sigprocmask(SIG_BLOCK,&set,&oldset);
+
+    /* signals are delivered only within ppoll */
+    struct sigaction sa;
+    memset(&sa,0,sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM,&sa,NULL);
+    sigaction(SIGINT,&sa,NULL);
+    sigaction(SIGHUP,&sa,NULL);
+    sigaction(SIGUSR1,&sa,NULL);
+    sigaction(SIGCHLD,&sa,NULL);
+
+    long now = now_ms();
+    if( tw_init(&wheel,RD_WHEEL_SLOTS,now / RD_TICK_MS) != 0 ) errx(1, "Unable to allocate timer wheel");
+    workers = calloc(nworkers,sizeof(struct worker));
+    if( workers == NULL ) errx(1, "Unable to allocate workers");
+
+    bucket      = burst;
+    bucket_time = now;
+
+    long next_scan = now;
+    while( ! terminate ){
+        now = now_ms();
+        /* the next discovery is started only after the previous one is finished */
+        if( (rescan || (now >= next_scan)) && ! discovering ){
+            rescan = 0;
+            discover();
+            now = now_ms();
+            next_scan = now + scan_interval*1000;
+        }
+        scan_users();
+
+        reap_workers();
+        unsigned long tick = now / RD_TICK_MS;
+        if( tick > wheel.now ){
+            tw_advance(&wheel,tick,expire_pag,NULL);
+            write_stats();
+        }
+        long wait = dispatch();
+
+        if( report ){
+            report = 0;
+            print_stats(stdout);
+            fflush(stdout);
+        }
+
+        /* sleep until the next tick, the bucket refill, output of helpers, or a signal */
+        long timeout = (tick + 1) * RD_TICK_MS - now_ms();
+        if( (wait >= 0) && (wait < timeout) ) timeout = wait;
+        if( timeout < 0 ) timeout = 0;
+
+        struct pollfd   fds[RD_MAX_SCANS];
+        nfds_t          nfds = 0;
+        for(int i=0; i < RD_MAX_SCANS; i++){
+            if( scans[i].pid == 0 ) continue;
+            fds[nfds].fd      = scans[i].fd;
+            fds[nfds].events  = POLLIN;
+            fds[nfds].revents = 0;
+            nfds++;
+        }
+
+        struct timespec ts;
+        ts.tv_sec  = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000L;
+        ppoll(fds,nfds,&ts,&oldset);
+    }
+
+    stop_workers();
+    tw_free(&wheel);
+    free(workers);
+    unlink(stats_path);
+}
+
+/* ========================================================================== */
+
+int main(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt_long(argc, argv, "hvdl:s:w:r:b:u:S:", longopts, NULL)) != -1) {
+        switch (c) {
+            case 'h':
+                print_usage();
+                return(0);
+            case '?':
+            default:
+                print_usage();
+                return(1);
+            case 'v':
+                kafs_print_version(NULL);
+                return(0);
+            case 'd':
+                verbose = 1;
+                kafs_set_verbose(1);
+                break;
+            case 'l':
+                lead = atol(optarg);
+                if( lead <= 0 ) errx(1, "Lead time must be positive");
+                break;
+            case 's':
+                scan_interval = atol(optarg);
+                if( scan_interval <= 0 ) errx(1, "Scan interval must be positive");
+                break;
+            case 'w':
+                nworkers = atoi(optarg);
+                if( nworkers <= 0 ) errx(1, "Number of workers must be positive");
+                break;
+            case 'r':
+                rate = atof(optarg);
+                if( rate <= 0 ) errx(1, "Rate must be positive");
+                break;
+            case 'b':
+                burst = atof(optarg);
+                if( burst < 1 ) errx(1, "Burst must be at least one");
+                break;
+            case 'u':
+                min_uid = atol(optarg);
+                break;
+            case 'S':
+                stats_path = optarg;
+                break;
+        }
+    }
+
+    if( burst == 0 ) burst = rate < 1 ? 1 : rate;
+
+    if( geteuid() != 0 ) errx(1, "kafs-refreshd must be started by root");
+    if( ! k_hasafs() ) errx(1, "AFS does not seem to be present on this machine");
+
+    /* debug messages of workers */
+    setvbuf(stdout,NULL,_IOLBF,0);
+
+    run();
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+#ifndef __KAFS_REFRESHD_H__
+#define __KAFS_REFRESHD_H__
+
+#include <sys/types.h>
+#include <time.h>
+#include <krb5.h>
+#include <kafs-user.h>
+
+#include "timerwheel.h"
+
+/* ============================================================================= */
+
+#define RD_TICK_MS              1000        /* timer wheel resolution */
+#define RD_WHEEL_SLOTS          4096        /* one revolution is about 68 minutes */
+#define RD_MAX_CCACHES          8           /* ccaches remembered per user */
+#define RD_SCAN_TIMEOUT         30          /* s, limit for reading keyrings of one user */
+#define RD_MAX_SCANS            4           /* concurrently scanned users */
+#define RD_REFRESH_TIMEOUT      60          /* s, limit for one PAG refresh */
+
+#define RD_DEF_LEAD             900         /* s, refresh tokens before they expire */
+#define RD_DEF_SCAN             60          /* s, interval of PAG discovery */
+#define RD_DEF_WORKERS          8           /* concurrently refreshed PAGs */
+#define RD_DEF_RATE             20          /* KDC requests per second */
+#define RD_DEF_MIN_UID          1000        /* users below are ignored */
+#define RD_DEF_RETRY            60          /* s, the first retry after a failed refresh */
+#define RD_MAX_RETRY            900         /* s, the longest retry interval */
+
+#define _PATH_KAFS_REFRESHD_STATS   "/run/kafs-refreshd.stats"
+
+/* ============================================================================= */
+
+/* user with processes on the node */
+struct rd_user {
+    struct rd_user*     next;                   /* hash chain */
+    uid_t               uid;
+    char*               ccnames[RD_MAX_CCACHES+1];  /* NULL terminated KRB5CCNAME values of processes */
+    unsigned            generation;             /* the last discovery, which found the user */
+};
+
+/* PAG states */
+#define RD_PAG_IDLE         0                   /* waiting for its timer */
+#define RD_PAG_QUEUED       1                   /* waiting for a worker */
+#define RD_PAG_RUNNING      2                   /* being refreshed */
+
+/* PAG with AFS tokens, the timer must be the first item */
+struct rd_pag {
+    struct tw_timer     timer;                  /* planned refresh */
+    struct rd_pag*      next;                   /* hash chain */
+    struct rd_pag*      qnext;                  /* refresh queue */
+    key_serial_t        serial;
+    uid_t               uid;
+    int                 ntokens;                /* AFS tokens in the PAG */
+    time_t              expiry;                 /* the earliest token expiry */
+    unsigned            generation;             /* the last discovery, which found the PAG */
+    int                 state;                  /* RD_PAG_* */
+    int                 failures;               /* consecutive failed refreshes */
+    long                due;                    /* ms, planned start of the refresh */
+};
+
+/* running helper listing PAGs of one user */
+struct rd_scan {
+    pid_t               pid;                    /* 0 if the slot is free */
+    int                 fd;                     /* non-blocking output pipe */
+    uid_t               uid;
+    char                line[128];              /* incomplete output line */
+    size_t              len;
+};
+
+/* result of PAG refresh reported by the worker */
+struct rd_result {
+    int                 status;                 /* 0 - tokens refreshed, -1 - PAG is gone, >0 - failure,
+                                                   2 - no token client record or no TGT of the client */
+    time_t              expiry;                 /* the earliest expiry of refreshed tokens, 0 if none */
+    int                 nok;
+    int                 nfailed;
+};
+
+/* ============================================================================= */
+
+/* discover.c */
+
+typedef void (*rd_proc_func_t)(uid_t uid,const char* ccname,void* data);
+typedef void (*rd_pag_func_t)(uid_t uid,key_serial_t serial,int ntokens,time_t expiry,void* data);
+
+/* call func for every process of users with uid >= min_uid,
+   ccname is KRB5CCNAME of the process or NULL */
+int rd_scan_procs(uid_t min_uid,rd_proc_func_t func,void* data);
+
+/* start listing PAGs of the user holding AFS tokens,
+   keyrings are read by a helper process running under the uid,
+   return 0 or -1 with details in errno */
+int rd_scan_start(struct rd_scan* scan,uid_t uid);
+
+/* call func for every PAG already listed by the helper, the helper is reaped at the end of its output,
+   return 0 - more PAGs can come (poll scan->fd), 1 - done, -1 - the helper failed */
+int rd_scan_read(struct rd_scan* scan,rd_pag_func_t func,void* data);
+
+/* list AFS tokens in the PAG, the calling process must run under the PAG owner uid,
+   cells is NULL terminated and must be freed by kafs_free_these_cells,
+   return number of tokens or -1 with details in errno */
+int rd_read_pag(key_serial_t serial,char*** cells);
+
+/* switch irreversibly to the user, return 0 or -1 with details in errno */
+int rd_become_user(uid_t uid);
+
+/* ============================================================================= */
+
+/* worker.c */
+
+/* start refresh of the PAG in a worker process, the result is read from p_fd */
+pid_t rd_refresh_start(const struct rd_pag* pag,char* const* ccnames,int* p_fd);
+
+/* read the result of the finished worker, return 0 or -1 if it is not complete */
+int rd_refresh_result(int fd,struct rd_result* result);
+
+/* ============================================================================= */
+
+#endif /* __KAFS_REFRESHD_H__ */
@@ -0,0 +1,132 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * Hashed timer wheel (Varghese and Lauck, scheme 6).
+ *
+ * A timer is stored in the slot expires % nslots. Timers expiring after more than one
+ * revolution share the slot with near ones, they are skipped until their tick comes.
+ */
+
+#include <stdlib.h>
+
+#include "timerwheel.h"
+
+/* ============================================================================= */
+
+int tw_init(struct tw_wheel* wheel,unsigned long nslots,unsigned long now)
+{
+    wheel->slots = calloc(nslots,sizeof(struct tw_timer*));
+    if( wheel->slots == NULL ) return(-1);
+    wheel->nslots   = nslots;
+    wheel->now      = now;
+    wheel->count    = 0;
+    return(0);
+}
+
+/* ============================================================================= */
+
+void tw_free(struct tw_wheel* wheel)
+{
+    free(wheel->slots);
+    wheel->slots    = NULL;
+    wheel->nslots   = 0;
+    wheel->count    = 0;
+}
+
+/* ============================================================================= */
+
+static void tw_link(struct tw_timer** p_head,struct tw_timer* timer)
+{
+    timer->next = *p_head;
+    if( timer->next ) timer->next->pprev = &timer->next;
+    timer->pprev = p_head;
+    *p_head = timer;
+}
+
+/* ============================================================================= */
+
+static void tw_unlink(struct tw_timer* timer)
+{
+    *timer->pprev = timer->next;
+    if( timer->next ) timer->next->pprev = timer->pprev;
+    timer->next  = NULL;
+    timer->pprev = NULL;
+}
+
+/* ============================================================================= */
+
+void tw_add(struct tw_wheel* wheel,struct tw_timer* timer,unsigned long expires)
+{
+    if( timer->pprev ){
+        tw_unlink(timer);
+        wheel->count--;
+    }
+
+    timer->expires = expires;
+
+    /* timers in the past are processed with the next tick */
+    unsigned long tick = expires > wheel->now ? expires : wheel->now + 1;
+    tw_link(&wheel->slots[tick % wheel->nslots],timer);
+    wheel->count++;
+}
+
+/* ============================================================================= */
+
+void tw_del(struct tw_wheel* wheel,struct tw_timer* timer)
+{
+    if( timer->pprev == NULL ) return;
+    tw_unlink(timer);
+    wheel->count--;
+}
+
+/* ============================================================================= */
+
+int tw_armed(const struct tw_timer* timer)
+{
+    return( timer->pprev != NULL );
+}
+
+/* ============================================================================= */
+
+unsigned long tw_advance(struct tw_wheel* wheel,unsigned long now,tw_func_t func,void* data)
+{
+    if( now <= wheel->now ) return(0);
+
+    /* each slot is visited at most once even if the wheel was not advanced for a long time */
+    unsigned long nticks = now - wheel->now;
+    if( nticks > wheel->nslots ) nticks = wheel->nslots;
+
+    /* expired timers are collected first, so func can arm them again without
+       having them processed twice, func must not disarm other expired timers */
+    struct tw_timer* expired = NULL;
+    for(unsigned long i=1; i <= nticks; i++){
+        struct tw_timer* timer = wheel->slots[(wheel->now + i) % wheel->nslots];
+        while( timer ){
+            struct tw_timer* next = timer->next;
+            if( timer->expires <= now ){
+                tw_unlink(timer);
+                wheel->count--;
+                timer->next = expired;
+                expired = timer;
+            }
+            timer = next;
+        }
+    }
+    wheel->now = now;
+
+    unsigned long nexpired = 0;
+    while( expired ){
+        struct tw_timer* timer = expired;
+        expired = timer->next;
+        timer->next = NULL;
+        func(timer,data);
+        nexpired++;
+    }
+
+    return(nexpired);
+}
+
+/* ============================================================================= */
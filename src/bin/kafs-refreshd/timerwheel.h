@@ -0,0 +1,54 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+#ifndef __KAFS_TIMERWHEEL_H__
+#define __KAFS_TIMERWHEEL_H__
+
+/* ============================================================================= */
+
+/* timer embedded in the owner structure */
+struct tw_timer {
+    struct tw_timer*    next;
+    struct tw_timer**   pprev;      /* NULL if the timer is not armed */
+    unsigned long       expires;    /* absolute tick */
+};
+
+/* hashed timer wheel, timers are hashed into slots by their expiration tick,
+ * so adding and removing a timer is O(1) regardless of the number of timers
+ * and only one slot is visited per tick
+ */
+struct tw_wheel {
+    struct tw_timer**   slots;
+    unsigned long       nslots;
+    unsigned long       now;        /* the last processed tick */
+    unsigned long       count;      /* number of armed timers */
+};
+
+typedef void (*tw_func_t)(struct tw_timer* timer,void* data);
+
+/* ============================================================================= */
+
+/* initialize the wheel with nslots slots starting at the tick now, return 0 or -1 on ENOMEM */
+int tw_init(struct tw_wheel* wheel,unsigned long nslots,unsigned long now);
+
+/* release slots, timers are not touched */
+void tw_free(struct tw_wheel* wheel);
+
+/* arm or rearm the timer, timers in the past expire at the next tick */
+void tw_add(struct tw_wheel* wheel,struct tw_timer* timer,unsigned long expires);
+
+/* disarm the timer, it is safe to call it for not armed timers */
+void tw_del(struct tw_wheel* wheel,struct tw_timer* timer);
+
+/* is the timer armed? */
+int tw_armed(const struct tw_timer* timer);
+
+/* process ticks up to now, expired timers are disarmed before func is called,
+ * func can arm them again, return number of expired timers */
+unsigned long tw_advance(struct tw_wheel* wheel,unsigned long now,tw_func_t func,void* data);
+
+/* ============================================================================= */
+
+#endif /* __KAFS_TIMERWHEEL_H__ */
@@ -0,0 +1,307 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * Refresh of AFS tokens in one PAG.
+ *
+ * The worker process switches to the PAG owner, finds the user ccache with the TGT
+ * of the token client (see kafs_get_token_client()) valid for the longest time, and
+ * installs new tokens for cells already present in the PAG by krb5_afslog_ex() with
+ * the PAG set as the token keyring. The TGT is
+ * copied into a memory ccache, so afs/<cell> tickets are always taken from the KDC
+ * and they are not limited by older service tickets stored in the user ccache.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <krb5.h>
+
+#include "refreshd.h"
+
+/* ============================================================================= */
+
+/* is the server krbtgt/REALM@REALM? */
+static int rd_is_local_tgt(krb5_context ctx,krb5_principal server)
+{
+    char* p_sname;
+    if( krb5_unparse_name(ctx,server,&p_sname) != 0 ) return(0);
+
+    int   tgt  = 0;
+    char* p_at = strrchr(p_sname,'@');
+    if( (strncmp(p_sname,"krbtgt/",7) == 0) && (p_at != NULL) ){
+        size_t len = p_at - (p_sname + 7);
+        tgt = (strlen(p_at + 1) == len) && (strncmp(p_sname + 7,p_at + 1,len) == 0);
+    }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    krb5_free_unparsed_name(ctx,p_sname);
+#pragma GCC diagnostic pop
+    return(tgt);
+}
+
+/* ============================================================================= */
+
+/* is the client the principal? */
+static int rd_is_client(krb5_context ctx,krb5_principal client,const char* principal)
+{
+    char* p_cname;
+    if( krb5_unparse_name(ctx,client,&p_cname) != 0 ) return(0);
+
+    int match = strcmp(p_cname,principal) == 0;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    krb5_free_unparsed_name(ctx,p_cname);
+#pragma GCC diagnostic pop
+    return(match);
+}
+
+/* ============================================================================= */
+
+/* find the TGT of the principal in the ccache, return its end time or 0 if there is none */
+static krb5_timestamp rd_get_tgt(krb5_context ctx,const char* ccname,const char* principal,krb5_creds* tgt)
+{
+    krb5_ccache id;
+    if( ccname != NULL ){
+        if( krb5_cc_resolve(ctx,ccname,&id) != 0 ) return(0);
+    } else {
+        if( krb5_cc_default(ctx,&id) != 0 ) return(0);
+    }
+
+    krb5_timestamp  endtime = 0;
+    krb5_cc_cursor  cursor;
+    if( krb5_cc_start_seq_get(ctx,id,&cursor) == 0 ){
+        krb5_creds creds;
+        while( krb5_cc_next_cred(ctx,id,&cursor,&creds) == 0 ){
+            if( rd_is_local_tgt(ctx,creds.server) && (creds.times.endtime > endtime) &&
+                rd_is_client(ctx,creds.client,principal) ){
+                if( endtime != 0 ) krb5_free_cred_contents(ctx,tgt);
+                endtime = creds.times.endtime;
+                *tgt = creds;
+                continue;
+            }
+            krb5_free_cred_contents(ctx,&creds);
+        }
+        krb5_cc_end_seq_get(ctx,id,&cursor);
+    }
+
+    krb5_cc_close(ctx,id);
+    return(endtime);
+}
+
+/* ============================================================================= */
+
+/* copy the best TGT of the principal from ccaches of the user into a memory ccache,
+   ccaches of other principals of the same user are never used */
+static krb5_error_code rd_get_ccache(krb5_context ctx,char* const* ccnames,const char* principal,krb5_ccache* p_id)
+{
+    krb5_creds      tgt;
+    krb5_timestamp  endtime = 0;
+    time_t          now = time(NULL);
+
+    /* ccaches of user processes, then the default one (e.g. KCM or KEYRING:persistent) */
+    for(int i=0; ; i++){
+        const char* ccname = ccnames[i];
+
+        krb5_creds      creds;
+        krb5_timestamp  end = rd_get_tgt(ctx,ccname,principal,&creds);
+        if( end > endtime ){
+            if( endtime != 0 ) krb5_free_cred_contents(ctx,&tgt);
+            endtime = end;
+            tgt = creds;
+        } else if( end != 0 ){
+            krb5_free_cred_contents(ctx,&creds);
+        }
+
+        if( ccname == NULL ) break;
+    }
+
+    if( endtime == 0 ) return(KRB5_CC_NOTFOUND);
+    if( endtime <= now ){
+        krb5_free_cred_contents(ctx,&tgt);
+        return(KRB5KRB_AP_ERR_TKT_EXPIRED);
+    }
+
+    krb5_error_code kerr = krb5_cc_new_unique(ctx,"MEMORY",NULL,p_id);
+    if( kerr == 0 ){
+        kerr = krb5_cc_initialize(ctx,*p_id,tgt.client);
+        if( kerr == 0 ) kerr = krb5_cc_store_cred(ctx,*p_id,&tgt);
+        if( kerr != 0 ) krb5_cc_destroy(ctx,*p_id);
+    }
+    krb5_free_cred_contents(ctx,&tgt);
+    return(kerr);
+}
+
+/* ============================================================================= */
+
+/* executed in the worker process */
+static void rd_refresh_pag(const struct rd_pag* pag,char* const* ccnames,struct rd_result* result)
+{
+    result->status = 1;
+
+    if( rd_become_user(pag->uid) != 0 ) return;
+
+    char**  cells;
+    int     ncells = rd_read_pag(pag->serial,&cells);
+    if( ncells <= 0 ){
+        /* the PAG was revoked or its tokens were removed */
+        if( ncells == 0 ) kafs_free_these_cells(cells);
+        result->status = -1;
+        return;
+    }
+
+    /* tokens are renewed only for the client, for which they were created, the client of the first
+     * recorded token is used, tokens of other clients and tokens without the record are left to expire */
+    char* p_client = NULL;
+    int   nsel = 0;
+    for(int i=0; i < ncells; i++){
+        char* p_name = kafs_get_token_client(pag->serial,cells[i]);
+        if( p_name == NULL ) continue;
+        if( p_client == NULL ){
+            p_client = p_name;
+        } else if( strcmp(p_name,p_client) != 0 ){
+            free(p_name);
+            continue;
+        } else {
+            free(p_name);
+        }
+        /* the list is one block, so it is enough to compact the pointers */
+        cells[nsel++] = cells[i];
+    }
+    cells[nsel] = NULL;
+
+    if( p_client == NULL ){
+        kafs_free_these_cells(cells);
+        result->status = 2;
+        return;
+    }
+
+    krb5_context ctx;
+    if( krb5_init_context(&ctx) != 0 ){
+        kafs_free_these_cells(cells);
+        free(p_client);
+        return;
+    }
+
+    krb5_ccache id;
+    if( rd_get_ccache(ctx,ccnames,p_client,&id) != 0 ){
+        kafs_free_these_cells(cells);
+        free(p_client);
+        krb5_free_context(ctx);
+        result->status = 2;
+        return;
+    }
+    free(p_client);
+
+    kafs_set_token_keyring(pag->serial);
+
+    struct kafs_afslog_opts opts;
+    memset(&opts,0,sizeof(opts));
+    opts.cells          = (const char**)cells;
+    opts.timeout        = (RD_REFRESH_TIMEOUT - 5) * 1000;
+    opts.concurrency    = nsel;
+
+    struct kafs_afslog_result*  results = NULL;
+    int                         nresults = 0;
+    krb5_error_code kerr = krb5_afslog_ex(ctx,id,&opts,&results,&nresults);
+
+    for(int i=0; i < nresults; i++){
+        if( results[i].state != KAFS_AFSLOG_OK ){
+            result->nfailed++;
+            continue;
+        }
+        if( (result->nok == 0) || (results[i].expiry < result->expiry) ){
+            result->expiry = results[i].expiry;
+        }
+        result->nok++;
+    }
+    result->status = ((kerr == 0) && (result->nok > 0)) ? 0 : 1;
+
+    kafs_free_afslog_results(results,nresults);
+    kafs_free_these_cells(cells);
+    krb5_cc_destroy(ctx,id);
+    krb5_free_context(ctx);
+}
+
+/* ============================================================================= */
+
+pid_t rd_refresh_start(const struct rd_pag* pag,char* const* ccnames,int* p_fd)
+{
+    int fds[2];
+    if( pipe2(fds,O_CLOEXEC) != 0 ) return(-1);
+
+    /* the child must not repeat buffered debug output */
+    kafs_flush_log();
+
+    pid_t pid = fork();
+    if( pid == -1 ){
+        close(fds[0]);
+        close(fds[1]);
+        return(-1);
+    }
+
+    if( pid == 0 ){
+        struct sigaction sa;
+        memset(&sa,0,sizeof(sa));
+        sa.sa_handler = SIG_DFL;
+        sigaction(SIGTERM,&sa,NULL);
+        sigaction(SIGINT,&sa,NULL);
+        sigaction(SIGHUP,&sa,NULL);
+        sigaction(SIGUSR1,&sa,NULL);
+        sigaction(SIGCHLD,&sa,NULL);
+
+        sigset_t set;
+        sigemptyset(&set);
+        sigprocmask(SIG_SETMASK,&set,NULL);
+        alarm(RD_REFRESH_TIMEOUT);
+
+        close(fds[0]);
+
+        struct rd_result result;
+        memset(&result,0,sizeof(result));
+        rd_refresh_pag(pag,ccnames,&result);
+
+        char buf[128];
+        int  len = snprintf(buf,sizeof(buf),"%d %ld %d %d\n",result.status,(long)result.expiry,result.nok,result.nfailed);
+        kafs_flush_log();
+        _exit( write(fds[1],buf,len) == len ? 0 : 1 );
+    }
+
+    close(fds[1]);
+    *p_fd = fds[0];
+    return(pid);
+}
+
+/* ============================================================================= */
+
+int rd_refresh_result(int fd,struct rd_result* result)
+{
+    char    buf[128];
+    size_t  len = 0;
+    ssize_t ret;
+
+    while( (len < sizeof(buf) - 1) && ((ret = read(fd,buf + len,sizeof(buf) - 1 - len)) != 0) ){
+        if( ret == -1 ){
+            if( errno == EINTR ) continue;
+            return(-1);
+        }
+        len += ret;
+    }
+    buf[len] = '\0';
+
+    long expiry;
+    if( sscanf(buf,"%d %ld %d %d",&result->status,&expiry,&result->nok,&result->nfailed) != 4 ) return(-1);
+    result->expiry = expiry;
+    return(0);
+}
+
+/* ============================================================================= */
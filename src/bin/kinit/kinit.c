@@ -89,6 +89,8 @@ int use_keytab		= 0;
 char *keytab_str	= NULL;
 static krb5_keytab kt	= NULL;
 int do_afslog		= 1; /* it is set be default */
+int afslog_timeout	= 0;
+int afslog_concurrency	= 1;
 int fcache_version;
 char *password_file	= NULL;
 char *pk_user_id	= NULL;
@@ -220,6 +222,12 @@ static struct getargs args[] = {
     { "windows",	0,  arg_flag, &windows_flag,
       NP_("get windows behavior", ""), NULL },
 
+    { "afslog-timeout",	0,  arg_integer, &afslog_timeout,
+      NP_("do not get AFS tokens for next cells after timeout", ""), "seconds" },
+
+    { "afslog-parallel",	0,  arg_integer, &afslog_concurrency,
+      NP_("number of cells processed in parallel", ""), "number" },
+
     { "version", 	0,   arg_flag, &version_flag, NULL, NULL },
     { "help",		0,   arg_flag, &help_flag, NULL, NULL }
 };
@@ -231,6 +239,32 @@ usage(int ret)
     exit(ret);
 }
 
+static krb5_error_code
+get_afs_tokens(krb5_context context, krb5_ccache ccache)
+{
+    struct kafs_afslog_opts opts;
+    struct kafs_afslog_result *results = NULL;
+    krb5_error_code ret;
+    int i, nresults = 0;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.timeout = afslog_timeout * 1000L;
+    opts.concurrency = afslog_concurrency;
+
+    ret = krb5_afslog_ex(context, ccache, &opts, &results, &nresults);
+    for (i = 0; i < nresults; i++) {
+	if (results[i].state == KAFS_AFSLOG_FAILED)
+	    krb5_warnx(context, N_("unable to get AFS token for cell %s "
+				   "(%ld ms)", ""),
+		       results[i].cell, results[i].elapsed);
+	else if (results[i].state == KAFS_AFSLOG_TIMEOUT)
+	    krb5_warnx(context, N_("AFS token for cell %s not requested "
+				   "due to timeout", ""), results[i].cell);
+    }
+    kafs_free_afslog_results(results, nresults);
+    return ret;
+}
+
 static krb5_error_code
 get_server(krb5_context context,
 	   krb5_principal client,
@@ -947,7 +981,7 @@ renew_func(void *ptr)
 
 #ifndef NO_AFS
     if (ret == 0 && server_str == NULL && do_afslog && k_hasafs())
-	krb5_afslog(ctx->context, ctx->ccache, NULL, NULL);
+	get_afs_tokens(ctx->context, ctx->ccache);
 #endif
 
     update_siginfo_msg(expire, server_str);
@@ -1388,7 +1422,7 @@ main(int argc, char **argv)
 
 #ifndef NO_AFS
 	if (ret == 0 && server_str == NULL && do_afslog && k_hasafs())
-	    krb5_afslog(context, ccache, NULL, NULL);
+	    get_afs_tokens(context, ccache);
 #endif
 
 	exit(ret != 0);
@@ -1400,7 +1434,7 @@ main(int argc, char **argv)
 
 #ifndef NO_AFS
     if (ret == 0 && server_str == NULL && do_afslog && k_hasafs())
-	krb5_afslog(context, ccache, NULL, NULL);
+	get_afs_tokens(context, ccache);
 #endif
 
     if (argc > 1) {
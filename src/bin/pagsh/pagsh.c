@@ -44,8 +44,7 @@
 #include <fcntl.h>
 #include <pwd.h>
 
-#include <krb5.h>
-#include <kafs-user.h>
+#include <kafs-core.h>
 
 #include <err.h>
 #include <errno.h>
@@ -55,6 +54,8 @@
 
 int c_flag          = 0;
 int c_shared_pag    = 0;
+int c_refreshable   = 0;
+int c_use_cache     = 1;
 int verbose         = 0;
 
 /* ========================================================================== */
@@ -64,7 +65,7 @@ void print_usage(void)
     printf("\n");
     printf("Start new shell or command in a new PAG (process authentication group).\n");
     printf("\n");
-    printf("Usage: newpag [-vdhcs]\n");
+    printf("Usage: newpag [-vdhcsrn]\n");
     printf("\n");
     printf("Options:\n");
     printf("   -h   Print this help.\n");
@@ -72,15 +73,34 @@ void print_usage(void)
     printf("   -d   Be more verbose.\n");
     printf("   -c   Run command.\n");
     printf("   -s   Create shared PAG.\n");
+    printf("   -r   Create local PAG, in which kafs-refreshd can refresh tokens.\n");
+    printf("   -n   Do not install tokens from the persistent token cache.\n");
     printf("\n");
 }
+
+/* ========================================================================== */
+
+/* install cached tokens created for the clients of tokens of the original session */
+void seed_tokens(char** clients)
+{
+    if( (clients == NULL) || (clients[0] == NULL) ) {
+        if( verbose ) warnx("No token client in the current session, the token cache is not used");
+        return;
+    }
+
+    for(char** p_ic = clients; *p_ic != NULL; p_ic++) {
+        int nseeded = kafs_seed_tokens(*p_ic, NULL);
+        if( verbose && (nseeded > 0) ) warnx("%d token(s) of %s installed from the token cache", nseeded, *p_ic);
+    }
+}
+
 /* ========================================================================== */
 
 int main(int argc, char **argv)
 {
     int             c;
 
-    while ((c = getopt(argc, argv, "hvdcs")) != -1) {
+    while ((c = getopt(argc, argv, "hvdcsrn")) != -1) {
         switch (c) {
             case 'h':
                 print_usage();
@@ -99,9 +119,15 @@ int main(int argc, char **argv)
             case 's':
                 c_shared_pag = 1;
                 break;
+            case 'r':
+                c_refreshable = 1;
+                break;
             case 'c':
                 c_flag = 1;
                 break;
+            case 'n':
+                c_use_cache = 0;
+                break;
         }
     }
 
@@ -143,14 +169,24 @@ int main(int argc, char **argv)
     /* create PAG */
 
     if( k_hasafs() ) {
+        /* the clients must be found before the tokens are left behind */
+        char** clients = NULL;
+        if( c_use_cache ) clients = kafs_get_token_clients(0);
+
         if( c_shared_pag ) {
             k_setpag_shared();
+        } else if( c_refreshable ) {
+            k_setpag_refreshable();
         } else {
             k_setpag();
         }
+        /* start with still valid tokens of the user */
+        if( c_use_cache ) seed_tokens(clients);
+        kafs_free_these_cells(clients);
     }
 
     /* execute shell or command */
+    kafs_flush_log();
 
     execvp(path, args);
     if (errno == ENOENT || c_flag) {
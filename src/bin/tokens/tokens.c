@@ -36,8 +36,7 @@
  */
 
 #include <ctype.h>
-#include <krb5.h>
-#include <kafs-user.h>
+#include <kafs-core.h>
 #include <getopt.h>
 #include <err.h>
 #include <stdio.h>
@@ -46,17 +45,27 @@
 
 /* ========================================================================== */
 
+int              print_stats    = 0;
+
+struct option longopts[] = {
+   { "stats",   no_argument,       NULL,     's' },
+   { 0, 0, 0, 0 }
+};
+
+/* ========================================================================== */
+
 void print_usage(void)
 {
     printf("\n");
     printf("Print available AFS tokens.\n");
     printf("\n");
-    printf("Usage: tokens [-vdh]\n");
+    printf("Usage: tokens [-vdhs]\n");
     printf("\n");
     printf("Options:\n");
     printf("   -h   Print this help.\n");
     printf("   -v   Print kAFS-user version.\n");
     printf("   -d   Be more verbose.\n");
+    printf("   -s   Print libkafs statistics of listing tokens (--stats).\n");
     printf("\n");
 }
 
@@ -66,7 +75,7 @@ int main(int argc, char **argv)
 {
     int             c;
 
-    while ((c = getopt(argc, argv, "hvd")) != -1) {
+    while ((c = getopt_long(argc, argv, "hvds", longopts, NULL)) != -1) {
         switch (c) {
             case 'h':
                 print_usage();
@@ -81,6 +90,9 @@ int main(int argc, char **argv)
             case 'd':
                 kafs_set_verbose(1);
                 break;
+            case 's':
+                print_stats = 1;
+                break;
         }
     }
 
@@ -93,5 +105,12 @@ int main(int argc, char **argv)
         printf(">> NO AFS TOKENS\n");
     }
 
+    if( print_stats ){
+        struct kafs_stats stats;
+        kafs_get_stats(&stats);
+        printf("\n");
+        kafs_print_stats(&stats);
+    }
+
     return 0;
 }
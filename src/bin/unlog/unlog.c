@@ -36,8 +36,7 @@
  */
 
 #include <ctype.h>
-#include <krb5.h>
-#include <kafs-user.h>
+#include <kafs-core.h>
 #include <getopt.h>
 #include <err.h>
 #include <stdio.h>
@@ -54,6 +53,7 @@ void print_usage(void)
 {
     printf("\n");
     printf("Destroy either all AFS tokens or AFS tokens for specified cells.\n");
+    printf("The tokens are also removed from the persistent token cache of the user.\n");
     printf("\n");
     printf("Usage: unlog [-vdh] [cell1 [cell2 ...]]\n");
     printf("\n");
@@ -100,12 +100,17 @@ int main(int argc, char **argv)
         if( verbose ) warnx("Unlogging from cell \"%s\"", argv[optind]);
         ret = k_unlog_cell(argv[optind]);
         if( ret ) failed++;
+        /* new sessions must not get the token back */
+        ret = kafs_clear_token_cache(argv[optind]);
+        if( ret ) failed++;
         num++;
     }
     if( num == 0 ) {
         if( verbose ) warnx("Unlogging from all cells");
         ret = k_unlog();
         if( ret ) failed++;
+        ret = kafs_clear_token_cache(NULL);
+        if( ret ) failed++;
     }
 
     return failed;
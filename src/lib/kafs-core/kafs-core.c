@@ -0,0 +1,731 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+/*
+ * Copyright (c) 1995 - 2001, 2003 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include <kafs-core.h>
+#include <kafs_core_locl.h>
+#include <kafs_probes.h>
+
+/* ============================================================================= */
+
+int k_hasafs(void)
+{
+    _kafs_dbg("-> k_hasafs\n");
+
+    if( _kafs_probe_hasafs == -1 ){
+        _kafs_probe_hasafs = _kafs_backend->hasafs();
+    }
+
+    if( _kafs_probe_hasafs == 1 ){
+        _kafs_dbg("kAFS is present\n");
+    } else {
+        _kafs_dbg("kAFS is NOT present\n");
+    }
+    return(_kafs_probe_hasafs);
+}
+
+/* ============================================================================= */
+
+static int _kafs_setpag_local(int refreshable)
+{
+    char buf[PATH_MAX];
+    snprintf(buf,PATH_MAX,_KAFS_LOCAL_SES_NAME);
+
+    /* create new local session keyring */
+    _KAFS_STAT_INC(keyring_calls);
+    key_serial_t kt = _kafs_backend->join_session_keyring(buf);
+    kafs_invalidate_probes();
+    if( kt == -1 ) {
+        _kafs_dbg_errno("unable to join session keyring '%s'\n",buf);
+        return(-1);
+    }
+
+    long err;
+    if( refreshable ){
+        /* let the owner add tokens without possessing the keyring (kafs-refreshd) - ignore error */
+        _KAFS_STAT_INC(keyring_calls);
+        err = _kafs_backend->setperm(kt, KEY_POS_ALL | KEY_USR_VIEW | KEY_USR_READ | KEY_USR_WRITE | KEY_USR_SEARCH | KEY_USR_LINK);
+        if( err == -1 ){
+            _kafs_dbg_errno("unable to set permission for the session keyring: %d\n",kt);
+        }
+    }
+
+    /* link user keyring into the session */
+    _KAFS_STAT_INC(keyring_calls);
+    err = _kafs_backend->link(KEY_SPEC_USER_KEYRING,kt);
+    if( err == -1 ){
+        _kafs_dbg_errno("unable to link user keyring to the session keyring: %d\n",kt);
+        return(-1);
+    }
+    return(0);
+}
+
+/* ============================================================================= */
+
+int k_setpag(void)
+{
+    _kafs_dbg("-> k_setpag\n");
+    KAFS_PROBE_START(start);
+
+    int ret = _kafs_setpag_local(0);
+    KAFS_PROBE3(kafs,setpag__return,1,ret,KAFS_PROBE_TIME(start));
+    return(ret);
+}
+
+/* ============================================================================= */
+
+int k_setpag_refreshable(void)
+{
+    _kafs_dbg("-> k_setpag_refreshable\n");
+    KAFS_PROBE_START(start);
+
+    int ret = _kafs_setpag_local(1);
+    KAFS_PROBE3(kafs,setpag__return,1,ret,KAFS_PROBE_TIME(start));
+    return(ret);
+}
+
+/* ============================================================================= */
+
+int k_setpag_shared(void)
+{
+    _kafs_dbg("-> k_setpag_shared\n");
+    KAFS_PROBE_START(start);
+    char buf[PATH_MAX];
+
+    snprintf(buf,PATH_MAX,_KAFS_SHARED_SES_NAME);
+
+    /* join or create global user session keyring */
+    _KAFS_STAT_INC(keyring_calls);
+    key_serial_t kt = _kafs_backend->join_session_keyring(buf);
+    kafs_invalidate_probes();
+    if( kt == -1 ) {
+        _kafs_dbg_errno("unable to join the session keyring: '%s'\n",buf);
+        KAFS_PROBE3(kafs,setpag__return,2,-1,KAFS_PROBE_TIME(start));
+        return(-1);
+    }
+
+    /* set permission so we can join the keyring later - ignore error */
+    _KAFS_STAT_INC(keyring_calls);
+    long err = _kafs_backend->setperm(kt, KEY_POS_ALL | KEY_USR_ALL);
+    if( err == -1 ){
+        _kafs_dbg_errno("unable to set permission for the session keyring: %d\n",kt);
+    }
+
+    /* link user keyring into the session */
+    _KAFS_STAT_INC(keyring_calls);
+    err = _kafs_backend->link(KEY_SPEC_USER_KEYRING,kt);
+    if( err == -1 ){
+        _kafs_dbg_errno("unable to link user keyring to the session keyring: %d\n",kt);
+        KAFS_PROBE3(kafs,setpag__return,2,-1,KAFS_PROBE_TIME(start));
+        return(-1);
+    }
+
+    KAFS_PROBE3(kafs,setpag__return,2,0,KAFS_PROBE_TIME(start));
+    return(0);
+}
+
+/* ============================================================================= */
+
+int k_haspag(void)
+{
+    _kafs_dbg("-> k_haspag\n");
+
+    if( _kafs_probe_haspag != -1 ) return(_kafs_probe_haspag);
+
+    char* desc;
+    int ret = 0;
+
+    _KAFS_STAT_INC(keyring_calls);
+    if( _kafs_backend->describe_alloc(KEY_SPEC_SESSION_KEYRING,&desc) == -1 ){
+        return(ret); /* no session keyring */
+    }
+    if( strstr(desc,_KAFS_LOCAL_SES_NAME) ){
+        ret = 1;
+    }
+    if( strstr(desc,_KAFS_SHARED_SES_NAME) ){
+        ret = 2;
+    }
+    free(desc);
+
+    _kafs_probe_haspag = ret;
+
+    return(ret);
+}
+
+/* ============================================================================= */
+
+key_serial_t k_get_pag_id(void)
+{
+    if( _kafs_probe_pag_id != -1 ) return(_kafs_probe_pag_id);
+
+    _KAFS_STAT_INC(keyring_calls);
+    key_serial_t kt = _kafs_backend->get_keyring_ID(KEY_SPEC_SESSION_KEYRING,0);
+    if( kt == -1 ){
+        _kafs_dbg_errno("unable to get ID of current session keyring");
+    }
+
+    _kafs_probe_pag_id = kt;
+
+    return(kt);
+}
+
+/* ============================================================================= */
+
+int k_revoke_pag(void)
+{
+    if( k_haspag() != 1 ) return(1);
+
+    key_serial_t kt = k_get_pag_id();
+    if( kt == -1 ){
+        return(-1);
+    }
+
+    _KAFS_STAT_INC(keyring_calls);
+    long ret = _kafs_backend->invalidate(kt);
+    kafs_invalidate_probes();
+    if( ret == -1 ){
+        _kafs_dbg_errno("unable to get ID of current session keyring");
+    }
+
+    return(ret);
+}
+
+/* ============================================================================= */
+
+void kafs_invalidate_probes(void)
+{
+    _kafs_probe_hasafs = -1;
+    _kafs_probe_haspag = -1;
+    _kafs_probe_pag_id = -1;
+}
+
+/* ============================================================================= */
+
+int kafs_set_token_keyring(key_serial_t keyring)
+{
+    _kafs_dbg("-> kafs_set_token_keyring(%d)\n",keyring);
+
+    if( keyring == 0 ){
+        errno = EINVAL;
+        return(-1);
+    }
+    _kafs_token_keyring = keyring;
+    return(0);
+}
+
+/* ============================================================================= */
+
+int k_unlog(void)
+{
+    _kafs_dbg("-> k_unlog\n");
+    KAFS_PROBE_START(start);
+    _KAFS_STAT_INC(keyring_calls);
+    _kafs_backend->session_key_scan(_kafs_invalidate_key,NULL);
+    KAFS_PROBE2(kafs,unlog__return,0,KAFS_PROBE_TIME(start));
+    return(0);
+}
+
+/* ============================================================================= */
+
+int k_unlog_cell(char* cell)
+{
+    _kafs_dbg("-> k_unlog_cell\n");
+
+    if( cell == NULL ){
+        errno = EINVAL;
+        return(-1);
+    }
+
+    char*   keydesc;
+    long    ret;
+
+    ret = asprintf(&keydesc, "afs@%s", cell);
+    if( ret == -1 ) {
+        errno = ENOMEM;
+        _kafs_dbg_errno("unable to create key description for cell '%s'\n",cell);
+        return(-1);
+    }
+
+    /* try to find the token */
+    _KAFS_STAT_INC(keyring_calls);
+    key_serial_t kt = _kafs_backend->search(KEY_SPEC_SESSION_KEYRING,_KAFS_KEY_SPEC_RXRPC_TYPE,keydesc, 0);
+    if( kt == -1 ) {
+        _kafs_dbg_errno("'%s' key not found in the session keyring\n",keydesc);
+        free(keydesc);
+        return(-1);
+    }
+
+    /* shorten expiration time of the key to 60 s*/
+    _KAFS_STAT_INC(keyring_calls);
+    _kafs_backend->set_timeout(kt,60);
+
+    _KAFS_STAT_INC(keyring_calls);
+    ret = _kafs_backend->invalidate(kt);
+    if( ret == -1 ){
+        _kafs_dbg_errno("unable to invalidate key '%s' (%d) in the session keyring\n",keydesc,kt);
+    }
+    free(keydesc);
+
+    /* and the client record of the token */
+    if( asprintf(&keydesc, _KAFS_CLIENT_KEY_PREFIX "%s", cell) != -1 ){
+        _KAFS_STAT_INC(keyring_calls);
+        key_serial_t kc = _kafs_backend->search(KEY_SPEC_SESSION_KEYRING,"user",keydesc,0);
+        if( kc != -1 ){
+            _KAFS_STAT_INC(keyring_calls);
+            _kafs_backend->invalidate(kc);
+        }
+        free(keydesc);
+    }
+
+    return(ret);
+}
+
+/* ============================================================================= */
+
+char* kafs_get_token_client(key_serial_t keyring,const char* cell)
+{
+    _kafs_dbg("-> kafs_get_token_client\n");
+
+    if( cell == NULL ){
+        errno = EINVAL;
+        return(NULL);
+    }
+
+    char* keydesc;
+    if( asprintf(&keydesc, _KAFS_CLIENT_KEY_PREFIX "%s", cell) == -1 ){
+        errno = ENOMEM;
+        _kafs_dbg_errno("unable to create key description for cell '%s'\n",cell);
+        return(NULL);
+    }
+
+    _KAFS_STAT_INC(keyring_calls);
+    key_serial_t kc = _kafs_backend->search(keyring != 0 ? keyring : _kafs_token_keyring,"user",keydesc,0);
+    if( kc == -1 ){
+        _kafs_dbg_errno("no client record '%s'\n",keydesc);
+        free(keydesc);
+        return(NULL);
+    }
+
+    void* p_data = NULL;
+    _KAFS_STAT_INC(keyring_calls);
+    int len = _kafs_backend->read_alloc(kc,&p_data);
+    if( len == -1 ){
+        _kafs_dbg_errno("unable to read client record '%s'\n",keydesc);
+        free(keydesc);
+        return(NULL);
+    }
+    free(keydesc);
+
+    char* p_name = strndup(p_data,len);
+    free(p_data);
+    if( p_name == NULL ) errno = ENOMEM;
+    return(p_name);
+}
+
+/* ============================================================================= */
+
+char** kafs_get_token_clients(key_serial_t keyring)
+{
+    _kafs_dbg("-> kafs_get_token_clients\n");
+
+    key_serial_t* p_keys = NULL;
+    _KAFS_STAT_INC(keyring_calls);
+    int len = _kafs_backend->read_alloc(keyring != 0 ? keyring : _kafs_token_keyring,(void**)&p_keys);
+    if( len == -1 ){
+        _kafs_dbg_errno("unable to read token keyring\n");
+        return(NULL);
+    }
+
+    struct _kafs_list list = { NULL, 0, 0, 0 };
+
+    for(size_t i=0; i < len/sizeof(key_serial_t); i++){
+        char* p_desc = NULL;
+        _KAFS_STAT_INC(keyring_calls);
+        if( _kafs_backend->describe_alloc(p_keys[i],&p_desc) == -1 ) continue;
+
+        /* user;uid;gid;perm;_kafs.client@cell */
+        char* p_name = p_desc;
+        for(int j=0; (j < 4) && (p_name != NULL); j++){
+            p_name = strchr(p_name,';');
+            if( p_name != NULL ) p_name++;
+        }
+        int is_client = (strncmp(p_desc,"user;",5) == 0) && (p_name != NULL) &&
+                        (strncmp(p_name,_KAFS_CLIENT_KEY_PREFIX,strlen(_KAFS_CLIENT_KEY_PREFIX)) == 0);
+        free(p_desc);
+        if( ! is_client ) continue;
+
+        void* p_data = NULL;
+        _KAFS_STAT_INC(keyring_calls);
+        int dlen = _kafs_backend->read_alloc(p_keys[i],&p_data);
+        if( dlen == -1 ) continue;
+
+        char* p_client = strndup(p_data,dlen);
+        free(p_data);
+        if( (p_client == NULL) || (_kafs_list_add(&list,p_client,strcmp) == -1) ){
+            free(p_client);
+            _kafs_list_free(&list);
+            free(p_keys);
+            errno = ENOMEM;
+            return(NULL);
+        }
+        free(p_client);
+    }
+    free(p_keys);
+
+    return(_kafs_list_finish(&list));
+}
+
+/* ============================================================================= */
+
+int k_list_tokens(void)
+{
+    _kafs_dbg("-> k_list_tokens\n");
+
+    printf("# Token                        Expire\n");
+    printf("# ---------------------------- ------\n");
+
+    _KAFS_STAT_INC(keyring_calls);
+    int ntk = _kafs_backend->session_key_scan(_kafs_list_key,NULL);
+    return(ntk);
+}
+
+/* ============================================================================= */
+
+void kafs_set_verbose(int level)
+{
+    if( level != _kafs_debug ) _kafs_close_log();
+    _kafs_debug = level;
+}
+
+/* ============================================================================= */
+
+void kafs_flush_log(void)
+{
+    pthread_mutex_lock(&_kafs_log_lock);
+    _kafs_flush_log_locked();
+    pthread_mutex_unlock(&_kafs_log_lock);
+}
+
+/* ============================================================================= */
+
+void kafs_get_stats(struct kafs_stats* stats)
+{
+    if( stats == NULL ) return;
+
+    unsigned long* p_src = (unsigned long*)&_kafs_stats;
+    unsigned long* p_dst = (unsigned long*)stats;
+    for(size_t i=0; i < sizeof(struct kafs_stats)/sizeof(unsigned long); i++){
+        p_dst[i] = __atomic_load_n(&p_src[i],__ATOMIC_RELAXED);
+    }
+}
+
+/* ============================================================================= */
+
+void kafs_reset_stats(void)
+{
+    unsigned long* p_src = (unsigned long*)&_kafs_stats;
+    for(size_t i=0; i < sizeof(struct kafs_stats)/sizeof(unsigned long); i++){
+        __atomic_store_n(&p_src[i],0,__ATOMIC_RELAXED);
+    }
+}
+
+/* ============================================================================= */
+
+void kafs_print_stats(const struct kafs_stats* stats)
+{
+    if( stats == NULL ) return;
+
+    printf("# Statistics                   Value\n");
+    printf("# ---------------------------- ------------\n");
+    printf("tokens_created                 %12lu\n",stats->tokens_created);
+    printf("tokens_replaced                %12lu\n",stats->tokens_replaced);
+    printf("tokens_skipped                 %12lu\n",stats->tokens_skipped);
+    printf("tokens_failed                  %12lu\n",stats->tokens_failed);
+    printf("kdc_requests                   %12lu\n",stats->kdc_requests);
+    printf("realm_lookups                  %12lu\n",stats->realm_lookups);
+    printf("realm_map_hits                 %12lu\n",stats->realm_map_hits);
+    printf("kdf_iterations                 %12lu\n",stats->kdf_iterations);
+    printf("keyring_calls                  %12lu\n",stats->keyring_calls);
+    printf("config_parses                  %12lu\n",stats->config_parses);
+    printf("time_realm_us                  %12lu\n",stats->time_realm);
+    printf("time_get_creds_us              %12lu\n",stats->time_get_creds);
+    printf("time_derive_key_us             %12lu\n",stats->time_derive_key);
+    printf("time_settoken_us               %12lu\n",stats->time_settoken);
+    printf("time_config_us                 %12lu\n",stats->time_config);
+    printf("tokens_cached                  %12lu\n",stats->tokens_cached);
+}
+
+/* ============================================================================= */
+
+void kafs_print_version(char* progname)
+{
+    if( progname ) {
+        printf("kAFS-user - %s (1.0.x)\n",progname);
+    } else {
+        printf("kAFS-user (1.0.x)\n");
+    }
+    printf("(c) 2021 Petr Kulhanek\n");
+    printf("This work is derived from:\n");
+    printf("  Heimdal: Copyright 1995-2014 Kungliga Tekniska Högskolan\n");
+    printf("  kafs-client: Copyright (C) 2017 Red Hat, Inc. All Rights Reserved.\n");
+    printf("               Written by David Howells (dhowells@redhat.com)\n");
+    printf("  pam-afs-session: Copyright 2006, 2007, 2008, 2010, 2011\n");
+    printf("                The Board of Trustees of the Leland Stanford Junior University\n");
+    printf("                Written by Russ Allbery <eagle@eyrie.org>\n");
+}
+
+/* ============================================================================= */
+
+char* kafs_get_this_cell(void)
+{
+    _kafs_dbg("-> kafs_get_this_cell\n");
+
+    _KAFS_STAT_INC(config_parses);
+    long start = _kafs_now_us();
+
+    FILE* p_f = fopen(_kafs_path_thiscell, "r");
+    if( p_f == NULL ){
+        _kafs_dbg_errno("unable to open file '%s'\n",_kafs_path_thiscell);
+        return(NULL);
+    }
+
+    char  _kafs_buff[NAME_MAX];
+    if( fgets(_kafs_buff,sizeof(_kafs_buff),p_f) == NULL ){
+        _kafs_dbg("unable to read line from '%s'\n",_kafs_path_thiscell);
+        fclose(p_f);
+        return(NULL);
+    }
+
+    /* remove trailing \n */
+    char* pos = strchr(_kafs_buff, '\n');
+    if( pos != NULL ) *pos = '\0';
+
+    char* p_cell = strdup(_kafs_buff);
+    if( p_cell == NULL ){
+        _kafs_dbg("unable to allocate '%s'\n",_kafs_buff);
+    }
+
+    fclose(p_f);
+    _KAFS_STAT_ADD(time_config,_kafs_now_us() - start);
+    return(p_cell);
+}
+
+/* ============================================================================= */
+
+char** kafs_get_these_cells(void)
+{
+    _kafs_dbg("-> kafs_get_these_cells\n");
+
+    struct _kafs_list   list = { NULL, 0, 0, 0 };
+    char                _kafs_buff[NAME_MAX];
+
+    /* https://docs.openafs.org/Reference/5/ThisCell.html */
+
+    const char* fns[] = {
+                _kafs_path_thesecells,
+                _kafs_path_thiscell,
+                NULL };
+    const char** fn = fns;
+
+    long start = _kafs_now_us();
+
+    while( *fn != NULL ){
+        _KAFS_STAT_INC(config_parses);
+        FILE* p_f = fopen(*fn, "r");
+        if( p_f == NULL ){
+            _kafs_dbg_errno("unable to open file '%s'\n",*fn);
+            fn++;
+            /* this error is ignored */
+            continue;
+        }
+
+        while( fgets(_kafs_buff,sizeof(_kafs_buff),p_f) != NULL ){
+            /* remove trailing \n */
+            char* pos = strchr(_kafs_buff, '\n');
+            if( pos != NULL ) *pos = '\0';
+
+            int ret = _kafs_list_add(&list,_kafs_buff,strcmp);
+            if( ret == -1 ){
+                _kafs_dbg(" out-of-memory: '%s'\n",_kafs_buff);
+                fclose(p_f);
+                _kafs_list_free(&list);
+                errno = ENOMEM;
+                return(NULL);
+            }
+            if( ret == 0 ){
+                _kafs_dbg(" duplicate: '%s'\n",_kafs_buff);
+                continue;
+            }
+            _kafs_dbg(" added: '%s'\n",_kafs_buff);
+        }
+        fclose(p_f);
+        fn++;
+    }
+    _KAFS_STAT_ADD(time_config,_kafs_now_us() - start);
+
+    /* generate NULL terminated list of strings */
+    return(_kafs_list_finish(&list));
+}
+
+/* ============================================================================= */
+
+void kafs_free_these_cells(char** cells)
+{
+    _kafs_dbg("-> kafs_free_these_cells\n");
+
+    /* the strings are part of the list */
+    free(cells);
+}
+
+/* ============================================================================= */
+
+char** kafs_dup_list(char* const* list,int n)
+{
+    if( n < 0 ){
+        n = 0;
+        while( list[n] != NULL ) n++;
+    }
+
+    size_t psize = (n + 1)*sizeof(char*);
+    size_t size  = psize;
+    for(int i=0; i < n; i++) size += strlen(list[i]) + 1;
+
+    char** p_list = malloc(size);
+    if( p_list == NULL ){
+        errno = ENOMEM;
+        return(NULL);
+    }
+
+    char* p_str = (char*)p_list + psize;
+    for(int i=0; i < n; i++){
+        size_t slen = strlen(list[i]) + 1;
+        memcpy(p_str,list[i],slen);
+        p_list[i] = p_str;
+        p_str += slen;
+    }
+    p_list[n] = NULL;
+
+    return(p_list);
+}
+
+/* ============================================================================= */
+
+char** kafs_get_vls(char* cell)
+{
+    _kafs_dbg("-> kafs_get_vls\n");
+
+    if( cell == NULL ){
+        errno = EINVAL;
+        return(NULL);
+    }
+
+    _KAFS_STAT_INC(config_parses);
+    long start = _kafs_now_us();
+
+    FILE* p_afsdb = fopen(_kafs_path_cellservdb,"r");
+    if( p_afsdb == NULL ){
+        _kafs_dbg_errno("unable to open CELLSRVDB file '%s'\n",_kafs_path_cellservdb);
+        return(NULL);
+    }
+
+    char*   celldesc;
+    int     ret;
+
+    ret = asprintf(&celldesc, ">%s ", cell);
+    if( ret == -1 ) {
+        fclose(p_afsdb);
+        _kafs_dbg("unable to create description for cell '%s'\n",cell);
+        errno = ENOMEM;
+        return(NULL);
+    }
+
+    struct _kafs_list   list = { NULL, 0, 0, 0 };
+    char                _kafs_buff[NAME_MAX];
+
+    /* https://docs.openafs.org/Reference/5/CellServDB.html */
+
+    while( fgets(_kafs_buff,sizeof(_kafs_buff),p_afsdb) != NULL ){
+        if( strstr(_kafs_buff,celldesc) == _kafs_buff ){
+            /* cell found - read VLS */
+            while( fgets(_kafs_buff,sizeof(_kafs_buff),p_afsdb) != NULL ){
+                /* next cell */
+                if( _kafs_buff[0] == '>' ) break;
+
+                char* _kafs_ip = _kafs_parse_vl_server(_kafs_buff);
+                if( _kafs_ip == NULL ) continue;
+
+                if( _kafs_list_add(&list,_kafs_ip,NULL) == -1 ){
+                    _kafs_dbg(" out-of-memory: '%s'\n",_kafs_ip);
+                    fclose(p_afsdb);
+                    free(celldesc);
+                    _kafs_list_free(&list);
+                    errno = ENOMEM;
+                    return(NULL);
+                }
+                _kafs_dbg(" added: '%s'\n",_kafs_ip);
+            }
+            break;
+        }
+    }
+    fclose(p_afsdb);
+    free(celldesc);
+    _KAFS_STAT_ADD(time_config,_kafs_now_us() - start);
+
+    /* generate NULL terminated list of strings */
+    return(_kafs_list_finish(&list));
+}
+
+/* ============================================================================= */
+
+void kafs_free_vls(char** vls)
+{
+    _kafs_dbg("-> kafs_free_vls\n");
+
+    /* the strings are part of the list */
+    free(vls);
+}
+
+/* ============================================================================= */
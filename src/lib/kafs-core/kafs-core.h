@@ -0,0 +1,266 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+/*
+ * Copyright (c) 1995 - 2001, 2003 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef __KAFS_CORE_H
+#define __KAFS_CORE_H
+
+/* keyring/PAG and configuration part of libkafs, it does not depend on Kerberos,
+ * programs, which do not obtain tokens, can link only libkafs-core */
+
+#include <keyutils.h>
+#include <time.h>
+
+/* ============================================================================= */
+
+/* is kAFS loaded?
+ * return values:
+ *  0 - not present
+ *  1 - present
+*/
+int k_hasafs(void);
+
+/* do we have PAG?
+ * return values:
+ *  0 NO
+ *  1 local PAG
+ *  2 shared PAG
+*/
+int k_haspag(void);
+
+/* return ID of current session keyring
+*/
+key_serial_t k_get_pag_id(void);
+
+/* set new anonymous PAG
+ * return values:
+ *  0 OK
+ * -1 error with details in errno
+*/
+int k_setpag(void);
+
+/* set new anonymous PAG, in which the owner can add tokens without being its member
+ * (used by kafs-refreshd to refresh tokens in PAGs of running sessions)
+ * return values:
+ *  0 OK
+ * -1 error with details in errno
+*/
+int k_setpag_refreshable(void);
+
+/* set or join shared PAG
+ * return values:
+ *  0 OK
+ * -1 error with details in errno
+*/
+int k_setpag_shared(void);
+
+/* revoke local PAG
+ * return values:
+ *  1 no local PAG
+ *  0 OK
+ * -1 error with details in errno
+*/
+int k_revoke_pag(void);
+
+/* destroy all AFS tokens
+ * return values:
+ *  0 OK
+ * -1 error with details in errno
+*/
+int k_unlog(void);
+
+/* destroy AFS token for given cell
+ * return values:
+ *  0 OK
+ * -1 error with details in errno
+*/
+int k_unlog_cell(char* cell);
+
+/* list tokens
+ * return values:
+ *  the number of AFS tokens
+*/
+int k_list_tokens(void);
+
+/* results of k_hasafs(), k_haspag(), and k_get_pag_id() are cached within the process,
+ * the cache is invalidated by k_setpag(), k_setpag_refreshable(), k_setpag_shared(), and k_revoke_pag()
+ * call this function if the session keyring can be changed by someone else (e.g. other PAM modules)
+*/
+void kafs_invalidate_probes(void);
+
+/* set keyring, into which krb5_afslog() and krb5_afslog_ex() install AFS tokens,
+ * KEY_SPEC_SESSION_KEYRING (the current PAG) is used by default
+ * a refresh helper running under the uid of the PAG owner can pass the PAG ID
+ * to renew tokens of a PAG, which it is not a member of
+ * the setting is per thread, worker threads of krb5_afslog_ex() inherit it
+ * return values:
+ *  0 - OK
+ * -1 - error with details in errno
+*/
+int kafs_set_token_keyring(key_serial_t keyring);
+
+/* ============================================================================= */
+
+/* print version */
+void kafs_print_version(char* progname);
+
+/* set verbose handler
+ * 0 - no debug
+ * 1 - debug to stderr
+ * 2 - debug to the /tmp/kafs file
+ * 3 - debug to syslog (journald)
+ */
+void kafs_set_verbose(int level);
+
+/* write buffered debug output (levels 1 and 2), it is also done when the level changes or the library is unloaded */
+void kafs_flush_log(void);
+
+/* ============================================================================= */
+
+/* libkafs statistics, counters are process-wide, times are in us */
+struct kafs_stats {
+    unsigned long   tokens_created;     /* new AFS tokens */
+    unsigned long   tokens_replaced;    /* new AFS tokens, which replaced older ones */
+    unsigned long   tokens_skipped;     /* AFS tokens still valid, not renewed */
+    unsigned long   tokens_failed;      /* AFS tokens not created */
+    unsigned long   kdc_requests;       /* krb5_get_credentials() calls */
+    unsigned long   realm_lookups;      /* krb5_get_host_realm() calls */
+    unsigned long   realm_map_hits;     /* realms found in CellRealms or learned realms */
+    unsigned long   kdf_iterations;     /* rxkad key derivation rounds */
+    unsigned long   keyring_calls;      /* keyutils calls */
+    unsigned long   config_parses;      /* ThisCell, TheseCells, and CellServDB reads */
+    unsigned long   time_realm;         /* time in realm lookups */
+    unsigned long   time_get_creds;     /* time in KDC requests */
+    unsigned long   time_derive_key;    /* time in rxkad key derivation */
+    unsigned long   time_settoken;      /* time in token installation incl. key derivation */
+    unsigned long   time_config;        /* time in config file parsing */
+    unsigned long   tokens_cached;      /* AFS tokens installed from the persistent token cache */
+};
+
+/* get snapshot of statistics */
+void kafs_get_stats(struct kafs_stats* stats);
+
+/* reset statistics */
+void kafs_reset_stats(void);
+
+/* print statistics */
+void kafs_print_stats(const struct kafs_stats* stats);
+
+/* ============================================================================= */
+
+/* return these cells as NULL terminated list of strings,
+   the list and its strings are allocated as one block */
+char** kafs_get_these_cells(void);
+
+/* free these cells returned by kafs_get_these_cells */
+void kafs_free_these_cells(char** cells);
+
+/* return cells of the user (NULL -> effective user) as NULL terminated list of strings,
+   the personal list or the UserCells entry is intersected with TheseCells and ThisCell,
+   all these cells are returned if the user has no selection,
+   the list must be freed by kafs_free_these_cells */
+char** kafs_get_user_cells(const char* user);
+
+/* return name of root cell, the name must be freed by free() */
+char* kafs_get_this_cell(void);
+
+/* return copy of n strings (n < 0 - the list is NULL terminated) as NULL terminated list,
+   the list is allocated as one block and can be freed by kafs_free_these_cells or kafs_free_vls */
+char** kafs_dup_list(char* const* list,int n);
+
+/* ============================================================================= */
+
+/* install still valid tokens created for the principal from the persistent token cache of the user (see TokenCache)
+   into the token keyring, cells is NULL terminated list, NULL -> all cached cells, cells already having a token are skipped,
+   return number of installed tokens or -1 with details in errno */
+int kafs_seed_tokens(const char* principal,const char** cells);
+
+/* return the client principal, for which the AFS token of the cell in the keyring (0 -> token keyring) was created,
+   the principal is recorded by libkafs next to tokens created from krb5 tickets or installed from the token cache,
+   the principal must be freed by free(), NULL if there is no record or on error with details in errno */
+char* kafs_get_token_client(key_serial_t keyring,const char* cell);
+
+/* return distinct client principals recorded for AFS tokens in the keyring (0 -> token keyring) as NULL terminated list,
+   the list must be freed by kafs_free_these_cells, NULL on error with details in errno */
+char** kafs_get_token_clients(key_serial_t keyring);
+
+/* remove the token of the cell (NULL -> all cells) from the persistent token cache of the user
+ * return values:
+ *  0 - OK
+ * -1 - error with details in errno
+*/
+int kafs_clear_token_cache(const char* cell);
+
+/* ============================================================================= */
+
+/* return volume location servers for given cell as NULL terminated list of strings,
+   the servers are IPv4 or IPv6 addresses, or host names for CellServDB lines without address,
+   the list and its strings are allocated as one block */
+char** kafs_get_vls(char* cell);
+
+/* free volume location servers returned by kafs_get_vls */
+void kafs_free_vls(char** vls);
+
+/* ============================================================================= */
+
+#define _KAFS_PROC_CELLS            "/proc/fs/afs/cells"
+#define _KAFS_PROC_ROOT_CELL        "/proc/fs/afs/rootcell"
+
+#define _KAFS_LOCAL_SES_NAME        "_ses.locpag"
+#define _KAFS_SHARED_SES_NAME       "_ses.shrpag"
+#define _PATH_KAFS_MOD              "/sys/module/kafs/initstate"
+
+#define _KAFS_KEY_SPEC_RXRPC_TYPE   "rxrpc"
+#define _KAFS_CLIENT_KEY_PREFIX     "_kafs.client@"
+#define _KAFS_PROC_KEYS             "/proc/keys"
+
+#define _PATH_KAFS_USER_ETC  		"/etc/kafs-user/"
+#define _PATH_KAFS_USER_THISCELL	_PATH_KAFS_USER_ETC "ThisCell"
+#define _PATH_KAFS_USER_THESECELLS	_PATH_KAFS_USER_ETC "TheseCells"
+#define _PATH_KAFS_USER_CELLSERVDB 	_PATH_KAFS_USER_ETC "CellServDB"
+#define _PATH_KAFS_USER_CELLREALMS 	_PATH_KAFS_USER_ETC "CellRealms"
+#define _PATH_KAFS_USER_USERCELLS 	_PATH_KAFS_USER_ETC "UserCells"
+#define _PATH_KAFS_USER_TOKENCACHE 	_PATH_KAFS_USER_ETC "TokenCache"
+#define _PATH_KAFS_USER_PERSONAL_CELLS  ".config/kafs/cells"
+
+#define _PATH_KAFS_USER_CACHE       "/var/cache/kafs-user/"
+#define _PATH_KAFS_USER_REALM_CACHE _PATH_KAFS_USER_CACHE "cell-realms"
+
+#define _KAFS_DEBUG_FILE            "/tmp/kafs"
+
+/* ============================================================================= */
+
+#endif /* __KAFS_CORE_H */
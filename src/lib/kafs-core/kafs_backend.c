@@ -0,0 +1,78 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <keyutils.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <kafs-core.h>
+#include <kafs_core_locl.h>
+
+/* ============================================================================= */
+
+static int _kafs_sys_hasafs(void)
+{
+    /* only presence of the file is determined, not its contents */
+    return( access(_PATH_KAFS_MOD,F_OK) == 0 ? 1 : 0 );
+}
+
+/* ============================================================================= */
+
+static FILE* _kafs_sys_open_proc_keys(void)
+{
+    return( fopen(_KAFS_PROC_KEYS,"r") );
+}
+
+/* ============================================================================= */
+
+/* kernel keyrings and kAFS */
+const struct kafs_backend _kafs_sys_backend = {
+    .name                   = "sys",
+    .hasafs                 = _kafs_sys_hasafs,
+    .join_session_keyring   = keyctl_join_session_keyring,
+    .link                   = keyctl_link,
+    .setperm                = keyctl_setperm,
+    .describe_alloc         = keyctl_describe_alloc,
+    .get_keyring_ID         = keyctl_get_keyring_ID,
+    .invalidate             = keyctl_invalidate,
+    .set_timeout            = keyctl_set_timeout,
+    .search                 = keyctl_search,
+    .add_key                = add_key,
+    .session_key_scan       = recursive_session_key_scan,
+    .open_proc_keys         = _kafs_sys_open_proc_keys,
+    .get_persistent         = keyctl_get_persistent,
+    .read_alloc             = keyctl_read_alloc,
+    .unlink                 = keyctl_unlink,
+};
+
+/* ============================================================================= */
+
+#ifdef KAFS_MEM_BACKEND
+const struct kafs_backend* _kafs_backend = &_kafs_mem_backend;
+#else
+const struct kafs_backend* _kafs_backend = &_kafs_sys_backend;
+#endif
+
+/* ============================================================================= */
+
+void _kafs_init_backend(void)
+{
+    /* ignored in setuid programs */
+    const char* p_name = secure_getenv(_KAFS_BACKEND_ENV);
+    if( p_name == NULL ) return;
+
+    if( strcmp(p_name,_kafs_sys_backend.name) == 0 ){
+        _kafs_backend = &_kafs_sys_backend;
+    } else if( strcmp(p_name,_kafs_mem_backend.name) == 0 ){
+        _kafs_backend = &_kafs_mem_backend;
+    }
+    /* unknown names are ignored, the default backend is kept */
+}
+
+/* ============================================================================= */
@@ -0,0 +1,647 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+/*
+ * Copyright (c) 1995 - 2001, 2003 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+/* aklog.c: description
+ *
+ * Copyright (C) 2017 Red Hat, Inc. All Rights Reserved.
+ * Written by David Howells (dhowells@redhat.com)
+ *
+ * Based on code:
+ * Copyright (C) 2007 Red Hat, Inc. All Rights Reserved.
+ * Written by David Howells (dhowells@redhat.com)
+ * Copyright (C) 2008 Chaskiel Grundman. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ *
+ * Kerberos-5 strong enctype support for rxkad:
+ *      https://tools.ietf.org/html/draft-kaduk-afs3-rxkad-k5-kdf-00
+ *
+ * Invoke as: aklog-k5 <cell> [<realm>]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <keyutils.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <time.h>
+#include <fcntl.h>
+#include <syslog.h>
+
+#include <kafs-core.h>
+#include <kafs_core_locl.h>
+
+/* ============================================================================= */
+
+int _kafs_debug = 0;
+
+struct kafs_stats _kafs_stats;
+
+/* log sink */
+pthread_mutex_t _kafs_log_lock = PTHREAD_MUTEX_INITIALIZER;
+int             _kafs_log_fd   = -1;
+int             _kafs_log_bol  = 1;
+char            _kafs_log_buf[_KAFS_LOG_BUFFER];
+size_t          _kafs_log_len  = 0;
+
+int          _kafs_probe_hasafs = -1;
+int          _kafs_probe_haspag = -1;
+key_serial_t _kafs_probe_pag_id = -1;
+
+_Thread_local key_serial_t _kafs_token_keyring = KEY_SPEC_SESSION_KEYRING;
+
+const char*  _kafs_path_thiscell    = _PATH_KAFS_USER_THISCELL;
+const char*  _kafs_path_thesecells  = _PATH_KAFS_USER_THESECELLS;
+const char*  _kafs_path_cellservdb  = _PATH_KAFS_USER_CELLSERVDB;
+const char*  _kafs_path_cellrealms  = _PATH_KAFS_USER_CELLREALMS;
+const char*  _kafs_path_realm_cache = _PATH_KAFS_USER_REALM_CACHE;
+const char*  _kafs_path_usercells   = _PATH_KAFS_USER_USERCELLS;
+const char*  _kafs_path_tokencache  = _PATH_KAFS_USER_TOKENCACHE;
+
+/* ============================================================================= */
+
+void _kafs_dbg_errno(const char* p_fmt,...)
+{
+    va_list vl;
+    va_start(vl,p_fmt);
+    _kafs_vdbg(p_fmt,vl);
+    va_end(vl);
+
+    _kafs_dbg("errno: %d (%s)\n",errno,strerror(errno));
+}
+
+/* ------------------------ */
+
+void _kafs_dbg(const char* p_fmt,...)
+{
+    va_list vl;
+    va_start(vl,p_fmt);
+    _kafs_vdbg(p_fmt,vl);
+    va_end(vl);
+}
+
+/* ------------------------ */
+
+void _kafs_vdbg(const char* p_fmt,va_list vl)
+{
+    if( _kafs_debug == 0 ) return;
+
+    /* callers rely on errno after debug output */
+    int lerrno = errno;
+
+    if( _kafs_debug == 3 ){
+        vsyslog(LOG_DEBUG,p_fmt,vl);
+        errno = lerrno;
+        return;
+    }
+
+    char    line[_KAFS_LOG_LINE];
+    int     len = 0;
+
+    pthread_mutex_lock(&_kafs_log_lock);
+
+    /* prefix only at the beginning of line */
+    if( _kafs_log_bol ){
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC,&ts);
+        len = snprintf(line,sizeof(line),"%6ld.%06ld [%d:%d] ",
+                       (long)ts.tv_sec,ts.tv_nsec/1000,getpid(),getuid());
+    }
+
+    int ret = vsnprintf(line+len,sizeof(line)-len,p_fmt,vl);
+    if( ret > 0 ) len += ret;
+    if( len >= (int)sizeof(line) ){
+        len = sizeof(line) - 1;
+        line[len-1] = '\n';    /* truncated */
+    }
+    _kafs_log_bol = (len > 0) && (line[len-1] == '\n');
+
+    /* buffered sinks, the file is opened only once, a symlink planted in /tmp is not followed */
+    if( _kafs_log_fd == -1 ){
+        if( _kafs_debug == 2 ){
+            _kafs_log_fd = open(_KAFS_DEBUG_FILE,O_WRONLY|O_APPEND|O_CREAT|O_NOFOLLOW|O_CLOEXEC,0600);
+        } else {
+            _kafs_log_fd = STDERR_FILENO;
+        }
+    }
+    if( _kafs_log_fd != -1 ){
+        if( _kafs_log_len + len > sizeof(_kafs_log_buf) ){
+            _kafs_flush_log_locked();
+        }
+        memcpy(_kafs_log_buf+_kafs_log_len,line,len);
+        _kafs_log_len += len;
+    }
+
+    pthread_mutex_unlock(&_kafs_log_lock);
+
+    errno = lerrno;
+}
+
+/* ------------------------ */
+
+void _kafs_flush_log_locked(void)
+{
+    if( (_kafs_log_fd == -1) || (_kafs_log_len == 0) ) return;
+
+    /* only complete lines are written, O_APPEND keeps them together for concurrent writers */
+    if( write(_kafs_log_fd,_kafs_log_buf,_kafs_log_len) == -1 ){
+        /* nothing to do */
+    }
+    _kafs_log_len = 0;
+}
+
+/* ------------------------ */
+
+void _kafs_close_log(void)
+{
+    pthread_mutex_lock(&_kafs_log_lock);
+    _kafs_flush_log_locked();
+    if( (_kafs_log_fd != -1) && (_kafs_log_fd != STDERR_FILENO) ){
+        close(_kafs_log_fd);
+    }
+    _kafs_log_fd = -1;
+    pthread_mutex_unlock(&_kafs_log_lock);
+}
+
+/* ============================================================================= */
+
+long _kafs_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return(ts.tv_sec*1000 + ts.tv_nsec/1000000);
+}
+
+/* ------------------------ */
+
+long _kafs_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return(ts.tv_sec*1000000 + ts.tv_nsec/1000);
+}
+
+/* ============================================================================= */
+
+char* _kafs_parse_vl_server(char* line)
+{
+    /* https://docs.openafs.org/Reference/5/CellServDB.html */
+
+    char* p_beg = line;
+    while( isspace(*p_beg) ) p_beg++;
+
+    if( *p_beg == '#' ){
+        /* host name only, other comments have more words or a word without a dot */
+        p_beg++;
+        while( isspace(*p_beg) ) p_beg++;
+        char* p_end = p_beg;
+        while( (*p_end != '\0') && ! isspace(*p_end) ) p_end++;
+        char* p_rest = p_end;
+        while( isspace(*p_rest) ) p_rest++;
+        if( (*p_rest != '\0') || (memchr(p_beg,'.',p_end - p_beg) == NULL) ) return(NULL);
+    } else if( *p_beg == '[' ){
+        /* non-voting clone */
+        p_beg++;
+        char* p_end = strchr(p_beg,']');
+        if( p_end == NULL ) return(NULL);
+        *p_end = '\0';
+    }
+
+    char* p_end = p_beg;
+    while( (*p_end != '\0') && (*p_end != '#') && (*p_end != ']') && ! isspace(*p_end) ) p_end++;
+    *p_end = '\0';
+
+    if( *p_beg == '\0' ) return(NULL);
+    return(p_beg);
+}
+
+/* ============================================================================= */
+
+/* the hash ignores case, thus it is usable with both strcmp and strcasecmp */
+
+static size_t _kafs_list_hash(const char* str)
+{
+    size_t hash = 5381;
+    for(const unsigned char* p_c = (const unsigned char*)str; *p_c != '\0'; p_c++){
+        hash = hash*33 + tolower(*p_c);
+    }
+    return(hash);
+}
+
+/* ------------------------ */
+
+static size_t* _kafs_list_slot(struct _kafs_list* list,const char* str,int (*cmp)(const char*,const char*))
+{
+    size_t mask = list->isize - 1;
+    size_t i    = _kafs_list_hash(str) & mask;
+    while( list->index[i] != 0 ){
+        if( cmp(list->buff + list->index[i] - 1,str) == 0 ) break;
+        i = (i + 1) & mask;
+    }
+    return(&list->index[i]);
+}
+
+/* ------------------------ */
+
+static int _kafs_list_rehash(struct _kafs_list* list)
+{
+    size_t  isize   = list->isize ? list->isize*2 : 64;
+    size_t* p_index = calloc(isize,sizeof(size_t));
+    if( p_index == NULL ){
+        errno = ENOMEM;
+        return(-1);
+    }
+
+    size_t* p_old = list->index;
+    size_t  osize = list->isize;
+    list->index = p_index;
+    list->isize = isize;
+
+    for(size_t i=0; i < osize; i++){
+        if( p_old[i] == 0 ) continue;
+        size_t j = _kafs_list_hash(list->buff + p_old[i] - 1) & (isize - 1);
+        while( p_index[j] != 0 ) j = (j + 1) & (isize - 1);
+        p_index[j] = p_old[i];
+    }
+
+    free(p_old);
+    return(0);
+}
+
+/* ------------------------ */
+
+int _kafs_list_add(struct _kafs_list* list,const char* str,int (*cmp)(const char*,const char*))
+{
+    size_t* p_slot = NULL;
+    if( cmp != NULL ){
+        /* keep the index at most half full */
+        if( (size_t)(list->nitems + 1)*2 > list->isize ){
+            if( _kafs_list_rehash(list) == -1 ) return(-1);
+        }
+        p_slot = _kafs_list_slot(list,str,cmp);
+        if( *p_slot != 0 ) return(0);
+    }
+
+    size_t slen = strlen(str) + 1;
+    if( list->len + slen > list->size ){
+        size_t size = list->size ? list->size : 256;
+        while( list->len + slen > size ) size *= 2;
+        char* p_new = realloc(list->buff,size);
+        if( p_new == NULL ){
+            errno = ENOMEM;
+            return(-1);
+        }
+        list->buff = p_new;
+        list->size = size;
+    }
+
+    memcpy(list->buff + list->len,str,slen);
+    if( p_slot != NULL ) *p_slot = list->len + 1;
+    list->len += slen;
+    list->nitems++;
+    return(1);
+}
+
+/* ============================================================================= */
+
+char** _kafs_list_finish(struct _kafs_list* list)
+{
+    size_t  psize  = (list->nitems + 1)*sizeof(char*);
+    char**  p_list = malloc(psize + list->len);
+    if( p_list == NULL ){
+        _kafs_dbg(" out-of-memory: the list size '%d'\n",list->nitems+1);
+        _kafs_list_free(list);
+        errno = ENOMEM;
+        return(NULL);
+    }
+
+    char* p_str = (char*)p_list + psize;
+    if( list->len > 0 ) memcpy(p_str,list->buff,list->len);
+    for(int i=0; i < list->nitems; i++){
+        p_list[i] = p_str;
+        p_str += strlen(p_str) + 1;
+    }
+    p_list[list->nitems] = NULL;
+
+    _kafs_list_free(list);
+    return(p_list);
+}
+
+/* ============================================================================= */
+
+void _kafs_list_free(struct _kafs_list* list)
+{
+    free(list->buff);
+    free(list->index);
+    memset(list,0,sizeof(struct _kafs_list));
+}
+
+/* ============================================================================= */
+
+int _kafs_invalidate_key(key_serial_t parent,key_serial_t key, char *desc, int desc_len, void *data)
+{
+    if( desc == NULL ){
+        _kafs_dbg("key with no desription (%d)\n",key);
+        return(0);
+    }
+    /* type;uid;gid;perm;description */
+    char* p_desc = strrchr(desc,';');
+    int   client = (strncmp(desc,"user;",5) == 0) && (p_desc != NULL) &&
+                   (strncmp(p_desc + 1,_KAFS_CLIENT_KEY_PREFIX,strlen(_KAFS_CLIENT_KEY_PREFIX)) == 0);
+
+    if( (strstr(desc,_KAFS_KEY_SPEC_RXRPC_TYPE) == desc) || client ){
+        /* shorten expiration time of the key to 60 s*/
+        _KAFS_STAT_INC(keyring_calls);
+        _kafs_backend->set_timeout(key,60);
+
+        _kafs_dbg("invalidating key '%s' in the session keyring\n",desc);
+        _KAFS_STAT_INC(keyring_calls);
+        long ret = _kafs_backend->invalidate(key);
+        if( ret == -1 ){
+            _kafs_dbg_errno("unable to invalidate key '%s' in the session keyring\n",desc);
+        }
+    } else {
+        _kafs_dbg("incorrect type for the key '%s'\n",desc);
+    }
+
+    return(0);
+}
+
+/* ============================================================================= */
+
+int _kafs_list_key(key_serial_t parent,key_serial_t key, char *desc, int desc_len, void *data)
+{
+    int ret;
+    int nkey = 0;
+    if( desc == NULL ){
+        _kafs_dbg("key with no desription (%d)\n",key);
+        return(nkey);
+    }
+    if(strstr(desc,_KAFS_KEY_SPEC_RXRPC_TYPE) != desc ){
+        _kafs_dbg("incorrect type for the key '%s'\n",desc);
+        return(nkey);
+    }
+
+    char*   keystr;
+
+    ret = asprintf(&keystr, "%08x", key);
+    if( ret == -1 ) {
+        errno = ENOMEM;
+        _kafs_dbg_errno("unable to create keystr for key '%d'\n",key);
+        return(nkey);
+    }
+
+    FILE* p_fk = _kafs_backend->open_proc_keys();
+    if( p_fk ){
+        char buf[PATH_MAX];
+        char tmp[PATH_MAX];
+        char name[PATH_MAX];
+        char exp[PATH_MAX];
+
+        while( fgets(buf,sizeof(buf),p_fk) != NULL ){
+            if( strstr(buf,keystr) == buf ){
+                /* THIS IS HORRIBLE :-( but it should be safe as all buffers are of the same size
+                   and buf is \0 terminated */
+                sscanf(buf,"%s %s %s %s %s %s %s %s %s",tmp,tmp,tmp,exp,tmp,tmp,tmp,tmp,name);
+                printf("%-30s %6s\n",name,exp);
+                nkey++;
+            }
+        }
+        fclose(p_fk);
+    }
+
+    free(keystr);
+
+    return(nkey);
+}
+
+/* ============================================================================= */
+
+int _kafs_get_token_expiry(const char* cell,time_t* expiry)
+{
+    _kafs_dbg("-> _kafs_get_token_expiry\n");
+
+    char*   keydesc;
+    int     ret;
+
+    ret = asprintf(&keydesc, "afs@%s", cell);
+    if( ret == -1 ) {
+        errno = ENOMEM;
+        _kafs_dbg_errno("unable to create key description for cell '%s'\n",cell);
+        return(-1);
+    }
+
+    _KAFS_STAT_INC(keyring_calls);
+    key_serial_t kt = _kafs_backend->search(_kafs_token_keyring,_KAFS_KEY_SPEC_RXRPC_TYPE,keydesc,0);
+    free(keydesc);
+    if( kt == -1 ){
+        _kafs_dbg("no AFS token for the cell '%s'\n",cell);
+        return(-1);
+    }
+
+    char    keystr[16];
+    snprintf(keystr,sizeof(keystr),"%08x ",kt);
+
+    FILE* p_fk = _kafs_backend->open_proc_keys();
+    if( p_fk == NULL ){
+        _kafs_dbg_errno("unable to open '%s'\n",_KAFS_PROC_KEYS);
+        return(-1);
+    }
+
+    /* /proc/keys provides only remaining time rounded down to s, m, h, d or w */
+    char buf[PATH_MAX];
+    char tmp[PATH_MAX];
+    char exp[PATH_MAX];
+
+    ret = -1;
+    while( fgets(buf,sizeof(buf),p_fk) != NULL ){
+        if( strstr(buf,keystr) != buf ) continue;
+
+        sscanf(buf,"%s %s %s %s",tmp,tmp,tmp,exp);
+
+        long    value = 0;
+        char    unit = 0;
+        if( strcmp(exp,"perm") == 0 ){
+            *expiry = 0x7fffffff;
+            ret = 0;
+        } else if( strcmp(exp,"expd") == 0 ){
+            *expiry = time(NULL);
+            ret = 0;
+        } else if( sscanf(exp,"%ld%c",&value,&unit) == 2 ){
+            switch(unit){
+                case 'w': value *= 7;
+                /* fall through */
+                case 'd': value *= 24;
+                /* fall through */
+                case 'h': value *= 60;
+                /* fall through */
+                case 'm': value *= 60;
+                /* fall through */
+                case 's':
+                    *expiry = time(NULL) + value;
+                    ret = 0;
+                    break;
+            }
+        }
+        break;
+    }
+    fclose(p_fk);
+
+    if( ret == 0 ){
+        _kafs_dbg("AFS token for the cell '%s' expires in %ld s\n",cell,(long)(*expiry - time(NULL)));
+    }
+
+    return(ret);
+}
+
+/* ============================================================================= */
+
+int _kafs_install_token(const char* keydesc,const void* payload,size_t plen,int* replaced)
+{
+    _kafs_dbg("-> _kafs_install_token\n");
+
+    /*
+     * keyctl_update is not supported on rxrpc keys
+     *
+     * add_key will substitute a previous key, which is detached from the current session keyring.
+     * With standard righs, the old key becomes practically inaccessible for user but it still
+     * occupies kernel until it expires. This can cause problems with quota reserved for user keys.
+     *
+     * it seems that this is a bug in kAFS, which does not properly handle rxrpc keys,
+     * which should not be used.
+     *
+     */
+
+    key_serial_t old_kt;
+    _KAFS_STAT_INC(keyring_calls);
+    old_kt = _kafs_backend->search(_kafs_token_keyring,"rxrpc",keydesc,0);
+    if( old_kt < 0 ){
+        _kafs_dbg_errno("AFS token '%s' does not exist yet\n",keydesc);
+    } else {
+        _kafs_dbg("Old AFS token found: %10d 0x%08x (%s)\n",old_kt,old_kt,keydesc);
+        /* grant user proper rights, which are required later for key invalidation */
+        _KAFS_STAT_INC(keyring_calls);
+        if( _kafs_backend->setperm(old_kt,(KEY_POS_ALL & ~KEY_POS_WRITE)|(KEY_USR_ALL & ~KEY_USR_WRITE)) != 0 ){
+            _kafs_dbg_errno("unable to set permission on old AFS token: %10d 0x%08x (%s)\n",old_kt,old_kt,keydesc);
+            /* ignore this error */
+        }
+    }
+
+    key_serial_t kt;
+    _KAFS_STAT_INC(keyring_calls);
+    kt = _kafs_backend->add_key(_KAFS_KEY_SPEC_RXRPC_TYPE, keydesc, payload, plen, _kafs_token_keyring);
+    if( kt < 0 ){
+        _kafs_dbg_errno("AFS token: unable to add rxrpc key (%s)\n",keydesc);
+        /* revert back rights on old key */
+        if( old_kt != -1 ){
+            _KAFS_STAT_INC(keyring_calls);
+            if( _kafs_backend->setperm(old_kt,(KEY_POS_ALL & ~KEY_POS_WRITE) | KEY_USR_VIEW) != 0 ){
+                _kafs_dbg_errno("unable to restore permission on old AFS token: %10d 0x%08x (%s)\n",old_kt,old_kt,keydesc);
+            }
+        }
+    } else {
+        _kafs_dbg("AFS token created: %10d 0x%08x (%s)\n",kt,kt,keydesc);
+        if( replaced != NULL ) *replaced = (old_kt != -1);
+    }
+
+    if( (kt != -1) && (old_kt != -1) ){
+        /* shorten expiration time of the previous key to 60 s*/
+        _KAFS_STAT_INC(keyring_calls);
+        _kafs_backend->set_timeout(old_kt,60);
+        /* and invalidate the key */
+        _KAFS_STAT_INC(keyring_calls);
+        if( _kafs_backend->invalidate(old_kt) != 0 ){
+            _kafs_dbg_errno("unable to invalidate previous AFS token: %10d 0x%08x (%s)\n",old_kt,old_kt,keydesc);
+        } else {
+            _kafs_dbg("Old AFS token revoked: %10d 0x%08x (%s)\n",old_kt,old_kt,keydesc);
+        }
+    }
+
+    if( kt == - 1 ) return(-1);
+    return(0);
+}
+
+/* ============================================================================= */
+
+int _kafs_set_token_client(const char* cell,const char* principal,time_t expiry)
+{
+    _kafs_dbg("-> _kafs_set_token_client\n");
+
+    char*   keydesc;
+    int     ret;
+
+    ret = asprintf(&keydesc, _KAFS_CLIENT_KEY_PREFIX "%s", cell);
+    if( ret == -1 ) {
+        errno = ENOMEM;
+        _kafs_dbg_errno("unable to create key description for cell '%s'\n",cell);
+        return(-1);
+    }
+
+    /* user keys are updated in place, so the record always follows the last token */
+    key_serial_t kt;
+    _KAFS_STAT_INC(keyring_calls);
+    kt = _kafs_backend->add_key("user", keydesc, principal, strlen(principal), _kafs_token_keyring);
+    if( kt == -1 ){
+        _kafs_dbg_errno("unable to record client '%s' of AFS token for the cell '%s'\n",principal,cell);
+        free(keydesc);
+        return(-1);
+    }
+
+    /* the owner can find the record in PAGs, which it does not possess, see kafs_get_token_client() */
+    _KAFS_STAT_INC(keyring_calls);
+    if( _kafs_backend->setperm(kt,KEY_POS_ALL | KEY_USR_VIEW | KEY_USR_READ | KEY_USR_SEARCH) != 0 ){
+        _kafs_dbg_errno("unable to set permission on the client record '%s'\n",keydesc);
+    }
+
+    /* the record expires with the token */
+    time_t now = time(NULL);
+    _KAFS_STAT_INC(keyring_calls);
+    _kafs_backend->set_timeout(kt,expiry > now ? (unsigned)(expiry - now) : 1);
+
+    _kafs_dbg("AFS token client recorded: %10d 0x%08x (%s -> %s)\n",kt,kt,keydesc,principal);
+    free(keydesc);
+    return(0);
+}
+
+/* ============================================================================= */
@@ -0,0 +1,295 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+/*
+ * Copyright (c) 1995, 1996, 1997, 1998, 1999 Kungliga Tekniska Högskolan
+ * (Royal Institute of Technology, Stockholm, Sweden).
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the Institute nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE INSTITUTE AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE INSTITUTE OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+/* aklog.c: description
+ *
+ * Copyright (C) 2017 Red Hat, Inc. All Rights Reserved.
+ * Written by David Howells (dhowells@redhat.com)
+ *
+ * Based on code:
+ * Copyright (C) 2007 Red Hat, Inc. All Rights Reserved.
+ * Written by David Howells (dhowells@redhat.com)
+ * Copyright (C) 2008 Chaskiel Grundman. All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ *
+ * Kerberos-5 strong enctype support for rxkad:
+ *      https://tools.ietf.org/html/draft-kaduk-afs3-rxkad-k5-kdf-00
+ *
+ * Invoke as: aklog-k5 <cell> [<realm>]
+ */
+
+#ifndef __KAFS_CORE_LOCL_H__
+#define __KAFS_CORE_LOCL_H__
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <keyutils.h>
+#include <pthread.h>
+
+/* ============================================================================= */
+
+/* payload of rxrpc key with AFS token */
+struct rxrpc_key_sec2_v1 {
+        uint32_t        kver;                   /* key payload interface version */
+        uint16_t        security_index;         /* RxRPC header security index */
+        uint16_t        ticket_length;          /* length of ticket[] */
+        uint32_t        expiry;                 /* time at which expires */
+        uint32_t        kvno;                   /* key version number */
+        uint8_t         session_key[8];         /* DES session key */
+        uint8_t         ticket[];               /* the encrypted ticket as felxible array */
+};
+
+#define RXKAD_TKT_TYPE_KERBEROS_V5              256
+
+/* ============================================================================= */
+
+/* keyring and kAFS backend
+ * all keyutils calls and kAFS probes go through the selected backend,
+ * the kernel one is used by default, the in-memory one allows to run the library
+ * without kAFS and session keyrings (KAFS_BACKEND=mem or -DKAFS_MEM_BACKEND)
+ */
+struct kafs_backend {
+    const char*     name;
+    int             (*hasafs)(void);
+    key_serial_t    (*join_session_keyring)(const char* name);
+    long            (*link)(key_serial_t key,key_serial_t keyring);
+    long            (*setperm)(key_serial_t key,key_perm_t perm);
+    int             (*describe_alloc)(key_serial_t key,char** desc);
+    key_serial_t    (*get_keyring_ID)(key_serial_t key,int create);
+    long            (*invalidate)(key_serial_t key);
+    long            (*set_timeout)(key_serial_t key,unsigned timeout);
+    long            (*search)(key_serial_t keyring,const char* type,const char* desc,key_serial_t dest);
+    key_serial_t    (*add_key)(const char* type,const char* desc,const void* payload,size_t plen,key_serial_t keyring);
+    int             (*session_key_scan)(recursive_key_scanner_t func,void* data);
+    FILE*           (*open_proc_keys)(void);
+    long            (*get_persistent)(uid_t uid,key_serial_t dest);
+    int             (*read_alloc)(key_serial_t key,void** buffer);
+    long            (*unlink)(key_serial_t key,key_serial_t keyring);
+};
+
+#define _KAFS_BACKEND_ENV           "KAFS_BACKEND"
+#define _KAFS_MEM_MAXKEYS_ENV       "KAFS_MEM_MAXKEYS"
+#define _KAFS_MEM_MAXBYTES_ENV      "KAFS_MEM_MAXBYTES"
+
+/* ============================================================================= */
+
+/* Default to a hidden visibility for all internal functions. */
+#pragma GCC visibility push(hidden)
+
+/* ============================================================================= */
+
+/*
+ * 0 - no debug
+ * 1 - debug to stderr
+ * 2 - debug to the /tmp/kafs file
+ * 3 - debug to syslog (journald)
+ */
+
+extern int _kafs_debug;
+
+/* debug lines are prefixed by monotonic time, pid and uid,
+ * stderr and the file sink are buffered until kafs_flush_log(), a level change, or unload */
+#define _KAFS_LOG_LINE      1024
+#define _KAFS_LOG_BUFFER    16384
+
+extern pthread_mutex_t  _kafs_log_lock;
+extern int              _kafs_log_fd;
+extern int              _kafs_log_bol;
+extern char             _kafs_log_buf[_KAFS_LOG_BUFFER];
+extern size_t           _kafs_log_len;
+
+/* cached results of environment probes
+ * -1 - unknown
+ */
+extern int          _kafs_probe_hasafs;
+extern int          _kafs_probe_haspag;
+extern key_serial_t _kafs_probe_pag_id;
+
+/* keyring, into which new AFS tokens are installed by the thread, see kafs_set_token_keyring() */
+extern _Thread_local key_serial_t _kafs_token_keyring;
+
+/* ============================================================================= */
+
+/* configuration files, only benchmarks linked with the library sources change them */
+extern const char*  _kafs_path_thiscell;
+extern const char*  _kafs_path_thesecells;
+extern const char*  _kafs_path_cellservdb;
+extern const char*  _kafs_path_cellrealms;
+extern const char*  _kafs_path_realm_cache;
+extern const char*  _kafs_path_usercells;
+extern const char*  _kafs_path_tokencache;
+
+/* ============================================================================= */
+
+/* selected backend */
+extern const struct kafs_backend*   _kafs_backend;
+extern const struct kafs_backend    _kafs_sys_backend;
+extern const struct kafs_backend    _kafs_mem_backend;
+
+/* select backend according to KAFS_BACKEND, called when the library is loaded */
+void _kafs_init_backend(void) __attribute__((constructor));
+
+/* ============================================================================= */
+
+/* statistics */
+extern struct kafs_stats _kafs_stats;
+
+#define _KAFS_STAT_INC(item)        __atomic_fetch_add(&_kafs_stats.item,1,__ATOMIC_RELAXED)
+#define _KAFS_STAT_ADD(item,value)  __atomic_fetch_add(&_kafs_stats.item,(value),__ATOMIC_RELAXED)
+
+/* ============================================================================= */
+
+/* print debug info */
+void _kafs_vdbg(const char* p_fmt,va_list vl);
+void _kafs_dbg(const char* p_fmt,...)       __attribute__((__format__(printf, 1, 2)));
+void _kafs_dbg_errno(const char* p_fmt,...) __attribute__((__format__(printf, 1, 2)));
+
+/* write buffered debug lines, _kafs_log_lock must be held */
+void _kafs_flush_log_locked(void);
+
+/* flush and close the file sink, called also when the library is unloaded */
+void _kafs_close_log(void) __attribute__((destructor));
+
+/* ============================================================================= */
+
+/* monotonic time in ms */
+long _kafs_now_ms(void);
+
+/* monotonic time in us */
+long _kafs_now_us(void);
+
+/* ============================================================================= */
+
+/* parse VL server from CellServDB line, the line is modified in place
+ * lines are: address #hostname, [address] #hostname for non-voting clones, or #hostname,
+ * the host name is returned when the address is missing, NULL for empty lines and for
+ * comments, which are # lines with more than one word or without a dot in the word
+ */
+char* _kafs_parse_vl_server(char* line);
+
+/* get expiration time of the AFS token for the cell from the token keyring
+ * return values:
+ *  0 OK
+ * -1 no token or unable to determine its expiration time
+ */
+int _kafs_get_token_expiry(const char* cell,time_t* expiry);
+
+/* install rxrpc key with the payload as AFS token into the token keyring, it replaces the previous token,
+ * replaced is set to 1 if there was a previous token, it can be NULL
+ * return values:
+ *  0 OK
+ * -1 error with details in errno
+ */
+int _kafs_install_token(const char* keydesc,const void* payload,size_t plen,int* replaced);
+
+/* record the client principal of the AFS token of the cell into the token keyring, the record expires
+ * with the token and it is removed by k_unlog() and k_unlog_cell(), see kafs_get_token_client()
+ * return values:
+ *  0 OK
+ * -1 error with details in errno
+ */
+int _kafs_set_token_client(const char* cell,const char* principal,time_t expiry);
+
+/* ============================================================================= */
+
+/* persistent token cache of the user, see kafs_tokcache.c */
+#define _KAFS_TOKCACHE_KEYRING      "_kafs.tokens"
+#define _KAFS_TOKCACHE_FRESHNESS    300         /* s, default minimum remaining lifetime of cached tokens */
+#define _KAFS_TOKCACHE_MAX_PAYLOAD  32767       /* limit of user keys */
+
+/* minimum remaining lifetime of cached tokens of the cell from TokenCache, -1 - the cache is disabled for the cell */
+long _kafs_cache_freshness(const char* cell);
+
+/* store copy of the token created for the principal into the cache, errors are not fatal for callers
+ * return values:
+ *  0 OK or the cache is not used for the cell
+ * -1 error with details in errno
+ */
+int _kafs_cache_store(const char* cell,const char* principal,const void* payload,size_t plen,time_t expiry);
+
+/* install the cached token of the cell into the token keyring if it was created for the principal
+ * return values:
+ *  0 OK, expiry of the token is set
+ * -1 no usable token in the cache or error with details in errno
+ */
+int _kafs_cache_seed(const char* cell,const char* principal,time_t* expiry);
+
+/* ============================================================================= */
+
+/* growable list of strings, the strings are packed one after another into one buffer,
+ * duplicates are looked up in an open addressing hash index of string offsets */
+struct _kafs_list {
+    char*   buff;
+    size_t  len;        /* used bytes including terminating zeros */
+    size_t  size;       /* allocated bytes */
+    int     nitems;
+    size_t* index;      /* offset + 1 of indexed strings, 0 marks an empty slot */
+    size_t  isize;      /* number of index slots, power of two */
+};
+
+/* add string to the list, duplicates found by cmp are skipped, cmp can be NULL
+ * return values:
+ *  1 added
+ *  0 duplicate
+ * -1 out-of-memory
+ */
+int _kafs_list_add(struct _kafs_list* list,const char* str,int (*cmp)(const char*,const char*));
+
+/* return the strings as NULL terminated list, the pointer array and the strings are
+ * allocated as one block released by free(), the builder is released in any case */
+char** _kafs_list_finish(struct _kafs_list* list);
+
+/* release the builder */
+void _kafs_list_free(struct _kafs_list* list);
+
+/* invalidate AFS token or its client record for k_unlog() */
+int _kafs_invalidate_key(key_serial_t parent,key_serial_t key, char *desc, int desc_len, void *data);
+
+/* list AFS tokens for k_list_tokens() */
+int _kafs_list_key(key_serial_t parent,key_serial_t key, char *desc, int desc_len, void *data);
+
+/* ============================================================================= */
+
+/* Undo default visibility change. */
+#pragma GCC visibility pop
+
+/* ============================================================================= */
+
+#endif /* __KAFS_CORE_LOCL_H__ */
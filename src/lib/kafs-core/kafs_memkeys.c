@@ -0,0 +1,914 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * In-memory stand-in for session keyrings and kAFS.
+ *
+ * It mimics the kernel behaviour relevant for libkafs:
+ *  - session, user and user session keyrings of the process
+ *  - one persistent keyring, the thread keyring is not emulated and all keys are possessed
+ *  - add_key() replaces a key with the same type and description in the keyring,
+ *    the old key is detached but it still occupies quota until it expires or is invalidated,
+ *    user keys are updated in place
+ *  - rxrpc keys expire at the time stored in the payload
+ *  - key quota (KAFS_MEM_MAXKEYS, KAFS_MEM_MAXBYTES, defaults as in the kernel)
+ *  - /proc/keys in the kernel format
+ *  - kAFS is always present
+ *
+ * The state is process-wide and protected by a single lock. Slots of dead keys are
+ * reused, key serials combine the slot index with its generation so that serials
+ * of dead keys are not resolved to new keys.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <keyutils.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <kafs-core.h>
+#include <kafs_core_locl.h>
+
+/* ============================================================================= */
+
+#define _KAFS_MEM_SERIAL_BASE       0x20000000
+#define _KAFS_MEM_INDEX_BITS        20
+#define _KAFS_MEM_MAX_SLOTS         (1 << _KAFS_MEM_INDEX_BITS)
+#define _KAFS_MEM_GENERATIONS       1024    /* serials stay below 0x60000000 */
+#define _KAFS_MEM_KEYRING_TYPE      "keyring"
+#define _KAFS_MEM_USER_TYPE         "user"
+#define _KAFS_MEM_DEFAULT_PERM      (KEY_POS_ALL | KEY_USR_VIEW)
+#define _KAFS_MEM_MAX_DEPTH         6
+
+struct _kafs_mem_key {
+    char*           type;
+    char*           desc;
+    void*           payload;
+    size_t          plen;
+    key_perm_t      perm;
+    time_t          expiry;     /* 0 - permanent */
+    int             dead;
+    int             gen;        /* generation of the slot */
+    key_serial_t*   links;      /* contents of keyring */
+    int             nlinks;
+    int             mlinks;
+};
+
+static pthread_mutex_t          _kafs_mem_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct _kafs_mem_key*    _kafs_mem_keys = NULL;
+static int                      _kafs_mem_nkeys = 0;
+static int                      _kafs_mem_mkeys = 0;
+static int                      _kafs_mem_ndead = 0;
+static int                      _kafs_mem_ready = 0;
+
+static key_serial_t             _kafs_mem_session = -1;
+static key_serial_t             _kafs_mem_user = -1;
+static key_serial_t             _kafs_mem_user_session = -1;
+static key_serial_t             _kafs_mem_persistent = -1;
+
+/* quota */
+static unsigned long            _kafs_mem_qnkeys = 0;
+static unsigned long            _kafs_mem_qnbytes = 0;
+static unsigned long            _kafs_mem_maxkeys = 0;
+static unsigned long            _kafs_mem_maxbytes = 0;
+
+/* ============================================================================= */
+
+static int _kafs_mem_is_keyring(struct _kafs_mem_key* p_key)
+{
+    return( strcmp(p_key->type,_KAFS_MEM_KEYRING_TYPE) == 0 );
+}
+
+/* ============================================================================= */
+
+static int _kafs_mem_is_expired(struct _kafs_mem_key* p_key,time_t now)
+{
+    return( (p_key->expiry != 0) && (p_key->expiry <= now) );
+}
+
+/* ============================================================================= */
+
+static key_serial_t _kafs_mem_serial(int i)
+{
+    return( _KAFS_MEM_SERIAL_BASE + (_kafs_mem_keys[i].gen << _KAFS_MEM_INDEX_BITS) + i );
+}
+
+/* ============================================================================= */
+
+static struct _kafs_mem_key* _kafs_mem_at(key_serial_t serial)
+{
+    if( serial < _KAFS_MEM_SERIAL_BASE ) return(NULL);
+    int i = (serial - _KAFS_MEM_SERIAL_BASE) & (_KAFS_MEM_MAX_SLOTS - 1);
+    int gen = (serial - _KAFS_MEM_SERIAL_BASE) >> _KAFS_MEM_INDEX_BITS;
+    if( (i >= _kafs_mem_nkeys) || (_kafs_mem_keys[i].gen != gen) ) return(NULL);
+    return(&_kafs_mem_keys[i]);
+}
+
+/* ============================================================================= */
+
+/* resolve special IDs, the lock must be held */
+static key_serial_t _kafs_mem_resolve(key_serial_t serial)
+{
+    switch(serial){
+        case KEY_SPEC_SESSION_KEYRING:
+            serial = _kafs_mem_session;
+            break;
+        case KEY_SPEC_USER_KEYRING:
+            serial = _kafs_mem_user;
+            break;
+        case KEY_SPEC_USER_SESSION_KEYRING:
+            serial = _kafs_mem_user_session;
+            break;
+        default:
+            break;
+    }
+
+    struct _kafs_mem_key* p_key = _kafs_mem_at(serial);
+    if( (p_key == NULL) || p_key->dead ){
+        errno = ENOKEY;
+        return(-1);
+    }
+    return(serial);
+}
+
+/* ============================================================================= */
+
+/* release the key, the lock must be held */
+static void _kafs_mem_kill(key_serial_t serial)
+{
+    struct _kafs_mem_key* p_key = _kafs_mem_at(serial);
+    if( (p_key == NULL) || p_key->dead ) return;
+
+    p_key->dead = 1;
+    _kafs_mem_qnkeys--;
+    _kafs_mem_qnbytes -= p_key->plen;
+
+    free(p_key->type);
+    p_key->type     = NULL;
+    free(p_key->desc);
+    p_key->desc     = NULL;
+    free(p_key->payload);
+    p_key->payload  = NULL;
+    p_key->plen     = 0;
+    free(p_key->links);
+    p_key->links    = NULL;
+    p_key->nlinks   = 0;
+    p_key->mlinks   = 0;
+
+    /* unlink it from all keyrings */
+    for(int i=0; i < _kafs_mem_nkeys; i++){
+        struct _kafs_mem_key* p_ring = &_kafs_mem_keys[i];
+        for(int j=0; j < p_ring->nlinks; j++){
+            if( p_ring->links[j] == serial ){
+                p_ring->links[j] = p_ring->links[--p_ring->nlinks];
+                j--;
+            }
+        }
+    }
+
+    /* the slot can be reused, the old serial does not match anymore */
+    p_key->gen = (p_key->gen + 1) % _KAFS_MEM_GENERATIONS;
+    _kafs_mem_ndead++;
+}
+
+/* ============================================================================= */
+
+/* release expired keys, the lock must be held */
+static void _kafs_mem_gc(void)
+{
+    time_t now = time(NULL);
+    for(int i=0; i < _kafs_mem_nkeys; i++){
+        struct _kafs_mem_key* p_key = &_kafs_mem_keys[i];
+        if( (p_key->dead == 0) && _kafs_mem_is_expired(p_key,now) ){
+            _kafs_mem_kill(_kafs_mem_serial(i));
+        }
+    }
+}
+
+/* ============================================================================= */
+
+/* create new key, the lock must be held */
+static key_serial_t _kafs_mem_new(const char* type,const char* desc,const void* payload,size_t plen)
+{
+    if( (_kafs_mem_qnkeys + 1 > _kafs_mem_maxkeys) || (_kafs_mem_qnbytes + plen > _kafs_mem_maxbytes) ){
+        _kafs_mem_gc();
+        if( (_kafs_mem_qnkeys + 1 > _kafs_mem_maxkeys) || (_kafs_mem_qnbytes + plen > _kafs_mem_maxbytes) ){
+            errno = EDQUOT;
+            return(-1);
+        }
+    }
+
+    /* a slot of a dead key or a new one */
+    int i = _kafs_mem_nkeys;
+    if( _kafs_mem_ndead > 0 ){
+        for(i=0; i < _kafs_mem_nkeys; i++){
+            if( _kafs_mem_keys[i].dead ) break;
+        }
+    }
+
+    if( i == _kafs_mem_nkeys ){
+        if( _kafs_mem_nkeys == _KAFS_MEM_MAX_SLOTS ){
+            errno = EDQUOT;
+            return(-1);
+        }
+        if( _kafs_mem_nkeys == _kafs_mem_mkeys ){
+            int mkeys = _kafs_mem_mkeys ? 2*_kafs_mem_mkeys : 64;
+            struct _kafs_mem_key* p_keys = realloc(_kafs_mem_keys,mkeys*sizeof(struct _kafs_mem_key));
+            if( p_keys == NULL ){
+                errno = ENOMEM;
+                return(-1);
+            }
+            _kafs_mem_keys = p_keys;
+            _kafs_mem_mkeys = mkeys;
+        }
+        _kafs_mem_keys[i].gen = 0;
+    }
+
+    struct _kafs_mem_key* p_key = &_kafs_mem_keys[i];
+    int gen = p_key->gen;
+    memset(p_key,0,sizeof(struct _kafs_mem_key));
+    p_key->gen = gen;
+    p_key->dead = 1;
+
+    p_key->type = strdup(type);
+    p_key->desc = strdup(desc != NULL ? desc : "");
+    if( plen > 0 ){
+        p_key->payload = malloc(plen);
+    }
+    if( (p_key->type == NULL) || (p_key->desc == NULL) || ((plen > 0) && (p_key->payload == NULL)) ){
+        free(p_key->type);
+        free(p_key->desc);
+        free(p_key->payload);
+        p_key->type = NULL;
+        p_key->desc = NULL;
+        p_key->payload = NULL;
+        errno = ENOMEM;
+        return(-1);
+    }
+    if( plen > 0 ){
+        memcpy(p_key->payload,payload,plen);
+    }
+    p_key->plen = plen;
+    p_key->perm = _KAFS_MEM_DEFAULT_PERM;
+
+    /* rxrpc keys expire together with the ticket */
+    if( (strcmp(type,_KAFS_KEY_SPEC_RXRPC_TYPE) == 0) && (plen >= sizeof(struct rxrpc_key_sec2_v1)) ){
+        const struct rxrpc_key_sec2_v1* p_tkn = payload;
+        p_key->expiry = p_tkn->expiry;
+    }
+
+    _kafs_mem_qnkeys++;
+    _kafs_mem_qnbytes += plen;
+
+    p_key->dead = 0;
+    if( i == _kafs_mem_nkeys ){
+        _kafs_mem_nkeys++;
+    } else {
+        _kafs_mem_ndead--;
+    }
+    return(_kafs_mem_serial(i));
+}
+
+/* ============================================================================= */
+
+/* link the key into the keyring, the lock must be held */
+static int _kafs_mem_add_link(struct _kafs_mem_key* p_ring,key_serial_t serial)
+{
+    for(int i=0; i < p_ring->nlinks; i++){
+        if( p_ring->links[i] == serial ) return(0);
+    }
+    if( p_ring->nlinks == p_ring->mlinks ){
+        int mlinks = p_ring->mlinks ? 2*p_ring->mlinks : 8;
+        key_serial_t* p_links = realloc(p_ring->links,mlinks*sizeof(key_serial_t));
+        if( p_links == NULL ){
+            errno = ENOMEM;
+            return(-1);
+        }
+        p_ring->links = p_links;
+        p_ring->mlinks = mlinks;
+    }
+    p_ring->links[p_ring->nlinks++] = serial;
+    return(0);
+}
+
+/* ============================================================================= */
+
+/* is the key reachable from the keyring? the lock must be held */
+static int _kafs_mem_reachable(key_serial_t ring,key_serial_t serial,int depth)
+{
+    if( ring == serial ) return(1);
+    if( depth > _KAFS_MEM_MAX_DEPTH ) return(0);
+
+    struct _kafs_mem_key* p_ring = _kafs_mem_at(ring);
+    if( (p_ring == NULL) || p_ring->dead || ! _kafs_mem_is_keyring(p_ring) ) return(0);
+
+    for(int i=0; i < p_ring->nlinks; i++){
+        if( _kafs_mem_reachable(p_ring->links[i],serial,depth+1) ) return(1);
+    }
+    return(0);
+}
+
+/* ============================================================================= */
+
+/* lock and lazily create initial keyrings */
+static int _kafs_mem_enter(void)
+{
+    pthread_mutex_lock(&_kafs_mem_lock);
+    if( _kafs_mem_ready ) return(0);
+
+    const char* p_val;
+    int         root = getuid() == 0;
+
+    _kafs_mem_maxkeys  = root ? 1000000 : 200;
+    _kafs_mem_maxbytes = root ? 25000000 : 20000;
+    if( (p_val = secure_getenv(_KAFS_MEM_MAXKEYS_ENV)) != NULL ){
+        _kafs_mem_maxkeys = strtoul(p_val,NULL,10);
+    }
+    if( (p_val = secure_getenv(_KAFS_MEM_MAXBYTES_ENV)) != NULL ){
+        _kafs_mem_maxbytes = strtoul(p_val,NULL,10);
+    }
+
+    char desc[64];
+
+    snprintf(desc,sizeof(desc),"_uid.%u",(unsigned)getuid());
+    _kafs_mem_user = _kafs_mem_new(_KAFS_MEM_KEYRING_TYPE,desc,NULL,0);
+
+    snprintf(desc,sizeof(desc),"_uid_ses.%u",(unsigned)getuid());
+    _kafs_mem_user_session = _kafs_mem_new(_KAFS_MEM_KEYRING_TYPE,desc,NULL,0);
+
+    _kafs_mem_session = _kafs_mem_new(_KAFS_MEM_KEYRING_TYPE,"_ses",NULL,0);
+
+    if( (_kafs_mem_user == -1) || (_kafs_mem_user_session == -1) || (_kafs_mem_session == -1) ){
+        pthread_mutex_unlock(&_kafs_mem_lock);
+        errno = ENOMEM;
+        return(-1);
+    }
+    _kafs_mem_add_link(_kafs_mem_at(_kafs_mem_user_session),_kafs_mem_user);
+
+    _kafs_mem_ready = 1;
+    return(0);
+}
+
+/* ============================================================================= */
+
+static void _kafs_mem_leave(void)
+{
+    pthread_mutex_unlock(&_kafs_mem_lock);
+}
+
+/* ============================================================================= */
+/* ============================================================================= */
+
+static int _kafs_mem_hasafs(void)
+{
+    return(1);
+}
+
+/* ============================================================================= */
+
+static key_serial_t _kafs_mem_join_session_keyring(const char* name)
+{
+    if( _kafs_mem_enter() != 0 ) return(-1);
+
+    key_serial_t serial = -1;
+
+    /* join existing named keyring */
+    if( name != NULL ){
+        for(int i=0; i < _kafs_mem_nkeys; i++){
+            struct _kafs_mem_key* p_key = &_kafs_mem_keys[i];
+            if( (p_key->dead == 0) && _kafs_mem_is_keyring(p_key) && (strcmp(p_key->desc,name) == 0) ){
+                serial = _kafs_mem_serial(i);
+                break;
+            }
+        }
+    }
+
+    /* or create new one */
+    if( serial == -1 ){
+        serial = _kafs_mem_new(_KAFS_MEM_KEYRING_TYPE,name != NULL ? name : "_ses",NULL,0);
+    }
+    if( serial != -1 ){
+        _kafs_mem_session = serial;
+    }
+
+    _kafs_mem_leave();
+    return(serial);
+}
+
+/* ============================================================================= */
+
+static long _kafs_mem_link(key_serial_t key,key_serial_t keyring)
+{
+    if( _kafs_mem_enter() != 0 ) return(-1);
+
+    long ret = -1;
+    key    = _kafs_mem_resolve(key);
+    keyring = _kafs_mem_resolve(keyring);
+
+    if( (key != -1) && (keyring != -1) ){
+        if( ! _kafs_mem_is_keyring(_kafs_mem_at(keyring)) ){
+            errno = ENOTDIR;
+        } else if( _kafs_mem_reachable(key,keyring,0) ){
+            errno = EDEADLK;
+        } else {
+            ret = _kafs_mem_add_link(_kafs_mem_at(keyring),key);
+        }
+    }
+
+    _kafs_mem_leave();
+    return(ret);
+}
+
+/* ============================================================================= */
+
+static long _kafs_mem_setperm(key_serial_t key,key_perm_t perm)
+{
+    if( _kafs_mem_enter() != 0 ) return(-1);
+
+    long ret = -1;
+    key = _kafs_mem_resolve(key);
+    if( key != -1 ){
+        _kafs_mem_at(key)->perm = perm;
+        ret = 0;
+    }
+
+    _kafs_mem_leave();
+    return(ret);
+}
+
+/* ============================================================================= */
+
+static int _kafs_mem_describe_alloc(key_serial_t key,char** desc)
+{
+    if( _kafs_mem_enter() != 0 ) return(-1);
+
+    int ret = -1;
+    key = _kafs_mem_resolve(key);
+    if( key != -1 ){
+        struct _kafs_mem_key* p_key = _kafs_mem_at(key);
+        ret = asprintf(desc,"%s;%u;%u;%08x;%s",p_key->type,(unsigned)getuid(),(unsigned)getgid(),
+                       (unsigned)p_key->perm,p_key->desc);
+        if( ret == -1 ) errno = ENOMEM;
+    }
+
+    _kafs_mem_leave();
+    return(ret);
+}
+
+/* ============================================================================= */
+
+static key_serial_t _kafs_mem_get_keyring_ID(key_serial_t key,int create)
+{
+    if( _kafs_mem_enter() != 0 ) return(-1);
+
+    key_serial_t serial = _kafs_mem_resolve(key);
+    if( (serial == -1) && (key == KEY_SPEC_SESSION_KEYRING) && create ){
+        serial = _kafs_mem_new(_KAFS_MEM_KEYRING_TYPE,"_ses",NULL,0);
+        if( serial != -1 ) _kafs_mem_session = serial;
+    }
+
+    _kafs_mem_leave();
+    return(serial);
+}
+
+/* ============================================================================= */
+
+static long _kafs_mem_invalidate(key_serial_t key)
+{
+    if( _kafs_mem_enter() != 0 ) return(-1);
+
+    long ret = -1;
+    key = _kafs_mem_resolve(key);
+    if( key != -1 ){
+        _kafs_mem_kill(key);
+        ret = 0;
+    }
+
+    _kafs_mem_leave();
+    return(ret);
+}
+
+/* ============================================================================= */
+
+static long _kafs_mem_set_timeout(key_serial_t key,unsigned timeout)
+{
+    if( _kafs_mem_enter() != 0 ) return(-1);
+
+    long ret = -1;
+    key = _kafs_mem_resolve(key);
+    if( key != -1 ){
+        _kafs_mem_at(key)->expiry = timeout ? time(NULL) + timeout : 0;
+        ret = 0;
+    }
+
+    _kafs_mem_leave();
+    return(ret);
+}
+
+/* ============================================================================= */
+
+/* depth-first search in the keyring, the lock must be held */
+static key_serial_t _kafs_mem_find(key_serial_t ring,const char* type,const char* desc,
+                                   time_t now,int depth,int* expired)
+{
+    struct _kafs_mem_key* p_ring = _kafs_mem_at(ring);
+
+    for(int i=0; i < p_ring->nlinks; i++){
+        struct _kafs_mem_key* p_key = _kafs_mem_at(p_ring->links[i]);
+        if( (strcmp(p_key->type,type) == 0) && (strcmp(p_key->desc,desc) == 0) ){
+            if( ! _kafs_mem_is_expired(p_key,now) ) return(p_ring->links[i]);
+            *expired = 1;
+        }
+    }
+
+    if( depth >= _KAFS_MEM_MAX_DEPTH ) return(-1);
+
+    for(int i=0; i < p_ring->nlinks; i++){
+        struct _kafs_mem_key* p_key = _kafs_mem_at(p_ring->links[i]);
+        if( _kafs_mem_is_keyring(p_key) && ! _kafs_mem_is_expired(p_key,now) ){
+            key_serial_t serial = _kafs_mem_find(p_ring->links[i],type,desc,now,depth+1,expired);
+            if( serial != -1 ) return(serial);
+        }
+    }
+
+    return(-1);
+}
+
+/* ============================================================================= */
+
+static long _kafs_mem_search(key_serial_t keyring,const char* type,const char* desc,key_serial_t dest)
+{
+    if( _kafs_mem_enter() != 0 ) return(-1);
+
+    key_serial_t serial = -1;
+    keyring = _kafs_mem_resolve(keyring);
+
+    if( keyring != -1 ){
+        if( ! _kafs_mem_is_keyring(_kafs_mem_at(keyring)) ){
+            errno = ENOTDIR;
+        } else {
+            int expired = 0;
+            serial = _kafs_mem_find(keyring,type,desc,time(NULL),0,&expired);
+            if( serial == -1 ){
+                errno = expired ? EKEYEXPIRED : ENOKEY;
+            } else if( dest != 0 ){
+                dest = _kafs_mem_resolve(dest);
+                if( (dest == -1) || (_kafs_mem_add_link(_kafs_mem_at(dest),serial) != 0) ){
+                    serial = -1;
+                }
+            }
+        }
+    }
+
+    _kafs_mem_leave();
+    return(serial);
+}
+
+/* ============================================================================= */
+
+/* update user key in the keyring or create new one, the lock must be held */
+static key_serial_t _kafs_mem_update(key_serial_t keyring,const char* desc,const void* payload,size_t plen)
+{
+    struct _kafs_mem_key* p_ring = _kafs_mem_at(keyring);
+
+    for(int i=0; i < p_ring->nlinks; i++){
+        struct _kafs_mem_key* p_key = _kafs_mem_at(p_ring->links[i]);
+        if( (strcmp(p_key->type,_KAFS_MEM_USER_TYPE) != 0) || (strcmp(p_key->desc,desc) != 0) ) continue;
+
+        if( _kafs_mem_qnbytes - p_key->plen + plen > _kafs_mem_maxbytes ){
+            errno = EDQUOT;
+            return(-1);
+        }
+        void* p_data = NULL;
+        if( (plen > 0) && ((p_data = malloc(plen)) == NULL) ){
+            errno = ENOMEM;
+            return(-1);
+        }
+        if( plen > 0 ) memcpy(p_data,payload,plen);
+
+        _kafs_mem_qnbytes = _kafs_mem_qnbytes - p_key->plen + plen;
+        free(p_key->payload);
+        p_key->payload = p_data;
+        p_key->plen    = plen;
+        return(p_ring->links[i]);
+    }
+
+    return(_kafs_mem_new(_KAFS_MEM_USER_TYPE,desc,payload,plen));
+}
+
+/* ============================================================================= */
+
+static key_serial_t _kafs_mem_add_key(const char* type,const char* desc,const void* payload,size_t plen,key_serial_t keyring)
+{
+    if( (type == NULL) || (desc == NULL) ){
+        errno = EINVAL;
+        return(-1);
+    }
+
+    if( _kafs_mem_enter() != 0 ) return(-1);
+
+    key_serial_t serial = -1;
+    keyring = _kafs_mem_resolve(keyring);
+
+    if( keyring != -1 ){
+        if( ! _kafs_mem_is_keyring(_kafs_mem_at(keyring)) ){
+            errno = ENOTDIR;
+        } else if( strcmp(type,_KAFS_MEM_USER_TYPE) == 0 ){
+            serial = _kafs_mem_update(keyring,desc,payload,plen);
+        } else {
+            serial = _kafs_mem_new(type,desc,payload,plen);
+        }
+    }
+
+    if( serial != -1 ){
+        /* the new key replaces link to the old one, which is detached but kept */
+        struct _kafs_mem_key* p_ring = _kafs_mem_at(keyring);
+        int i;
+        for(i=0; i < p_ring->nlinks; i++){
+            struct _kafs_mem_key* p_key = _kafs_mem_at(p_ring->links[i]);
+            if( (strcmp(p_key->type,type) == 0) && (strcmp(p_key->desc,desc) == 0) ){
+                p_ring->links[i] = serial;
+                break;
+            }
+        }
+        if( (i == p_ring->nlinks) && (_kafs_mem_add_link(p_ring,serial) != 0) ){
+            _kafs_mem_kill(serial);
+            serial = -1;
+        }
+    }
+
+    _kafs_mem_leave();
+    return(serial);
+}
+
+/* ============================================================================= */
+
+struct _kafs_mem_scan_item {
+    key_serial_t    parent;
+    key_serial_t    key;
+    char*           desc;
+};
+
+struct _kafs_mem_scan {
+    struct _kafs_mem_scan_item* items;
+    int                         nitems;
+    int                         mitems;
+};
+
+/* ============================================================================= */
+
+/* collect keys in the same order as recursive_key_scan(), the lock must be held */
+static void _kafs_mem_collect(struct _kafs_mem_scan* p_scan,key_serial_t parent,key_serial_t serial,time_t now,int depth)
+{
+    struct _kafs_mem_key* p_key = _kafs_mem_at(serial);
+
+    if( _kafs_mem_is_keyring(p_key) && (depth < _KAFS_MEM_MAX_DEPTH) ){
+        for(int i=0; i < p_key->nlinks; i++){
+            _kafs_mem_collect(p_scan,serial,p_key->links[i],now,depth+1);
+        }
+    }
+
+    if( p_scan->nitems == p_scan->mitems ){
+        int mitems = p_scan->mitems ? 2*p_scan->mitems : 16;
+        struct _kafs_mem_scan_item* p_items = realloc(p_scan->items,mitems*sizeof(struct _kafs_mem_scan_item));
+        if( p_items == NULL ) return;
+        p_scan->items = p_items;
+        p_scan->mitems = mitems;
+    }
+
+    struct _kafs_mem_scan_item* p_item = &p_scan->items[p_scan->nitems++];
+    p_item->parent  = parent;
+    p_item->key     = serial;
+    p_item->desc    = NULL;
+
+    /* expired keys cannot be described */
+    if( ! _kafs_mem_is_expired(p_key,now) ){
+        if( asprintf(&p_item->desc,"%s;%u;%u;%08x;%s",p_key->type,(unsigned)getuid(),(unsigned)getgid(),
+                     (unsigned)p_key->perm,p_key->desc) == -1 ){
+            p_item->desc = NULL;
+        }
+    }
+}
+
+/* ============================================================================= */
+
+static int _kafs_mem_session_key_scan(recursive_key_scanner_t func,void* data)
+{
+    if( _kafs_mem_enter() != 0 ) return(0);
+
+    struct _kafs_mem_scan scan;
+    memset(&scan,0,sizeof(scan));
+
+    key_serial_t session = _kafs_mem_resolve(KEY_SPEC_SESSION_KEYRING);
+    if( session != -1 ){
+        _kafs_mem_collect(&scan,0,session,time(NULL),0);
+    }
+
+    _kafs_mem_leave();
+
+    /* callbacks can call the backend again */
+    int kcount = 0;
+    for(int i=0; i < scan.nitems; i++){
+        struct _kafs_mem_scan_item* p_item = &scan.items[i];
+        kcount += func(p_item->parent,p_item->key,p_item->desc,
+                       p_item->desc != NULL ? strlen(p_item->desc) : 0,data);
+        free(p_item->desc);
+    }
+    free(scan.items);
+
+    return(kcount);
+}
+
+/* ============================================================================= */
+
+static FILE* _kafs_mem_open_proc_keys(void)
+{
+    char*   p_text = NULL;
+    size_t  len = 0;
+
+    FILE* p_fw = open_memstream(&p_text,&len);
+    if( p_fw == NULL ) return(NULL);
+
+    if( _kafs_mem_enter() != 0 ){
+        fclose(p_fw);
+        free(p_text);
+        return(NULL);
+    }
+
+    time_t now = time(NULL);
+
+    for(int i=0; i < _kafs_mem_nkeys; i++){
+        struct _kafs_mem_key* p_key = &_kafs_mem_keys[i];
+        if( p_key->dead ) continue;
+
+        char timeout[24];
+        if( p_key->expiry == 0 ){
+            snprintf(timeout,sizeof(timeout),"perm");
+        } else if( p_key->expiry <= now ){
+            snprintf(timeout,sizeof(timeout),"expd");
+        } else {
+            long timo = p_key->expiry - now;
+            if( timo < 60 ){
+                snprintf(timeout,sizeof(timeout),"%lds",timo);
+            } else if( timo < 60*60 ){
+                snprintf(timeout,sizeof(timeout),"%ldm",timo/60);
+            } else if( timo < 60*60*24 ){
+                snprintf(timeout,sizeof(timeout),"%ldh",timo/(60*60));
+            } else if( timo < 60*60*24*7 ){
+                snprintf(timeout,sizeof(timeout),"%ldd",timo/(60*60*24));
+            } else {
+                snprintf(timeout,sizeof(timeout),"%ldw",timo/(60*60*24*7));
+            }
+        }
+
+        fprintf(p_fw,"%08x I--Q---     1 %4s %08x %5u %5u %-9.9s %s: ",
+                _kafs_mem_serial(i),timeout,(unsigned)p_key->perm,
+                (unsigned)getuid(),(unsigned)getgid(),p_key->type,p_key->desc);
+        if( _kafs_mem_is_keyring(p_key) ){
+            if( p_key->nlinks == 0 ){
+                fprintf(p_fw,"empty\n");
+            } else {
+                fprintf(p_fw,"%d\n",p_key->nlinks);
+            }
+        } else if( strcmp(p_key->type,_KAFS_KEY_SPEC_RXRPC_TYPE) == 0 ){
+            fprintf(p_fw,"ka\n");
+        } else {
+            fprintf(p_fw,"%lu\n",(unsigned long)p_key->plen);
+        }
+    }
+
+    _kafs_mem_leave();
+
+    if( fclose(p_fw) != 0 ){
+        free(p_text);
+        return(NULL);
+    }
+
+    /* the buffer allocated by fmemopen() is released by fclose() */
+    FILE* p_fk = fmemopen(NULL,len+1,"w+");
+    if( p_fk != NULL ){
+        fwrite(p_text,1,len,p_fk);
+        rewind(p_fk);
+    }
+    free(p_text);
+
+    return(p_fk);
+}
+
+/* ============================================================================= */
+
+static long _kafs_mem_get_persistent(uid_t uid,key_serial_t dest)
+{
+    if( _kafs_mem_enter() != 0 ) return(-1);
+
+    key_serial_t serial = -1;
+    if( _kafs_mem_resolve(_kafs_mem_persistent) != -1 ){
+        serial = _kafs_mem_persistent;
+    } else {
+        char desc[64];
+        snprintf(desc,sizeof(desc),"_persistent.%u",(unsigned)uid);
+        serial = _kafs_mem_new(_KAFS_MEM_KEYRING_TYPE,desc,NULL,0);
+        if( serial != -1 ) _kafs_mem_persistent = serial;
+    }
+
+    if( (serial != -1) && (dest != KEY_SPEC_THREAD_KEYRING) ){
+        dest = _kafs_mem_resolve(dest);
+        if( (dest == -1) || (_kafs_mem_add_link(_kafs_mem_at(dest),serial) != 0) ){
+            serial = -1;
+        }
+    }
+
+    _kafs_mem_leave();
+    return(serial);
+}
+
+/* ============================================================================= */
+
+static int _kafs_mem_read_alloc(key_serial_t key,void** buffer)
+{
+    if( _kafs_mem_enter() != 0 ) return(-1);
+
+    int ret = -1;
+    key = _kafs_mem_resolve(key);
+    if( key != -1 ){
+        struct _kafs_mem_key* p_key = _kafs_mem_at(key);
+        /* keyrings are read as a list of serials, other keys as payload with a trailing zero */
+        const void* p_data = p_key->payload;
+        size_t      len    = p_key->plen;
+        if( _kafs_mem_is_keyring(p_key) ){
+            p_data = p_key->links;
+            len    = p_key->nlinks*sizeof(key_serial_t);
+        }
+        if( _kafs_mem_is_expired(p_key,time(NULL)) ){
+            errno = EKEYEXPIRED;
+        } else if( (*buffer = malloc(len + 1)) == NULL ){
+            errno = ENOMEM;
+        } else {
+            if( len > 0 ) memcpy(*buffer,p_data,len);
+            ((char*)*buffer)[len] = '\0';
+            ret = len;
+        }
+    }
+
+    _kafs_mem_leave();
+    return(ret);
+}
+
+/* ============================================================================= */
+
+static long _kafs_mem_unlink(key_serial_t key,key_serial_t keyring)
+{
+    if( keyring == KEY_SPEC_THREAD_KEYRING ) return(0);
+
+    if( _kafs_mem_enter() != 0 ) return(-1);
+
+    long ret = -1;
+    key = _kafs_mem_resolve(key);
+    keyring = _kafs_mem_resolve(keyring);
+
+    if( (key != -1) && (keyring != -1) ){
+        struct _kafs_mem_key* p_ring = _kafs_mem_at(keyring);
+        errno = ENOENT;
+        for(int i=0; i < p_ring->nlinks; i++){
+            if( p_ring->links[i] == key ){
+                p_ring->links[i] = p_ring->links[--p_ring->nlinks];
+                ret = 0;
+                break;
+            }
+        }
+    }
+
+    _kafs_mem_leave();
+    return(ret);
+}
+
+/* ============================================================================= */
+
+const struct kafs_backend _kafs_mem_backend = {
+    .name                   = "mem",
+    .hasafs                 = _kafs_mem_hasafs,
+    .join_session_keyring   = _kafs_mem_join_session_keyring,
+    .link                   = _kafs_mem_link,
+    .setperm                = _kafs_mem_setperm,
+    .describe_alloc         = _kafs_mem_describe_alloc,
+    .get_keyring_ID         = _kafs_mem_get_keyring_ID,
+    .invalidate             = _kafs_mem_invalidate,
+    .set_timeout            = _kafs_mem_set_timeout,
+    .search                 = _kafs_mem_search,
+    .add_key                = _kafs_mem_add_key,
+    .session_key_scan       = _kafs_mem_session_key_scan,
+    .open_proc_keys         = _kafs_mem_open_proc_keys,
+    .get_persistent         = _kafs_mem_get_persistent,
+    .read_alloc             = _kafs_mem_read_alloc,
+    .unlink                 = _kafs_mem_unlink,
+};
+
+/* ============================================================================= */
@@ -0,0 +1,51 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+#ifndef __KAFS_PROBES_H__
+#define __KAFS_PROBES_H__
+
+/* ============================================================================= */
+
+/*
+ * USDT static tracepoints, enabled by -DKAFS_USDT (cmake -DENABLE_USDT=ON)
+ * durations are in microseconds
+ * see contrib/bpftrace for examples
+ */
+
+#ifdef KAFS_USDT
+
+#include <sys/sdt.h>
+#include <time.h>
+
+static inline long _kafs_probe_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return(ts.tv_sec*1000000L + ts.tv_nsec/1000);
+}
+
+#define KAFS_PROBE_START(start)                 long start = _kafs_probe_now_us()
+#define KAFS_PROBE_TIME(start)                  (_kafs_probe_now_us() - (start))
+
+#define KAFS_PROBE1(prov,name,a)                DTRACE_PROBE1(prov,name,a)
+#define KAFS_PROBE2(prov,name,a,b)              DTRACE_PROBE2(prov,name,a,b)
+#define KAFS_PROBE3(prov,name,a,b,c)            DTRACE_PROBE3(prov,name,a,b,c)
+#define KAFS_PROBE4(prov,name,a,b,c,d)          DTRACE_PROBE4(prov,name,a,b,c,d)
+
+#else
+
+#define KAFS_PROBE_START(start)
+#define KAFS_PROBE_TIME(start)
+
+#define KAFS_PROBE1(prov,name,a)
+#define KAFS_PROBE2(prov,name,a,b)
+#define KAFS_PROBE3(prov,name,a,b,c)
+#define KAFS_PROBE4(prov,name,a,b,c,d)
+
+#endif
+
+/* ============================================================================= */
+
+#endif /* __KAFS_PROBES_H__ */
@@ -0,0 +1,464 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * Per-user persistent cache of AFS tokens.
+ *
+ * Tokens created by the library are also stored into the _kafs.tokens keyring in the persistent
+ * keyring (keyctl_get_persistent()) of the owner of the token keyring. Entries are user keys
+ * "afs@<cell>" holding the NUL terminated name of the client principal followed by the rxrpc
+ * payload, they expire together with the token. New sessions install copies of still valid
+ * entries created for the principal of their ccache instead of contacting KDC. Copies are used
+ * rather than links, so unlog in one session does not destroy tokens of other sessions.
+ *
+ * TokenCache sets the minimum remaining lifetime of cached tokens per cell:
+ *   cell|.domain|*  seconds|off
+ * the cell takes precedence over the longest matching domain and over "*", "off" disables
+ * the cache for the cell.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <keyutils.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <time.h>
+
+#include <kafs-core.h>
+#include <kafs_core_locl.h>
+
+/* ============================================================================= */
+
+long _kafs_cache_freshness(const char* cell)
+{
+    long freshness = _KAFS_TOKCACHE_FRESHNESS;
+
+    _KAFS_STAT_INC(config_parses);
+    FILE* p_f = fopen(_kafs_path_tokencache,"r");
+    if( p_f == NULL ){
+        _kafs_dbg_errno("unable to open file '%s'\n",_kafs_path_tokencache);
+        /* this error is ignored */
+        return(freshness);
+    }
+
+    size_t  clen = strlen(cell);
+    size_t  best = 0;       /* 1 - "*", 2 + length - domain, SIZE_MAX - cell */
+    char    line[LINE_MAX];
+
+    while( fgets(line,sizeof(line),p_f) != NULL ){
+        char* p_save  = NULL;
+        char* p_name  = strtok_r(line," \t\n",&p_save);
+        char* p_value = strtok_r(NULL," \t\n",&p_save);
+        if( (p_name == NULL) || (p_name[0] == '#') || (p_value == NULL) ) continue;
+
+        size_t rank = 0;
+        size_t nlen = strlen(p_name);
+        if( strcasecmp(p_name,cell) == 0 ){
+            rank = SIZE_MAX;
+        } else if( (p_name[0] == '.') && (nlen < clen) && (strcasecmp(cell + clen - nlen,p_name) == 0) ){
+            rank = 2 + nlen;
+        } else if( strcmp(p_name,"*") == 0 ){
+            rank = 1;
+        }
+        /* the first line wins among lines with the same rank */
+        if( rank <= best ) continue;
+
+        best = rank;
+        if( strcmp(p_value,"off") == 0 ){
+            freshness = -1;
+        } else {
+            freshness = atol(p_value);
+            if( freshness < 0 ) freshness = -1;
+        }
+    }
+    fclose(p_f);
+
+    _kafs_dbg("token cache freshness for the cell '%s': %ld\n",cell,freshness);
+    return(freshness);
+}
+
+/* ============================================================================= */
+
+/* uid of the owner of the token keyring */
+static int _kafs_cache_owner(uid_t* uid)
+{
+    char*           p_desc = NULL;
+    unsigned int    kuid;
+
+    _KAFS_STAT_INC(keyring_calls);
+    if( _kafs_backend->describe_alloc(_kafs_token_keyring,&p_desc) == -1 ){
+        _kafs_dbg_errno("unable to describe token keyring\n");
+        return(-1);
+    }
+
+    char* p_uid = strchr(p_desc,';');
+    int   ret   = ( (p_uid != NULL) && (sscanf(p_uid + 1,"%u;",&kuid) == 1) ) ? 0 : -1;
+    free(p_desc);
+
+    if( ret != 0 ){
+        errno = EINVAL;
+        return(-1);
+    }
+    *uid = kuid;
+    return(0);
+}
+
+/* ============================================================================= */
+
+/* unlink the persistent keyring from the thread keyring */
+static void _kafs_cache_leave(key_serial_t pers)
+{
+    if( pers == -1 ) return;
+
+    int err = errno;
+    _KAFS_STAT_INC(keyring_calls);
+    _kafs_backend->unlink(pers,KEY_SPEC_THREAD_KEYRING);
+    errno = err;
+}
+
+/* ============================================================================= */
+
+/* return the cache keyring, the persistent keyring is linked into the thread keyring,
+ * so the cache is possessed until _kafs_cache_leave() */
+static key_serial_t _kafs_cache_enter(int create,key_serial_t* pers)
+{
+    uid_t uid;
+
+    *pers = -1;
+    if( _kafs_cache_owner(&uid) != 0 ) return(-1);
+
+    _KAFS_STAT_INC(keyring_calls);
+    *pers = _kafs_backend->get_persistent(uid,KEY_SPEC_THREAD_KEYRING);
+    if( *pers == -1 ){
+        _kafs_dbg_errno("unable to get persistent keyring of uid %u\n",(unsigned)uid);
+        return(-1);
+    }
+
+    _KAFS_STAT_INC(keyring_calls);
+    key_serial_t ring = _kafs_backend->search(*pers,"keyring",_KAFS_TOKCACHE_KEYRING,0);
+    if( (ring == -1) && create ){
+        _KAFS_STAT_INC(keyring_calls);
+        ring = _kafs_backend->add_key("keyring",_KAFS_TOKCACHE_KEYRING,NULL,0,*pers);
+    }
+    if( ring == -1 ){
+        _kafs_dbg_errno("no token cache of uid %u\n",(unsigned)uid);
+        _kafs_cache_leave(*pers);
+        *pers = -1;
+    }
+    return(ring);
+}
+
+/* ============================================================================= */
+
+int _kafs_cache_store(const char* cell,const char* principal,const void* payload,size_t plen,time_t expiry)
+{
+    _kafs_dbg("-> _kafs_cache_store\n");
+
+    long    freshness = _kafs_cache_freshness(cell);
+    long    lifetime  = expiry - time(NULL);
+    size_t  hlen      = strlen(principal) + 1;
+
+    /* disabled or useless for new sessions */
+    if( (freshness < 0) || (lifetime <= freshness) || (hlen + plen > _KAFS_TOKCACHE_MAX_PAYLOAD) ){
+        _kafs_dbg("AFS token for the cell '%s' is not cached\n",cell);
+        return(0);
+    }
+
+    char* keydesc;
+    if( asprintf(&keydesc, "afs@%s", cell) == -1 ){
+        errno = ENOMEM;
+        return(-1);
+    }
+
+    /* the principal is the header of the entry */
+    char* p_entry = malloc(hlen + plen);
+    if( p_entry == NULL ){
+        free(keydesc);
+        errno = ENOMEM;
+        return(-1);
+    }
+    memcpy(p_entry,principal,hlen);
+    memcpy(p_entry + hlen,payload,plen);
+
+    key_serial_t pers;
+    key_serial_t ring = _kafs_cache_enter(1,&pers);
+    key_serial_t kt   = -1;
+
+    if( ring != -1 ){
+        /* user keys are updated in place */
+        _KAFS_STAT_INC(keyring_calls);
+        kt = _kafs_backend->add_key("user",keydesc,p_entry,hlen + plen,ring);
+        if( kt == -1 ){
+            _kafs_dbg_errno("unable to store AFS token '%s' into the token cache\n",keydesc);
+        } else {
+            _KAFS_STAT_INC(keyring_calls);
+            _kafs_backend->set_timeout(kt,lifetime);
+            _kafs_dbg("AFS token stored into the token cache: %10d 0x%08x (%s)\n",kt,kt,keydesc);
+        }
+        _kafs_cache_leave(pers);
+    }
+
+    memset(p_entry,0,hlen + plen);
+    free(p_entry);
+    free(keydesc);
+    return( kt == -1 ? -1 : 0 );
+}
+
+/* ============================================================================= */
+
+/* install the entry of the cache keyring as the token of the cell if it was created for the principal */
+static int _kafs_cache_install(key_serial_t ring,const char* cell,const char* principal,long freshness,time_t* expiry)
+{
+    char* keydesc;
+    if( asprintf(&keydesc, "afs@%s", cell) == -1 ){
+        errno = ENOMEM;
+        return(-1);
+    }
+
+    _KAFS_STAT_INC(keyring_calls);
+    key_serial_t entry = _kafs_backend->search(ring,"user",keydesc,0);
+    if( entry == -1 ){
+        _kafs_dbg("no cached AFS token for the cell '%s'\n",cell);
+        free(keydesc);
+        return(-1);
+    }
+
+    void* p_data = NULL;
+    _KAFS_STAT_INC(keyring_calls);
+    int len = _kafs_backend->read_alloc(entry,&p_data);
+    if( len == -1 ){
+        _kafs_dbg_errno("unable to read cached AFS token '%s'\n",keydesc);
+        free(keydesc);
+        return(-1);
+    }
+
+    const char*                     p_name = p_data;
+    const char*                     p_end  = memchr(p_name,0,len);
+    const char*                     p_tkn  = NULL;
+    size_t                          tlen   = 0;
+    int                             ret    = -1;
+
+    if( p_end != NULL ){
+        p_tkn = p_end + 1;
+        tlen  = len - (p_end + 1 - p_name);
+    }
+
+    /* the token follows the principal, so its header is copied before it is checked */
+    struct rxrpc_key_sec2_v1 tkn;
+    if( (p_tkn != NULL) && (tlen >= sizeof(tkn)) ) memcpy(&tkn,p_tkn,sizeof(tkn));
+
+    if( (p_tkn == NULL) || (tlen < sizeof(tkn)) || (tkn.kver != 1) || (tkn.security_index != 2) ||
+        (sizeof(tkn) + tkn.ticket_length != tlen) ){
+        _kafs_dbg("cached AFS token '%s' is malformed\n",keydesc);
+        errno = EINVAL;
+    } else if( strcmp(p_name,principal) != 0 ){
+        _kafs_dbg("cached AFS token '%s' was created for '%s' and not for '%s'\n",keydesc,p_name,principal);
+        errno = EKEYREJECTED;
+    } else if( (time_t)tkn.expiry - time(NULL) < freshness ){
+        _kafs_dbg("cached AFS token '%s' expires too soon\n",keydesc);
+        errno = EKEYEXPIRED;
+    } else {
+        ret = _kafs_install_token(keydesc,p_tkn,tlen,NULL);
+        if( ret == 0 ){
+            _KAFS_STAT_INC(tokens_cached);
+            _kafs_set_token_client(cell,principal,tkn.expiry);
+            *expiry = tkn.expiry;
+            _kafs_dbg("AFS token for the cell '%s' installed from the token cache\n",cell);
+        }
+    }
+
+    memset(p_data,0,len);
+    free(p_data);
+    free(keydesc);
+    return(ret);
+}
+
+/* ============================================================================= */
+
+int _kafs_cache_seed(const char* cell,const char* principal,time_t* expiry)
+{
+    _kafs_dbg("-> _kafs_cache_seed\n");
+
+    long freshness = _kafs_cache_freshness(cell);
+    if( freshness < 0 ){
+        errno = ENOKEY;
+        return(-1);
+    }
+
+    key_serial_t pers;
+    key_serial_t ring = _kafs_cache_enter(0,&pers);
+    if( ring == -1 ) return(-1);
+
+    int ret = _kafs_cache_install(ring,cell,principal,freshness,expiry);
+    _kafs_cache_leave(pers);
+
+    return(ret);
+}
+
+/* ============================================================================= */
+
+/* _kafs_cache_enter() failed because there is nothing to work with */
+static int _kafs_cache_missing(void)
+{
+    return( (errno == ENOKEY) || (errno == EOPNOTSUPP) );
+}
+
+/* ============================================================================= */
+
+/* return cells of the cache as NULL terminated list, the list is freed by free() */
+static char** _kafs_cache_cells(key_serial_t ring)
+{
+    key_serial_t* p_keys = NULL;
+    _KAFS_STAT_INC(keyring_calls);
+    int len = _kafs_backend->read_alloc(ring,(void**)&p_keys);
+    if( len == -1 ){
+        _kafs_dbg_errno("unable to read token cache\n");
+        return(NULL);
+    }
+
+    struct _kafs_list list;
+    memset(&list,0,sizeof(list));
+
+    for(size_t i=0; i < len/sizeof(key_serial_t); i++){
+        char* p_desc = NULL;
+        _KAFS_STAT_INC(keyring_calls);
+        if( _kafs_backend->describe_alloc(p_keys[i],&p_desc) == -1 ) continue;
+
+        /* user;uid;gid;perm;afs@cell */
+        char* p_name = p_desc;
+        for(int j=0; (j < 4) && (p_name != NULL); j++){
+            p_name = strchr(p_name,';');
+            if( p_name != NULL ) p_name++;
+        }
+        int ret = 0;
+        if( (strncmp(p_desc,"user;",5) == 0) && (p_name != NULL) && (strncmp(p_name,"afs@",4) == 0) ){
+            ret = _kafs_list_add(&list,p_name + 4,strcasecmp);
+        }
+        free(p_desc);
+
+        if( ret == -1 ){
+            _kafs_list_free(&list);
+            free(p_keys);
+            errno = ENOMEM;
+            return(NULL);
+        }
+    }
+    free(p_keys);
+
+    return(_kafs_list_finish(&list));
+}
+
+/* ============================================================================= */
+
+int kafs_seed_tokens(const char* principal,const char** cells)
+{
+    _kafs_dbg("-> kafs_seed_tokens\n");
+
+    if( principal == NULL ){
+        errno = EINVAL;
+        return(-1);
+    }
+
+    key_serial_t pers;
+    key_serial_t ring = _kafs_cache_enter(0,&pers);
+    if( ring == -1 ){
+        /* nothing cached yet or no persistent keyrings */
+        return( _kafs_cache_missing() ? 0 : -1 );
+    }
+
+    char** p_cached = NULL;
+    if( cells == NULL ){
+        p_cached = _kafs_cache_cells(ring);
+        if( p_cached == NULL ){
+            _kafs_cache_leave(pers);
+            return(-1);
+        }
+        cells = (const char**)p_cached;
+    }
+
+    int nseeded = 0;
+    for(int i=0; cells[i] != NULL; i++){
+        char* keydesc;
+        if( asprintf(&keydesc, "afs@%s", cells[i]) == -1 ) continue;
+
+        /* existing tokens are kept, e.g. in a shared PAG */
+        _KAFS_STAT_INC(keyring_calls);
+        key_serial_t kt = _kafs_backend->search(_kafs_token_keyring,_KAFS_KEY_SPEC_RXRPC_TYPE,keydesc,0);
+        free(keydesc);
+        if( kt != -1 ){
+            _kafs_dbg("AFS token for the cell '%s' already exists\n",cells[i]);
+            continue;
+        }
+
+        long    freshness = _kafs_cache_freshness(cells[i]);
+        time_t  expiry;
+        if( (freshness >= 0) && (_kafs_cache_install(ring,cells[i],principal,freshness,&expiry) == 0) ){
+            nseeded++;
+        }
+    }
+
+    _kafs_cache_leave(pers);
+    free(p_cached);
+
+    _kafs_dbg("%d AFS tokens installed from the token cache\n",nseeded);
+    return(nseeded);
+}
+
+/* ============================================================================= */
+
+int kafs_clear_token_cache(const char* cell)
+{
+    _kafs_dbg("-> kafs_clear_token_cache\n");
+
+    key_serial_t pers;
+    key_serial_t ring = _kafs_cache_enter(0,&pers);
+    if( ring == -1 ){
+        return( _kafs_cache_missing() ? 0 : -1 );
+    }
+
+    int ret = 0;
+
+    if( cell != NULL ){
+        char* keydesc;
+        if( asprintf(&keydesc, "afs@%s", cell) == -1 ){
+            _kafs_cache_leave(pers);
+            errno = ENOMEM;
+            return(-1);
+        }
+        _KAFS_STAT_INC(keyring_calls);
+        key_serial_t entry = _kafs_backend->search(ring,"user",keydesc,0);
+        if( entry != -1 ){
+            _KAFS_STAT_INC(keyring_calls);
+            ret = _kafs_backend->invalidate(entry);
+        }
+        free(keydesc);
+    } else {
+        /* entries are invalidated explicitly, they are not only unlinked with the keyring */
+        key_serial_t* p_keys = NULL;
+        _KAFS_STAT_INC(keyring_calls);
+        int len = _kafs_backend->read_alloc(ring,(void**)&p_keys);
+        for(int i=0; i < len/(int)sizeof(key_serial_t); i++){
+            _KAFS_STAT_INC(keyring_calls);
+            _kafs_backend->invalidate(p_keys[i]);
+        }
+        free(p_keys);
+        _KAFS_STAT_INC(keyring_calls);
+        ret = _kafs_backend->invalidate(ring);
+    }
+
+    if( ret != 0 ){
+        _kafs_dbg_errno("unable to clear token cache\n");
+        ret = -1;
+    }
+    _kafs_cache_leave(pers);
+
+    return(ret);
+}
+
+/* ============================================================================= */
@@ -0,0 +1,257 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * Per-user selection of cells.
+ *
+ * The cells are taken from the first available source:
+ *  - ~/.config/kafs/cells of the user, read with the current credentials
+ *  - the first line of UserCells for the user ("user cell ...")
+ *  - the first line of UserCells for a group of the user ("@group cell ...")
+ * The selection is intersected with TheseCells and ThisCell, so users cannot
+ * extend the set of cells configured by the administrator.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <keyutils.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <grp.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include <kafs-core.h>
+#include <kafs_core_locl.h>
+
+/* ============================================================================= */
+
+/* the user selection, duplicates are skipped */
+static int _kafs_sel_add(struct _kafs_list* sel,const char* cell)
+{
+    if( _kafs_list_add(sel,cell,strcasecmp) == -1 ) return(-1);
+    return(0);
+}
+
+/* ============================================================================= */
+
+/* open only regular files, a FIFO in the home directory must not block login */
+static FILE* _kafs_open_regular(const char* path)
+{
+    int fd = open(path,O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+    if( fd < 0 ) return(NULL);
+
+    struct stat st;
+    if( (fstat(fd,&st) != 0) || (! S_ISREG(st.st_mode)) ){
+        close(fd);
+        errno = EINVAL;
+        return(NULL);
+    }
+
+    FILE* p_f = fdopen(fd,"r");
+    if( p_f == NULL ) close(fd);
+    return(p_f);
+}
+
+/* ============================================================================= */
+
+/* add all cells from the rest of the line */
+static int _kafs_sel_add_line(struct _kafs_list* sel,char** p_save)
+{
+    char* p_cell;
+    while( (p_cell = strtok_r(NULL," \t\n",p_save)) != NULL ){
+        if( p_cell[0] == '#' ) break;
+        if( _kafs_sel_add(sel,p_cell) != 0 ) return(-1);
+    }
+    return(0);
+}
+
+/* ============================================================================= */
+
+/* cells from ~/.config/kafs/cells, separated by white spaces */
+static int _kafs_read_personal_cells(struct _kafs_list* sel,const struct passwd* pw)
+{
+    char path[PATH_MAX];
+    if( snprintf(path,sizeof(path),"%s/%s",pw->pw_dir,_PATH_KAFS_USER_PERSONAL_CELLS) >= (int)sizeof(path) ){
+        return(0);
+    }
+
+    _KAFS_STAT_INC(config_parses);
+    FILE* p_f = _kafs_open_regular(path);
+    if( p_f == NULL ){
+        _kafs_dbg_errno("unable to open file '%s'\n",path);
+        /* this error is ignored */
+        return(0);
+    }
+
+    char line[LINE_MAX];
+    int  ret = 0;
+    while( (ret == 0) && (fgets(line,sizeof(line),p_f) != NULL) ){
+        char* p_save = NULL;
+        char* p_cell = strtok_r(line," \t\n",&p_save);
+        if( (p_cell == NULL) || (p_cell[0] == '#') ) continue;
+        ret = _kafs_sel_add(sel,p_cell);
+        if( ret == 0 ) ret = _kafs_sel_add_line(sel,&p_save);
+    }
+    fclose(p_f);
+
+    if( sel->nitems > 0 ) _kafs_dbg(" personal cells: '%s'\n",path);
+    return(ret);
+}
+
+/* ============================================================================= */
+
+/* is the user member of the group? */
+static int _kafs_in_group(const struct passwd* pw,const char* group,gid_t* groups,int ngroups)
+{
+    struct group    gr;
+    struct group*   p_gr = NULL;
+    char            buf[4096];
+
+    if( (getgrnam_r(group,&gr,buf,sizeof(buf),&p_gr) != 0) || (p_gr == NULL) ) return(0);
+    if( p_gr->gr_gid == pw->pw_gid ) return(1);
+    for(int i=0; i < ngroups; i++){
+        if( groups[i] == p_gr->gr_gid ) return(1);
+    }
+    return(0);
+}
+
+/* ============================================================================= */
+
+/* cells from UserCells, a user line takes precedence over group lines */
+static int _kafs_read_mapped_cells(struct _kafs_list* sel,const struct passwd* pw)
+{
+    _KAFS_STAT_INC(config_parses);
+    FILE* p_f = fopen(_kafs_path_usercells,"r");
+    if( p_f == NULL ){
+        _kafs_dbg_errno("unable to open file '%s'\n",_kafs_path_usercells);
+        /* this error is ignored */
+        return(0);
+    }
+
+    gid_t*  groups  = NULL;
+    int     ngroups = -1;
+    long    group   = -1;       /* line of the first matching group */
+    long    lineno  = 0;
+    char    line[LINE_MAX];
+    int     ret     = 0;
+
+    /* the first pass looks for the user */
+    while( fgets(line,sizeof(line),p_f) != NULL ){
+        lineno++;
+        char* p_save = NULL;
+        char* p_name = strtok_r(line," \t\n",&p_save);
+        if( (p_name == NULL) || (p_name[0] == '#') ) continue;
+
+        if( p_name[0] != '@' ){
+            if( strcmp(p_name,pw->pw_name) != 0 ) continue;
+            ret = _kafs_sel_add_line(sel,&p_save);
+            _kafs_dbg(" user cells: '%s'\n",pw->pw_name);
+            group = -1;
+            break;
+        }
+        if( group >= 0 ) continue;
+
+        /* the group list is obtained only if there are group lines */
+        if( ngroups < 0 ){
+            ngroups = 0;
+            getgrouplist(pw->pw_name,pw->pw_gid,NULL,&ngroups);
+            groups = calloc(ngroups > 0 ? ngroups : 1,sizeof(gid_t));
+            if( (groups == NULL) || (getgrouplist(pw->pw_name,pw->pw_gid,groups,&ngroups) < 0) ) ngroups = 0;
+        }
+        if( _kafs_in_group(pw,p_name+1,groups,ngroups) ) group = lineno;
+    }
+
+    /* the second pass reads the line of the first matching group */
+    if( group >= 0 ){
+        rewind(p_f);
+        lineno = 0;
+        while( fgets(line,sizeof(line),p_f) != NULL ){
+            if( ++lineno < group ) continue;
+            char* p_save = NULL;
+            char* p_name = strtok_r(line," \t\n",&p_save);
+            ret = _kafs_sel_add_line(sel,&p_save);
+            _kafs_dbg(" group cells: '%s'\n",p_name);
+            break;
+        }
+    }
+
+    free(groups);
+    fclose(p_f);
+    return(ret);
+}
+
+/* ============================================================================= */
+
+char** kafs_get_user_cells(const char* user)
+{
+    _kafs_dbg("-> kafs_get_user_cells\n");
+
+    char** p_cells = kafs_get_these_cells();
+    if( p_cells == NULL ) return(NULL);
+
+    struct passwd   pw;
+    struct passwd*  p_pw = NULL;
+    char            buf[4096];
+    int             ret;
+
+    if( user != NULL ){
+        ret = getpwnam_r(user,&pw,buf,sizeof(buf),&p_pw);
+    } else {
+        ret = getpwuid_r(geteuid(),&pw,buf,sizeof(buf),&p_pw);
+    }
+    if( (ret != 0) || (p_pw == NULL) ){
+        _kafs_dbg(" unknown user '%s', all cells are used\n",user ? user : "-");
+        return(p_cells);
+    }
+
+    long start = _kafs_now_us();
+
+    struct _kafs_list sel = { NULL, 0, 0, 0 };
+    ret = _kafs_read_personal_cells(&sel,p_pw);
+    if( (ret == 0) && (sel.nitems == 0) ) ret = _kafs_read_mapped_cells(&sel,p_pw);
+
+    _KAFS_STAT_ADD(time_config,_kafs_now_us() - start);
+
+    if( (ret != 0) || (sel.nitems == 0) ){
+        if( ret != 0 ) _kafs_dbg(" out-of-memory: user cells\n");
+        _kafs_list_free(&sel);
+        return(p_cells);
+    }
+
+    /* keep the user order, the spelling of cells is taken from TheseCells and ThisCell */
+    struct _kafs_list list = { NULL, 0, 0, 0 };
+    char* p_sc = sel.buff;
+    for(int i=0; i < sel.nitems; i++, p_sc += strlen(p_sc) + 1){
+        char** p_ic = p_cells;
+        while( (*p_ic != NULL) && (strcasecmp(*p_ic,p_sc) != 0) ) p_ic++;
+        if( *p_ic == NULL ){
+            _kafs_dbg(" ignored: '%s' (not in TheseCells or ThisCell)\n",p_sc);
+            continue;
+        }
+        if( _kafs_list_add(&list,*p_ic,strcmp) == -1 ) ret = -1;
+    }
+    _kafs_list_free(&sel);
+
+    if( (ret != 0) || (list.nitems == 0) ){
+        _kafs_dbg(" no user cell selected, all cells are used\n");
+        _kafs_list_free(&list);
+        return(p_cells);
+    }
+
+    char** p_list = _kafs_list_finish(&list);
+    if( p_list == NULL ) return(p_cells);
+
+    for(char** p_ic = p_list; *p_ic != NULL; p_ic++) _kafs_dbg(" selected: '%s'\n",*p_ic);
+    kafs_free_these_cells(p_cells);
+    return(p_list);
+}
+
+/* ============================================================================= */
@@ -0,0 +1,308 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * Heimdal libkafs compatible interface.
+ *
+ * The library is a drop-in replacement of Heimdal libkafs.so.0 for programs (e.g. PBSPro),
+ * which are linked with it, so they can create PAGs and AFS tokens for kAFS in-process.
+ * Only functions of Heimdal kafs.h are exported with the HEIMDAL_KAFS_1.0 version,
+ * the library must be built with Heimdal Krb5 because the caller passes Heimdal objects.
+ *
+ * kafs_set_verbose() and krb5_afslog() have the same names as functions of libkafs,
+ * which are renamed by the build (see CMakeLists.txt) and they are defined here
+ * with Heimdal semantics.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <krb5.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include <kafs-user.h>
+#include <kafs_locl.h>
+
+#undef kafs_set_verbose
+#undef krb5_afslog
+
+/* ============================================================================= */
+
+/* token in the Heimdal (OpenAFS) format */
+struct ClearToken {
+    int32_t AuthHandle;                         /* kvno, 256 for Kerberos 5 tickets */
+    char    HandShakeKey[8];                    /* DES session key */
+    int32_t ViceId;
+    int32_t BeginTimestamp;
+    int32_t EndTimestamp;
+};
+
+/* pioctl parameters, not used by kAFS */
+struct ViceIoctl;
+
+/* krb4 credentials, not supported */
+typedef struct credentials CREDENTIALS;
+
+/* user cells of Heimdal libkafs */
+#define _KAFS_HML_USER_CELLS    ".TheseCells"
+
+/* ============================================================================= */
+
+/* exported functions, prototypes are the same as in Heimdal kafs.h */
+
+int k_hasafs_recheck(void);
+int k_pioctl(char* a_path,int o_opcode,struct ViceIoctl* a_paramsP,int a_followSymlinks);
+int k_afs_cell_of_file(const char* path,char* cell,int len);
+void kafs_set_verbose(void (*kafs_verbose)(void*,const char*),void* kafs_verbose_ctx);
+int kafs_settoken_rxkad(const char* cell,struct ClearToken* ct,void* ticket,size_t ticket_len);
+int kafs_settoken(const char* cell,uid_t uid,CREDENTIALS* c);
+int kafs_settoken5(krb5_context context,const char* cell,uid_t uid,krb5_creds* c);
+krb5_error_code krb5_afslog(krb5_context context,krb5_ccache id,const char* cell,const char* realm);
+krb5_error_code krb5_afslog_uid(krb5_context context,krb5_ccache id,const char* cell,const char* realm,uid_t uid);
+krb5_error_code krb5_afslog_home(krb5_context context,krb5_ccache id,const char* cell,const char* realm,
+                                 const char* homedir);
+krb5_error_code krb5_afslog_uid_home(krb5_context context,krb5_ccache id,const char* cell,const char* realm,
+                                     uid_t uid,const char* homedir);
+krb5_error_code krb5_realm_of_cell(const char* cell,char** realm);
+
+/* ============================================================================= */
+
+static void (*_kafs_hml_verbose)(void*,const char*) = NULL;
+static void* _kafs_hml_verbose_ctx = NULL;
+
+/* ============================================================================= */
+
+static void _kafs_hml_log(const char* p_fmt,...) __attribute__((__format__(printf, 1, 2)));
+
+static void _kafs_hml_log(const char* p_fmt,...)
+{
+    if( _kafs_hml_verbose == NULL ) return;
+
+    char    buf[_KAFS_LOG_LINE];
+    va_list vl;
+    va_start(vl,p_fmt);
+    vsnprintf(buf,sizeof(buf),p_fmt,vl);
+    va_end(vl);
+
+    _kafs_hml_verbose(_kafs_hml_verbose_ctx,buf);
+}
+
+/* ============================================================================= */
+
+/* cells from homedir/.TheseCells followed by TheseCells and ThisCell,
+ * the list must be freed by kafs_free_these_cells() */
+static char** _kafs_hml_get_cells(const char* homedir)
+{
+    struct _kafs_list list = { NULL, 0, 0, 0 };
+
+    if( homedir == NULL ) homedir = getenv("HOME");
+    if( homedir != NULL ){
+        char path[PATH_MAX];
+        snprintf(path,sizeof(path),"%s/%s",homedir,_KAFS_HML_USER_CELLS);
+        FILE* p_f = fopen(path,"r");
+        if( p_f != NULL ){
+            char line[NAME_MAX];
+            char cell[NAME_MAX+1];
+            while( fgets(line,sizeof(line),p_f) != NULL ){
+                if( sscanf(line,"%255s",cell) != 1 ) continue;
+                if( _kafs_list_add(&list,cell,strcmp) == -1 ) break;
+            }
+            fclose(p_f);
+        }
+    }
+
+    char** these_cells = kafs_get_these_cells();
+    if( these_cells != NULL ){
+        for(char** p_ic = these_cells; *p_ic != NULL; p_ic++){
+            if( _kafs_list_add(&list,*p_ic,strcmp) == -1 ) break;
+        }
+        kafs_free_these_cells(these_cells);
+    }
+
+    if( list.nitems == 0 ){
+        _kafs_list_free(&list);
+        return(NULL);
+    }
+    return(_kafs_list_finish(&list));
+}
+
+/* ============================================================================= */
+
+/* the uid is ignored, kAFS tokens belong to the session keyring */
+static krb5_error_code _kafs_hml_afslog(krb5_context context,krb5_ccache id,const char* cell,const char* realm,
+                                        const char* homedir)
+{
+    _kafs_dbg("-> _kafs_hml_afslog\n");
+
+    struct kafs_afslog_opts opts;
+    memset(&opts,0,sizeof(opts));
+
+    const char* one_cell[2] = { cell, NULL };
+    char**      cells = NULL;
+
+    if( cell != NULL ){
+        opts.cells = one_cell;
+    } else {
+        cells = _kafs_hml_get_cells(homedir);
+        if( cells == NULL ){
+            _kafs_dbg("no cells in .TheseCells, TheseCells, and ThisCell\n");
+            return(-1);
+        }
+        opts.cells = (const char**)cells;
+    }
+    opts.realm = realm;
+
+    struct kafs_afslog_result*  results = NULL;
+    int                         nresults = 0;
+    krb5_error_code kerr = krb5_afslog_ex(context,id,&opts,&results,&nresults);
+
+    for(int i=0; i < nresults; i++){
+        if( results[i].state == KAFS_AFSLOG_OK ){
+            _kafs_hml_log("kAFS: got token for cell %s (realm %s)",results[i].cell,
+                          results[i].realm ? results[i].realm : "unknown");
+        } else {
+            _kafs_hml_log("kAFS: unable to get token for cell %s",results[i].cell);
+        }
+    }
+
+    kafs_free_afslog_results(results,nresults);
+    if( cells != NULL ) kafs_free_these_cells(cells);
+    return(kerr);
+}
+
+/* ============================================================================= */
+/* ============================================================================= */
+
+int k_hasafs_recheck(void)
+{
+    _kafs_dbg("-> k_hasafs_recheck\n");
+
+    kafs_invalidate_probes();
+    return(k_hasafs());
+}
+
+/* ============================================================================= */
+
+int k_pioctl(char* a_path,int o_opcode,struct ViceIoctl* a_paramsP,int a_followSymlinks)
+{
+    _kafs_dbg("-> k_pioctl\n");
+
+    /* kAFS does not provide pioctl */
+    errno = ENOSYS;
+    return(-1);
+}
+
+/* ============================================================================= */
+
+int k_afs_cell_of_file(const char* path,char* cell,int len)
+{
+    _kafs_dbg("-> k_afs_cell_of_file\n");
+
+    if( len <= 0 ){
+        errno = EINVAL;
+        return(-1);
+    }
+
+    ssize_t size = getxattr(path,"afs.cell",cell,len - 1);
+    if( size < 0 ){
+        _kafs_dbg_errno("unable to get afs.cell of '%s'\n",path);
+        return(-1);
+    }
+    cell[size] = '\0';
+    return(0);
+}
+
+/* ============================================================================= */
+
+void kafs_set_verbose(void (*kafs_verbose)(void*,const char*),void* kafs_verbose_ctx)
+{
+    _kafs_hml_verbose       = kafs_verbose;
+    _kafs_hml_verbose_ctx   = kafs_verbose_ctx;
+}
+
+/* ============================================================================= */
+
+int kafs_settoken_rxkad(const char* cell,struct ClearToken* ct,void* ticket,size_t ticket_len)
+{
+    _kafs_dbg("-> kafs_settoken_rxkad\n");
+
+    /* the client is not known, the token is not cached */
+    return(_kafs_add_rxkad_token(cell,NULL,(const uint8_t*)ct->HandShakeKey,ct->AuthHandle,ct->EndTimestamp,
+                                 ticket,ticket_len));
+}
+
+/* ============================================================================= */
+
+int kafs_settoken(const char* cell,uid_t uid,CREDENTIALS* c)
+{
+    _kafs_dbg("-> kafs_settoken\n");
+
+    /* krb4 */
+    errno = ENOTSUP;
+    return(-1);
+}
+
+/* ============================================================================= */
+
+int kafs_settoken5(krb5_context context,const char* cell,uid_t uid,krb5_creds* c)
+{
+    _kafs_dbg("-> kafs_settoken5\n");
+
+    return(_kafs_settoken_rxkad(context,cell,c));
+}
+
+/* ============================================================================= */
+
+krb5_error_code krb5_afslog(krb5_context context,krb5_ccache id,const char* cell,const char* realm)
+{
+    return(_kafs_hml_afslog(context,id,cell,realm,NULL));
+}
+
+/* ============================================================================= */
+
+krb5_error_code krb5_afslog_uid(krb5_context context,krb5_ccache id,const char* cell,const char* realm,uid_t uid)
+{
+    return(_kafs_hml_afslog(context,id,cell,realm,NULL));
+}
+
+/* ============================================================================= */
+
+krb5_error_code krb5_afslog_home(krb5_context context,krb5_ccache id,const char* cell,const char* realm,
+                                 const char* homedir)
+{
+    return(_kafs_hml_afslog(context,id,cell,realm,homedir));
+}
+
+/* ============================================================================= */
+
+krb5_error_code krb5_afslog_uid_home(krb5_context context,krb5_ccache id,const char* cell,const char* realm,
+                                     uid_t uid,const char* homedir)
+{
+    return(_kafs_hml_afslog(context,id,cell,realm,homedir));
+}
+
+/* ============================================================================= */
+
+krb5_error_code krb5_realm_of_cell(const char* cell,char** realm)
+{
+    _kafs_dbg("-> krb5_realm_of_cell\n");
+
+    krb5_context    ctx;
+    krb5_error_code kerr = krb5_init_context(&ctx);
+    if( kerr != 0 ) return(kerr);
+
+    kerr = _kafs_get_cell_realm(ctx,cell,realm);
+
+    krb5_free_context(ctx);
+    return(kerr);
+}
+
+/* ============================================================================= */
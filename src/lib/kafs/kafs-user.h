@@ -38,97 +38,7 @@
 #ifndef __KAFS_H
 #define __KAFS_H
 
-#include <keyutils.h>
-
-/* ============================================================================= */
-
-/* is kAFS loaded?
- * return values:
- *  0 - not present
- *  1 - present
-*/
-int k_hasafs(void);
-
-/* do we have PAG?
- * return values:
- *  0 NO
- *  1 local PAG
- *  2 shared PAG
-*/
-int k_haspag(void);
-
-/* return ID of current session keyring
-*/
-key_serial_t k_get_pag_id(void);
-
-/* set new anonymous PAG
- * return values:
- *  0 OK
- * -1 error with details in errno
-*/
-int k_setpag(void);
-
-/* set or join shared PAG
- * return values:
- *  0 OK
- * -1 error with details in errno
-*/
-int k_setpag_shared(void);
-
-/* revoke local PAG
- * return values:
- *  1 no local PAG
- *  0 OK
- * -1 error with details in errno
-*/
-int k_revoke_pag(void);
-
-/* destroy all AFS tokens
- * return values:
- *  0 OK
- * -1 error with details in errno
-*/
-int k_unlog(void);
-
-/* destroy AFS token for given cell
- * return values:
- *  0 OK
- * -1 error with details in errno
-*/
-int k_unlog_cell(char* cell);
-
-/* list tokens
- * return values:
- *  the number of AFS tokens
-*/
-int k_list_tokens(void);
-
-/* ============================================================================= */
-
-/* print version */
-void kafs_print_version(char* progname);
-
-/* set verbose handler */
-void kafs_set_verbose(int level);
-
-/* ============================================================================= */
-
-/* return these cells as NULL terminated list of strings */
-char** kafs_get_these_cells(void);
-
-/* free these cells returned by kafs_get_these_cells */
-void kafs_free_these_cells(char** cells);
-
-/* return name of root cell, the name must be freed by free() */
-char* kafs_get_this_cell(void);
-
-/* ============================================================================= */
-
-/* return volume location servers for given cell as NULL terminated list of strings */
-char** kafs_get_vls(char* cell);
-
-/* free volume location servers returned by kafs_get_vls */
-void kafs_free_vls(char** vls);
+#include <kafs-core.h>
 
 /* ============================================================================= */
 
@@ -148,23 +58,116 @@ krb5_error_code krb5_afslog(krb5_context context,
 
 /* ============================================================================= */
 
-#define _KAFS_PROC_CELLS            "/proc/fs/afs/cells"
-#define _KAFS_PROC_ROOT_CELL        "/proc/fs/afs/rootcell"
+/* options for krb5_afslog_ex(), zeroed structure gives krb5_afslog() like behaviour */
+struct kafs_afslog_opts {
+    const char**    cells;          /* NULL terminated list of cells, NULL -> TheseCells and ThisCell */
+    const char**    realms;         /* optional realm overrides, realms[i] is used for cells[i] if not NULL */
+    const char*     realm;          /* realm for cells without override, NULL -> REALM from krb5.conf */
+    long            timeout;        /* overall deadline in ms, cells not started before it are not processed, 0 -> none */
+    long            min_lifetime;   /* keep existing tokens valid at least this number of seconds, 0 -> always renew */
+    int             concurrency;    /* number of cells processed in parallel, <= 1 -> serially */
+    int             use_cache;      /* install still valid tokens from the persistent token cache before contacting KDC */
+};
+
+/* per-cell state */
+#define KAFS_AFSLOG_OK          0   /* token created */
+#define KAFS_AFSLOG_SKIPPED     1   /* token still valid, not renewed */
+#define KAFS_AFSLOG_FAILED      2   /* token not created */
+#define KAFS_AFSLOG_TIMEOUT     3   /* cell not processed due to the deadline */
+#define KAFS_AFSLOG_CACHED      4   /* token installed from the persistent token cache */
+
+/* per-cell result of krb5_afslog_ex() */
+struct kafs_afslog_result {
+    char*           cell;
+    char*           realm;          /* realm used, NULL if not determined */
+    int             state;          /* KAFS_AFSLOG_* */
+    krb5_error_code status;         /* the same meaning as return value of krb5_afslog() */
+    int             error;          /* errno if status == -1 */
+    long            elapsed;        /* time spent on the cell in ms */
+    time_t          expiry;         /* expiration time of the token, 0 if unknown */
+};
+
+/* create AFS tokens according to options, all cells are always processed
+ * note: context and id must be initialized prior calling this function
+ * results and nresults can be NULL, otherwise results must be freed by kafs_free_afslog_results()
+ * return values:
+ *    0 - OK for all cells
+ *   -1 - error with details in errno
+ *   >0 - krb5 error of the first failed cell
+ */
+krb5_error_code krb5_afslog_ex(krb5_context context,
+                 krb5_ccache id,
+                 const struct kafs_afslog_opts* opts,
+                 struct kafs_afslog_result** results,
+                 int* nresults);
+
+/* free results returned by krb5_afslog_ex */
+void kafs_free_afslog_results(struct kafs_afslog_result* results,int nresults);
+
+/* ============================================================================= */
+
+/* create AFS tokens by kafs-brokerd, the same as krb5_afslog_ex() but tokens are created by the broker
+ * and installed into the token keyring of the calling thread (see kafs_set_token_keyring())
+ * the ccache is handed over as a copy, the broker serves the request under the uid of the caller,
+ * the token keyring must be owned by the caller and grant write and search to the owner (EACCES otherwise)
+ * return values:
+ *    0 - OK for all cells
+ *   -1 - error with details in errno, without results the broker is not available or it refused the request
+ *        and the caller can use krb5_afslog_ex() instead
+ *   >0 - krb5 error of the first failed cell
+ */
+krb5_error_code krb5_afslog_broker(krb5_context context,
+                 krb5_ccache id,
+                 const struct kafs_afslog_opts* opts,
+                 struct kafs_afslog_result** results,
+                 int* nresults);
+
+/* ============================================================================= */
+
+/* background acquisition of AFS service tickets started by krb5_afslog_prefetch() */
+struct kafs_afslog_prefetch;
+
+/* start acquisition of afs/<cell> tickets for cells of opts in a background thread, nothing is installed
+ * the ccache is copied into a MEMORY ccache by the caller, tickets are kept in memory until krb5_afslog_install()
+ * the prefetch must be released by kafs_free_afslog_prefetch()
+ * fork() of the process waits until the thread finishes, set the timeout option to limit the wait
+ * return values:
+ *    0 - OK, the thread is running
+ *   -1 - error with details in errno
+ */
+krb5_error_code krb5_afslog_prefetch(krb5_context context,
+                 krb5_ccache id,
+                 const struct kafs_afslog_opts* opts,
+                 struct kafs_afslog_prefetch** prefetch);
 
-#define _KAFS_LOCAL_SES_NAME        "_ses.locpag"
-#define _KAFS_SHARED_SES_NAME       "_ses.shrpag"
-#define _PATH_KAFS_MOD              "/sys/module/kafs/initstate"
+/* wait for the prefetch and install tokens into the token keyring, the same as krb5_afslog_ex() for cells of the prefetch
+ * prefetched tickets are used only if they belong to the principal of id, other cells are processed by krb5_afslog_ex()
+ * it can be called only once for the prefetch, results and nresults can be NULL
+ */
+krb5_error_code krb5_afslog_install(krb5_context context,
+                 krb5_ccache id,
+                 struct kafs_afslog_prefetch* prefetch,
+                 struct kafs_afslog_result** results,
+                 int* nresults);
 
-#define _KAFS_MAX_LIST              1024
-#define _KAFS_KEY_SPEC_RXRPC_TYPE   "rxrpc"
-#define _KAFS_PROC_KEYS             "/proc/keys"
+/* wait for the prefetch thread and release the prefetch */
+void kafs_free_afslog_prefetch(struct kafs_afslog_prefetch* prefetch);
 
-#define _PATH_KAFS_USER_ETC  		"/etc/kafs-user/"
-#define _PATH_KAFS_USER_THISCELL	_PATH_KAFS_USER_ETC "ThisCell"
-#define _PATH_KAFS_USER_THESECELLS	_PATH_KAFS_USER_ETC "TheseCells"
-#define _PATH_KAFS_USER_CELLSERVDB 	_PATH_KAFS_USER_ETC "CellServDB"
+/* ============================================================================= */
 
-#define _KAFS_DEBUG_FILE            "/tmp/kafs"
+/* kafs-brokerd protocol
+ * the request is sent with the ccache file descriptor (SCM_RIGHTS):
+ *   AFSLOG keyring timeout min_lifetime concurrency [use_cache]
+ *   REALM realm                            (optional, opts.realm)
+ *   CELL cell realm|-                      (zero or more, none -> TheseCells and ThisCell)
+ *   END
+ * the response:
+ *   RESULT state status error elapsed expiry cell realm|-     (per cell)
+ *   DONE status error
+ */
+#define _PATH_KAFS_BROKERD_SOCKET   "/run/kafs-brokerd.sock"
+#define _KAFS_BROKERD_MAX_LINE      1024
+#define _KAFS_BROKERD_TIMEOUT       120     /* s, default limit for the response */
 
 /* ============================================================================= */
 
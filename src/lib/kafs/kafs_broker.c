@@ -0,0 +1,322 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * Client of kafs-brokerd.
+ *
+ * The ccache is copied into an unlinked FILE ccache, whose descriptor is passed to the broker
+ * together with the request, so the broker never opens ccaches of the user by name. The broker
+ * installs tokens into the keyring given by its ID, it must be owned by the caller and grant
+ * write and search to the owner, which is checked before the broker is contacted.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <krb5.h>
+#include <keyutils.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <kafs-user.h>
+#include <kafs_locl.h>
+
+/* ============================================================================= */
+
+static int _kafs_broker_connect(long timeout)
+{
+    struct sockaddr_un sa;
+    memset(&sa,0,sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    snprintf(sa.sun_path,sizeof(sa.sun_path),"%s",_PATH_KAFS_BROKERD_SOCKET);
+
+    int fd = socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0);
+    if( fd == -1 ) return(-1);
+
+    if( connect(fd,(struct sockaddr*)&sa,sizeof(sa)) != 0 ){
+        int err = errno;
+        close(fd);
+        errno = err;
+        return(-1);
+    }
+
+    struct timeval tv = { timeout, 0 };
+    setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+    setsockopt(fd,SOL_SOCKET,SO_SNDTIMEO,&tv,sizeof(tv));
+    return(fd);
+}
+
+/* ============================================================================= */
+
+/* copy the ccache into a new FILE ccache, which is unlinked, and return its descriptor */
+static krb5_error_code _kafs_broker_copy_cc(krb5_context ctx,krb5_ccache id,int* p_fd)
+{
+    krb5_ccache     tmp;
+
+    krb5_error_code kerr = _kafs_copy_ccache(ctx,id,"FILE",&tmp);
+    if( kerr != 0 ) return(kerr);
+
+    const char* p_name = krb5_cc_get_name(ctx,tmp);
+    *p_fd = open(p_name,O_RDWR|O_CLOEXEC);
+    if( *p_fd == -1 ){
+        int err = errno;
+        _kafs_dbg_errno("unable to open temporary ccache '%s'\n",p_name);
+        krb5_cc_destroy(ctx,tmp);
+        errno = err;
+        return(-1);
+    }
+
+    /* only the descriptor remains */
+    unlink(p_name);
+    krb5_cc_close(ctx,tmp);
+    return(0);
+}
+
+/* ============================================================================= */
+
+static int _kafs_broker_send(int fd,const char* p_req,size_t len,int ccfd)
+{
+    union {
+        char            buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr  align;
+    } ctrl;
+    memset(&ctrl,0,sizeof(ctrl));
+
+    struct iovec    iov = { (void*)p_req, len };
+    struct msghdr   msg;
+    memset(&msg,0,sizeof(msg));
+    msg.msg_iov         = &iov;
+    msg.msg_iovlen      = 1;
+    msg.msg_control     = ctrl.buf;
+    msg.msg_controllen  = sizeof(ctrl.buf);
+
+    struct cmsghdr* p_cmsg = CMSG_FIRSTHDR(&msg);
+    p_cmsg->cmsg_level  = SOL_SOCKET;
+    p_cmsg->cmsg_type   = SCM_RIGHTS;
+    p_cmsg->cmsg_len    = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(p_cmsg),&ccfd,sizeof(int));
+
+    /* the descriptor goes with the first part */
+    ssize_t ret;
+    while( (ret = sendmsg(fd,&msg,MSG_NOSIGNAL)) == -1 ){
+        if( errno != EINTR ) return(-1);
+    }
+
+    p_req += ret;
+    len   -= ret;
+    while( len > 0 ){
+        ret = send(fd,p_req,len,MSG_NOSIGNAL);
+        if( ret == -1 ){
+            if( errno == EINTR ) continue;
+            return(-1);
+        }
+        p_req += ret;
+        len   -= ret;
+    }
+    return(0);
+}
+
+/* ============================================================================= */
+
+/* the broker is not a possessor of the keyring, so it can install tokens only
+   into keyrings of the caller, which grant write and search to their owner,
+   default PAGs do not, see shared_pag and refreshable_pag */
+static int _kafs_broker_check_keyring(key_serial_t keyring)
+{
+    char* p_desc = NULL;
+    _KAFS_STAT_INC(keyring_calls);
+    if( _kafs_backend->describe_alloc(keyring,&p_desc) == -1 ) return(-1);
+
+    unsigned int    kuid, kgid;
+    key_perm_t      perm;
+    int             ret = 0;
+
+    if( (strncmp(p_desc,"keyring;",8) != 0) ||
+        (sscanf(p_desc + 8,"%u;%u;%x;",&kuid,&kgid,&perm) != 3) ){
+        errno = EINVAL;
+        ret = -1;
+    } else if( (kuid != geteuid()) || ((perm & (KEY_USR_WRITE|KEY_USR_SEARCH)) != (KEY_USR_WRITE|KEY_USR_SEARCH)) ){
+        errno = EACCES;
+        ret = -1;
+    }
+
+    free(p_desc);
+    return(ret);
+}
+
+/* ============================================================================= */
+
+static int _kafs_broker_is_word(const char* p_str)
+{
+    if( (p_str == NULL) || (*p_str == '\0') ) return(0);
+    return( strpbrk(p_str," \t\r\n") == NULL );
+}
+
+/* ============================================================================= */
+
+krb5_error_code krb5_afslog_broker(krb5_context context,
+                 krb5_ccache id,
+                 const struct kafs_afslog_opts* opts,
+                 struct kafs_afslog_result** results,
+                 int* nresults)
+{
+    _kafs_dbg("-> krb5_afslog_broker\n");
+
+    struct kafs_afslog_opts defopts;
+
+    if( results != NULL ) *results = NULL;
+    if( nresults != NULL ) *nresults = 0;
+
+    if( opts == NULL ){
+        memset(&defopts,0,sizeof(defopts));
+        opts = &defopts;
+    }
+
+    /* the broker cannot resolve special keyring IDs of the caller */
+    key_serial_t keyring = _kafs_backend->get_keyring_ID(_kafs_token_keyring,0);
+    if( keyring == -1 ){
+        _kafs_dbg_errno("unable to get ID of token keyring\n");
+        return(-1);
+    }
+
+    /* refused keyrings are detected before the ccache is copied and the broker is contacted */
+    if( _kafs_broker_check_keyring(keyring) != 0 ){
+        _kafs_dbg_errno("token keyring %d cannot be used by broker\n",keyring);
+        return(-1);
+    }
+
+    /* request */
+    char*   p_req = NULL;
+    size_t  len = 0;
+    FILE*   p_fout = open_memstream(&p_req,&len);
+    if( p_fout == NULL ){
+        errno = ENOMEM;
+        return(-1);
+    }
+
+    int valid = 1;
+    fprintf(p_fout,"AFSLOG %d %ld %ld %d %d\n",keyring,opts->timeout,opts->min_lifetime,opts->concurrency,
+            opts->use_cache);
+    if( opts->realm != NULL ){
+        valid &= _kafs_broker_is_word(opts->realm);
+        fprintf(p_fout,"REALM %s\n",opts->realm);
+    }
+    for(int i=0; (opts->cells != NULL) && (opts->cells[i] != NULL); i++){
+        const char* p_realm = ((opts->realms != NULL) && (opts->realms[i] != NULL)) ? opts->realms[i] : "-";
+        valid &= _kafs_broker_is_word(opts->cells[i]) && _kafs_broker_is_word(p_realm);
+        fprintf(p_fout,"CELL %s %s\n",opts->cells[i],p_realm);
+    }
+    fprintf(p_fout,"END\n");
+    if( fclose(p_fout) != 0 ){
+        free(p_req);
+        errno = ENOMEM;
+        return(-1);
+    }
+    if( ! valid ){
+        _kafs_dbg("invalid cell or realm name\n");
+        free(p_req);
+        errno = EINVAL;
+        return(-1);
+    }
+
+    long timeout = _KAFS_BROKERD_TIMEOUT;
+    if( opts->timeout > 0 ) timeout = opts->timeout / 1000 + 30;
+
+    int fd = _kafs_broker_connect(timeout);
+    if( fd == -1 ){
+        _kafs_dbg_errno("unable to connect to '%s'\n",_PATH_KAFS_BROKERD_SOCKET);
+        free(p_req);
+        return(-1);
+    }
+
+    int ccfd;
+    krb5_error_code kerr = _kafs_broker_copy_cc(context,id,&ccfd);
+    if( kerr != 0 ){
+        close(fd);
+        free(p_req);
+        return(kerr);
+    }
+
+    int ret = _kafs_broker_send(fd,p_req,len,ccfd);
+    close(ccfd);
+    free(p_req);
+    if( ret != 0 ){
+        int err = errno;
+        _kafs_dbg_errno("unable to send request to broker\n");
+        close(fd);
+        errno = err;
+        return(-1);
+    }
+
+    /* response */
+    FILE* p_fin = fdopen(fd,"r");
+    if( p_fin == NULL ){
+        close(fd);
+        errno = ENOMEM;
+        return(-1);
+    }
+
+    struct kafs_afslog_result*  list = NULL;
+    int                         nlist = 0;
+    int                         done = 0;
+    int                         error = EPROTO;
+    char                        line[_KAFS_BROKERD_MAX_LINE];
+
+    kerr = -1;
+    while( fgets(line,sizeof(line),p_fin) != NULL ){
+        struct kafs_afslog_result   res;
+        long                        expiry;
+        char                        cell[_KAFS_BROKERD_MAX_LINE];
+        char                        realm[_KAFS_BROKERD_MAX_LINE];
+
+        memset(&res,0,sizeof(res));
+        if( sscanf(line,"RESULT %d %d %d %ld %ld %s %s",&res.state,&res.status,&res.error,
+                   &res.elapsed,&expiry,cell,realm) == 7 ){
+            struct kafs_afslog_result* p_new = realloc(list,(nlist + 1)*sizeof(struct kafs_afslog_result));
+            if( p_new == NULL ){
+                error = ENOMEM;
+                break;
+            }
+            list = p_new;
+            res.expiry = expiry;
+            res.cell   = strdup(cell);
+            if( strcmp(realm,"-") != 0 ) res.realm = strdup(realm);
+            list[nlist++] = res;
+            continue;
+        }
+        if( sscanf(line,"DONE %d %d",&kerr,&error) == 2 ){
+            done = 1;
+            break;
+        }
+    }
+    if( ! done && (errno == EAGAIN) ) error = ETIMEDOUT;
+    fclose(p_fin);
+
+    if( ! done ){
+        _kafs_dbg("incomplete response from broker\n");
+        kafs_free_afslog_results(list,nlist);
+        errno = error;
+        return(-1);
+    }
+
+    _kafs_dbg("broker status: %d, %d results\n",kerr,nlist);
+
+    if( (results != NULL) && (nresults != NULL) ){
+        *results  = list;
+        *nresults = nlist;
+    } else {
+        kafs_free_afslog_results(list,nlist);
+    }
+
+    if( kerr == -1 ) errno = error;
+    return(kerr);
+}
+
+/* ============================================================================= */
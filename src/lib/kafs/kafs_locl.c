@@ -66,28 +66,16 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <time.h>
+#include <fcntl.h>
+#include <syslog.h>
 
 #include <kafs-user.h>
 #include <kafs_locl.h>
+#include <kafs_probes.h>
 
 /* ============================================================================= */
 
-int _kafs_debug = 0;
-
-/* ============================================================================= */
-
-void _kafs_dbg_errno(const char* p_fmt,...)
-{
-    va_list vl;
-    va_start(vl,p_fmt);
-    _kafs_vdbg(p_fmt,vl);
-    va_end(vl);
-
-    _kafs_dbg("errno: %d (%s)\n",errno,strerror(errno));
-}
-
-/* ------------------------ */
-
 void _kafs_dbg_krb5(krb5_context ctx,int kerr,const char* p_fmt,...)
 {
     va_list vl;
@@ -102,75 +90,79 @@ void _kafs_dbg_krb5(krb5_context ctx,int kerr,const char* p_fmt,...)
     }
 }
 
-/* ------------------------ */
+/* ============================================================================= */
 
-void _kafs_dbg(const char* p_fmt,...)
+krb5_error_code _kafs_set_afs_token_1(krb5_context ctx,
+                 krb5_ccache id,
+                 const char* cell)
 {
-    va_list vl;
-    va_start(vl,p_fmt);
-    _kafs_vdbg(p_fmt,vl);
-    va_end(vl);
-}
+    _kafs_dbg("-> _kafs_set_afs_token_1\n");
 
-/* ------------------------ */
+    char*           p_realm;
+    krb5_error_code kerr;
 
-void _kafs_vdbg(const char* p_fmt,va_list vl)
-{
-    if( _kafs_debug == 0 ) return;
+    kerr = _kafs_get_cell_realm(ctx,cell,&p_realm);
+    if( kerr != 0 ) return(kerr);
 
-    FILE* p_fo = stderr;
-    if( _kafs_debug == 2 ){
-        p_fo = fopen(_KAFS_DEBUG_FILE,"a");
-        if( p_fo == NULL ) return;
+    kerr = _kafs_set_afs_token_2(ctx,id,cell,p_realm,NULL);
+    if( kerr == 0 ){
+        _kafs_learn_cell_realm(cell,p_realm);
+    } else if( _kafs_is_realm_error(kerr) ){
+        _kafs_forget_cell_realm(cell);
     }
 
-    vfprintf(p_fo,p_fmt,vl);
+    free(p_realm);
 
-    if( _kafs_debug == 2  ) fclose(p_fo);
+    return(kerr);
 }
 
 /* ============================================================================= */
 
-krb5_error_code _kafs_set_afs_token_1(krb5_context ctx,
-                 krb5_ccache id,
-                 const char* cell)
+krb5_error_code _kafs_get_cell_realm(krb5_context ctx,
+                 const char* cell,
+                 char** realm)
 {
-    _kafs_dbg("-> _kafs_set_afs_token_1\n");
+    _kafs_dbg("-> _kafs_get_cell_realm\n");
 
     char**          realms;
     krb5_error_code kerr;
 
+    /* no DNS involved */
+    if( _kafs_lookup_cell_realm(cell,realm) == 0 ) return(0);
+
+    long start = _kafs_now_us();
     kerr = krb5_get_host_realm(ctx, cell, &realms);
+    _KAFS_STAT_INC(realm_lookups);
+    _KAFS_STAT_ADD(time_realm,_kafs_now_us() - start);
     if( kerr != 0 ) {
         _kafs_dbg_krb5(ctx,kerr,"unable to get realm for the host: '%s'\n",cell);
         return(kerr);
     }
 
-    char buffer[PATH_MAX];
-    memset(buffer,0,sizeof(buffer));
-
-    char* p_realm;
-
     if( strlen(realms[0]) != 0 ){
-        p_realm = realms[0];
-        _kafs_dbg("realm: '%s'\n",p_realm);
+        *realm = strdup(realms[0]);
+        _kafs_dbg("realm: '%s'\n",realms[0]);
     } else {
-        const char* p_s = cell;
-        char* p_t = buffer;
-        while( *p_s ) {
-          *p_t = toupper((unsigned char) *p_s);
-          p_s++;
-          p_t++;
+        *realm = strdup(cell);
+        if( *realm != NULL ){
+            char* p_t = *realm;
+            while( *p_t ) {
+              *p_t = toupper((unsigned char) *p_t);
+              p_t++;
+            }
+            _kafs_dbg("referal realm, using '%s' instead\n",*realm);
         }
-        p_realm = buffer;
-        _kafs_dbg("referal realm, using '%s' instead\n",p_realm);
     }
 
-    kerr = _kafs_set_afs_token_2(ctx,id,cell,p_realm);
-
     krb5_free_host_realm(ctx, realms);
 
-    return(kerr);
+    if( *realm == NULL ){
+        errno = ENOMEM;
+        _kafs_dbg("unable to allocate realm for the cell '%s'\n",cell);
+        return(-1);
+    }
+
+    return(0);
 }
 
 /* ============================================================================= */
@@ -178,7 +170,8 @@ krb5_error_code _kafs_set_afs_token_1(krb5_context ctx,
 krb5_error_code _kafs_set_afs_token_2(krb5_context ctx,
                  krb5_ccache ccache,
                  const char* cell,
-                 const char* realm)
+                 const char* realm,
+                 time_t* expiry)
 {
     _kafs_dbg("-> _kafs_set_afs_token_2\n");
 
@@ -189,14 +182,18 @@ krb5_error_code _kafs_set_afs_token_2(krb5_context ctx,
     kerr = _kafs_get_creds(ctx,ccache,cell,realm,&creds);
     if( kerr != 0 ){
         _kafs_dbg("kafs_get_creds failed\n");
+        _KAFS_STAT_INC(tokens_failed);
         return(kerr);
     }
-    ret = _kafs_settoken_rxkad(cell,creds);
+    ret = _kafs_settoken_rxkad(ctx,cell,creds);
+
+    if( expiry != NULL ) *expiry = creds->times.endtime;
 
     krb5_free_creds(ctx,creds);
 
     if( ret == -1 ){
         _kafs_dbg("kafs_settoken_rxkad failed\n");
+        _KAFS_STAT_INC(tokens_failed);
         return(-1);
     }
     return(0);
@@ -211,6 +208,8 @@ int _kafs_get_creds(krb5_context ctx,
                    krb5_creds** creds)
 {
     _kafs_dbg("-> _kafs_get_creds\n");
+    KAFS_PROBE2(kafs,get_creds__entry,cell,realm);
+    KAFS_PROBE_START(start);
 
     krb5_creds search_cred;
     memset(&search_cred, 0, sizeof(krb5_creds));
@@ -219,6 +218,7 @@ int _kafs_get_creds(krb5_context ctx,
     kerr = krb5_cc_get_principal(ctx, ccache, &(search_cred.client));
     if( kerr != 0 ){
         _kafs_dbg_krb5(ctx,kerr,"unable to get principal from ccache\n");
+        KAFS_PROBE4(kafs,get_creds__return,cell,realm,kerr,KAFS_PROBE_TIME(start));
         return(kerr);
     }
 
@@ -230,6 +230,7 @@ int _kafs_get_creds(krb5_context ctx,
         krb5_free_principal(ctx,search_cred.client);
         errno = ENOMEM;
         _kafs_dbg("unable to create afs service principal name (cell: %s, realm: %s)\n",cell,realm);
+        KAFS_PROBE4(kafs,get_creds__return,cell,realm,-1,KAFS_PROBE_TIME(start));
         return(-1);
     }
 
@@ -240,10 +241,14 @@ int _kafs_get_creds(krb5_context ctx,
         _kafs_dbg_krb5(ctx,kerr,"unable to parse afs service principal name\n");
         krb5_free_principal(ctx,search_cred.client);
         free(princ);
+        KAFS_PROBE4(kafs,get_creds__return,cell,realm,kerr,KAFS_PROBE_TIME(start));
         return(kerr);
     }
 
+    long kdc_start = _kafs_now_us();
     kerr = krb5_get_credentials(ctx, 0, ccache, &search_cred, creds);
+    _KAFS_STAT_INC(kdc_requests);
+    _KAFS_STAT_ADD(time_get_creds,_kafs_now_us() - kdc_start);
 
     if( kerr != 0 ) {
         _kafs_dbg_krb5(ctx,kerr,"unable to get credentials for afs service principal\n");
@@ -253,14 +258,71 @@ int _kafs_get_creds(krb5_context ctx,
     krb5_free_principal(ctx,search_cred.client);
     krb5_free_principal(ctx,search_cred.server);
 
+    KAFS_PROBE4(kafs,get_creds__return,cell,realm,kerr,KAFS_PROBE_TIME(start));
     return(kerr);
 }
 
 /* ============================================================================= */
 
-int _kafs_settoken_rxkad(const char* cell, krb5_creds* creds)
+int _kafs_settoken_rxkad(krb5_context ctx,const char* cell,krb5_creds* creds)
 {
     _kafs_dbg("-> _kafs_settoken_rxkad\n");
+    KAFS_PROBE1(kafs,settoken__entry,cell);
+    KAFS_PROBE_START(start);
+    long stat_start = _kafs_now_us();
+
+    uint8_t session_key[8];
+    int     ret;
+
+    KAFS_PROBE_START(kdf_start);
+    long stat_kdf_start = _kafs_now_us();
+#ifdef HEIMDAL
+    ret = _kafs_derive_des_key(creds->session.keytype,
+                         creds->session.keyvalue.data,
+                         creds->session.keyvalue.length,
+                         session_key);
+    KAFS_PROBE3(kafs,derive_key__return,creds->session.keytype,ret,KAFS_PROBE_TIME(kdf_start));
+#else
+    ret = _kafs_derive_des_key(creds,session_key);
+    KAFS_PROBE3(kafs,derive_key__return,creds->keyblock.enctype,ret,KAFS_PROBE_TIME(kdf_start));
+#endif
+    _KAFS_STAT_ADD(time_derive_key,_kafs_now_us() - stat_kdf_start);
+
+    /* MIT returns 1 and Heimdal krb5 error codes, -1 is an OS error with errno */
+    if( ret != 0 ) {
+        if( ret != -1 ) errno = EINVAL;
+        _kafs_dbg("_kafs_derive_des_key failed\n");
+        KAFS_PROBE3(kafs,settoken__return,cell,-1,KAFS_PROBE_TIME(start));
+        return(-1);
+    }
+
+    /* the client is recorded with the token and with its cached copy */
+    char* p_cname = NULL;
+    if( (ctx != NULL) && (creds->client != NULL) && (krb5_unparse_name(ctx,creds->client,&p_cname) != 0) ) p_cname = NULL;
+
+    ret = _kafs_add_rxkad_token(cell,p_cname,session_key,RXKAD_TKT_TYPE_KERBEROS_V5,creds->times.endtime,
+                                creds->ticket.data,creds->ticket.length);
+    memset(session_key,0,sizeof(session_key));
+    if( p_cname != NULL ) _kafs_free_cc_principal(ctx,p_cname);
+
+    KAFS_PROBE3(kafs,settoken__return,cell,ret,KAFS_PROBE_TIME(start));
+    _KAFS_STAT_ADD(time_settoken,_kafs_now_us() - stat_start);
+
+    return(ret);
+}
+
+/* ============================================================================= */
+
+int _kafs_add_rxkad_token(const char* cell,const char* principal,const uint8_t session_key[8],uint32_t kvno,time_t expiry,
+                          const void* ticket,size_t ticket_len)
+{
+    _kafs_dbg("-> _kafs_add_rxkad_token\n");
+
+    if( ticket_len > UINT16_MAX ){
+        errno = EINVAL;
+        _kafs_dbg("AFS ticket is too long (%zu)\n",ticket_len);
+        return(-1);
+    }
 
     char*   keydesc;
     int     ret;
@@ -275,7 +337,7 @@ int _kafs_settoken_rxkad(const char* cell, krb5_creds* creds)
     struct rxrpc_key_sec2_v1*   payload;
     size_t                      plen;
 
-    plen = sizeof(*payload) + creds->ticket.length;
+    plen = sizeof(*payload) + ticket_len;
     payload = calloc(1, plen + 4);
     if( payload == NULL ) {
         errno = ENOMEM;
@@ -284,166 +346,356 @@ int _kafs_settoken_rxkad(const char* cell, krb5_creds* creds)
         return(-1);
     }
 
-#ifdef HEIMDAL
-    _kafs_dbg("plen=%zu tklen=%lu rk=%zu\n",
-           plen, creds->ticket.length, sizeof(*payload));
-#else
-    _kafs_dbg("plen=%zu tklen=%u rk=%zu\n",
-           plen, creds->ticket.length, sizeof(*payload));
-#endif
+    _kafs_dbg("plen=%zu tklen=%zu rk=%zu\n",plen,ticket_len,sizeof(*payload));
 
     /* use version 1 of the key data interface */
     payload->kver           = 1;
     payload->security_index = 2;
-    payload->ticket_length  = creds->ticket.length;
-    payload->expiry         = creds->times.endtime;
-    payload->kvno           = RXKAD_TKT_TYPE_KERBEROS_V5;
+    payload->ticket_length  = ticket_len;
+    payload->expiry         = expiry;
+    payload->kvno           = kvno;
+    memcpy(payload->session_key, session_key, 8);
+    memcpy(payload->ticket, ticket, ticket_len);
+
+    int replaced = 0;
+    ret = _kafs_install_token(keydesc,payload,plen,&replaced);
+
+    if( ret == 0 ){
+        if( replaced ){
+            _KAFS_STAT_INC(tokens_replaced);
+        } else {
+            _KAFS_STAT_INC(tokens_created);
+        }
+        /* new sessions of the same principal can start with a copy of the token,
+         * and kafs-refreshd renews the token only from ccaches of the same principal */
+        if( principal != NULL ){
+            _kafs_set_token_client(cell,principal,expiry);
+            _kafs_cache_store(cell,principal,payload,plen,expiry);
+        }
+    }
 
-#ifdef HEIMDAL
-    ret = _kafs_derive_des_key(creds->session.keytype,
-                         creds->session.keyvalue.data,
-                         creds->session.keyvalue.length,
-                         payload->session_key);
-#else
-    ret = _kafs_derive_des_key(creds,payload->session_key);
-#endif
+    free(keydesc);
+    memset(payload,0,plen);
+    free(payload);
 
-    if( ret == -1 ) {
-        _kafs_dbg("_kafs_derive_des_key failed\n");
-        free(keydesc);
-        free(payload);
+    return(ret);
+}
+
+/* ============================================================================= */
+
+int _kafs_afslog_init(struct kafs_afslog_job* job,const struct kafs_afslog_opts* opts)
+{
+    _kafs_dbg("-> _kafs_afslog_init\n");
+
+    memset(job,0,sizeof(struct kafs_afslog_job));
+    job->opts = opts;
+    job->keyring = _kafs_token_keyring;
+    if( opts->timeout > 0 ){
+        job->deadline = _kafs_now_ms() + opts->timeout;
+    }
+
+    /* list of cells */
+    char** p_cells = NULL;
+    const char** p_ic = opts->cells;
+    if( p_ic == NULL ){
+        p_cells = kafs_get_these_cells();
+        if( p_cells == NULL ){
+            _kafs_dbg("no cells in TheseCells and ThisCell\n");
+            return(-1);
+        }
+        p_ic = (const char**)p_cells;
+    }
+
+    while( p_ic[job->nresults] != NULL ) job->nresults++;
+
+    if( job->nresults == 0 ){
+        _kafs_dbg("no cells to process\n");
+        kafs_free_these_cells(p_cells);
         return(-1);
     }
 
-    memcpy(payload->ticket, creds->ticket.data, creds->ticket.length);
-
-    /*
-     * keyctl_update is not supported on rxrpc keys
-     *
-     * add_key will substitute a previous key, which is detached from the current session keyring.
-     * With standard righs, the old key becomes practically inaccessible for user but it still
-     * occupies kernel until it expires. This can cause problems with quota reserved for user keys.
-     *
-     * it seems that this is a bug in kAFS, which does not properly handle rxrpc keys,
-     * which should not be used.
-     *
-     */
-
-    key_serial_t old_kt;
-    old_kt = keyctl_search(KEY_SPEC_SESSION_KEYRING,"rxrpc",keydesc,0);
-    if( old_kt < 0 ){
-        _kafs_dbg_errno("AFS token '%s' does not exist yet\n",keydesc);
-    } else {
-        _kafs_dbg("Old AFS token found: %10d 0x%08x (%s)\n",old_kt,old_kt,keydesc);
-        /* grant user proper rights, which are required later for key invalidation */
-        if( keyctl_setperm(old_kt,(KEY_POS_ALL & ~KEY_POS_WRITE)|(KEY_USR_ALL & ~KEY_USR_WRITE)) != 0 ){
-            _kafs_dbg_errno("unable to set permission on old AFS token: %10d 0x%08x (%s)\n",old_kt,old_kt,keydesc);
-            /* ignore this error */
+    job->results = calloc(job->nresults,sizeof(struct kafs_afslog_result));
+    if( job->results == NULL ){
+        _kafs_dbg(" out-of-memory: results size '%d'\n",job->nresults);
+        kafs_free_these_cells(p_cells);
+        errno = ENOMEM;
+        return(-1);
+    }
+
+    for(int i=0; i < job->nresults; i++){
+        const char* p_realm = opts->realm;
+        if( (opts->cells != NULL) && (opts->realms != NULL) && (opts->realms[i] != NULL) ){
+            p_realm = opts->realms[i];
+        }
+        job->results[i].cell = strdup(p_ic[i]);
+        if( p_realm != NULL ) job->results[i].realm = strdup(p_realm);
+        if( (job->results[i].cell == NULL) || ((p_realm != NULL) && (job->results[i].realm == NULL)) ){
+            _kafs_dbg(" out-of-memory: '%s'\n",p_ic[i]);
+            kafs_free_afslog_results(job->results,job->nresults);
+            kafs_free_these_cells(p_cells);
+            job->results = NULL;
+            errno = ENOMEM;
+            return(-1);
         }
     }
+    kafs_free_these_cells(p_cells);
 
-    key_serial_t kt;
-    kt = add_key(_KAFS_KEY_SPEC_RXRPC_TYPE, keydesc, payload, plen, KEY_SPEC_SESSION_KEYRING);
-    if( kt < 0 ){
-        _kafs_dbg_errno("AFS token: unable to add rxrpc key (%s)\n",keydesc);
-        /* revert back rights on old key */
-        if( old_kt != -1 ){
-            if( keyctl_setperm(old_kt,(KEY_POS_ALL & ~KEY_POS_WRITE) | KEY_USR_VIEW) != 0 ){
-                _kafs_dbg_errno("unable to restore permission on old AFS token: %10d 0x%08x (%s)\n",old_kt,old_kt,keydesc);
-            }
+    return(0);
+}
+
+/* ============================================================================= */
+
+void _kafs_afslog_exec(struct kafs_afslog_job* job,krb5_context ctx,krb5_ccache id)
+{
+    _kafs_dbg("-> _kafs_afslog_exec\n");
+
+    int nworkers = job->opts->concurrency;
+    if( nworkers > job->nresults ) nworkers = job->nresults;
+
+    if( nworkers > 1 ){
+        if( asprintf(&job->ccname,"%s:%s",krb5_cc_get_type(ctx,id),krb5_cc_get_name(ctx,id)) == -1 ){
+            _kafs_dbg("unable to create ccache name, cells are processed serially\n");
+            job->ccname = NULL;
+            nworkers = 1;
         }
-    } else {
-        _kafs_dbg("AFS token created: %10d 0x%08x (%s)\n",kt,kt,keydesc);
     }
 
-    if( (kt != 0) && (old_kt != -1) ){
-        /* shorten expiration time of the previous key to 60 s*/
-        keyctl_set_timeout(old_kt,60);
-        /* and invalidate the key */
-        if( keyctl_invalidate(old_kt) != 0 ){
-            _kafs_dbg_errno("unable to invalidate previous AFS token: %10d 0x%08x (%s)\n",old_kt,old_kt,keydesc);
-        } else {
-            _kafs_dbg("Old AFS token revoked: %10d 0x%08x (%s)\n",old_kt,old_kt,keydesc);
+    pthread_mutex_init(&job->lock,NULL);
+
+    if( nworkers > 1 ){
+        pthread_t* p_tids = calloc(nworkers,sizeof(pthread_t));
+        int        nstarted = 0;
+        if( p_tids != NULL ){
+            for(nstarted=0; nstarted < nworkers; nstarted++){
+                if( pthread_create(&p_tids[nstarted],NULL,_kafs_afslog_thread,job) != 0 ){
+                    _kafs_dbg_errno("unable to start worker thread\n");
+                    break;
+                }
+            }
+            _kafs_dbg("%d worker threads started\n",nstarted);
+            for(int i=0; i < nstarted; i++) pthread_join(p_tids[i],NULL);
+            free(p_tids);
         }
     }
 
-    free(keydesc);
-    free(payload);
+    /* serial processing or cells left by failed workers */
+    _kafs_afslog_run(job,ctx,id);
+
+    pthread_mutex_destroy(&job->lock);
+    free(job->ccname);
+    job->ccname = NULL;
+}
+
+/* ============================================================================= */
 
-    if( kt == - 1 ) return(-1);
+krb5_error_code _kafs_afslog_status(const struct kafs_afslog_job* job)
+{
+    for(int i=0; i < job->nresults; i++){
+        if( (job->results[i].state == KAFS_AFSLOG_FAILED) || (job->results[i].state == KAFS_AFSLOG_TIMEOUT) ){
+            if( job->results[i].status == -1 ) errno = job->results[i].error;
+            return(job->results[i].status);
+        }
+    }
     return(0);
 }
 
 /* ============================================================================= */
 
-int _kafs_invalidate_key(key_serial_t parent,key_serial_t key, char *desc, int desc_len, void *data)
+void _kafs_afslog_run(struct kafs_afslog_job* job,krb5_context ctx,krb5_ccache id)
 {
-    if( desc == NULL ){
-        _kafs_dbg("key with no desription (%d)\n",key);
-        return(0);
-    }
-    if(strstr(desc,_KAFS_KEY_SPEC_RXRPC_TYPE) == desc ){
-        /* shorten expiration time of the key to 60 s*/
-        keyctl_set_timeout(key,60);
-
-        _kafs_dbg("invalidating key '%s' in the session keyring\n",desc);
-        long ret = keyctl_invalidate(key);
-        if( ret == -1 ){
-            _kafs_dbg_errno("unable to invalidate key '%s' in the session keyring\n",desc);
+    _kafs_dbg("-> _kafs_afslog_run\n");
+
+    /* cached tokens are installed only if they were created for the principal of the ccache */
+    char* p_cname = NULL;
+    if( job->opts->use_cache && (job->creds == NULL) ) p_cname = _kafs_cc_principal(ctx,id);
+
+    for(;;){
+        pthread_mutex_lock(&job->lock);
+        int i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        if( i >= job->nresults ) break;
+
+        struct kafs_afslog_result* p_res = &job->results[i];
+        long start = _kafs_now_ms();
+
+        if( (job->deadline != 0) && (start >= job->deadline) ){
+            _kafs_dbg("deadline reached, skipping cell '%s'\n",p_res->cell);
+            p_res->state  = KAFS_AFSLOG_TIMEOUT;
+            p_res->status = -1;
+            p_res->error  = ETIMEDOUT;
+            continue;
         }
-    } else {
-        _kafs_dbg("incorrect type for the key '%s'\n",desc);
+
+        /* is the current token still fresh enough? */
+        if( (job->opts->min_lifetime > 0) && (job->creds == NULL) ){
+            time_t expiry;
+            if( (_kafs_get_token_expiry(p_res->cell,&expiry) == 0) &&
+                (expiry - time(NULL) >= job->opts->min_lifetime) ){
+                _kafs_dbg("AFS token for the cell '%s' is still valid\n",p_res->cell);
+                _KAFS_STAT_INC(tokens_skipped);
+                p_res->state   = KAFS_AFSLOG_SKIPPED;
+                p_res->expiry  = expiry;
+                p_res->elapsed = _kafs_now_ms() - start;
+                continue;
+            }
+        }
+
+        /* a copy of the token from the persistent token cache of the user */
+        if( (p_cname != NULL) && (_kafs_cache_seed(p_res->cell,p_cname,&p_res->expiry) == 0) ){
+            p_res->state   = KAFS_AFSLOG_CACHED;
+            p_res->elapsed = _kafs_now_ms() - start;
+            continue;
+        }
+
+        krb5_error_code kerr = 0;
+        int             lookup = 0;
+
+        if( p_res->realm == NULL ){
+            kerr = _kafs_get_cell_realm(ctx,p_res->cell,&p_res->realm);
+            lookup = 1;
+        }
+        if( kerr == 0 ){
+            if( job->creds != NULL ){
+                /* prefetch, the ticket is kept for later installation */
+                kerr = _kafs_get_creds(ctx,id,p_res->cell,p_res->realm,&job->creds[i]);
+                if( kerr == 0 ) p_res->expiry = job->creds[i]->times.endtime;
+            } else {
+                _kafs_dbg("using _kafs_set_afs_token_2 (cell: %s, realm: %s)\n",p_res->cell,p_res->realm);
+                kerr = _kafs_set_afs_token_2(ctx,id,p_res->cell,p_res->realm,&p_res->expiry);
+            }
+            if( lookup ){
+                if( kerr == 0 ){
+                    _kafs_learn_cell_realm(p_res->cell,p_res->realm);
+                } else if( _kafs_is_realm_error(kerr) ){
+                    _kafs_forget_cell_realm(p_res->cell);
+                }
+            }
+        }
+
+        p_res->status  = kerr;
+        p_res->state   = (kerr == 0) ? KAFS_AFSLOG_OK : KAFS_AFSLOG_FAILED;
+        p_res->error   = (kerr == -1) ? errno : 0;
+        p_res->elapsed = _kafs_now_ms() - start;
+
+        _kafs_dbg("cell '%s' done in %ld ms (status: %d)\n",p_res->cell,p_res->elapsed,kerr);
     }
 
-    return(0);
+    if( p_cname != NULL ) _kafs_free_cc_principal(ctx,p_cname);
+}
+
+/* ============================================================================= */
+
+void* _kafs_afslog_thread(void* p_job)
+{
+    _kafs_dbg("-> _kafs_afslog_thread\n");
+
+    struct kafs_afslog_job* job = p_job;
+    krb5_context            ctx;
+    krb5_ccache             id;
+    krb5_error_code         kerr;
+
+    _kafs_token_keyring = job->keyring;
+
+    /* krb5 context cannot be shared among threads */
+    kerr = krb5_init_context(&ctx);
+    if( kerr != 0 ){
+        _kafs_dbg("unable to init krb5 context for worker thread\n");
+        return(NULL);   /* remaining cells are processed by other workers */
+    }
+
+    kerr = krb5_cc_resolve(ctx,job->ccname,&id);
+    if( kerr != 0 ){
+        _kafs_dbg_krb5(ctx,kerr,"unable to resolve ccache '%s' in worker thread\n",job->ccname);
+        krb5_free_context(ctx);
+        return(NULL);
+    }
+
+    _kafs_afslog_run(job,ctx,id);
+
+    krb5_cc_close(ctx,id);
+    krb5_free_context(ctx);
+
+    return(NULL);
 }
 
 /* ============================================================================= */
 
-int _kafs_list_key(key_serial_t parent,key_serial_t key, char *desc, int desc_len, void *data)
+char* _kafs_cc_principal(krb5_context ctx,krb5_ccache id)
 {
-    int ret;
-    int nkey = 0;
-    if( desc == NULL ){
-        _kafs_dbg("key with no desription (%d)\n",key);
-        return(nkey);
+    krb5_principal  princ;
+    char*           p_cname = NULL;
+
+    krb5_error_code kerr = krb5_cc_get_principal(ctx,id,&princ);
+    if( kerr != 0 ){
+        _kafs_dbg_krb5(ctx,kerr,"unable to get principal from ccache\n");
+        return(NULL);
     }
-    if(strstr(desc,_KAFS_KEY_SPEC_RXRPC_TYPE) != desc ){
-        _kafs_dbg("incorrect type for the key '%s'\n",desc);
-        return(nkey);
+    kerr = krb5_unparse_name(ctx,princ,&p_cname);
+    krb5_free_principal(ctx,princ);
+    if( kerr != 0 ){
+        _kafs_dbg_krb5(ctx,kerr,"unable to unparse principal\n");
+        return(NULL);
     }
+    return(p_cname);
+}
 
-    char*   keystr;
+/* ============================================================================= */
 
-    ret = asprintf(&keystr, "%08x", key);
-    if( ret == -1 ) {
-        errno = ENOMEM;
-        _kafs_dbg_errno("unable to create keystr for key '%d'\n",key);
-        return(nkey);
-    }
-
-    FILE* p_fk = fopen(_KAFS_PROC_KEYS,"r");
-    if( p_fk ){
-        char buf[PATH_MAX];
-        char tmp[PATH_MAX];
-        char name[PATH_MAX];
-        char exp[PATH_MAX];
-
-        while( fgets(buf,sizeof(buf),p_fk) != NULL ){
-            if( strstr(buf,keystr) == buf ){
-                /* THIS IS HORRIBLE :-( but it should be safe as all buffers are of the same size
-                   and buf is \0 terminated */
-                sscanf(buf,"%s %s %s %s %s %s %s %s %s",tmp,tmp,tmp,exp,tmp,tmp,tmp,tmp,name);
-                printf("%-30s %6s\n",name,exp);
-                nkey++;
-            }
+void _kafs_free_cc_principal(krb5_context ctx,char* p_cname)
+{
+#ifdef HEIMDAL
+    krb5_xfree(p_cname);
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    krb5_free_unparsed_name(ctx,p_cname);
+#pragma GCC diagnostic pop
+#endif
+}
+
+/* ============================================================================= */
+
+krb5_error_code _kafs_copy_ccache(krb5_context ctx,krb5_ccache id,const char* type,krb5_ccache* p_copy)
+{
+    krb5_principal  princ;
+    krb5_ccache     tmp;
+
+    krb5_error_code kerr = krb5_cc_get_principal(ctx,id,&princ);
+    if( kerr != 0 ){
+        _kafs_dbg_krb5(ctx,kerr,"unable to get principal from ccache\n");
+        return(kerr);
+    }
+
+    kerr = krb5_cc_new_unique(ctx,type,NULL,&tmp);
+    if( kerr != 0 ){
+        _kafs_dbg_krb5(ctx,kerr,"unable to create temporary ccache\n");
+        krb5_free_principal(ctx,princ);
+        return(kerr);
+    }
+
+    kerr = krb5_cc_initialize(ctx,tmp,princ);
+    krb5_free_principal(ctx,princ);
+
+    krb5_cc_cursor cursor;
+    if( kerr == 0 ) kerr = krb5_cc_start_seq_get(ctx,id,&cursor);
+    if( kerr == 0 ){
+        krb5_creds creds;
+        while( (kerr == 0) && (krb5_cc_next_cred(ctx,id,&cursor,&creds) == 0) ){
+            kerr = krb5_cc_store_cred(ctx,tmp,&creds);
+            krb5_free_cred_contents(ctx,&creds);
         }
-        fclose(p_fk);
+        krb5_cc_end_seq_get(ctx,id,&cursor);
     }
 
-    free(keystr);
+    if( kerr != 0 ){
+        _kafs_dbg_krb5(ctx,kerr,"unable to copy ccache\n");
+        krb5_cc_destroy(ctx,tmp);
+        return(kerr);
+    }
 
-    return(nkey);
+    *p_copy = tmp;
+    return(0);
 }
 
 /* ============================================================================= */
@@ -58,22 +58,26 @@
 #ifndef __KAFS_LOCL_H__
 #define __KAFS_LOCL_H__
 
+#include <stdio.h>
 #include <keyutils.h>
+#include <pthread.h>
+#include <kafs_core_locl.h>
 
 /* ============================================================================= */
 
-struct rxrpc_key_sec2_v1 {
-        uint32_t        kver;                   /* key payload interface version */
-        uint16_t        security_index;         /* RxRPC header security index */
-        uint16_t        ticket_length;          /* length of ticket[] */
-        uint32_t        expiry;                 /* time at which expires */
-        uint32_t        kvno;                   /* key version number */
-        uint8_t         session_key[8];         /* DES session key */
-        uint8_t         ticket[];               /* the encrypted ticket as felxible array */
+/* shared state of krb5_afslog_ex() workers */
+struct kafs_afslog_job {
+    const struct kafs_afslog_opts*  opts;
+    char*                           ccname;     /* full ccache name for worker threads */
+    struct kafs_afslog_result*      results;
+    int                             nresults;
+    int                             next;       /* next cell to be processed */
+    long                            deadline;   /* in _kafs_now_ms() units, 0 -> none */
+    key_serial_t                    keyring;    /* token keyring of the calling thread */
+    krb5_creds**                    creds;      /* per cell, tickets are only fetched if not NULL */
+    pthread_mutex_t                 lock;
 };
 
-#define RXKAD_TKT_TYPE_KERBEROS_V5              256
-
 /* ============================================================================= */
 
 /* Default to a hidden visibility for all internal functions. */
@@ -81,20 +85,12 @@ struct rxrpc_key_sec2_v1 {
 
 /* ============================================================================= */
 
-/*
- * 0 - no debug
- * 1 - debug to stderr
- * 2 - debgu to the /tmp/kafs file
- */
-
-extern int _kafs_debug;
+/* learned realms are used at most for given time in s */
+#define _KAFS_REALM_CACHE_TTL       (7*86400)
 
 /* ============================================================================= */
 
-/* print debug info */
-void _kafs_vdbg(const char* p_fmt,va_list vl);
-void _kafs_dbg(const char* p_fmt,...)       __attribute__((__format__(printf, 1, 2)));
-void _kafs_dbg_errno(const char* p_fmt,...) __attribute__((__format__(printf, 1, 2)));
+/* print debug info with krb5 error message */
 void _kafs_dbg_krb5(krb5_context ctx,int kerr,const char* p_fmt,...)
                                             __attribute__((__format__(printf, 3, 4)));
 
@@ -105,11 +101,58 @@ krb5_error_code _kafs_set_afs_token_1(krb5_context ctx,
                  krb5_ccache ccache,
                  const char* cell);
 
-/* create AFS token, cell and realm MUST be provided */
+/* create AFS token, cell and realm MUST be provided, expiry of the token is returned if not NULL */
 krb5_error_code _kafs_set_afs_token_2(krb5_context ctx,
                  krb5_ccache id,
                  const char* cell,
-                 const char* realm);
+                 const char* realm,
+                 time_t* expiry);
+
+/* determine REALM for the cell from CellRealms, learned realms, or krb5.conf, the realm must be freed by free() */
+krb5_error_code _kafs_get_cell_realm(krb5_context ctx,
+                 const char* cell,
+                 char** realm);
+
+/* determine REALM for the cell from CellRealms or learned realms, the realm must be freed by free()
+ * return values:
+ *  0 OK
+ * -1 no mapping
+ */
+int _kafs_lookup_cell_realm(const char* cell,char** realm);
+
+/* remember REALM, which was used to obtain token for the cell */
+void _kafs_learn_cell_realm(const char* cell,const char* realm);
+
+/* forget learned REALM of the cell, the token was not obtained with it */
+void _kafs_forget_cell_realm(const char* cell);
+
+/* does the error show that the REALM used for the cell is wrong? */
+int _kafs_is_realm_error(krb5_error_code kerr);
+
+/* prepare krb5_afslog_ex() job for cells of opts, opts must be valid until the job is done
+ * return 0 or -1 with details in errno */
+int _kafs_afslog_init(struct kafs_afslog_job* job,const struct kafs_afslog_opts* opts);
+
+/* process all cells of the job, by worker threads if requested by opts */
+void _kafs_afslog_exec(struct kafs_afslog_job* job,krb5_context ctx,krb5_ccache id);
+
+/* overall status of the job, the same meaning as return value of krb5_afslog_ex() */
+krb5_error_code _kafs_afslog_status(const struct kafs_afslog_job* job);
+
+/* process cells of krb5_afslog_ex() job within given context */
+void _kafs_afslog_run(struct kafs_afslog_job* job,krb5_context ctx,krb5_ccache id);
+
+/* thread entry for krb5_afslog_ex() job, it uses own context */
+void* _kafs_afslog_thread(void* p_job);
+
+/* return the unparsed principal of the ccache, it must be freed by _kafs_free_cc_principal(), NULL on error */
+char* _kafs_cc_principal(krb5_context ctx,krb5_ccache id);
+
+/* free the principal name unparsed by krb5 */
+void _kafs_free_cc_principal(krb5_context ctx,char* p_cname);
+
+/* copy the principal and all tickets of the ccache into a new unique ccache of given type */
+krb5_error_code _kafs_copy_ccache(krb5_context ctx,krb5_ccache id,const char* type,krb5_ccache* p_copy);
 
 /* get AFS service ticket */
 int _kafs_get_creds(krb5_context ctx,
@@ -118,10 +161,16 @@ int _kafs_get_creds(krb5_context ctx,
                    const char* realm,
                    krb5_creds** creds);
 
-/* insert token into session keyring */
-int _kafs_settoken_rxkad(const char* cell, krb5_creds* creds);
+/* insert token into session keyring, the token is cached for its client only if ctx is not NULL */
+int _kafs_settoken_rxkad(krb5_context ctx,const char* cell,krb5_creds* creds);
+
+/* insert token with already derived session key into session keyring, it replaces the previous token,
+   the token is cached for the principal if it is not NULL */
+int _kafs_add_rxkad_token(const char* cell,const char* principal,const uint8_t session_key[8],uint32_t kvno,time_t expiry,
+                          const void* ticket,size_t ticket_len);
 
-/* derive session key */
+/* derive session key, return 0 on success,
+   -1 with details in errno (MIT, AF_ALG failure), or other non-zero value */
 #ifdef HEIMDAL
 int _kafs_derive_des_key(krb5_enctype enctype, void *keydata, size_t keylen,
                          unsigned char output[8]);
@@ -129,12 +178,6 @@ int _kafs_derive_des_key(krb5_enctype enctype, void *keydata, size_t keylen,
 int _kafs_derive_des_key(krb5_creds *creds, uint8_t *session_key);
 #endif
 
-/* invalidate AFS token for k_unlog() */
-int _kafs_invalidate_key(key_serial_t parent,key_serial_t key, char *desc, int desc_len, void *data);
-
-/* list AFS tokens for k_list_tokens() */
-int _kafs_list_key(key_serial_t parent,key_serial_t key, char *desc, int desc_len, void *data);
-
 /* ============================================================================= */
 
 /* Undo default visibility change. */
@@ -0,0 +1,370 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * Prefetch of AFS service tickets.
+ *
+ * afs/<cell> tickets are obtained by a background thread with its own krb5 context
+ * as soon as the ccache is available, e.g. in the PAM auth phase. Only the installation
+ * of tokens into the token keyring, which is cheap, is left for krb5_afslog_install().
+ * The thread exists only in the process, which started it, forked children fall back
+ * to krb5_afslog_ex(). The thread can hold libkafs and krb5 internal locks, which cannot
+ * all be taken by atfork handlers, so fork() waits until running prefetch threads finish
+ * (they are limited by the timeout option) and no new one starts during the fork.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <krb5.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <kafs-user.h>
+#include <kafs_locl.h>
+
+/* ============================================================================= */
+
+struct kafs_afslog_prefetch {
+    struct kafs_afslog_job      job;
+    struct kafs_afslog_opts     opts;       /* copy of options without cell lists */
+    char*                       ccname;     /* MEMORY copy of the ccache made by the caller */
+    int                         ccopy;      /* the copy is not destroyed yet */
+    krb5_context                ctx;        /* context of the thread, it owns fetched tickets */
+    pid_t                       pid;        /* process running the thread */
+    pthread_t                   thread;
+    int                         running;    /* the thread is not joined yet */
+};
+
+/* running prefetch threads */
+static pthread_mutex_t  _kafs_prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   _kafs_prefetch_done = PTHREAD_COND_INITIALIZER;
+static int              _kafs_prefetch_active = 0;
+static pthread_once_t   _kafs_prefetch_once = PTHREAD_ONCE_INIT;
+
+/* ============================================================================= */
+
+/* the lock is held over fork, so no prefetch thread runs or starts in the meantime */
+static void _kafs_prefetch_prepare(void)
+{
+    pthread_mutex_lock(&_kafs_prefetch_lock);
+    while( _kafs_prefetch_active > 0 ){
+        pthread_cond_wait(&_kafs_prefetch_done,&_kafs_prefetch_lock);
+    }
+    pthread_mutex_lock(&_kafs_log_lock);
+}
+
+/* ============================================================================= */
+
+static void _kafs_prefetch_release(void)
+{
+    pthread_mutex_unlock(&_kafs_log_lock);
+    pthread_mutex_unlock(&_kafs_prefetch_lock);
+}
+
+/* ============================================================================= */
+
+static void _kafs_prefetch_atfork(void)
+{
+    pthread_atfork(_kafs_prefetch_prepare,_kafs_prefetch_release,_kafs_prefetch_release);
+}
+
+/* ============================================================================= */
+
+static void* _kafs_prefetch_thread(void* p_data)
+{
+    _kafs_dbg("-> _kafs_prefetch_thread\n");
+
+    struct kafs_afslog_prefetch*    pf = p_data;
+    krb5_ccache                     id;
+    krb5_error_code                 kerr;
+
+    kerr = krb5_init_context(&pf->ctx);
+    if( kerr != 0 ){
+        _kafs_dbg("unable to init krb5 context for prefetch thread\n");
+        pf->ctx = NULL;
+    } else if( (kerr = krb5_cc_resolve(pf->ctx,pf->ccname,&id)) != 0 ){
+        _kafs_dbg_krb5(pf->ctx,kerr,"unable to resolve ccache '%s' in prefetch thread\n",pf->ccname);
+    } else {
+        _kafs_afslog_exec(&pf->job,pf->ctx,id);
+        _kafs_dbg("prefetch of %d cells done\n",pf->job.nresults);
+
+        krb5_cc_destroy(pf->ctx,id);
+        pf->ccopy = 0;
+    }
+
+    /* a waiting fork can continue */
+    pthread_mutex_lock(&_kafs_prefetch_lock);
+    if( --_kafs_prefetch_active == 0 ) pthread_cond_broadcast(&_kafs_prefetch_done);
+    pthread_mutex_unlock(&_kafs_prefetch_lock);
+    return(NULL);
+}
+
+/* ============================================================================= */
+
+/* return 1 if tickets of the thread can be used */
+static int _kafs_prefetch_wait(struct kafs_afslog_prefetch* pf)
+{
+    if( pf->pid != getpid() ){
+        _kafs_dbg("prefetch started by another process\n");
+        return(0);
+    }
+    if( pf->running ){
+        pthread_join(pf->thread,NULL);
+        pf->running = 0;
+    }
+    return( pf->ctx != NULL );
+}
+
+/* ============================================================================= */
+
+krb5_error_code krb5_afslog_prefetch(krb5_context context,
+                 krb5_ccache id,
+                 const struct kafs_afslog_opts* opts,
+                 struct kafs_afslog_prefetch** prefetch)
+{
+    _kafs_dbg("-> krb5_afslog_prefetch\n");
+
+    struct kafs_afslog_opts defopts;
+
+    *prefetch = NULL;
+
+    if( opts == NULL ){
+        memset(&defopts,0,sizeof(defopts));
+        opts = &defopts;
+    }
+
+    struct kafs_afslog_prefetch* pf = calloc(1,sizeof(struct kafs_afslog_prefetch));
+    if( pf == NULL ){
+        errno = ENOMEM;
+        return(-1);
+    }
+
+    if( _kafs_afslog_init(&pf->job,opts) != 0 ){
+        free(pf);
+        return(-1);
+    }
+
+    /* cells and realms are already copied into results */
+    pf->opts        = *opts;
+    pf->opts.cells  = NULL;
+    pf->opts.realms = NULL;
+    pf->opts.realm  = NULL;
+    pf->job.opts    = &pf->opts;
+    pf->pid         = getpid();
+
+    pf->job.creds = calloc(pf->job.nresults,sizeof(krb5_creds*));
+    if( pf->job.creds == NULL ){
+        kafs_free_afslog_prefetch(pf);
+        errno = ENOMEM;
+        return(-1);
+    }
+
+    /* the thread can outlive privileges of the caller, so it works with a copy read now */
+    krb5_ccache     copy;
+    krb5_error_code kerr = _kafs_copy_ccache(context,id,"MEMORY",&copy);
+    if( kerr != 0 ){
+        kafs_free_afslog_prefetch(pf);
+        return(kerr);
+    }
+    if( asprintf(&pf->ccname,"MEMORY:%s",krb5_cc_get_name(context,copy)) == -1 ){
+        pf->ccname = NULL;
+        krb5_cc_destroy(context,copy);
+        kafs_free_afslog_prefetch(pf);
+        errno = ENOMEM;
+        return(-1);
+    }
+    krb5_cc_close(context,copy);
+    pf->ccopy = 1;
+
+    pthread_once(&_kafs_prefetch_once,_kafs_prefetch_atfork);
+
+    pthread_mutex_lock(&_kafs_prefetch_lock);
+    int ret = pthread_create(&pf->thread,NULL,_kafs_prefetch_thread,pf);
+    if( ret == 0 ) _kafs_prefetch_active++;
+    pthread_mutex_unlock(&_kafs_prefetch_lock);
+    if( ret != 0 ){
+        kafs_free_afslog_prefetch(pf);
+        errno = ret;
+        _kafs_dbg_errno("unable to start prefetch thread\n");
+        return(-1);
+    }
+    pf->running = 1;
+
+    _kafs_dbg("prefetch of %d cells started (ccache: %s)\n",pf->job.nresults,pf->ccname);
+    *prefetch = pf;
+    return(0);
+}
+
+/* ============================================================================= */
+
+krb5_error_code krb5_afslog_install(krb5_context context,
+                 krb5_ccache id,
+                 struct kafs_afslog_prefetch* prefetch,
+                 struct kafs_afslog_result** results,
+                 int* nresults)
+{
+    _kafs_dbg("-> krb5_afslog_install\n");
+
+    struct kafs_afslog_prefetch*    pf = prefetch;
+    struct kafs_afslog_job*         job = &pf->job;
+
+    if( results != NULL ) *results = NULL;
+    if( nresults != NULL ) *nresults = 0;
+
+    if( job->results == NULL ){
+        /* already installed */
+        errno = EINVAL;
+        return(-1);
+    }
+
+    int usable = _kafs_prefetch_wait(pf);
+
+    krb5_principal princ = NULL;
+    if( usable && (krb5_cc_get_principal(context,id,&princ) != 0) ){
+        _kafs_dbg("unable to get principal from ccache, prefetched tickets are not used\n");
+        princ = NULL;
+    }
+
+    const char**    cells  = calloc(job->nresults + 1,sizeof(char*));
+    const char**    realms = calloc(job->nresults + 1,sizeof(char*));
+    int*            index  = calloc(job->nresults + 1,sizeof(int));
+    int             nleft  = 0;
+
+    if( (cells == NULL) || (realms == NULL) || (index == NULL) ){
+        if( princ != NULL ) krb5_free_principal(context,princ);
+        free(cells);
+        free(realms);
+        free(index);
+        errno = ENOMEM;
+        return(-1);
+    }
+
+    for(int i=0; i < job->nresults; i++){
+        struct kafs_afslog_result*  p_res = &job->results[i];
+        krb5_creds*                 creds = usable ? job->creds[i] : NULL;
+        long                        start = _kafs_now_ms();
+
+        /* the ticket must belong to the principal of the session ccache */
+        if( (creds == NULL) || (princ == NULL) || (! krb5_principal_compare(context,creds->client,princ)) ||
+            (creds->times.endtime <= time(NULL)) ){
+            cells[nleft]  = p_res->cell;
+            realms[nleft] = p_res->realm;
+            index[nleft]  = i;
+            nleft++;
+            continue;
+        }
+
+        p_res->state  = KAFS_AFSLOG_OK;
+        p_res->status = 0;
+        p_res->error  = 0;
+
+        time_t expiry;
+        if( (pf->opts.min_lifetime > 0) && (_kafs_get_token_expiry(p_res->cell,&expiry) == 0) &&
+            (expiry - time(NULL) >= pf->opts.min_lifetime) ){
+            _kafs_dbg("AFS token for the cell '%s' is still valid\n",p_res->cell);
+            _KAFS_STAT_INC(tokens_skipped);
+            p_res->state  = KAFS_AFSLOG_SKIPPED;
+            p_res->expiry = expiry;
+        } else if( _kafs_settoken_rxkad(context,p_res->cell,creds) != 0 ){
+            _kafs_dbg("kafs_settoken_rxkad failed\n");
+            _KAFS_STAT_INC(tokens_failed);
+            p_res->state  = KAFS_AFSLOG_FAILED;
+            p_res->status = -1;
+            p_res->error  = errno;
+        } else {
+            p_res->expiry = creds->times.endtime;
+        }
+        p_res->elapsed = _kafs_now_ms() - start;
+
+        _kafs_dbg("prefetched cell '%s' installed in %ld ms (state: %d)\n",p_res->cell,p_res->elapsed,p_res->state);
+    }
+
+    if( princ != NULL ) krb5_free_principal(context,princ);
+
+    /* cells without usable tickets are processed as by krb5_afslog_ex() */
+    if( nleft > 0 ){
+        _kafs_dbg("%d cells without prefetched tickets\n",nleft);
+
+        struct kafs_afslog_opts     opts = pf->opts;
+        struct kafs_afslog_result*  left = NULL;
+        int                         nresleft = 0;
+
+        opts.cells  = cells;
+        opts.realms = realms;
+
+        krb5_afslog_ex(context,id,&opts,&left,&nresleft);
+
+        for(int j=0; j < nleft; j++){
+            struct kafs_afslog_result* p_res = &job->results[index[j]];
+            if( j < nresleft ){
+                free(p_res->cell);
+                free(p_res->realm);
+                *p_res = left[j];
+                left[j].cell  = NULL;
+                left[j].realm = NULL;
+            } else {
+                p_res->state  = KAFS_AFSLOG_FAILED;
+                p_res->status = -1;
+                p_res->error  = errno;
+            }
+        }
+        kafs_free_afslog_results(left,nresleft);
+    }
+
+    free(cells);
+    free(realms);
+    free(index);
+
+    krb5_error_code err = _kafs_afslog_status(job);
+
+    if( (results != NULL) && (nresults != NULL) ){
+        *results  = job->results;
+        *nresults = job->nresults;
+    } else {
+        kafs_free_afslog_results(job->results,job->nresults);
+    }
+    job->results = NULL;
+
+    return(err);
+}
+
+/* ============================================================================= */
+
+void kafs_free_afslog_prefetch(struct kafs_afslog_prefetch* prefetch)
+{
+    _kafs_dbg("-> kafs_free_afslog_prefetch\n");
+
+    struct kafs_afslog_prefetch* pf = prefetch;
+    if( pf == NULL ) return;
+
+    /* the thread and its context do not exist in forked children */
+    if( ! _kafs_prefetch_wait(pf) && (pf->pid != getpid()) ) return;
+
+    if( pf->job.creds != NULL ){
+        for(int i=0; i < pf->job.nresults; i++){
+            if( (pf->job.creds[i] != NULL) && (pf->ctx != NULL) ) krb5_free_creds(pf->ctx,pf->job.creds[i]);
+        }
+    }
+
+    /* the thread did not get to the copy of the ccache */
+    krb5_context ctx = pf->ctx;
+    if( pf->ccopy && ((ctx != NULL) || (krb5_init_context(&ctx) == 0)) ){
+        krb5_ccache id;
+        if( krb5_cc_resolve(ctx,pf->ccname,&id) == 0 ) krb5_cc_destroy(ctx,id);
+        if( ctx != pf->ctx ) krb5_free_context(ctx);
+    }
+    if( pf->ctx != NULL ) krb5_free_context(pf->ctx);
+
+    kafs_free_afslog_results(pf->job.results,pf->job.nresults);
+    free(pf->job.creds);
+    free(pf->ccname);
+    free(pf);
+}
+
+/* ============================================================================= */
@@ -0,0 +1,445 @@
+/* Copyright (c) 2021 Petr Kulhanek (kulhanek@chemi.muni.cz)
+ * Support for kAFS (kernel AFS) adapted from Heimdal libkafs,
+ * kafs-client and pam-afs-session.
+ */
+
+/*
+ * Cell to realm mapping consulted before krb5_get_host_realm().
+ *
+ * CellRealms contains lines "cell REALM", a cell starting with a dot matches all
+ * cells in that domain. Realms used to obtain tokens are remembered in the learned
+ * cache "cell REALM timestamp", which is stored persistently only by root. Both
+ * files are loaded into sorted tables and reloaded when they change.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <krb5.h>
+#include <keyutils.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <limits.h>
+
+#include <kafs-user.h>
+#include <kafs_locl.h>
+
+/* ============================================================================= */
+
+struct _kafs_realm_entry {
+    char*   cell;
+    char*   realm;
+    long    stamp;      /* time when the realm was learned, 0 for CellRealms */
+};
+
+struct _kafs_realm_map {
+    const char**                path;
+    struct _kafs_realm_entry*   entries;    /* sorted by cell */
+    size_t                      nentries;
+    size_t                      mentries;
+    dev_t                       dev;        /* identity of the loaded file */
+    ino_t                       ino;
+    struct timespec             mtime;
+    off_t                       size;
+};
+
+static pthread_mutex_t          _kafs_realm_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct _kafs_realm_map   _kafs_cellrealms = { &_kafs_path_cellrealms, NULL, 0, 0, 0, 0, {0, 0}, 0 };
+static struct _kafs_realm_map   _kafs_learned    = { &_kafs_path_realm_cache, NULL, 0, 0, 0, 0, {0, 0}, 0 };
+
+/* ============================================================================= */
+
+static int _kafs_realm_cmp(const void* p_a,const void* p_b)
+{
+    const struct _kafs_realm_entry* a = p_a;
+    const struct _kafs_realm_entry* b = p_b;
+    return( strcasecmp(a->cell,b->cell) );
+}
+
+/* ============================================================================= */
+
+static void _kafs_realm_clear(struct _kafs_realm_map* map)
+{
+    for(size_t i=0; i < map->nentries; i++){
+        free(map->entries[i].cell);
+        free(map->entries[i].realm);
+    }
+    free(map->entries);
+    map->entries  = NULL;
+    map->nentries = 0;
+    map->mentries = 0;
+}
+
+/* ============================================================================= */
+
+/* append entry, the table must be sorted afterwards */
+static int _kafs_realm_append(struct _kafs_realm_map* map,const char* cell,const char* realm,long stamp)
+{
+    if( map->nentries == map->mentries ){
+        size_t mentries = map->mentries ? 2*map->mentries : 16;
+        struct _kafs_realm_entry* p_entries = realloc(map->entries,mentries*sizeof(struct _kafs_realm_entry));
+        if( p_entries == NULL ) return(-1);
+        map->entries  = p_entries;
+        map->mentries = mentries;
+    }
+
+    struct _kafs_realm_entry* p_e = &map->entries[map->nentries];
+    p_e->cell  = strdup(cell);
+    p_e->realm = strdup(realm);
+    p_e->stamp = stamp;
+    if( (p_e->cell == NULL) || (p_e->realm == NULL) ){
+        free(p_e->cell);
+        free(p_e->realm);
+        return(-1);
+    }
+    map->nentries++;
+    return(0);
+}
+
+/* ============================================================================= */
+
+static struct _kafs_realm_entry* _kafs_realm_find(struct _kafs_realm_map* map,const char* cell)
+{
+    struct _kafs_realm_entry key;
+    key.cell = (char*)cell;
+    return( bsearch(&key,map->entries,map->nentries,sizeof(struct _kafs_realm_entry),_kafs_realm_cmp) );
+}
+
+/* ============================================================================= */
+
+/* only files, which cannot be modified by other users, are trusted */
+static int _kafs_realm_trusted(const struct stat* st)
+{
+    if( (st->st_uid != 0) && (st->st_uid != geteuid()) ) return(0);
+    if( (st->st_mode & (S_IWGRP|S_IWOTH)) != 0 ) return(0);
+    return(1);
+}
+
+/* ============================================================================= */
+
+/* reload the map if its file changed, _kafs_realm_lock must be held */
+static void _kafs_realm_reload(struct _kafs_realm_map* map)
+{
+    struct stat st;
+
+    if( stat(*map->path,&st) != 0 ){
+        if( map->ino != 0 ){
+            _kafs_realm_clear(map);
+            map->ino = 0;
+        }
+        return;
+    }
+
+    if( (st.st_dev == map->dev) && (st.st_ino == map->ino) && (st.st_size == map->size) &&
+        (st.st_mtim.tv_sec == map->mtime.tv_sec) && (st.st_mtim.tv_nsec == map->mtime.tv_nsec) ){
+        return;
+    }
+
+    _kafs_realm_clear(map);
+    map->dev   = st.st_dev;
+    map->ino   = st.st_ino;
+    map->size  = st.st_size;
+    map->mtime = st.st_mtim;
+
+    if( ! _kafs_realm_trusted(&st) ){
+        _kafs_dbg("'%s' is writable by other users, ignored\n",*map->path);
+        return;
+    }
+
+    _KAFS_STAT_INC(config_parses);
+    long  start = _kafs_now_us();
+    FILE* p_f = fopen(*map->path,"r");
+    if( p_f == NULL ){
+        _kafs_dbg_errno("unable to open file '%s'\n",*map->path);
+        return;
+    }
+
+    char buff[LINE_MAX];
+    while( fgets(buff,sizeof(buff),p_f) != NULL ){
+        char* pos = strchr(buff,'#');
+        if( pos != NULL ) *pos = '\0';
+
+        char* p_save  = NULL;
+        char* p_cell  = strtok_r(buff," \t\n",&p_save);
+        char* p_realm = strtok_r(NULL," \t\n",&p_save);
+        char* p_stamp = strtok_r(NULL," \t\n",&p_save);
+        if( (p_cell == NULL) || (p_realm == NULL) ) continue;
+
+        long stamp = p_stamp ? strtol(p_stamp,NULL,10) : 0;
+        if( _kafs_realm_append(map,p_cell,p_realm,stamp) != 0 ){
+            _kafs_dbg("out-of-memory: '%s'\n",*map->path);
+            break;
+        }
+    }
+    fclose(p_f);
+
+    qsort(map->entries,map->nentries,sizeof(struct _kafs_realm_entry),_kafs_realm_cmp);
+    _KAFS_STAT_ADD(time_config,_kafs_now_us() - start);
+    _kafs_dbg("'%s' loaded with %lu entries\n",*map->path,(unsigned long)map->nentries);
+}
+
+/* ============================================================================= */
+
+/* CellRealms entry for the cell or its domain, _kafs_realm_lock must be held */
+static struct _kafs_realm_entry* _kafs_cellrealms_find(const char* cell)
+{
+    struct _kafs_realm_entry* p_e = _kafs_realm_find(&_kafs_cellrealms,cell);
+    if( p_e != NULL ) return(p_e);
+
+    /* the longest matching domain */
+    for(const char* p_dom = strchr(cell,'.'); p_dom != NULL; p_dom = strchr(p_dom+1,'.')){
+        p_e = _kafs_realm_find(&_kafs_cellrealms,p_dom);
+        if( p_e != NULL ) return(p_e);
+    }
+    return(NULL);
+}
+
+/* ============================================================================= */
+
+int _kafs_lookup_cell_realm(const char* cell,char** realm)
+{
+    _kafs_dbg("-> _kafs_lookup_cell_realm\n");
+
+    pthread_mutex_lock(&_kafs_realm_lock);
+
+    _kafs_realm_reload(&_kafs_cellrealms);
+    struct _kafs_realm_entry* p_e = _kafs_cellrealms_find(cell);
+
+    if( p_e == NULL ){
+        _kafs_realm_reload(&_kafs_learned);
+        p_e = _kafs_realm_find(&_kafs_learned,cell);
+        if( (p_e != NULL) && (time(NULL) - p_e->stamp > _KAFS_REALM_CACHE_TTL) ){
+            _kafs_dbg("learned realm '%s' for the cell '%s' expired\n",p_e->realm,cell);
+            p_e = NULL;
+        }
+    }
+
+    if( p_e == NULL ){
+        pthread_mutex_unlock(&_kafs_realm_lock);
+        return(-1);
+    }
+
+    *realm = strdup(p_e->realm);
+    _kafs_dbg("realm '%s' for the cell '%s' from '%s'\n",p_e->realm,cell,
+              p_e->stamp == 0 ? _kafs_path_cellrealms : _kafs_path_realm_cache);
+
+    pthread_mutex_unlock(&_kafs_realm_lock);
+
+    if( *realm == NULL ){
+        errno = ENOMEM;
+        return(-1);
+    }
+    _KAFS_STAT_INC(realm_map_hits);
+    return(0);
+}
+
+/* ============================================================================= */
+
+/* create the directory of the map file if needed */
+static int _kafs_realm_mkdir(struct _kafs_realm_map* map)
+{
+    char p_dir[PATH_MAX];
+
+    if( snprintf(p_dir,sizeof(p_dir),"%s",*map->path) >= (int)sizeof(p_dir) ) return(-1);
+    char* p_slash = strrchr(p_dir,'/');
+    if( p_slash != NULL ){
+        *p_slash = '\0';
+        if( (p_dir[0] != '\0') && (mkdir(p_dir,0755) == -1) && (errno != EEXIST) ) return(-1);
+    }
+    return(0);
+}
+
+/* ============================================================================= */
+
+/* lock the map file against other processes by flock() of "<file>.lock", return the lock descriptor */
+static int _kafs_realm_lock_file(struct _kafs_realm_map* map)
+{
+    char p_lock[PATH_MAX];
+
+    if( snprintf(p_lock,sizeof(p_lock),"%s.lock",*map->path) >= (int)sizeof(p_lock) ) return(-1);
+    if( _kafs_realm_mkdir(map) != 0 ) return(-1);
+
+    int fd = open(p_lock,O_RDWR|O_CREAT|O_NOFOLLOW|O_CLOEXEC,0600);
+    if( fd == -1 ) return(-1);
+
+    int ret;
+    while( ((ret = flock(fd,LOCK_EX)) == -1) && (errno == EINTR) );
+    if( ret == -1 ){
+        close(fd);
+        return(-1);
+    }
+    return(fd);
+}
+
+/* ============================================================================= */
+
+/* write the learned cache, _kafs_realm_lock and the file lock must be held */
+static int _kafs_realm_save(struct _kafs_realm_map* map)
+{
+    char p_tmp[PATH_MAX];
+
+    if( snprintf(p_tmp,sizeof(p_tmp),"%s.XXXXXX",*map->path) >= (int)sizeof(p_tmp) ) return(-1);
+
+    int fd = mkstemp(p_tmp);
+    if( fd == -1 ) return(-1);
+    fchmod(fd,0644);
+
+    FILE* p_fout = fdopen(fd,"w");
+    if( p_fout == NULL ){
+        close(fd);
+        unlink(p_tmp);
+        return(-1);
+    }
+
+    long now = time(NULL);
+    for(size_t i=0; i < map->nentries; i++){
+        if( now - map->entries[i].stamp > _KAFS_REALM_CACHE_TTL ) continue;
+        fprintf(p_fout,"%s %s %ld\n",map->entries[i].cell,map->entries[i].realm,map->entries[i].stamp);
+    }
+
+    if( (fclose(p_fout) != 0) || (rename(p_tmp,*map->path) != 0) ){
+        unlink(p_tmp);
+        return(-1);
+    }
+    return(0);
+}
+
+/* ============================================================================= */
+
+/* set or remove (realm is NULL) the learned realm of the cell in memory, _kafs_realm_lock must be held */
+static void _kafs_learned_apply(const char* cell,const char* realm,long stamp)
+{
+    struct _kafs_realm_entry* p_e = _kafs_realm_find(&_kafs_learned,cell);
+
+    if( realm == NULL ){
+        if( p_e == NULL ) return;
+        free(p_e->cell);
+        free(p_e->realm);
+        size_t i = p_e - _kafs_learned.entries;
+        memmove(p_e,p_e+1,(_kafs_learned.nentries-i-1)*sizeof(struct _kafs_realm_entry));
+        _kafs_learned.nentries--;
+    } else if( p_e != NULL ){
+        char* p_realm = strdup(realm);
+        if( p_realm == NULL ) return;
+        free(p_e->realm);
+        p_e->realm = p_realm;
+        p_e->stamp = stamp;
+    } else if( _kafs_realm_append(&_kafs_learned,cell,realm,stamp) == 0 ){
+        qsort(_kafs_learned.entries,_kafs_learned.nentries,sizeof(struct _kafs_realm_entry),_kafs_realm_cmp);
+    }
+}
+
+/* ============================================================================= */
+
+/* change the learned cache, _kafs_realm_lock must be held,
+ * only root maintains the persistent cache, others keep it in memory,
+ * the file is re-read under the file lock, so changes of concurrent processes are merged and not lost */
+static void _kafs_learned_change(const char* cell,const char* realm,long stamp)
+{
+    if( geteuid() != 0 ){
+        _kafs_learned_apply(cell,realm,stamp);
+        return;
+    }
+
+    int lock = _kafs_realm_lock_file(&_kafs_learned);
+    if( lock == -1 ){
+        _kafs_dbg_errno("unable to lock learned realms '%s'\n",_kafs_path_realm_cache);
+        _kafs_learned_apply(cell,realm,stamp);
+        return;
+    }
+
+    _kafs_realm_reload(&_kafs_learned);
+    _kafs_learned_apply(cell,realm,stamp);
+
+    if( _kafs_realm_save(&_kafs_learned) != 0 ){
+        _kafs_dbg_errno("unable to save learned realms into '%s'\n",_kafs_path_realm_cache);
+    } else {
+        /* do not reload own changes */
+        struct stat st;
+        if( stat(_kafs_path_realm_cache,&st) == 0 ){
+            _kafs_learned.dev   = st.st_dev;
+            _kafs_learned.ino   = st.st_ino;
+            _kafs_learned.size  = st.st_size;
+            _kafs_learned.mtime = st.st_mtim;
+        }
+    }
+
+    close(lock);
+}
+
+/* ============================================================================= */
+
+void _kafs_learn_cell_realm(const char* cell,const char* realm)
+{
+    _kafs_dbg("-> _kafs_learn_cell_realm\n");
+
+    if( (cell == NULL) || (realm == NULL) ) return;
+
+    pthread_mutex_lock(&_kafs_realm_lock);
+
+    /* explicit mapping takes precedence */
+    _kafs_realm_reload(&_kafs_cellrealms);
+    if( _kafs_cellrealms_find(cell) != NULL ){
+        pthread_mutex_unlock(&_kafs_realm_lock);
+        return;
+    }
+
+    _kafs_realm_reload(&_kafs_learned);
+    struct _kafs_realm_entry* p_e = _kafs_realm_find(&_kafs_learned,cell);
+    long now = time(NULL);
+
+    /* still fresh */
+    if( (p_e != NULL) && (strcmp(p_e->realm,realm) == 0) && (now - p_e->stamp < _KAFS_REALM_CACHE_TTL/2) ){
+        pthread_mutex_unlock(&_kafs_realm_lock);
+        return;
+    }
+
+    _kafs_learned_change(cell,realm,now);
+    _kafs_dbg("learned realm '%s' for the cell '%s'\n",realm,cell);
+
+    pthread_mutex_unlock(&_kafs_realm_lock);
+}
+
+/* ============================================================================= */
+
+void _kafs_forget_cell_realm(const char* cell)
+{
+    _kafs_dbg("-> _kafs_forget_cell_realm\n");
+
+    if( cell == NULL ) return;
+
+    pthread_mutex_lock(&_kafs_realm_lock);
+
+    _kafs_realm_reload(&_kafs_learned);
+    struct _kafs_realm_entry* p_e = _kafs_realm_find(&_kafs_learned,cell);
+    if( p_e != NULL ){
+        _kafs_dbg("learned realm '%s' for the cell '%s' removed\n",p_e->realm,cell);
+        _kafs_learned_change(cell,NULL,0);
+    }
+
+    pthread_mutex_unlock(&_kafs_realm_lock);
+}
+
+/* ============================================================================= */
+
+int _kafs_is_realm_error(krb5_error_code kerr)
+{
+    /* other errors, e.g. an expired TGT or an unreachable KDC, say nothing about the realm */
+    switch(kerr){
+        case KRB5KDC_ERR_S_PRINCIPAL_UNKNOWN:
+        case KRB5_REALM_UNKNOWN:
+        case KRB5_REALM_CANT_RESOLVE:
+            return(1);
+    }
+    return(0);
+}
+
+/* ============================================================================= */
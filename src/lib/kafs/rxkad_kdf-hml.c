@@ -46,6 +46,7 @@
 #include <hcrypto/des.h>
 #include <hcrypto/hmac.h>
 
+#include <kafs-user.h>
 #include <kafs_locl.h>
 
 /* helper methods */
@@ -96,6 +97,7 @@ int rxkad_derive_des_key(const void *in, size_t insize, unsigned char out[8])
 
     /* stop when 8 bit counter wraps to 0 */
     for (i = 1; i; i++) {
+        _KAFS_STAT_INC(kdf_iterations);
         HMAC_CTX_init(&mctx);
         HMAC_Init_ex(&mctx, in, insize, EVP_md5(), NULL);
         HMAC_Update(&mctx, &i, 1);
@@ -32,14 +32,12 @@
 #include <sys/socket.h>
 #include <krb5/krb5.h>
 #include <linux/if_alg.h>
+#include <kafs-user.h>
 #include <kafs_locl.h>
 
 #define MD5_DIGEST_SIZE		16
 
 #define RXKAD_TKT_TYPE_KERBEROS_V5              256
-#define OSERROR(X, Y) do { if ((long)(X) == -1) { perror(Y); exit(1); } } while(0)
-#define OSZERROR(X, Y) do { if ((long)(X) == 0) { perror(Y); exit(1); } } while(0)
-#define KRBERROR(X, Y) do { if ((X) != 0) { const char *msg = krb5_get_error_message(k5_ctx, (X)); fprintf(stderr, "%s: %s\n", (Y), msg); krb5_free_error_message(k5_ctx, msg); exit(1); } } while(0)
 
 static const uint64_t des_weak_keys[16] = {
 	0x0101010101010101ULL,
@@ -132,31 +130,49 @@ static unsigned int des3_key_to_random(unsigned char *random, const unsigned cha
 }
 
 /*
- * Do HMAC(MD5).
+ * Open HMAC(MD5) keyed by the ticket session key.  The kernel transformation
+ * is set up once and the returned socket is reused for all rounds of the KDF,
+ * each write/read pair computes one digest.
  */
-static size_t HMAC_MD5(const void *key, size_t key_len,
-		       const void *data, size_t data_len,
-		       unsigned char *md, size_t md_len)
+static int HMAC_MD5_open(const void *key, size_t key_len)
 {
-	static struct sockaddr_alg sa = {
+	static const struct sockaddr_alg sa = {
 		.salg_family	= AF_ALG,
 		.salg_type	= "hash",
 		.salg_name	= "hmac(md5)",
 	};
-	int alg, sock, ret;
-
-	alg = socket(AF_ALG, SOCK_SEQPACKET, 0);
-	OSERROR(alg, "AF_ALG");
-	OSERROR(bind(alg, (struct sockaddr *)&sa, sizeof(sa)), "bind/AF_ALG");
-	OSERROR(setsockopt(alg, SOL_ALG, ALG_SET_KEY, key, key_len), "setsockopt/AF_ALG");
-	sock = accept(alg, NULL, 0);
-	OSERROR(sock, "AF_ALG");
-	OSERROR(write(sock, data, data_len), "write/AF_ALG");
-	ret = read(sock, md, md_len);
-	OSERROR(ret, "read/AF_ALG");
-	close(sock);
+	int alg, sock;
+
+	alg = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (alg == -1) {
+		_kafs_dbg_errno("aklog: unable to open AF_ALG socket\n");
+		return -1;
+	}
+	if ((bind(alg, (const struct sockaddr *)&sa, sizeof(sa)) != 0) ||
+	    (setsockopt(alg, SOL_ALG, ALG_SET_KEY, key, key_len) != 0)) {
+		_kafs_dbg_errno("aklog: unable to set up hmac(md5)\n");
+		close(alg);
+		return -1;
+	}
+	/* the operation socket keeps the transformation */
+	sock = accept4(alg, NULL, 0, SOCK_CLOEXEC);
+	if (sock == -1)
+		_kafs_dbg_errno("aklog: unable to accept AF_ALG socket\n");
 	close(alg);
-	return ret;
+	return sock;
+}
+
+/*
+ * Do HMAC(MD5).
+ */
+static ssize_t HMAC_MD5(int sock, const void *data, size_t data_len,
+			unsigned char *md, size_t md_len)
+{
+	if (write(sock, data, data_len) != (ssize_t)data_len) {
+		_kafs_dbg_errno("aklog: unable to write to AF_ALG socket\n");
+		return -1;
+	}
+	return read(sock, md, md_len);
 }
 
 /*
@@ -182,25 +198,32 @@ static const struct kdf_data rxkad_kdf_data = {
  *
  * [afs3-rxkad-k5-kdf-00 §4.3]
  */
-static int key_derivation_function(krb5_creds *creds, uint8_t *session_key)
+static int key_derivation_function(const void *key, size_t key_len, uint8_t *session_key)
 {
 	struct kdf_data kdf_data = rxkad_kdf_data;
-	unsigned int i, len;
+	unsigned int i;
+	ssize_t len;
+	int sock;
 	union {
 		unsigned char md5[MD5_DIGEST_SIZE];
 		uint64_t n_des;
 	} buf;
 
+	sock = HMAC_MD5_open(key, key_len);
+	if (sock == -1)
+		return -1;
+
 	for (i = 1; i <= 255; i++) {
 		/* K(i) = PRF(Ks, [i]_2 || Label || 0x00 || [L]_2) */
 		kdf_data.i_2 = i;
-		len = HMAC_MD5(creds->keyblock.contents, creds->keyblock.length,
-			       (unsigned char *)&kdf_data, sizeof(kdf_data),
+		_KAFS_STAT_INC(kdf_iterations);
+		len = HMAC_MD5(sock, (unsigned char *)&kdf_data, sizeof(kdf_data),
 			       buf.md5, sizeof(buf.md5));
 
-		if (len < sizeof(buf.n_des)) {
-			fprintf(stderr, "aklog: HMAC returned short result\n");
-            return(1);
+		if (len < (ssize_t)sizeof(buf.n_des)) {
+			_kafs_dbg("aklog: HMAC returned short result\n");
+			close(sock);
+			return(1);
 		}
 
 		/* Overlay the DES parity. */
@@ -210,11 +233,14 @@ static int key_derivation_function(krb5_creds *creds, uint8_t *session_key)
 			goto success;
 	}
 
+    close(sock);
     _kafs_dbg("aklog: Unable to derive strong DES key\n");
     return(1);
 
 success:
+	close(sock);
 	memcpy(session_key, &buf.n_des, sizeof(buf.n_des));
+	memset(&buf, 0, sizeof(buf));
     return(0);
 }
 
@@ -224,6 +250,8 @@ success:
 int _kafs_derive_des_key(krb5_creds *creds, uint8_t *session_key)
 {
 	unsigned int length = creds->keyblock.length;
+	unsigned char random[32];
+	int ret;
 
 	switch (creds->keyblock.enctype) {
 	case ENCTYPE_NULL:		goto not_supported;
@@ -257,14 +285,19 @@ des3_discard_parity:
         _kafs_dbg("aklog: 3DES session key not multiple of 8 octets.\n");
         return(1);
 	}
-	creds->keyblock.length = des3_key_to_random(creds->keyblock.contents,
-						    creds->keyblock.contents,
-						    length);
-	goto derive_key;
+	if (length > sizeof(random) + 8) {
+        _kafs_dbg("aklog: 3DES session key too long.\n");
+        return(1);
+	}
+	/* the ticket is not modified, it can be used again */
+	length = des3_key_to_random(random, creds->keyblock.contents, length);
+	ret = key_derivation_function(random, length, session_key);
+	memset(random, 0, sizeof(random));
+	return(ret);
 
 	/* Do KDF [afs3-rxkad-k5-kdf-00 §4.3]. */
 derive_key:
-    return( key_derivation_function(creds, session_key) );
+    return( key_derivation_function(creds->keyblock.contents, length, session_key) );
 
 	/* Use as-is for single-DES [afs3-rxkad-k5-kdf-00 §4.1]. */
 just_copy:
@@ -20,6 +20,7 @@
 #include <krb5.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <kafs-user.h>
 
 /* ============================================================================= */
 
@@ -31,6 +32,25 @@
 
 /* ============================================================================= */
 
+/* per-transaction statistics, times are in ms */
+struct pam_kafs_stats {
+    struct kafs_stats   lib_start;  /* libkafs statistics at the beginning */
+    long    start;
+    long    t_locpag;
+    long    t_pag;
+    long    t_convert;
+    long    t_afslog;
+    int     ncells;
+    int     ncreated;
+    int     nskipped;
+    int     ncached;
+    int     nfailed;
+    int     err;
+    const char* convert;    /* result of ccache conversion, NULL -> none */
+    const char* broker;     /* kafs-brokerd use, NULL -> not configured */
+    const char* prefetch;   /* prefetched tickets used, NULL -> none */
+};
+
 struct pma_kafs_handle {
     pam_handle_t*   pamh;
     krb5_context    ctx;
@@ -41,18 +61,39 @@ struct pma_kafs_handle {
 
     /* local config */
     int     conf_verbosity;
+    int     conf_libkafs_debug;
     int     conf_create_pag;
     int     conf_create_tokens;
     int     conf_minimum_uid;
     int     conf_shared_pag;
+    int     conf_refreshable_pag;
     char*   conf_locpag_for_pam;
     char*   conf_locpag_for_user;
     char*   conf_locpag_for_principal;
     char*   conf_convert_cc_to;
+    int     conf_afslog_timeout;
+    int     conf_afslog_min_lifetime;
+    int     conf_afslog_concurrency;
+    int     conf_user_cells;
+    int     conf_broker;
+    int     conf_prefetch;
+    int     conf_token_cache;
+    int     conf_summary;
+    int     conf_summary_threshold;
+
+    struct pam_kafs_stats   stats;
 };
 
 typedef struct pma_kafs_handle kafs_handle_t;
 
+/* credentials read from ccache */
+struct pam_kafs_creds {
+    krb5_creds* creds;
+    int         ncreds;
+    int         ndropped;   /* expired and duplicate entries */
+    int         tgt;        /* index of krbtgt/REALM@REALM, -1 if none */
+};
+
 /* ============================================================================= */
 
 /* logging */
@@ -71,6 +112,12 @@ void putil_debug(kafs_handle_t* kafs,const char* p_fmt,...)
 void putil_err_krb5(kafs_handle_t* kafs,int kerr,const char* p_fmt,...)
                 __attribute__((__format__(printf, 3, 4)));
 
+/* monotonic time in ms */
+long putil_now_ms(void);
+
+/* log one record with phase durations and token counts */
+void putil_summary(kafs_handle_t* kafs,const char* p_op);
+
 /* ============================================================================= */
 
 /* user magic */
@@ -94,12 +141,37 @@ int pamkafs_tests_for_locpag(kafs_handle_t* kafs);
 /* if requested, convert ccache type to desired type */
 int pamkafs_convert_ccache(kafs_handle_t* kafs);
 
-/* copy ccache */
+/* copy ccache without expired and duplicate entries, skipped if newcc holds the same TGT,
+   oldcc is destroyed on success and closed otherwise */
 int pamkafs_copy_cc(kafs_handle_t* kafs,krb5_ccache oldcc,krb5_ccache newcc);
 
+/* read ccache without expired and duplicate entries */
+int pamkafs_read_cc(kafs_handle_t* kafs,krb5_ccache cc,struct pam_kafs_creds* list);
+
+/* free credentials read by pamkafs_read_cc */
+void pamkafs_free_creds(kafs_handle_t* kafs,struct pam_kafs_creds* list);
+
+/* is it krbtgt/REALM@REALM? */
+int pamkafs_is_local_tgt(kafs_handle_t* kafs,krb5_principal server);
+
+/* does ccache hold the same TGT for the principal? */
+int pamkafs_has_same_tgt(kafs_handle_t* kafs,krb5_ccache cc,krb5_principal princ,krb5_creds* tgt);
+
+/* cleanup of PAM data allocated by malloc */
+void pamkafs_free_data(pam_handle_t* pamh,void* data,int error_status);
+
+/* options of afslog, cells must be freed by kafs_free_these_cells */
+void pamkafs_afslog_opts(kafs_handle_t* kafs,struct kafs_afslog_opts* opts,char*** cells);
+
 /* afslog */
 int pamkafs_afslog(kafs_handle_t* kafs);
 
+/* start background acquisition of AFS service tickets for afslog */
+int pamkafs_prefetch(kafs_handle_t* kafs);
+
+/* cleanup of PAM data with prefetched tickets */
+void pamkafs_free_prefetch(pam_handle_t* pamh,void* data,int error_status);
+
 /* destroy tokens */
 int pamkafs_destroy_tokens(kafs_handle_t* kafs);
 
@@ -109,6 +181,8 @@ int pamkafs_destroy_tokens(kafs_handle_t* kafs);
 #define PAMAFS_MODULE_NAME          "pam-kafs-session"
 #define AFSLOG                      "-afslog"
 #define LOCPAG                      "-locpag"
+#define CONVERTED                   "-converted"
+#define PREFETCH                    "-prefetch"
 
 /* ============================================================================= */
 
@@ -25,6 +25,7 @@
 #include <syslog.h>
 #include <fnmatch.h>
 #include <stdio.h>
+#include <time.h>
 #include <linux/limits.h>
 #include <security/pam_ext.h>
 #include <security/pam_modutil.h>
@@ -45,16 +46,34 @@ kafs_handle_t* __init_user(pam_handle_t *pamh)
     kafs->pamh      = pamh;
     kafs->ctx       = NULL;
 
+    /* other modules could change the session keyring since the last call */
+    kafs_invalidate_probes();
+
     /* config - default value */
     kafs->conf_verbosity                = 0;
+    kafs->conf_libkafs_debug            = 0;
     kafs->conf_create_pag               = 1;
     kafs->conf_create_tokens            = 1;
     kafs->conf_minimum_uid              = 1000;
     kafs->conf_shared_pag               = 0;
+    kafs->conf_refreshable_pag          = 0;
     kafs->conf_locpag_for_pam           = NULL;
     kafs->conf_locpag_for_user          = NULL;
     kafs->conf_locpag_for_principal     = NULL;
     kafs->conf_convert_cc_to            = NULL;
+    kafs->conf_afslog_timeout           = 0;
+    kafs->conf_afslog_min_lifetime      = 0;
+    kafs->conf_afslog_concurrency       = 1;
+    kafs->conf_user_cells               = 1;
+    kafs->conf_broker                   = 0;
+    kafs->conf_prefetch                 = 0;
+    kafs->conf_token_cache              = 1;
+    kafs->conf_summary                  = 0;
+    kafs->conf_summary_threshold        = 0;
+
+    memset(&kafs->stats,0,sizeof(kafs->stats));
+    kafs->stats.start = putil_now_ms();
+    kafs_get_stats(&kafs->stats.lib_start);
 
     /* read setup from krb5.conf */
     krb5_error_code kret;
@@ -74,10 +93,15 @@ kafs_handle_t* __init_user(pam_handle_t *pamh)
     krb5_appdefault_string(kafs->ctx, PAMAFS_MODULE_NAME, NULL, "verbosity", "0", &p_cs);
     kafs->conf_verbosity = atol(p_cs);
 
+    krb5_appdefault_string(kafs->ctx, PAMAFS_MODULE_NAME, NULL, "libkafs_debug", "0", &p_cs);
+    kafs->conf_libkafs_debug = atol(p_cs);
+    kafs_set_verbose(kafs->conf_libkafs_debug);
+
     krb5_appdefault_boolean(kafs->ctx, PAMAFS_MODULE_NAME, NULL, "create_pag", 1, &(kafs->conf_create_pag));
     krb5_appdefault_boolean(kafs->ctx, PAMAFS_MODULE_NAME, NULL, "create_tokens", 1, &(kafs->conf_create_tokens));
 
     krb5_appdefault_boolean(kafs->ctx, PAMAFS_MODULE_NAME, NULL, "shared_pag", 0, &(kafs->conf_shared_pag));
+    krb5_appdefault_boolean(kafs->ctx, PAMAFS_MODULE_NAME, NULL, "refreshable_pag", 0, &(kafs->conf_refreshable_pag));
 
     krb5_appdefault_string(kafs->ctx, PAMAFS_MODULE_NAME, NULL, "minimum_uid", "1000", &p_cs);
     kafs->conf_minimum_uid = atol(p_cs);
@@ -88,6 +112,27 @@ kafs_handle_t* __init_user(pam_handle_t *pamh)
 
     krb5_appdefault_string(kafs->ctx, PAMAFS_MODULE_NAME, NULL, "convert_cc_to", "", &(kafs->conf_convert_cc_to));
 
+    krb5_appdefault_string(kafs->ctx, PAMAFS_MODULE_NAME, NULL, "afslog_timeout", "0", &p_cs);
+    kafs->conf_afslog_timeout = atol(p_cs);
+
+    krb5_appdefault_string(kafs->ctx, PAMAFS_MODULE_NAME, NULL, "afslog_min_lifetime", "0", &p_cs);
+    kafs->conf_afslog_min_lifetime = atol(p_cs);
+
+    krb5_appdefault_string(kafs->ctx, PAMAFS_MODULE_NAME, NULL, "afslog_concurrency", "1", &p_cs);
+    kafs->conf_afslog_concurrency = atol(p_cs);
+
+    krb5_appdefault_boolean(kafs->ctx, PAMAFS_MODULE_NAME, NULL, "user_cells", 1, &(kafs->conf_user_cells));
+
+    krb5_appdefault_boolean(kafs->ctx, PAMAFS_MODULE_NAME, NULL, "broker", 0, &(kafs->conf_broker));
+
+    krb5_appdefault_boolean(kafs->ctx, PAMAFS_MODULE_NAME, NULL, "prefetch", 0, &(kafs->conf_prefetch));
+
+    krb5_appdefault_boolean(kafs->ctx, PAMAFS_MODULE_NAME, NULL, "token_cache", 1, &(kafs->conf_token_cache));
+
+    krb5_appdefault_boolean(kafs->ctx, PAMAFS_MODULE_NAME, NULL, "summary", 0, &(kafs->conf_summary));
+    krb5_appdefault_string(kafs->ctx, PAMAFS_MODULE_NAME, NULL, "summary_threshold", "0", &p_cs);
+    kafs->conf_summary_threshold = atol(p_cs);
+
 /* check the user context */
     if (getuid() != geteuid() || getgid() != getegid()) {
         putil_err(kafs, "kafs setup in a setuid context ignored");
@@ -160,6 +205,9 @@ void __free_user(kafs_handle_t* kafs)
    key_serial_t kt = k_get_pag_id();
    putil_debug(kafs,"> PAG ID: %10d (0x%08x)",kt,kt);
 
+   /* end of PAM transaction */
+   kafs_flush_log();
+
    krb5_free_context(kafs->ctx);
    free(kafs);
 }
@@ -344,10 +392,66 @@ void putil_debug(kafs_handle_t* kafs,const char* p_fmt,...)
 
 /* ============================================================================= */
 
+long putil_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return(ts.tv_sec*1000 + ts.tv_nsec/1000000);
+}
+
+/* ============================================================================= */
+
+void putil_summary(kafs_handle_t* kafs,const char* p_op)
+{
+    if( kafs == NULL ) return;
+    if( kafs->conf_summary == 0 ) return;
+
+    long total = putil_now_ms() - kafs->stats.start;
+    if( total < kafs->conf_summary_threshold ) return;
+
+    const void* p_service = NULL;
+    if( (pam_get_item(kafs->pamh, PAM_SERVICE, &p_service) != PAM_SUCCESS) || (p_service == NULL) ){
+        p_service = "-";
+    }
+
+    struct kafs_stats lib_end;
+    kafs_get_stats(&lib_end);
+
+    /* one record per transaction in key=value format */
+    pam_syslog(kafs->pamh,LOG_NOTICE,
+               "summary op=%s service=%s user=%s uid=%u total_ms=%ld locpag_ms=%ld pag_ms=%ld "
+               "convert_ms=%ld convert=%s broker=%s prefetch=%s afslog_ms=%ld cells=%d created=%d skipped=%d cached=%d failed=%d err=%d "
+               "replaced=%lu kdc_requests=%lu realm_lookups=%lu realm_map_hits=%lu kdf_iterations=%lu keyring_calls=%lu config_parses=%lu "
+               "realm_ms=%lu get_creds_ms=%lu derive_key_ms=%lu settoken_ms=%lu config_ms=%lu",
+               p_op,(const char*)p_service,kafs->pw_name,kafs->uid,total,
+               kafs->stats.t_locpag,kafs->stats.t_pag,kafs->stats.t_convert,
+               kafs->stats.convert ? kafs->stats.convert : "none",
+               kafs->stats.broker ? kafs->stats.broker : "none",
+               kafs->stats.prefetch ? kafs->stats.prefetch : "none",kafs->stats.t_afslog,
+               kafs->stats.ncells,kafs->stats.ncreated,kafs->stats.nskipped,kafs->stats.ncached,kafs->stats.nfailed,
+               kafs->stats.err,
+               lib_end.tokens_replaced - kafs->stats.lib_start.tokens_replaced,
+               lib_end.kdc_requests - kafs->stats.lib_start.kdc_requests,
+               lib_end.realm_lookups - kafs->stats.lib_start.realm_lookups,
+               lib_end.realm_map_hits - kafs->stats.lib_start.realm_map_hits,
+               lib_end.kdf_iterations - kafs->stats.lib_start.kdf_iterations,
+               lib_end.keyring_calls - kafs->stats.lib_start.keyring_calls,
+               lib_end.config_parses - kafs->stats.lib_start.config_parses,
+               (lib_end.time_realm - kafs->stats.lib_start.time_realm) / 1000,
+               (lib_end.time_get_creds - kafs->stats.lib_start.time_get_creds) / 1000,
+               (lib_end.time_derive_key - kafs->stats.lib_start.time_derive_key) / 1000,
+               (lib_end.time_settoken - kafs->stats.lib_start.time_settoken) / 1000,
+               (lib_end.time_config - kafs->stats.lib_start.time_config) / 1000);
+}
+
+/* ============================================================================= */
+
 int pamkafs_create_session(kafs_handle_t* kafs)
 {
     const void*     dummy;
     int             already_afslog;
+    int             ret = 0;
+    int             err = 0;
 
     /* was afslog already called? */
     already_afslog = 0;
@@ -358,14 +462,19 @@ int pamkafs_create_session(kafs_handle_t* kafs)
 
     /* become target user for subsequent operations */
     if( __enter_user(kafs) > 0 ){
-        return(1);   /* this is serious error */
+        err = 1;
+        ret = 1;    /* this is serious error */
+        goto done;
     }
 
-    int err = 0;
+    long phase;
 
     /* do some tests within context of target user */
+    phase = putil_now_ms();
     pamkafs_tests_for_locpag(kafs);  /* ignore errors */
+    kafs->stats.t_locpag = putil_now_ms() - phase;
 
+    phase = putil_now_ms();
     if( kafs->conf_create_pag == 1 ) {
         if( k_haspag() == 0 ){
             if( kafs->conf_shared_pag == 1 ) {
@@ -376,7 +485,7 @@ int pamkafs_create_session(kafs_handle_t* kafs)
                     putil_debug(kafs,"PAG: shared PAG created");
                 }
             } else {
-                if( k_setpag() != 0 ){
+                if( (kafs->conf_refreshable_pag == 1 ? k_setpag_refreshable() : k_setpag()) != 0 ){
                     putil_err(kafs, "unable to create local PAG");
                     err = 2;
                 } else {
@@ -390,11 +499,14 @@ int pamkafs_create_session(kafs_handle_t* kafs)
     } else {
         putil_debug(kafs,"PAG: reusing default session keyring");
     }
+    kafs->stats.t_pag = putil_now_ms() - phase;
 
     /* convert ccache if requested */
     if( err == 0 ) {
         /* if the PAG creation fails, we should convert ccache, because it can go to incorrect session keyring */
+        phase = putil_now_ms();
         pamkafs_convert_ccache(kafs); /* ignore errors */
+        kafs->stats.t_convert = putil_now_ms() - phase;
     } else {
         putil_debug(kafs,"KRB5: no ccache conversion due to previous PAG creation error");
     }
@@ -403,12 +515,14 @@ int pamkafs_create_session(kafs_handle_t* kafs)
     if( err == 0 ){
         /* if the PAG creation fails, we should not create AFS tokens, because they can go to incorrect session keyring */
         if( (kafs->conf_create_tokens == 1) && (already_afslog == 0)  ) {
+            phase = putil_now_ms();
             if( pamkafs_afslog(kafs) != 0 ) {
                 putil_err(kafs, "AFS: unable to afslog");
                 err = 4;
             }else {
                 putil_debug(kafs,"AFS: tokens created");
             }
+            kafs->stats.t_afslog = putil_now_ms() - phase;
         } else {
             putil_debug(kafs,"AFS: no tokens requested");
         }
@@ -418,7 +532,9 @@ int pamkafs_create_session(kafs_handle_t* kafs)
 
     /* restore service user */
     if( __leave_user(kafs) ){
-        return(2);  /* this is serious error */
+        err = 3;
+        ret = 2;    /* this is serious error */
+        goto done;
     }
 
     /* record success */
@@ -432,8 +548,13 @@ int pamkafs_create_session(kafs_handle_t* kafs)
         }
     }
 
-    /* always return success */
-    return(0);
+done:
+    /* err: 1 - enter user, 2 - PAG, 3 - leave user, 4 - afslog */
+    kafs->stats.err = err;
+    putil_summary(kafs,"open_session");
+
+    /* always return success unless the user context cannot be switched */
+    return(ret);
 }
 
 /* ============================================================================= */
@@ -441,26 +562,37 @@ int pamkafs_create_session(kafs_handle_t* kafs)
 int pamkafs_refresh_tokens(kafs_handle_t* kafs)
 {
     /* always reinitialize AFS tokens */
+    int ret = 0;
 
     /* become target user for subsequent operations */
     if( __enter_user(kafs) > 0 ){
-        return(1); /* serious error */
+        kafs->stats.err = 1;
+        ret = 1; /* serious error */
+        goto done;
     }
 
-    /* refresh tokens */
+    /* refresh tokens, cached copies would not be renewed */
+    kafs->conf_token_cache = 0;
+    long phase = putil_now_ms();
     if( pamkafs_afslog(kafs) != 0 ) {
         putil_err(kafs, "AFS: unable to refresh AFS tokens");
+        kafs->stats.err = 4;
     }else {
         putil_debug(kafs,"AFS: tokens refreshed");
     }
+    kafs->stats.t_afslog = putil_now_ms() - phase;
 
     /* restore service user */
     if( __leave_user(kafs) ){
-        return(2);  /* serious error */
+        kafs->stats.err = 3;
+        ret = 2;  /* serious error */
     }
 
-    /* always return success */
-    return(0);
+done:
+    putil_summary(kafs,"refresh_tokens");
+
+    /* always return success unless the user context cannot be switched */
+    return(ret);
 }
 
 /* ============================================================================= */
@@ -599,6 +731,14 @@ int pamkafs_convert_ccache(kafs_handle_t* kafs)
         return(0);
     }
 
+    /* converted by previous phase of this PAM transaction */
+    const void* p_converted;
+    if( (pam_get_data(kafs->pamh, PAMAFS_MODULE_NAME CONVERTED, &p_converted) == PAM_SUCCESS) &&
+        (p_converted != NULL) && (strcmp(p_converted,p_cc_name) == 0) ){
+        putil_debug(kafs,"KRB5: ccache '%s' already converted",p_cc_name);
+        return(0);
+    }
+
     krb5_error_code kret;
     krb5_ccache     ccache;
 
@@ -635,8 +775,11 @@ int pamkafs_convert_ccache(kafs_handle_t* kafs)
             return(2);
         }
 
-        if( pamkafs_copy_cc(kafs,ccache,ccache2) != 0 ){
-            putil_err(kafs,"KRB5: unable to copy ccache from '%s' to '%s'",p_cc_name,buffer1);
+        /* ccache is consumed */
+        kret = pamkafs_copy_cc(kafs,ccache,ccache2);
+        krb5_cc_close(kafs->ctx, ccache2);
+        if( kret != 0 ){
+            putil_err(kafs,"KRB5: unable to copy ccache to '%s'",buffer1);
             return(3);
         }
 
@@ -655,6 +798,14 @@ int pamkafs_convert_ccache(kafs_handle_t* kafs)
 
         putil_debug(kafs,"KRB5: new ccache name: '%s'",buffer1);
 
+        /* record the result for later phases */
+        char* p_name = strdup(buffer1);
+        if( (p_name == NULL) ||
+            (pam_set_data(kafs->pamh, PAMAFS_MODULE_NAME CONVERTED, p_name, pamkafs_free_data) != PAM_SUCCESS) ){
+            putil_err(kafs, "PAM: unable to set CONVERTED tag");
+            free(p_name);
+        }
+
     } else {
         putil_debug(kafs,"KRB5: ccache type is already (%s)",kafs->conf_convert_cc_to);
         krb5_cc_close(kafs->ctx, ccache);
@@ -667,67 +818,71 @@ int pamkafs_convert_ccache(kafs_handle_t* kafs)
 
 int pamkafs_copy_cc(kafs_handle_t* kafs,krb5_ccache oldcc,krb5_ccache newcc)
 {
-    krb5_cc_cursor  cursor;
-    krb5_error_code kret;
-    krb5_creds      creds;
+    struct pam_kafs_creds   list;
+    krb5_principal          princ;
+    krb5_error_code         kret;
 
-    kret = krb5_cc_start_seq_get(kafs->ctx, oldcc, &cursor);
+    memset(&list,0,sizeof(list));
+    list.tgt = -1;
+
+    kret = krb5_cc_get_principal(kafs->ctx,oldcc,&princ);
     if( kret != 0 ){
-        putil_err_krb5(kafs, kret, "cannot open credentials from old ccache");
-        goto done;
+        putil_err_krb5(kafs,kret,"unable to get principal from old cache");
+        krb5_cc_close(kafs->ctx, oldcc);
+        return(kret);
     }
 
-    kret = krb5_cc_next_cred(kafs->ctx, oldcc, &cursor, &creds);
-    if( kret != 0 ){
-        putil_err_krb5(kafs, kret, "cannot read credentials from old ccache");
+    kret = pamkafs_read_cc(kafs,oldcc,&list);
+    if( kret != 0 ) goto done;
+
+    /* repeated logins - the destination already holds the same TGT */
+    if( (list.tgt >= 0) && (pamkafs_has_same_tgt(kafs,newcc,princ,&list.creds[list.tgt]) == 1) ){
+        putil_debug(kafs,"KRB5: new ccache already holds the same TGT");
+        kafs->stats.convert = "skipped";
         goto done;
     }
 
-    krb5_principal princ;
-    kret = krb5_cc_get_principal(kafs->ctx,oldcc,&princ);
-    if( kret != 0 ){
-        putil_err_krb5(kafs,kret,"unable to get principal from old cache");
-        krb5_free_cred_contents(kafs->ctx, &creds);
-        goto done;
+    /* nothing to drop - let the library move the cache, it can use a native operation,
+       Heimdal does not support moves between different ccache types */
+    if( list.ndropped == 0 ){
+        kret = krb5_cc_move(kafs->ctx, oldcc, newcc);
+        if( kret == 0 ){
+            /* oldcc is destroyed by the move */
+            putil_debug(kafs,"KRB5: ccache moved (%d creds)",list.ncreds);
+            kafs->stats.convert = "moved";
+            pamkafs_free_creds(kafs,&list);
+            krb5_free_principal(kafs->ctx,princ);
+            return(0);
+        }
+        putil_debug(kafs,"KRB5: unable to move ccache (%d), copying",kret);
     }
 
     kret = krb5_cc_initialize(kafs->ctx, newcc, princ);
     if( kret != 0 ){
         putil_err_krb5(kafs, kret, "cannot initialize new ccache");
-        krb5_free_cred_contents(kafs->ctx, &creds);
-        krb5_free_principal(kafs->ctx,princ);
         goto done;
     }
 
-    kret = krb5_cc_store_cred(kafs->ctx, newcc, &creds);
-    if( kret != 0 ){
-        putil_err_krb5(kafs, kret, "cannot store credentials in new ccache");
-        krb5_free_cred_contents(kafs->ctx, &creds);
-        krb5_free_principal(kafs->ctx,princ);
-        goto done;
-    }
-
-    krb5_free_cred_contents(kafs->ctx, &creds);
-    krb5_free_principal(kafs->ctx,princ);
-
-    /* copy others if any */
-    while( krb5_cc_next_cred(kafs->ctx, oldcc, &cursor, &creds) == 0 ) {
-        kret = krb5_cc_store_cred(kafs->ctx, newcc, &creds);
-        krb5_free_cred_contents(kafs->ctx, &creds);
+    for(int i=0; i < list.ncreds; i++){
+        kret = krb5_cc_store_cred(kafs->ctx, newcc, &list.creds[i]);
         if( kret != 0 ){
             putil_err_krb5(kafs, kret, "cannot store credentials in new ccache");
-            krb5_free_cred_contents(kafs->ctx, &creds);
             goto done;
         }
     }
-
-    kret = 0;
+    putil_debug(kafs,"KRB5: ccache copied (%d creds, %d dropped)",list.ncreds,list.ndropped);
+    kafs->stats.convert = "copied";
 
 done:
-    krb5_cc_end_seq_get(kafs->ctx, oldcc, &cursor);
+    pamkafs_free_creds(kafs,&list);
+    krb5_free_principal(kafs->ctx,princ);
+
     if( kret == 0 ){
         /* everything is OK - destroy the old cache */
         krb5_cc_destroy(kafs->ctx, oldcc);
+    } else {
+        kafs->stats.convert = "failed";
+        krb5_cc_close(kafs->ctx, oldcc);
     }
 
     return(kret);
@@ -735,6 +890,154 @@ done:
 
 /* ============================================================================= */
 
+int pamkafs_read_cc(kafs_handle_t* kafs,krb5_ccache cc,struct pam_kafs_creds* list)
+{
+    krb5_cc_cursor  cursor;
+    krb5_error_code kret;
+    krb5_creds      creds;
+    time_t          now = time(NULL);
+
+    kret = krb5_cc_start_seq_get(kafs->ctx, cc, &cursor);
+    if( kret != 0 ){
+        putil_err_krb5(kafs, kret, "cannot open credentials from old ccache");
+        return(kret);
+    }
+
+    while( krb5_cc_next_cred(kafs->ctx, cc, &cursor, &creds) == 0 ) {
+        int config = krb5_is_config_principal(kafs->ctx, creds.server);
+
+        /* expired tickets are useless in the new ccache, config entries do not expire */
+        if( (config == 0) && (creds.times.endtime != 0) && (creds.times.endtime <= now) ){
+            krb5_free_cred_contents(kafs->ctx, &creds);
+            list->ndropped++;
+            continue;
+        }
+
+        /* duplicate entries - keep the one with the latest expiration */
+        int i;
+        for(i=0; i < list->ncreds; i++){
+            if( krb5_principal_compare(kafs->ctx, list->creds[i].server, creds.server) &&
+                krb5_principal_compare(kafs->ctx, list->creds[i].client, creds.client) ) break;
+        }
+        if( i < list->ncreds ){
+            list->ndropped++;
+            if( creds.times.endtime >= list->creds[i].times.endtime ){
+                krb5_free_cred_contents(kafs->ctx, &list->creds[i]);
+                list->creds[i] = creds;
+            } else {
+                krb5_free_cred_contents(kafs->ctx, &creds);
+            }
+            continue;
+        }
+
+        krb5_creds* p_new = realloc(list->creds,(list->ncreds+1)*sizeof(krb5_creds));
+        if( p_new == NULL ){
+            putil_err(kafs, "cannot allocate credentials list");
+            krb5_free_cred_contents(kafs->ctx, &creds);
+            kret = ENOMEM;
+            break;
+        }
+        list->creds = p_new;
+        list->creds[list->ncreds] = creds;
+        if( (config == 0) && (list->tgt < 0) && (pamkafs_is_local_tgt(kafs,creds.server) == 1) ){
+            list->tgt = list->ncreds;
+        }
+        list->ncreds++;
+    }
+
+    krb5_cc_end_seq_get(kafs->ctx, cc, &cursor);
+    return(kret);
+}
+
+/* ============================================================================= */
+
+void pamkafs_free_creds(kafs_handle_t* kafs,struct pam_kafs_creds* list)
+{
+    for(int i=0; i < list->ncreds; i++){
+        krb5_free_cred_contents(kafs->ctx, &list->creds[i]);
+    }
+    free(list->creds);
+    list->creds  = NULL;
+    list->ncreds = 0;
+}
+
+/* ============================================================================= */
+
+int pamkafs_is_local_tgt(kafs_handle_t* kafs,krb5_principal server)
+{
+    char* p_sname;
+    if( krb5_unparse_name(kafs->ctx, server, &p_sname) != 0 ) return(0);
+
+    /* krbtgt/REALM@REALM */
+    int   tgt  = 0;
+    char* p_at = strrchr(p_sname,'@');
+    if( (strncmp(p_sname,"krbtgt/",7) == 0) && (p_at != NULL) ){
+        size_t len = p_at - (p_sname + 7);
+        tgt = (strlen(p_at + 1) == len) && (strncmp(p_sname + 7,p_at + 1,len) == 0);
+    }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    krb5_free_unparsed_name(kafs->ctx,p_sname);
+#pragma GCC diagnostic pop
+
+    return(tgt);
+}
+
+/* ============================================================================= */
+
+int pamkafs_has_same_tgt(kafs_handle_t* kafs,krb5_ccache cc,krb5_principal princ,krb5_creds* tgt)
+{
+    krb5_principal  cc_princ;
+
+    /* not initialized or for other principal */
+    if( krb5_cc_get_principal(kafs->ctx, cc, &cc_princ) != 0 ) return(0);
+    int same = krb5_principal_compare(kafs->ctx, princ, cc_princ);
+    krb5_free_principal(kafs->ctx, cc_princ);
+    if( ! same ) return(0);
+
+    krb5_creds  mcreds;
+    krb5_creds  creds;
+
+    memset(&mcreds,0,sizeof(mcreds));
+    mcreds.client = tgt->client;
+    mcreds.server = tgt->server;
+    if( krb5_cc_retrieve_cred(kafs->ctx, cc, 0, &mcreds, &creds) != 0 ) return(0);
+
+    same = (creds.ticket.length == tgt->ticket.length) &&
+           (memcmp(creds.ticket.data,tgt->ticket.data,tgt->ticket.length) == 0);
+    krb5_free_cred_contents(kafs->ctx, &creds);
+
+    return(same ? 1 : 0);
+}
+
+/* ============================================================================= */
+
+void pamkafs_free_data(pam_handle_t* pamh UNUSED,void* data,int error_status UNUSED)
+{
+    free(data);
+}
+
+/* ============================================================================= */
+
+void pamkafs_afslog_opts(kafs_handle_t* kafs,struct kafs_afslog_opts* opts,char*** cells)
+{
+    memset(opts,0,sizeof(struct kafs_afslog_opts));
+    opts->timeout       = kafs->conf_afslog_timeout * 1000L;
+    opts->min_lifetime  = kafs->conf_afslog_min_lifetime;
+    opts->concurrency   = kafs->conf_afslog_concurrency;
+    opts->use_cache     = kafs->conf_token_cache;
+
+    /* narrow cells to the user selection, the personal list is read as the target user */
+    *cells = NULL;
+    if( kafs->conf_user_cells ){
+        *cells = kafs_get_user_cells(kafs->pw_name);
+        opts->cells = (const char**)*cells;
+    }
+}
+
+/* ============================================================================= */
+
 int pamkafs_afslog(kafs_handle_t* kafs)
 {    
     /* Don't try to get a token unless we have a K5 ticket cache. */
@@ -756,13 +1059,69 @@ int pamkafs_afslog(kafs_handle_t* kafs)
     }
 
     /* afslog */
-    kret = krb5_afslog(kafs->ctx, ccache, NULL, NULL);
+    struct kafs_afslog_opts     opts;
+    struct kafs_afslog_result*  results  = NULL;
+    int                         nresults = 0;
+    char**                      p_cells  = NULL;
+    const void*                 p_pf     = NULL;
+
+    pamkafs_afslog_opts(kafs,&opts,&p_cells);
+
+    if( (pam_get_data(kafs->pamh, PAMAFS_MODULE_NAME PREFETCH, &p_pf) == PAM_SUCCESS) && (p_pf != NULL) ){
+        /* service tickets were obtained in the auth phase, cells are given by the prefetch */
+        kret = krb5_afslog_install(kafs->ctx, ccache, (struct kafs_afslog_prefetch*)p_pf, &results, &nresults);
+        kafs->stats.prefetch = "yes";
+        /* the prefetch is released, it can be used only once */
+        pam_set_data(kafs->pamh, PAMAFS_MODULE_NAME PREFETCH, NULL, NULL);
+    } else if( kafs->conf_broker ){
+        /* tokens go to the session keyring of the user, i.e. the PAG */
+        kret = krb5_afslog_broker(kafs->ctx, ccache, &opts, &results, &nresults);
+        kafs->stats.broker = "yes";
+        if( (kret == -1) && (nresults == 0) ){
+            putil_debug(kafs,"AFS: kafs-brokerd not available (%s), tokens are created in-process",strerror(errno));
+            kafs->stats.broker = "fallback";
+            kret = krb5_afslog_ex(kafs->ctx, ccache, &opts, &results, &nresults);
+        }
+    } else {
+        kret = krb5_afslog_ex(kafs->ctx, ccache, &opts, &results, &nresults);
+    }
 
     /* clean up */
+    kafs_free_these_cells(p_cells);
     krb5_cc_close(kafs->ctx, ccache);
 
+    /* report */
+    kafs->stats.ncells += nresults;
+    for(int i=0; i < nresults; i++){
+        switch(results[i].state){
+            case KAFS_AFSLOG_OK:
+                kafs->stats.ncreated++;
+                putil_debug(kafs,"AFS: token for cell '%s' (realm: %s) created in %ld ms",
+                            results[i].cell,results[i].realm,results[i].elapsed);
+                break;
+            case KAFS_AFSLOG_SKIPPED:
+                kafs->stats.nskipped++;
+                putil_debug(kafs,"AFS: token for cell '%s' is still valid",results[i].cell);
+                break;
+            case KAFS_AFSLOG_CACHED:
+                kafs->stats.ncached++;
+                putil_debug(kafs,"AFS: token for cell '%s' taken from the token cache",results[i].cell);
+                break;
+            case KAFS_AFSLOG_FAILED:
+                kafs->stats.nfailed++;
+                putil_err(kafs,"AFS: unable to create token for cell '%s' (realm: %s, status: %d) in %ld ms",
+                             results[i].cell,results[i].realm ? results[i].realm : "-",results[i].status,results[i].elapsed);
+                break;
+            case KAFS_AFSLOG_TIMEOUT:
+                kafs->stats.nfailed++;
+                putil_err(kafs,"AFS: token for cell '%s' not created due to timeout",results[i].cell);
+                break;
+        }
+    }
+    kafs_free_afslog_results(results,nresults);
+
     if( kret != 0 ) {
-        putil_err(kafs,"krb5_afslog failed");
+        putil_err(kafs,"krb5_afslog_ex failed");
         return(4);
     }
     return(0);
@@ -770,6 +1129,89 @@ int pamkafs_afslog(kafs_handle_t* kafs)
 
 /* ============================================================================= */
 
+int pamkafs_prefetch(kafs_handle_t* kafs)
+{
+    const void* dummy;
+
+    /* started in the auth phase or tokens already created */
+    if( pam_get_data(kafs->pamh, PAMAFS_MODULE_NAME PREFETCH, &dummy) == PAM_SUCCESS ){
+        putil_debug(kafs,"AFS: prefetch already done");
+        return(0);
+    }
+
+    /* pam_krb5 provides its ccache in the auth phase as PAM_KRB5CCNAME,
+       the environment of the process is not used, it belongs to the caller and not to the user */
+    const char* p_cc_name = pam_getenv(kafs->pamh, "PAM_KRB5CCNAME");
+    if( p_cc_name == NULL ) p_cc_name = pam_getenv(kafs->pamh, "KRB5CCNAME");
+    if( p_cc_name == NULL ) {
+        putil_debug(kafs,"AFS: no ccache for prefetch");
+        return(0);
+    }
+
+    /* the ccache is opened as the user, the same cells as in the session */
+    if( __enter_user(kafs) > 0 ){
+        return(2);
+    }
+
+    krb5_error_code kret;
+    krb5_ccache     ccache;
+    krb5_principal  princ;
+
+    kret = krb5_cc_resolve(kafs->ctx, p_cc_name, &ccache);
+    if( kret != 0 ) {
+        putil_err_krb5(kafs,kret,"unable to resolve ccache");
+        __leave_user(kafs);
+        return(1);
+    }
+
+    /* only ccaches with tickets */
+    kret = krb5_cc_get_principal(kafs->ctx, ccache, &princ);
+    if( kret != 0 ) {
+        putil_debug(kafs,"AFS: ccache '%s' is empty, no prefetch",p_cc_name);
+        krb5_cc_close(kafs->ctx, ccache);
+        return(__leave_user(kafs) ? 2 : 0);
+    }
+    krb5_free_principal(kafs->ctx, princ);
+
+    struct kafs_afslog_opts         opts;
+    struct kafs_afslog_prefetch*    pf      = NULL;
+    char**                          p_cells = NULL;
+
+    pamkafs_afslog_opts(kafs,&opts,&p_cells);
+    kret = krb5_afslog_prefetch(kafs->ctx, ccache, &opts, &pf);
+
+    kafs_free_these_cells(p_cells);
+    krb5_cc_close(kafs->ctx, ccache);
+
+    if( __leave_user(kafs) ){
+        kafs_free_afslog_prefetch(pf);
+        return(2);
+    }
+
+    if( kret != 0 ) {
+        putil_err(kafs,"AFS: unable to start prefetch of service tickets");
+        return(3);
+    }
+
+    if( pam_set_data(kafs->pamh, PAMAFS_MODULE_NAME PREFETCH, pf, pamkafs_free_prefetch) != PAM_SUCCESS ){
+        putil_err(kafs,"PAM: unable to set PREFETCH data");
+        kafs_free_afslog_prefetch(pf);
+        return(4);
+    }
+
+    putil_debug(kafs,"AFS: prefetch of service tickets started (ccache: %s)",p_cc_name);
+    return(0);
+}
+
+/* ============================================================================= */
+
+void pamkafs_free_prefetch(pam_handle_t* pamh UNUSED,void* data,int error_status UNUSED)
+{
+    kafs_free_afslog_prefetch((struct kafs_afslog_prefetch*)data);
+}
+
+/* ============================================================================= */
+
 int pamkafs_destroy_tokens(kafs_handle_t* kafs)
 {
     const void*     dummy;
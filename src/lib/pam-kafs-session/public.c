@@ -21,6 +21,7 @@
 
 #include "internal.h"
 #include <kafs-user.h>
+#include <kafs_probes.h>
 
 /* ============================================================================= */
 
@@ -36,6 +37,9 @@ int pam_sm_open_session(pam_handle_t *pamh, int flags, int argc, const char *arg
     int             pamret;
     kafs_handle_t*  kafs;
 
+    KAFS_PROBE1(pam_kafs,open_session__entry,flags);
+    KAFS_PROBE_START(start);
+
     /* init user */
     kafs = __init_user(pamh);
     if( kafs == NULL ) {
@@ -66,6 +70,7 @@ int pam_sm_open_session(pam_handle_t *pamh, int flags, int argc, const char *arg
 
 done:
     putil_debug(kafs, "<<< pam_sm_open_session");
+    KAFS_PROBE4(pam_kafs,open_session__return,flags,kafs ? (int)kafs->uid : -1,pamret,KAFS_PROBE_TIME(start));
     __free_user(kafs);
     return pamret;
 }
@@ -73,12 +78,35 @@ done:
 /* ============================================================================= */
 
 /*
- * Don't do anything for authenticate.  We're only an auth module so that we
- * can supply a pam_setcred implementation.
+ * Don't do anything for authenticate unless prefetch is requested. We're only an auth module
+ * so that we can supply a pam_setcred implementation, and to start the prefetch of AFS service
+ * tickets as soon as the ccache from pam_krb5 is available.
  */
-int pam_sm_authenticate(pam_handle_t *pamh UNUSED, int flags UNUSED,
+int pam_sm_authenticate(pam_handle_t *pamh, int flags,
                         int argc UNUSED, const char *argv[] UNUSED)
 {
+    kafs_handle_t*  kafs;
+
+    KAFS_PROBE1(pam_kafs,authenticate__entry,flags);
+
+    /* init user */
+    kafs = __init_user(pamh);
+    if( kafs == NULL ) {
+        goto done;
+    }
+
+    putil_debug(kafs, ">>> pam_sm_authenticate flags: %x",flags);
+
+    /* overlap KDC requests with the rest of the PAM stack */
+    if( (kafs->conf_prefetch == 1) && (kafs->conf_create_tokens == 1) && k_hasafs() && (__ignore_user(kafs) == 0) ){
+        pamkafs_prefetch(kafs); /* ignore errors, tokens are created as usual */
+    }
+
+    putil_debug(kafs, "<<< pam_sm_authenticate");
+
+done:
+    __free_user(kafs);
+
     /*
      * We want to return PAM_IGNORE here, but Linux PAM 0.99.7.1 (at least)
      * has a bug that causes PAM_IGNORE to result in authentication failure
@@ -100,6 +128,9 @@ int pam_sm_setcred(pam_handle_t *pamh, int flags, int argc, const char *argv[])
     int             pamret;
     kafs_handle_t*  kafs;
 
+    KAFS_PROBE1(pam_kafs,setcred__entry,flags);
+    KAFS_PROBE_START(start);
+
     /* init user */
     kafs = __init_user(pamh);
     if( kafs == NULL ) {
@@ -143,6 +174,11 @@ int pam_sm_setcred(pam_handle_t *pamh, int flags, int argc, const char *argv[])
         goto done;
     }
 
+    /* the ccache of pam_krb5 can be created now if it was not available in the auth phase */
+    if( (flags & PAM_ESTABLISH_CRED) && (kafs->conf_prefetch == 1) && (kafs->conf_create_tokens == 1) ){
+        pamkafs_prefetch(kafs); /* ignore errors, tokens are created as usual */
+    }
+
     /* do not modify PAG here, only reinitialize AFS tokens if explicitly requested (screen unlock) */
 
     /* refresh tokens */
@@ -155,6 +191,7 @@ int pam_sm_setcred(pam_handle_t *pamh, int flags, int argc, const char *argv[])
 
 done:
     putil_debug(kafs, "<<< pam_sm_setcred");
+    KAFS_PROBE4(pam_kafs,setcred__return,flags,kafs ? (int)kafs->uid : -1,pamret,KAFS_PROBE_TIME(start));
     __free_user(kafs);
     return pamret;
 }
@@ -170,6 +207,9 @@ int pam_sm_close_session(pam_handle_t *pamh, int flags, int argc, const char *ar
     kafs_handle_t*  kafs;
     int             pamret;
 
+    KAFS_PROBE1(pam_kafs,close_session__entry,flags);
+    KAFS_PROBE_START(start);
+
     /* init user */
     kafs = __init_user(pamh);
     if( kafs == NULL ) {
@@ -184,6 +224,7 @@ int pam_sm_close_session(pam_handle_t *pamh, int flags, int argc, const char *ar
 
 done:
     putil_debug(kafs, "<<< pam_sm_close_session");
+    KAFS_PROBE4(pam_kafs,close_session__return,flags,kafs ? (int)kafs->uid : -1,pamret,KAFS_PROBE_TIME(start));
     __free_user(kafs);
     return pamret;
 }